@@ -0,0 +1,55 @@
+// 布隆过滤器: 判断元素一定不存在或可能存在
+
+#ifndef BLOOMFILTER_H_
+#define BLOOMFILTER_H_
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+
+namespace LI {
+
+// 位数组和哈希函数个数按预计的元素个数和目标误判率确定, 元素超过预计个数后误判率上升.
+// 哈希是带随机密钥的 SipHash, 分成两半做双重哈希得到 k 个位置, 外部无法构造大量冲突的元素.
+// 只能添加不能删除, 不会漏报. 位用原子操作设置, 多个线程可以同时添加和查询
+class BloomFilter {
+public:
+    /// @brief 构造函数
+    /// @param capacity 预计的元素个数
+    /// @param fprate 元素个数为 capacity 时的目标误判率, 如 0.01
+    BloomFilter(const size_t capacity, const double fprate);
+    BloomFilter(const BloomFilter&) = delete;
+    BloomFilter& operator=(const BloomFilter&) = delete;
+
+    /// @brief 添加元素
+    void Add(const char* data, const size_t len);
+
+    /// @brief 查询元素
+    /// @return false-一定不存在; true-可能存在
+    bool MayContain(const char* data, const size_t len) const;
+
+    /// @brief 添加的次数, 重复添加的元素也计数
+    size_t Count() const { return m_count.load(std::memory_order_relaxed); }
+
+    /// @brief 位数组的位数
+    size_t Bits() const { return m_bits; }
+
+    /// @brief 按已经置位的比例估算当前的误判率
+    double EstimatedFalsePositiveRate() const;
+
+private:
+    // 元素的 64 位哈希
+    uint64_t Hash(const char* data, const size_t len) const;
+
+    size_t m_bits;       // 位数
+    int m_hashes;        // 每个元素设置的位数
+    std::unique_ptr<std::atomic<uint64_t>[]> m_words;
+    std::atomic<size_t> m_count; // 添加的次数
+    std::atomic<size_t> m_set;   // 已经置位的位数
+    uint64_t m_key[2];
+};
+
+}
+
+#endif
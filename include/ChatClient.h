@@ -0,0 +1,192 @@
+// 无界面的聊天室客户端库: 供机器人和其他服务使用
+
+#ifndef CHATCLIENT_H_
+#define CHATCLIENT_H_
+
+#include "cppNetWork.h"
+#include "TimerWheel.h"
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace LI {
+
+// 收到的广播信息
+struct ChatMessage {
+    std::string name;  // 发送者
+    int color;         // 字体颜色
+    std::string text;  // 信息内容
+};
+
+class ClientLoop;
+
+// 一个客户端会话, 对应一个到服务端的连接, 由 ClientLoop::NewSession 创建.
+// 公有方法可以在任何线程调用, 实际操作在事件循环线程中执行; 回调都在事件循环线程中执行.
+// 不要在事件循环线程(包括回调)中等待返回的 future, 否则会死锁.
+// 登录成功后连接断开会自动重连并凭令牌恢复登录(令牌无效时用密码), 重新加入原来的房间; 加入的房间在其他节点时自动重定向
+class ChatSession : public std::enable_shared_from_this<ChatSession> {
+public:
+    // 会话的状态
+    enum State {
+        DISCONNECTED,  // 没有连接
+        CONNECTING,    // 正在连接
+        CONNECTED,     // 已连接, 没有登录
+        LOGGEDIN,      // 已登录
+        CLOSED         // 已关闭, 不再使用
+    };
+
+    using ResultCallback = std::function<void(bool)>;
+    using MessageCallback = std::function<void(const ChatMessage&)>;
+    using StateCallback = std::function<void(State)>;
+
+    /// @brief 注册账号, 没有连接时先连接服务端
+    /// @param cb 服务端回应后调用, 参数表示是否成功; 连接断开时以 false 调用
+    void Register(const std::string& name, const std::string& password, ResultCallback cb);
+    std::future<bool> Register(const std::string& name, const std::string& password);
+
+    /// @brief 登录, 没有连接时先连接服务端
+    /// @param cb 服务端回应后调用, 参数表示是否成功; 连接断开时以 false 调用
+    void Login(const std::string& name, const std::string& password, ResultCallback cb);
+    std::future<bool> Login(const std::string& name, const std::string& password);
+
+    /// @brief 加入房间, 登录后才能加入
+    /// @param room 房间名, 空表示回到大厅
+    /// @param cb 加入成功(包括重定向后成功)后调用
+    void Join(const std::string& room, ResultCallback cb);
+    std::future<bool> Join(const std::string& room);
+
+    /// @brief 发送信息, 没有登录或超过长度上限时丢弃
+    /// @param text 信息内容
+    /// @param color 字体颜色
+    void Send(const std::string& text, const int color = 0);
+
+    /// @brief 退出登录, 连接保留, 不再自动重连
+    void Logout();
+
+    /// @brief 关闭会话, 不再自动重连
+    void Close();
+
+    /// @brief 设置收到广播信息时的回调, 应当在登录前设置
+    void OnMessage(MessageCallback cb);
+
+    /// @brief 设置状态变化时的回调, 应当在登录前设置
+    void OnState(StateCallback cb);
+
+    /// @brief 设置断线后第一次重连的等待时间, 连续失败时指数增加(上限 30s)并加随机抖动
+    /// @param ms 等待时间, 单位: ms, 0 表示不重连, 缺省 1000ms
+    void SetReconnect(const int ms);
+
+    /// @brief 当前的状态
+    State GetState() const { return m_state.load(); }
+
+    ~ChatSession();
+
+private:
+    friend class ClientLoop;
+    ChatSession(ClientLoop* loop, const std::string& ip, const int port);
+
+    // 以下方法只在事件循环线程中调用
+    // 发起非阻塞连接
+    void Connect();
+    // epoll 事件
+    void OnEvent(const uint32_t events);
+    // 连接建立
+    void OnConnected();
+    // 处理服务端的一个报文
+    void HandleFrame(const char* buffer);
+    // 报文加上长度头放入发送缓冲区, 已连接时尽量发送
+    void Write(const std::string& data);
+    // 发送缓冲区中的数据, 写不完时关注可写事件
+    bool Flush();
+    // 发送请求, 回应按顺序对应 queue 中的回调
+    void Request(const std::string& data, std::deque<ResultCallback>& queue, ResultCallback cb);
+    // 重新登录: 有令牌时先凭令牌恢复, 失败再用密码, 完成后调用 after
+    void Relogin(ResultCallback after);
+    // 加入房间的请求
+    void SendJoin(const std::string& room, ResultCallback cb);
+    // 关闭 socket
+    void CloseSocket();
+    // 连接断开: 等待回应的请求都以 false 回调, 已登录的会话按间隔重连
+    void Disconnect();
+    // 重定向到房间的归属节点
+    void Redirect(const std::string& node, const std::string& room);
+    // 设置状态并回调
+    void SetState(const State state);
+
+    ClientLoop* m_loop;
+    std::string m_ip;              // 服务端地址, 重定向后改为新的节点
+    int m_port;
+    int m_sockfd;
+    std::atomic<State> m_state;
+    bool m_closed;                 // 已经调用 Close
+    bool m_want_write;             // 是否在等待可写事件
+    int m_reconnectms;             // 第一次重连的等待时间
+    int m_redirects;               // 连续重定向的次数
+    int m_retries;                 // 连续重连失败的次数, 决定退避时间
+    bool m_compress;               // 服务端能解压, 发送的大报文可以压缩
+    RecvBuffer m_recvbuf;          // 接收缓冲区
+    std::string m_outbuf;          // 发送缓冲区
+    std::string m_name;            // 登录的用户名
+    std::string m_login;           // 登录报文, 重连后重新登录, 空表示不需要重新登录
+    std::string m_token;           // 服务端签发的会话令牌
+    std::string m_room;            // 所在的房间
+    std::deque<ResultCallback> m_auth;  // 等待注册或登录回应的回调
+    std::deque<ResultCallback> m_joins; // 等待加入房间回应的回调
+    MessageCallback m_onmessage;
+    StateCallback m_onstate;
+};
+
+// 客户端事件循环, 一个线程可以驱动成千上万个会话.
+// Run 在调用者的线程中运行事件循环, 其他方法可以在任何线程调用
+class ClientLoop {
+public:
+    ClientLoop();
+    ClientLoop(const ClientLoop&) = delete;
+    ClientLoop& operator=(const ClientLoop&) = delete;
+
+    /// @brief 创建会话, 第一次注册或登录时才连接服务端
+    /// @param ip 服务端 ip 地址
+    /// @param port 服务端端口
+    std::shared_ptr<ChatSession> NewSession(const std::string& ip, const int port);
+
+    /// @brief 运行事件循环, 直到调用 Stop
+    void Run();
+
+    /// @brief 结束事件循环
+    void Stop();
+
+    /// @brief 把任务交给事件循环线程执行
+    void Post(std::function<void()> task);
+
+    ~ClientLoop();
+
+private:
+    friend class ChatSession;
+
+    // 执行其他线程交过来的任务
+    void RunTasks();
+    // 注册, 修改, 删除 socket 的事件
+    void AddFd(const int fd, ChatSession* session, const uint32_t events);
+    void ModFd(const int fd, const uint32_t events);
+    void DelFd(const int fd);
+
+    int m_epollfd;
+    int m_wakefd;                       // eventfd, 唤醒事件循环
+    std::atomic<bool> m_running;
+    std::mutex m_lock;                  // 保护 m_tasks
+    std::vector<std::function<void()>> m_tasks;
+    TimerWheel m_timers;                // 重连定时器, 只在事件循环线程中访问
+    std::map<int, ChatSession*> m_fds;  // socket 到会话的映射
+    std::set<std::shared_ptr<ChatSession>> m_sessions; // 没有关闭的会话
+};
+
+}
+
+#endif
@@ -0,0 +1,35 @@
+// 报文压缩
+
+#ifndef COMPRESS_H_
+#define COMPRESS_H_
+
+#include <cstddef>
+
+namespace LI {
+
+// LZ4 块格式的压缩和解压: 只有哈希表查找和字节复制, 压缩速度远高于网络带宽, 适合大报文和批量传输.
+// 不保存原始长度, 由调用者记录. 函数都是无状态的, 可以在任何线程调用
+
+/// @brief 压缩结果的最大长度, 不可压缩的数据会略微变长
+/// @param n 原始数据的长度, 单位: bytes
+size_t LZBound(const size_t n);
+
+/// @brief 压缩
+/// @param src 原始数据的地址
+/// @param n 原始数据的长度
+/// @param dst 存放压缩结果的地址
+/// @param cap dst 的大小, 不小于 LZBound(n) 时一定成功
+/// @return 压缩结果的长度, 0 表示 dst 放不下
+size_t LZCompress(const char* src, const size_t n, char* dst, const size_t cap);
+
+/// @brief 解压, 不信任输入, 越界的长度和偏移都会返回失败
+/// @param src 压缩数据的地址
+/// @param n 压缩数据的长度
+/// @param dst 存放原始数据的地址
+/// @param rawlen 原始数据的长度, 解压结果必须正好是这么长
+/// @return true-成功; false-数据损坏
+bool LZDecompress(const char* src, const size_t n, char* dst, const size_t rawlen);
+
+}
+
+#endif
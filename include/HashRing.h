@@ -0,0 +1,62 @@
+// 一致性哈希环
+
+#ifndef HASHRING_H_
+#define HASHRING_H_
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace LI {
+
+// 带虚拟节点的一致性哈希环, 用于决定房间由哪个服务端节点负责.
+// 节点加入或离开时只有约 1/n 的键改变归属. 所有节点用相同的节点集合构造, 得到的结果相同.
+// 不是线程安全的
+class HashRing {
+public:
+    /// @brief 构造函数
+    /// @param vnodes 每个节点在环上的虚拟节点个数, 越多分布越均匀
+    HashRing(const int vnodes = 100);
+
+    /// @brief 添加节点, 已经存在的节点不重复添加
+    /// @param node 节点标识, 如 ip:port
+    void AddNode(const std::string& node);
+
+    /// @brief 删除节点
+    /// @param node 节点标识
+    void RemoveNode(const std::string& node);
+
+    /// @brief 节点是否在环上
+    bool HasNode(const std::string& node) const;
+
+    /// @brief 查找键的归属节点
+    /// @param key 键的地址
+    /// @param len 键的长度, 单位: bytes
+    /// @return 节点标识, 环为空时返回空字符串
+    const std::string& Owner(const char* key, const size_t len) const;
+
+    /// @brief 节点个数
+    size_t Size() const { return m_nodes.size(); }
+
+    /// @brief 哈希函数(FNV-1a 加上混合), 各节点的结果一致
+    static uint64_t Hash(const char* data, const size_t len);
+
+private:
+    // 虚拟节点: 环上的位置和所属的节点下标
+    struct VNode {
+        uint64_t hash;
+        uint32_t node;
+    };
+
+    // 节点变化后重新生成环
+    void Rebuild();
+
+    const int m_vnodes;
+    std::vector<std::string> m_nodes; // 节点标识, 按字典序排列
+    std::vector<VNode> m_ring;        // 按哈希值排列的虚拟节点
+};
+
+}
+
+#endif
@@ -0,0 +1,132 @@
+// io_uring 的封装: 直接使用系统调用, 不依赖 liburing
+
+#ifndef IOURING_H_
+#define IOURING_H_
+
+#include <cstdint>
+#include <cstddef>
+
+namespace LI {
+
+// 一个完成事件
+struct IoEvent {
+    uint64_t user_data;  // 提交请求时的标识
+    int res;             // 结果, 同对应系统调用的返回值, 出错时为 -errno
+    uint32_t flags;      // IORING_CQE_F_*
+
+    /// @brief 多次触发(multishot)的请求是否还会继续产生事件, false 表示请求已经结束, 需要时重新提交
+    bool More() const;
+
+    /// @brief 事件是否使用了提供的缓冲区, 是时数据在 IoUring::Buffer(BufferId()) 中, 用完后归还
+    bool HasBuffer() const;
+    uint16_t BufferId() const;
+};
+
+// io_uring 实例: 提交队列和完成队列映射到用户空间, 准备请求不需要系统调用, 一次 io_uring_enter 提交一批请求并等待完成.
+// 接收使用提供的缓冲区环(provided buffer ring): 内核在数据到达时才从环中取缓冲区, 空闲连接不占用接收缓冲区.
+// 只能在一个线程中使用
+class IoUring {
+public:
+    IoUring();
+    IoUring(const IoUring&) = delete;
+    IoUring& operator=(const IoUring&) = delete;
+
+    /// @brief 创建 io_uring, 完成队列是提交队列的 4 倍, 多次触发的请求一次提交会产生多个事件
+    /// @param entries 提交队列的大小, 2 的幂
+    /// @return true-成功; false-内核不支持或被禁用(io_uring_disabled), 编译时的内核头文件太旧时也返回 false
+    bool Init(const unsigned entries);
+
+    /// @brief 是否已经创建
+    bool Enabled() const { return m_ringfd != -1; }
+
+    /// @brief 注册提供的缓冲区环, RecvMultishot 从中取缓冲区
+    /// @param count 缓冲区个数, 2 的幂, 不超过 32768
+    /// @param size 每个缓冲区的大小, 单位: bytes
+    /// @return true-成功; false-内核不支持(5.19 以前)
+    bool SetupBuffers(const unsigned count, const unsigned size);
+
+    /// @brief 缓冲区的地址
+    char* Buffer(const uint16_t bid) const { return m_buffers + (size_t)bid * m_bufsize; }
+
+    /// @brief 归还缓冲区, 在下一次 Submit 时一起交给内核
+    void RecycleBuffer(const uint16_t bid);
+
+    /// @brief 多次触发的 accept, 每个新连接一个事件, res 是连接的 socket
+    void AcceptMultishot(const int fd, const uint64_t user_data);
+
+    /// @brief 多次触发的 recv, 每次收到数据一个事件, 数据在提供的缓冲区中. 缓冲区用完时以 -ENOBUFS 结束
+    void RecvMultishot(const int fd, const uint64_t user_data);
+
+    /// @brief 一次性的 poll, 提交时已经就绪会立即完成, 相当于水平触发
+    /// @param events POLLIN 等
+    void PollOnce(const int fd, const uint32_t events, const uint64_t user_data);
+
+    /// @brief 发送, 发送完全部数据才完成(MSG_WAITALL), 不产生 SIGPIPE
+    /// @param buffer 数据的地址, 完成之前必须有效
+    /// @param nowait 为 true 时不等待(MSG_DONTWAIT): 发送缓冲区满时以已经发送的字节数或 -EAGAIN 完成.
+    ///               io_uring 不看 socket 的 O_NONBLOCK, 非阻塞的 socket 也要指定
+    void Send(const int fd, const void* buffer, const size_t len, const uint64_t user_data, const bool nowait = false);
+
+    /// @brief 取消 fd 上的所有请求, 被取消的请求以 -ECANCELED 结束
+    void CancelFd(const int fd, const uint64_t user_data);
+
+    /// @brief 取消所有请求
+    void CancelAll(const uint64_t user_data);
+
+    /// @brief 提交已经准备的请求, 并等待至少 waitnr 个完成事件
+    /// @param waitnr 等待的事件个数, 0 表示只提交不等待
+    /// @param timeout 等待的超时时间, 单位: ms, -1 表示无限等待
+    /// @return 0-成功或超时; -1-出错, 错误码在 errno 中(EINTR 表示被信号中断)
+    int Submit(const unsigned waitnr = 0, const int timeout = -1);
+
+    /// @brief 取出已经完成的事件, 不等待
+    /// @return 取出的个数
+    size_t Reap(IoEvent* events, const size_t max);
+
+    /// @brief 已经准备还没有提交的请求数
+    unsigned Pending() const { return m_sqtail - m_submitted; }
+
+    /// @brief 提交队列的大小
+    unsigned Entries() const { return m_sqentries; }
+
+    /// @brief 关闭 io_uring, 未完成的请求由内核取消
+    void Close();
+
+    ~IoUring();
+
+private:
+    // 取一个空闲的提交队列项, 队列满时先提交
+    void* GetSqe();
+
+    int m_ringfd;
+    unsigned m_sqentries;
+    unsigned m_sqtail;       // 本地的提交队列尾, Submit 时发布给内核
+    unsigned m_submitted;    // 已经发布的尾
+    // 提交队列
+    void* m_sqring;
+    size_t m_sqringsize;
+    unsigned* m_sqhead;
+    unsigned* m_sqktail;
+    unsigned m_sqmask;
+    unsigned* m_sqarray;
+    void* m_sqes;
+    size_t m_sqessize;
+    // 完成队列, 和提交队列共用一次映射时 m_cqring 为 nullptr
+    void* m_cqring;
+    size_t m_cqringsize;
+    unsigned* m_cqhead;
+    unsigned* m_cqtail;
+    unsigned m_cqmask;
+    void* m_cqes;
+    // 提供的缓冲区环
+    void* m_bufring;
+    size_t m_bufringsize;
+    unsigned m_bufcount;
+    unsigned m_bufsize;
+    uint16_t m_buftail;      // 本地的缓冲区环尾, Submit 时发布给内核
+    char* m_buffers;
+};
+
+}
+
+#endif
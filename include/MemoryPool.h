@@ -0,0 +1,76 @@
+// 线程缓存的内存池(slab), 用于热路径上的小对象、报文缓冲区和任务节点
+
+#ifndef MEMORYPOOL_H_
+#define MEMORYPOOL_H_
+
+#include <cstddef>
+#include <string>
+#include <new>
+#include <utility>
+
+namespace LI {
+
+/// @brief 从内存池分配内存. 大小按 2 的幂分级(16B ~ 64KB), 先从本线程的缓存取,
+///        缓存为空时从全局仓库批量取, 仓库也为空时才向系统申请一整块 slab 切分.
+///        超过 64KB 的请求直接使用 operator new.
+///        slab 从不归还系统: 内存池占用的内存是进程运行以来的峰值, 释放的内存只能被内存池再次分配
+/// @param n 需要的字节数
+/// @return 内存地址, 按 16 字节对齐
+void* PoolAlloc(const size_t n);
+
+/// @brief 归还内存到本线程的缓存, 可以在与分配时不同的线程中归还
+/// @param ptr PoolAlloc 返回的地址
+/// @param n 分配时的字节数
+void PoolFree(void* ptr, const size_t n);
+
+/// @brief 内存池能缓存的最大请求大小, 单位: bytes
+size_t PoolMaxSize();
+
+/// @brief 已经向系统申请的 slab 的总大小, 单位: bytes. 只增不减, 可以用来检查稳定运行时是否还在申请内存
+size_t PoolSlabBytes();
+
+/// @brief 在内存池中构造对象
+template<class T, class... Args>
+T* PoolNew(Args&&... args) {
+    void* ptr = PoolAlloc(sizeof(T));
+    return new (ptr) T(std::forward<Args>(args)...);
+}
+
+/// @brief 析构并释放 PoolNew 构造的对象
+template<class T>
+void PoolDelete(T* ptr) {
+    if (ptr == nullptr) return;
+    ptr->~T();
+    PoolFree(ptr, sizeof(T));
+}
+
+// 使用内存池的 STL 分配器
+template<class T>
+class PoolAllocator {
+public:
+    using value_type = T;
+
+    PoolAllocator() noexcept { }
+    template<class U>
+    PoolAllocator(const PoolAllocator<U>&) noexcept { }
+
+    T* allocate(size_t n) {
+        return static_cast<T*>(PoolAlloc(n * sizeof(T)));
+    }
+
+    void deallocate(T* ptr, size_t n) noexcept {
+        PoolFree(ptr, n * sizeof(T));
+    }
+
+    template<class U>
+    bool operator==(const PoolAllocator<U>&) const noexcept { return true; }
+    template<class U>
+    bool operator!=(const PoolAllocator<U>&) const noexcept { return false; }
+};
+
+// 使用内存池的字符串, 用于报文解析和组装
+using PoolString = std::basic_string<char, std::char_traits<char>, PoolAllocator<char>>;
+
+}
+
+#endif
@@ -0,0 +1,85 @@
+// 客户端的消息缓存
+
+#ifndef MESSAGECACHE_H_
+#define MESSAGECACHE_H_
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+namespace LI {
+
+// 消息缓存: 一个追加写的数据文件加一个 mmap 的索引文件, 启动时只映射索引, 不读取消息内容.
+// 数据文件(.log)每条记录: 4字节长度 + 8字节时间 + 内容; 索引文件(.idx)是文件头加每条记录一项 {时间, 偏移}, 按时间严格递增.
+// 先写数据再写索引, 进程崩溃后打开时丢弃没有索引的半条记录, 索引损坏时扫描数据文件重建. 不是线程安全的
+class MessageCache {
+public:
+    MessageCache();
+    MessageCache(const MessageCache&) = delete;
+    MessageCache& operator=(const MessageCache&) = delete;
+
+    /// @brief 打开缓存, 文件不存在时创建, 目录不存在时先创建目录
+    /// @param path 文件名, 不含后缀, 实际使用 path.log 和 path.idx
+    /// @return true-成功; false-失败
+    bool Open(const std::string& path);
+
+    /// @brief 关闭缓存
+    void Close();
+
+    bool IsOpen() const { return m_header != nullptr; }
+    const std::string& Path() const { return m_path; }
+
+    /// @brief 追加一条消息
+    /// @param time 消息的时间, 必须大于 LastTime()
+    /// @param data 消息内容的地址
+    /// @param len 消息内容的长度
+    /// @return true-成功; false-时间没有递增或写文件失败
+    bool Append(const int64_t time, const char* data, const size_t len);
+
+    /// @brief 消息的条数
+    size_t Count() const;
+
+    /// @brief 最后一条消息的时间, 没有消息时为 0
+    int64_t LastTime() const;
+
+    /// @brief 第一条时间大于 since 的消息的下标, 在索引上二分查找
+    /// @return 下标, 都不大于时返回 Count()
+    size_t Lower(const int64_t since) const;
+
+    /// @brief 读取一条消息
+    /// @param index 下标, 小于 Count()
+    /// @param data 存放消息内容
+    /// @param time 存放消息的时间, 可以为 nullptr
+    /// @return true-成功; false-下标越界或读文件失败
+    bool Read(const size_t index, std::string& data, int64_t* time = nullptr) const;
+
+    ~MessageCache();
+
+private:
+    struct IndexHeader {
+        char magic[8];    // 文件格式标识
+        uint64_t count;   // 记录的条数
+    };
+    struct IndexEntry {
+        int64_t time;     // 消息的时间
+        uint64_t offset;  // 记录在数据文件中的偏移
+    };
+
+    // 映射能容纳 entries 项的索引文件
+    bool Map(const size_t entries);
+    // 扫描数据文件重建索引, 截掉末尾不完整的记录
+    bool Rebuild();
+    // 第 i 项索引
+    IndexEntry* Entry(const size_t i) const { return (IndexEntry*)(m_header + 1) + i; }
+
+    std::string m_path;
+    int m_datafd;            // 数据文件
+    int m_indexfd;           // 索引文件
+    IndexHeader* m_header;   // 索引文件的映射
+    size_t m_capacity;       // 映射能容纳的索引项数
+    uint64_t m_datasize;     // 数据文件的长度
+};
+
+}
+
+#endif
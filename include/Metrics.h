@@ -0,0 +1,51 @@
+// 运行指标: 延迟直方图
+
+#ifndef METRICS_H_
+#define METRICS_H_
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+namespace LI {
+
+// 延迟直方图, 按 2 的幂划分区间(单位: us), 计数使用原子变量, 可以在多个线程中同时记录
+class LatencyHistogram {
+public:
+    LatencyHistogram();
+
+    /// @brief 记录一次延迟
+    /// @param us 延迟时间, 单位: us
+    void Record(const int64_t us);
+
+    /// @brief 记录的总次数
+    uint64_t Count() const;
+
+    /// @brief 记录过的最大延迟, 单位: us
+    int64_t Max() const;
+
+    /// @brief 平均延迟, 单位: us
+    int64_t Mean() const;
+
+    /// @brief 估算分位数
+    /// @param p 分位数, 如 0.99
+    /// @return 分位数所在区间的上界, 单位: us
+    int64_t Percentile(const double p) const;
+
+    /// @brief 形成统计信息字符串, 格式 "count=n mean=xus p50=xus p99=xus max=xus"
+    std::string Summary() const;
+
+    /// @brief 清空记录
+    void Reset();
+
+private:
+    static const int NBUCKET = 40; // 第 i 个区间为 [2^(i-1), 2^i) us
+    std::atomic<uint64_t> m_buckets[NBUCKET];
+    std::atomic<uint64_t> m_count;
+    std::atomic<uint64_t> m_sum;
+    std::atomic<int64_t> m_max;
+};
+
+}
+
+#endif
@@ -0,0 +1,73 @@
+// 用户名表: 用户名驻留, 每个用户名对应一个紧凑的整数编号
+
+#ifndef NAMETABLE_H_
+#define NAMETABLE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace LI {
+
+// 每个用户名只保存一份, 分配从 1 开始的编号, 0 表示没有编号. 编号只在进程内部使用, 不出现在报文中.
+// 用户名从不删除, 编号在进程中不变: 表的大小随进程运行期间登录过的不同用户名增长, 每个用户名约 32 字节加上
+// 名字本身和哈希表的一个节点, 进程重启(包括热重启)后重建.
+// 用户名分段存放, 第一段 1024 个, 之后每段是前一段的两倍, 用到时才分配, 段分配后不移动;
+// 已经分配的编号查找用户名不加锁, 可以在任何线程中进行; 分配编号加锁
+class NameTable {
+public:
+    NameTable();
+    ~NameTable();
+    NameTable(const NameTable&) = delete;
+    NameTable& operator=(const NameTable&) = delete;
+
+    /// @brief 取用户名的编号, 没有时分配
+    /// @return 编号; 0-表已满
+    uint32_t Intern(const char* name, const size_t len);
+
+    /// @brief 查找用户名的编号
+    /// @return 编号; 0-没有
+    uint32_t Find(const char* name, const size_t len) const;
+
+    /// @brief 编号对应的用户名, id 必须是 Intern 返回的编号, 引用一直有效
+    const std::string& Name(const uint32_t id) const {
+        size_t segment = 0, offset = 0;
+        Locate(id, &segment, &offset);
+        return m_segments[segment].load(std::memory_order_acquire)[offset];
+    }
+
+    /// @brief 已经分配的编号个数
+    size_t Size() const { return m_size.load(std::memory_order_acquire); }
+
+private:
+    static constexpr size_t kFirstBits = 10;                   // 第一段 1024 个用户名
+    static constexpr size_t kFirstSize = (size_t)1 << kFirstBits;
+    static constexpr size_t kSegments = 18;                    // 最多 1024 * (2^18 - 1) 个用户名, 约 2^28
+
+    // 编号所在的段和段中的下标: 第 k 段存放 pos = id + 1024 在 [1024 * 2^k, 1024 * 2^(k+1)) 中的编号
+    static void Locate(const uint32_t id, size_t* segment, size_t* offset) {
+        const uint64_t pos = (uint64_t)id + kFirstSize;
+        *segment = (size_t)(63 - __builtin_clzll(pos)) - kFirstBits;
+        *offset = (size_t)(pos - ((uint64_t)kFirstSize << *segment));
+    }
+
+    // 按用户名的内容比较的哈希表, 键指向段中的用户名
+    struct Hash {
+        size_t operator()(const std::string* s) const { return std::hash<std::string>()(*s); }
+    };
+    struct Equal {
+        bool operator()(const std::string* a, const std::string* b) const { return *a == *b; }
+    };
+
+    std::atomic<std::string*> m_segments[kSegments];
+    std::atomic<uint32_t> m_size;  // 下一个编号是 m_size + 1
+    mutable std::mutex m_lock;     // 保护 m_ids 和分配编号
+    std::unordered_map<const std::string*, uint32_t, Hash, Equal> m_ids;
+};
+
+}
+
+#endif
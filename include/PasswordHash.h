@@ -0,0 +1,70 @@
+// 口令的加盐慢哈希: scrypt(RFC 7914), 不依赖 OpenSSL
+
+#ifndef PASSWORDHASH_H_
+#define PASSWORDHASH_H_
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <mutex>
+#include <unordered_map>
+
+namespace LI {
+
+// scrypt 的参数: 内存占用 128 * r * 2^logn bytes, 耗时和 2^logn * r * p 成正比
+struct ScryptParams {
+    int logn;      // CPU/内存代价 N = 2^logn
+    uint32_t r;    // 块大小
+    uint32_t p;    // 并行度
+};
+
+/// @brief scrypt 密钥派生
+/// @param out 存放结果, outlen 个字节
+/// @return false-参数不正确(logn 不在 1~30, r 或 p 为 0, 内存超过 1GB)
+bool Scrypt(const char* pass, const size_t plen, const uint8_t* salt, const size_t slen,
+            const ScryptParams& params, uint8_t* out, const size_t outlen);
+
+/// @brief 计算保存到数据库的口令哈希, 使用 16 字节的随机盐.
+/// 格式: $scrypt$logn$r$p$盐(十六进制)$哈希(十六进制), 不超过 128 个字符
+std::string HashPassword(const char* password, const size_t len, const ScryptParams& params);
+
+/// @brief 校验口令, 比较的时间和内容无关. stored 不是 HashPassword 的格式时按旧版本的明文比较
+bool VerifyPassword(const char* password, const size_t len, const std::string& stored);
+
+/// @brief 保存的是明文或参数比 params 弱, 登录成功后应当用 params 重新哈希
+bool NeedsRehash(const std::string& stored, const ScryptParams& params);
+
+// 校验过的口令的缓存: 同一个用户用同一个口令重复登录(断线后用口令重连、多个连接登录同一个用户)时不再计算 scrypt.
+// 缓存的是用随机密钥对 "用户名, 口令, 数据库中的哈希" 计算的 SipHash, 不保存口令; 数据库中的哈希改变(修改口令)后自动失效.
+// 多个线程可以同时使用
+class CredentialCache {
+public:
+    /// @brief 构造函数
+    /// @param capacity 最多缓存的用户数
+    /// @param ttl 缓存的有效期, 单位: s
+    CredentialCache(const size_t capacity, const int64_t ttl);
+
+    /// @brief 查找, now 是当前时间, unix 时间戳, 单位: s
+    /// @return true-口令和数据库中的哈希都与缓存的相同且没有过期
+    bool Lookup(const std::string& name, const char* password, const size_t len, const std::string& stored, const int64_t now);
+
+    /// @brief 放入校验成功的口令, 缓存满时先删除过期的, 仍然满时删除任意一个
+    void Insert(const std::string& name, const char* password, const size_t len, const std::string& stored, const int64_t now);
+
+private:
+    uint64_t Fingerprint(const std::string& name, const char* password, const size_t len, const std::string& stored) const;
+
+    struct Entry {
+        uint64_t fingerprint;
+        int64_t expire;
+    };
+    std::mutex m_lock;
+    std::unordered_map<std::string, Entry> m_entries;
+    size_t m_capacity;
+    int64_t m_ttl;
+    uint64_t m_key[2];
+};
+
+}
+
+#endif
@@ -0,0 +1,307 @@
+// 报文协议: 字段和报文的声明, 编码和解码由模板在编译期生成
+
+#ifndef PROTOCOL_H_
+#define PROTOCOL_H_
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include "MemoryPool.h"
+
+namespace LI {
+namespace proto {
+    // 报文是一串 <label>值</label>, 第一个字段是固定的 <cmd>n</cmd>(客户端到服务端) 或 <code>n</code>(服务端到客户端).
+    // 每种报文声明为 Message<报文头, 字段...>, 字段是报文结构的成员, 成员名就是标签名.
+    // 标签和报文头的长度是编译期常量, 编码时先算出整个报文的长度, 只分配一次内存, 按顺序写入;
+    // 解码只扫描报文一遍, 文本字段引用报文中的内容, 不复制.
+    // 文本值中的 '<', '>', '&' 编码为 &lt; &gt; &amp;, 用户输入的标签文本不会被当作字段; 解码后用 Unescape 还原
+
+    // 文本字段的值: 编码时引用调用方的原文, 解码时引用报文中转义过的内容, 引用的内存要比值活得久
+    struct Text {
+        static constexpr size_t kUnknown = (size_t)-1;
+
+        const char* data;
+        size_t size;
+        // 转义后的长度, 编码时 ValueSize 算出后 WriteValue 不再扫描. 赋新值时重置; 直接修改 data 或 size 时要置为 kUnknown
+        mutable size_t escaped = kUnknown;
+
+        Text(): data(""), size(0) {}
+        Text(const char* d, const size_t n): data(d), size(n) {}
+        Text(const char* s): data(s), size(strlen(s)) {}
+        Text(const std::string& s): data(s.data()), size(s.size()) {}
+        Text(const PoolString& s): data(s.data()), size(s.size()) {}
+
+        std::string str() const { return std::string(data, size); }
+    };
+
+    // 整数字段的值, 十进制编码
+    using Int = int64_t;
+
+    // 整数的十进制位数
+    constexpr size_t Digits(const uint64_t v) {
+        return (v < 10) ? 1 : 1 + Digits(v / 10);
+    }
+
+    // c 在 [p, p + n) 中出现的次数, memchr 一次跳过没有 c 的一段
+    inline size_t CountChar(const char* p, const size_t n, const char c) {
+        const char* end = p + n;
+        size_t count = 0;
+        while (p < end && (p = (const char*)memchr(p, c, end - p)) != nullptr) {
+            ++count;
+            ++p;
+        }
+        return count;
+    }
+
+    /// @brief 是否含有需要转义的字符. 用户名和房间名原样写入报文, 不能含有这些字符
+    inline bool NeedsEscape(const char* p, const size_t n) {
+        return memchr(p, '<', n) != nullptr || memchr(p, '>', n) != nullptr || memchr(p, '&', n) != nullptr;
+    }
+
+    /// @brief 转义后的长度: '<' 和 '>' 各多 3 字节, '&' 多 4 字节. 大多数文本没有这些字符, 先判断是否需要计数
+    inline size_t EscapedSize(const char* p, const size_t n) {
+        if (!NeedsEscape(p, n)) return n;
+        return n + 3 * (CountChar(p, n, '<') + CountChar(p, n, '>')) + 4 * CountChar(p, n, '&');
+    }
+    template<class S>
+    bool NeedsEscape(const S& s) { return NeedsEscape(s.data(), s.size()); }
+
+    /// @brief 还原转义的文本, 原地进行. 不认识的 '&' 保持原样
+    template<class S>
+    void Unescape(S& s) {
+        size_t amp = s.find('&');
+        if (amp == S::npos) return;
+        size_t out = amp;
+        for (size_t i = amp; i < s.size(); ) {
+            if (s[i] == '&') {
+                if (s.compare(i, 4, "&lt;") == 0) { s[out++] = '<'; i += 4; continue; }
+                if (s.compare(i, 4, "&gt;") == 0) { s[out++] = '>'; i += 4; continue; }
+                if (s.compare(i, 5, "&amp;") == 0) { s[out++] = '&'; i += 5; continue; }
+            }
+            s[out++] = s[i++];
+        }
+        s.resize(out);
+    }
+
+    /// @brief 解码得到的文本字段还原后放入 out
+    template<class S>
+    void Unescape(const Text& v, S& out) {
+        out.assign(v.data, v.size);
+        Unescape(out);
+    }
+
+    inline size_t ValueSize(const Text& v) {
+        v.escaped = EscapedSize(v.data, v.size);
+        return v.escaped;
+    }
+    inline size_t ValueSize(const Int v) {
+        return (v < 0) ? 1 + Digits(0 - (uint64_t)v) : Digits((uint64_t)v);
+    }
+
+    inline char* WriteValue(char* p, const Text& v) {
+        if ((v.escaped != Text::kUnknown) ? v.escaped == v.size : !NeedsEscape(v.data, v.size)) {
+            memcpy(p, v.data, v.size);
+            return p + v.size;
+        }
+        for (size_t i = 0; i < v.size; ++i) {
+            switch (v.data[i]) {
+                case '<': memcpy(p, "&lt;", 4); p += 4; break;
+                case '>': memcpy(p, "&gt;", 4); p += 4; break;
+                case '&': memcpy(p, "&amp;", 5); p += 5; break;
+                default: *p++ = v.data[i];
+            }
+        }
+        return p;
+    }
+    inline char* WriteValue(char* p, const Int v) {
+        uint64_t u = (uint64_t)v;
+        if (v < 0) {
+            *p++ = '-';
+            u = 0 - u;
+        }
+        // 从个位开始倒着写
+        char* end = p + Digits(u);
+        char* q = end;
+        do {
+            *--q = (char)('0' + u % 10);
+            u /= 10;
+        } while (u != 0);
+        return end;
+    }
+
+    inline void ReadValue(const char* p, const size_t n, Text& v) {
+        v.data = p;
+        v.size = n;
+        v.escaped = Text::kUnknown;
+    }
+    // 和 atoi 相同: 跳过前导空白, 可选的符号, 到第一个非数字字符为止, 没有数字时是 0
+    inline void ReadValue(const char* p, const size_t n, Int& v) {
+        const char* end = p + n;
+        while (p < end && (*p == ' ' || (*p >= '\t' && *p <= '\r'))) ++p;
+        bool neg = false;
+        if (p < end && (*p == '-' || *p == '+')) neg = (*p++ == '-');
+        uint64_t u = 0;
+        for (; p < end && *p >= '0' && *p <= '9'; ++p) u = u * 10 + (uint64_t)(*p - '0');
+        v = neg ? (Int)(0 - u) : (Int)u;
+    }
+
+    // 声明字段: 字段类型名, 标签名(也是成员名), 值的类型
+#define PROTOFIELD(Type, label, Value)                                          \
+    struct Type {                                                               \
+        Value label = Value();                                                  \
+        static constexpr const char* Open() { return "<" #label ">"; }          \
+        static constexpr const char* Close() { return "</" #label ">"; }        \
+        static constexpr size_t LabelLen() { return sizeof(#label) - 1; }       \
+        Value& Get() { return label; }                                          \
+        const Value& Get() const { return label; }                              \
+    }
+
+    PROTOFIELD(NameTag, name, Text);        // 用户名
+    PROTOFIELD(ColorTag, color, Int);       // 用户名的颜色
+    PROTOFIELD(MessageTag, message, Text);  // 信息内容; 注册和登录时是 "用户名 口令"
+    PROTOFIELD(TimeTag, time, Int);         // 服务端的广播时间, 单位: ms
+    PROTOFIELD(CompressTag, compress, Int); // 1-能解压压缩报文
+
+    // 报文头: 固定的命令号或信息类型, 整个标签在编译期确定
+    template<int N>
+    struct Cmd {
+        static constexpr const char* Open() { return "<cmd>"; }
+        static constexpr const char* Close() { return "</cmd>"; }
+        static constexpr size_t LabelLen() { return 3; }
+        static constexpr int Value() { return N; }
+    };
+    template<int N>
+    struct Code {
+        static constexpr const char* Open() { return "<code>"; }
+        static constexpr const char* Close() { return "</code>"; }
+        static constexpr size_t LabelLen() { return 4; }
+        static constexpr int Value() { return N; }
+    };
+
+    // 逐个字段展开的编码和解码, I 是字段的序号
+    template<class M, size_t I, class... Fs>
+    struct FieldList {
+        static constexpr size_t TagsSize() { return 0; }
+        static size_t ValuesSize(const M&) { return 0; }
+        static char* Write(char* p, const M&) { return p; }
+        static int Read(M&, unsigned, const char*, size_t, const char**, const char*) { return -1; }
+    };
+    template<class M, size_t I, class F, class... Fs>
+    struct FieldList<M, I, F, Fs...> {
+        using Rest = FieldList<M, I + 1, Fs...>;
+
+        // <label></label> 的长度
+        static constexpr size_t TagsSize() { return 2 * F::LabelLen() + 5 + Rest::TagsSize(); }
+
+        static size_t ValuesSize(const M& m) {
+            return ValueSize(static_cast<const F&>(m).Get()) + Rest::ValuesSize(m);
+        }
+
+        static char* Write(char* p, const M& m) {
+            memcpy(p, F::Open(), F::LabelLen() + 2);
+            p = WriteValue(p + F::LabelLen() + 2, static_cast<const F&>(m).Get());
+            memcpy(p, F::Close(), F::LabelLen() + 3);
+            return Rest::Write(p + F::LabelLen() + 3, m);
+        }
+
+        // 标签名是本字段时读取值, *pos 指向值的开头, 读取后指向结束标签之后
+        // 返回字段的序号; -1 表示不是报文中的字段, found 中已经读过或没有结束标签; -2 表示值中有没有转义的 '<'
+        static int Read(M& m, unsigned found, const char* label, size_t len, const char** pos, const char* end) {
+            if (len != F::LabelLen() || memcmp(label, F::Open() + 1, len) != 0) {
+                return Rest::Read(m, found, label, len, pos, end);
+            }
+            if (found & (1u << I)) {
+                return -1;
+            }
+            // 编码时值中的 '<' 都转义了, 值之后的第一个 '<' 必须是本字段的结束标签, 否则报文不是按协议编码的, 字段的边界不可信
+            const size_t closelen = F::LabelLen() + 3;
+            const char* close = (const char*)memchr(*pos, '<', end - *pos);
+            if (close == nullptr || end - close < (ptrdiff_t)closelen) {
+                return -1;
+            }
+            if (memcmp(close, F::Close(), closelen) != 0) {
+                return -2;
+            }
+            ReadValue(*pos, close - *pos, static_cast<F&>(m).Get());
+            *pos = close + F::LabelLen() + 3;
+            return (int)I;
+        }
+    };
+
+    template<class Head, class... Fields>
+    struct Message : Fields... {
+        using List = FieldList<Message, 0, Fields...>;
+
+        /// @brief 报文头和所有标签的长度, 编译期常量; 报文长度是它加上各个值的长度
+        static constexpr size_t FixedSize() {
+            return 2 * Head::LabelLen() + 5 + Digits((uint64_t)Head::Value()) + List::TagsSize();
+        }
+
+        /// @brief 编码后的长度
+        size_t Size() const { return FixedSize() + List::ValuesSize(*this); }
+
+        /// @brief 编码到 p 开始的内存中, 内存至少有 Size() 字节
+        /// @return 写入的结尾
+        char* Write(char* p) const {
+            memcpy(p, Head::Open(), Head::LabelLen() + 2);
+            p = WriteValue(p + Head::LabelLen() + 2, (Int)Head::Value());
+            memcpy(p, Head::Close(), Head::LabelLen() + 3);
+            return List::Write(p + Head::LabelLen() + 3, *this);
+        }
+
+        /// @brief 编码后追加到 out 后面, out 只扩大一次
+        template<class S>
+        void AppendTo(S& out) const {
+            const size_t old = out.size();
+            out.resize(old + Size());
+            Write(&out[old]);
+        }
+
+        /// @brief 编码为一个字符串
+        std::string Encode() const {
+            std::string out;
+            AppendTo(out);
+            return out;
+        }
+
+        /// @brief 从报文中解码, 只扫描一遍. 报文头和不认识的标签跳过, 字段的顺序不限, 同名字段取第一个;
+        /// 字段的值到它的结束标签为止, 值中的标签不再当作字段. 报文中没有的字段保持原值.
+        /// 值中有没有转义的 '<' 时立即停止: 这个字段保持原值, 后面的内容也不再解析, 值中的标签不会被当作之后的字段
+        /// @return true-所有字段都有; false-缺少字段或报文不是按协议编码的
+        bool Decode(const char* data, const size_t len) {
+            const char* p = data;
+            const char* end = data + len;
+            unsigned found = 0;
+            while (p < end && (p = (const char*)memchr(p, '<', end - p)) != nullptr) {
+                const char* label = p + 1;
+                const char* gt = (const char*)memchr(label, '>', end - label);
+                if (gt == nullptr) break;
+                p = gt + 1;
+                if (*label == '/') continue; // 结束标签
+                const char* value = p;
+                const int idx = List::Read(*this, found, label, gt - label, &value, end);
+                if (idx == -2) return false;
+                if (idx < 0) continue;
+                found |= 1u << idx;
+                p = value;
+            }
+            return found == (1u << sizeof...(Fields)) - 1;
+        }
+    };
+
+    // ------------------ 报文声明 ---------------------------
+    // 客户端到服务端
+    using RegisterCmd = Message<Cmd<0>, MessageTag>;                    // 注册账号
+    using LoginCmd = Message<Cmd<1>, MessageTag, CompressTag>;          // 登录
+    using ChatCmd = Message<Cmd<2>, NameTag, ColorTag, MessageTag>;     // 发信息
+    using RelayCmd = Message<Cmd<7>, NameTag, ColorTag, MessageTag>;    // 其他节点转发的广播
+    // 服务端到客户端
+    using BroadcastCode = Message<Code<4>, NameTag, ColorTag, MessageTag, TimeTag>; // 广播信息
+
+    static_assert(BroadcastCode::FixedSize() == 74, "code 4 tags");
+    static_assert(ChatCmd::FixedSize() == 59, "cmd 2 tags");
+}
+}
+
+#endif
@@ -0,0 +1,33 @@
+// 令牌桶限速
+
+#ifndef RATELIMITER_H_
+#define RATELIMITER_H_
+
+#include <cstdint>
+
+namespace LI {
+
+// 令牌桶的参数
+struct RateSpec {
+    double rate = 0;   // 每秒补充的令牌数, 不大于 0 表示不限速
+    double burst = 0;  // 桶的容量, 即允许的突发个数
+};
+
+// 令牌桶: 每个请求消耗一个令牌, 令牌按速率补充, 最多积累 burst 个.
+// 参数不保存在桶中, 多个桶共用一份配置, 每个桶只有 16 bytes. 不是线程安全的
+class TokenBucket {
+public:
+    /// @brief 取一个令牌
+    /// @param spec 限速参数
+    /// @param nowms 当前时间(单调时钟), 单位: ms
+    /// @return true-取到令牌, 请求可以执行; false-超过限速
+    bool Take(const RateSpec& spec, const int64_t nowms);
+
+private:
+    double m_tokens = -1; // 桶中的令牌数, 小于 0 表示还没有使用过, 第一次使用时装满
+    int64_t m_last = 0;   // 上一次补充令牌的时间, 单位: ms
+};
+
+}
+
+#endif
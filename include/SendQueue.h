@@ -0,0 +1,70 @@
+// 非阻塞 socket 的发送队列: 发送缓冲区满时没有发送的部分留在队列中, 等可写时继续发送
+
+#ifndef SENDQUEUE_H_
+#define SENDQUEUE_H_
+
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <sys/types.h>
+
+namespace LI {
+
+// 一个连接的发送队列. 队列为空时直接发送, 发送缓冲区满时剩下的部分放入队列, 之后的报文都排在队列后面,
+// 由事件循环在可写时调用 Flush 继续发送. 任何线程都可以放入, 放入和发送都持有队列的锁, 报文不会交错, 按放入的顺序到达.
+// 积压超过上限(对端不读取)或连接出错时队列关闭, 之后放入的报文丢弃, 由调用者关闭连接. 不会阻塞
+class SendQueue {
+public:
+    // Push 和 Flush 的结果
+    enum Result {
+        DONE,      // 全部发送, 队列为空
+        QUEUED,    // 这次放入使队列从空变为非空, 调用者应当开始关注可写事件
+        PENDING,   // 队列中还有数据, 已经在关注可写事件
+        FAILED,    // 这次放入或发送使队列关闭(积压超过上限或连接出错), 调用者应当关闭连接
+        CLOSED     // 队列已经关闭, 报文丢弃
+    };
+
+    // 直接发送时使用的函数, 语义同 SendSome
+    using Sender = std::function<ssize_t(const char*, size_t)>;
+
+    /// @param sockfd 非阻塞的 socket 连接
+    /// @param limit 队列积压的上限, 单位: bytes
+    SendQueue(const int sockfd, const size_t limit);
+    SendQueue(const SendQueue&) = delete;
+    SendQueue& operator=(const SendQueue&) = delete;
+
+    /// @brief 发送一个完整的报文(已经带长度头)
+    /// @param send 队列为空时直接发送用的函数(如零拷贝发送), nullptr 时用 SendSome. 没有发送的部分复制到队列中
+    Result Push(const char* data, const size_t len, const Sender& send = nullptr);
+
+    /// @brief 可写时继续发送队列中的数据, 只在事件循环中调用
+    /// @return DONE, PENDING, FAILED 或 CLOSED
+    Result Flush();
+
+    /// @brief 关闭队列, 之后不再发送, 在 close(sockfd) 之前调用. 返回后没有线程再通过这个队列写 socket
+    void Close();
+
+    /// @brief 队列是否为空
+    bool Empty();
+
+    /// @brief 复制还没有发送的数据, 用于热重启时交给新进程. 交接失败时队列继续使用, 不关闭
+    void Unsent(std::string& out);
+
+    int Fd() const { return m_sockfd; }
+
+private:
+    // 关闭队列并释放数据, 持有锁时调用
+    void Close(std::unique_lock<std::mutex>& lk);
+
+    const int m_sockfd;
+    const size_t m_limit;
+    std::mutex m_lock;
+    std::string m_buf;       // 还没有发送的数据, [m_offset, size) 部分有效
+    size_t m_offset;         // 已经发送的部分, 超过一半时才移动, 避免每次部分发送都移动
+    bool m_closed;
+};
+
+}
+
+#endif
@@ -0,0 +1,55 @@
+// 会话令牌
+
+#ifndef SESSIONTOKEN_H_
+#define SESSIONTOKEN_H_
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+namespace LI {
+
+// 会话令牌: 登录成功后发给客户端, 断线重连时客户端出示令牌恢复登录, 服务端只校验签名, 不访问数据库.
+// 令牌格式: 过期时间.签名.用户名, 签名是用 128 位密钥对 "过期时间.用户名" 计算的 SipHash-2-4.
+// 集群中的节点使用相同的密钥时, 令牌在所有节点上有效. 密钥设置好后只读, 签发和校验可以在任何线程进行
+class SessionToken {
+public:
+    /// @brief 构造函数, 使用随机密钥, 令牌只在本进程中有效
+    SessionToken();
+
+    /// @brief 由口令生成密钥, 集群中的节点使用相同的口令
+    void SetSecret(const std::string& secret);
+
+    /// @brief 密钥的十六进制表示, 热重启时交给新进程
+    std::string ExportKey() const;
+
+    /// @brief 导入 ExportKey 的结果
+    /// @return 格式是否正确, 不正确时密钥不变
+    bool ImportKey(const std::string& hex);
+
+    /// @brief 签发令牌
+    /// @param name 用户名
+    /// @param expire 过期时间, unix 时间戳, 单位: s
+    std::string Issue(const char* name, const size_t len, const int64_t expire) const;
+
+    /// @brief 校验令牌
+    /// @param token 令牌的地址
+    /// @param len 令牌的长度, 单位: bytes
+    /// @param now 当前时间, unix 时间戳, 单位: s
+    /// @param name 校验成功时存放用户名, 可以为 nullptr
+    /// @return true-签名正确并且没有过期
+    bool Verify(const char* token, const size_t len, const int64_t now, std::string* name) const;
+
+    /// @brief SipHash-2-4, 带密钥的哈希函数, 不知道密钥时无法伪造结果
+    static uint64_t SipHash(const uint64_t key[2], const char* data, const size_t len);
+
+private:
+    // 对 "过期时间.用户名" 签名
+    uint64_t Sign(const char* expire, const size_t elen, const char* name, const size_t nlen) const;
+
+    uint64_t m_key[2];
+};
+
+}
+
+#endif
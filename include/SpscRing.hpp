@@ -0,0 +1,92 @@
+// 无锁的单生产者单消费者环形队列
+
+#ifndef SPSCRING_H_
+#define SPSCRING_H_
+
+#include <atomic>
+#include <vector>
+#include <cstddef>
+
+
+namespace LI {
+    // 只有一个线程放入, 只有一个线程取出, 两边都不加锁.
+    // 生产者和消费者的下标放在不同的缓存行中, 各自缓存对方的下标, 只有看起来满或空时才读取对方的下标, 减少缓存行的来回传递
+    template<class T>
+    class SpscRing {
+    public:
+        /// @brief 构造函数
+        /// @param capacity 容量, 向上取整为 2 的幂
+        explicit SpscRing(size_t capacity);
+        SpscRing(const SpscRing&) = delete;
+        SpscRing& operator=(const SpscRing&) = delete;
+
+        /// @brief 放入一个元素, 只在生产者线程中调用
+        /// @return true-成功; false-队列满, item 不变
+        bool Push(T&& item);
+
+        /// @brief 取出一个元素, 只在消费者线程中调用. 取出后槽中留下移动后的对象, shared_ptr 等立即释放
+        /// @return true-成功; false-队列空
+        bool Pop(T& item);
+
+        /// @brief 队列的容量
+        size_t Capacity() const { return m_mask + 1; }
+
+    private:
+        // 缓存行的大小
+        static constexpr size_t kLine = 64;
+
+        std::vector<T> m_slots;
+        size_t m_mask;
+        char m_pad0[kLine];
+        // 生产者使用
+        std::atomic<size_t> m_tail;   // 下一个放入的位置
+        size_t m_headcache;           // 最近一次读到的 m_head
+        char m_pad1[kLine - sizeof(std::atomic<size_t>) - sizeof(size_t)];
+        // 消费者使用
+        std::atomic<size_t> m_head;   // 下一个取出的位置
+        size_t m_tailcache;           // 最近一次读到的 m_tail
+        char m_pad2[kLine - sizeof(std::atomic<size_t>) - sizeof(size_t)];
+    };
+
+    template<class T>
+    SpscRing<T>::SpscRing(size_t capacity): m_tail(0), m_headcache(0), m_head(0), m_tailcache(0) {
+        size_t n = 1;
+        while (n < capacity) {
+            n <<= 1;
+        }
+        m_slots.resize(n);
+        m_mask = n - 1;
+    }
+
+    template<class T>
+    bool SpscRing<T>::Push(T&& item) {
+        const size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_headcache > m_mask) {
+            m_headcache = m_head.load(std::memory_order_acquire);
+            if (tail - m_headcache > m_mask) {
+                return false;
+            }
+        }
+        m_slots[tail & m_mask] = std::move(item);
+        // 发布之后消费者才能看到槽中的元素
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    template<class T>
+    bool SpscRing<T>::Pop(T& item) {
+        const size_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tailcache) {
+            m_tailcache = m_tail.load(std::memory_order_acquire);
+            if (head == m_tailcache) {
+                return false;
+            }
+        }
+        item = std::move(m_slots[head & m_mask]);
+        // 归还槽之后生产者才能覆盖
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+}
+
+#endif
@@ -12,46 +12,127 @@
 #include <memory>
 #include <functional>
 #include <stdexcept>
+#include <deque>
+#include <chrono>
+#include <pthread.h>
+#include "MemoryPool.h"
+#include "Metrics.h"
 
 
 namespace LI {
     class ThreadPool {
     public:
+        // 任务队列满时的处理策略
+        enum Overflow {
+            REJECT,     // 拒绝新任务
+            BLOCK,      // 阻塞提交任务的线程, 直到队列有空位
+            DROPOLDEST  // 丢弃队列中最早的任务, 放入新任务
+        };
+
         /// @brief 构造函数
         /// @param threads 要启动的线程个数
         ThreadPool(size_t threads);
 
+        /// @brief 设置任务队列的容量, 应当在提交任务之前调用
+        /// @param capacity 最多排队的任务数(不包括正在执行的), 0 表示不限制(缺省)
+        /// @param policy 队列满时的处理策略
+        void SetCapacity(const size_t capacity, const Overflow policy);
+
+        /// @brief 把所有线程绑定到一个 CPU 上, 和提交任务的线程在同一个核上时任务的数据留在本核的缓存中
+        /// @param cpu CPU 编号
+        /// @return true-成功; false-CPU 不存在或不允许使用
+        bool SetAffinity(const int cpu);
+
         /// @brief 把任务放入任务队列
         /// @tparam _Callable 可调用对象类型
         /// @tparam ...Args 可调用对象类型的参数类型
         /// @param _f 可调用对象
         /// @param ...args 可调用对象的参数
-        /// @return future<可调用对象的返回类型>
+        /// @return future<可调用对象的返回类型>, 任务被拒绝或丢弃时 future 得到 broken_promise 异常
         template<class _Callable, class... Args>
         auto enqueue(_Callable&& _f, Args&&... args)
             -> std::future< typename std::result_of<_Callable(Args...)>::type >;
+
+        /// @brief 把不需要返回结果的任务放入任务队列
+        ///        任务节点从内存池分配, 不创建 packaged_task 和 future, 稳定运行时不申请堆内存
+        /// @tparam _Callable 可调用对象类型
+        /// @tparam ...Args 可调用对象类型的参数类型
+        /// @param _f 可调用对象
+        /// @param ...args 可调用对象的参数
+        /// @return true-已经放入队列; false-队列满被拒绝
+        template<class _Callable, class... Args>
+        bool post(_Callable&& _f, Args&&... args);
+
+        /// @brief 同 post, 任务没有执行时调用 reject: REJECT 策略下队列满时在调用者线程中立即调用;
+        ///        DROPOLDEST 策略下任务被挤出队列时, 在提交新任务的线程中调用
+        /// @param reject 无参数的可调用对象
+        template<class _Reject, class _Callable, class... Args>
+        bool try_post(_Reject&& reject, _Callable&& _f, Args&&... args);
+
+        /// @brief 任务队列为空且没有正在执行的任务
+        /// @return true-空闲; false-还有任务
+        bool Idle();
+
+        /// @brief 排队的任务数
+        size_t Depth();
+
+        /// @brief 队列是否已满, 没有设置容量时总是 false
+        bool Full();
+
+        /// @brief 队列的容量, 0 表示不限制
+        size_t Capacity() const { return capacity; }
+
+        /// @brief 上次调用以来排队任务数的最大值, 调用后重新统计
+        size_t TakePeakDepth();
+
+        /// @brief 被拒绝的任务数
+        uint64_t Rejected();
+
+        /// @brief 被丢弃的任务数
+        uint64_t Dropped();
+
+        /// @brief 任务在队列中等待的时间
+        const LatencyHistogram& WaitTime() const { return wait_time; }
         
 
         // 析构函数
         ~ThreadPool();
     private:
+        // 队列中的任务: 参数为 true 时执行, false 时表示任务被丢弃, 只释放资源
+        struct QueuedTask {
+            std::function<void(bool)> fn;
+            std::chrono::steady_clock::time_point queued; // 入队时间
+        };
+
+        // 持有锁时放入任务, 返回 false 表示被拒绝; 被挤出的任务放在 dropped 中, 由调用者在锁外处理
+        bool Push(std::unique_lock<std::mutex>& lk, std::function<void(bool)>&& fn, std::function<void(bool)>& dropped);
+
         std::vector<std::thread> workers; // 线程数组
         // 任务队列
-        // 任务的可执行函数时无参数无返回类型的可调用对象
-        std::queue< std::function<void()> > tasks;
+        // 队列的存储块也从内存池分配
+        std::queue< QueuedTask, std::deque< QueuedTask, PoolAllocator<QueuedTask> > > tasks;
 
         // 同步变量
         std::mutex queue_mutex;
         std::condition_variable condv;
+        std::condition_variable not_full; // BLOCK 策略下等待队列有空位
         bool stop; // 终止标记
+        size_t busy; // 正在执行任务的线程个数
+        size_t capacity; // 队列容量, 0 表示不限制
+        Overflow policy; // 队列满时的处理策略
+        size_t peak; // 排队任务数的最大值
+        uint64_t rejected; // 被拒绝的任务数
+        uint64_t dropped; // 被丢弃的任务数
+        LatencyHistogram wait_time; // 任务在队列中等待的时间
     };
 
-    ThreadPool::ThreadPool(size_t threads): stop(false) {
+    ThreadPool::ThreadPool(size_t threads): stop(false), busy(0), capacity(0), policy(BLOCK), peak(0), rejected(0), dropped(0) {
         for (size_t i = 0; i < threads; ++i) {
             // 新增线程
             workers.emplace_back([this]() {
                 while (true) {
-                    std::function<void()> task;
+                    QueuedTask task;
+                    bool bounded; // 队列有容量上限, 取走任务后唤醒等待空位的线程
                     // 取任务
                     {
                         std::unique_lock<std::mutex> lk(this->queue_mutex);
@@ -66,15 +147,72 @@ namespace LI {
                         }
                         task = std::move(this->tasks.front()); // 避免复制
                         this->tasks.pop();
+                        ++this->busy;
+                        bounded = this->capacity > 0; // capacity 由 SetCapacity 修改, 只在锁内读取
                         // 出作用域 lk 自动 unlock()
                     }
+                    if (bounded) {
+                        this->not_full.notify_one();
+                    }
+                    this->wait_time.Record(std::chrono::duration_cast<std::chrono::microseconds>(
+                        std::chrono::steady_clock::now() - task.queued).count());
+
+                    task.fn(true); // 执行任务
 
-                    task(); // 执行任务
+                    {
+                        std::unique_lock<std::mutex> lk(this->queue_mutex);
+                        --this->busy;
+                    }
                 }
             } );
         }
     }
 
+    void ThreadPool::SetCapacity(const size_t capacity, const Overflow policy) {
+        std::unique_lock<std::mutex> lk(queue_mutex);
+        this->capacity = capacity;
+        this->policy = policy;
+    }
+
+    bool ThreadPool::SetAffinity(const int cpu) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+        for (std::thread& worker : workers) {
+            if (pthread_setaffinity_np(worker.native_handle(), sizeof(cpus), &cpus) != 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool ThreadPool::Push(std::unique_lock<std::mutex>& lk, std::function<void(bool)>&& fn, std::function<void(bool)>& dropped) {
+        if (capacity > 0 && tasks.size() >= capacity) {
+            switch (policy) {
+                case REJECT:
+                    ++rejected;
+                    return false;
+                case BLOCK:
+                    not_full.wait(lk, [this]() { return stop || tasks.size() < capacity; });
+                    if (stop) {
+                        ++rejected;
+                        return false;
+                    }
+                    break;
+                case DROPOLDEST:
+                    dropped = std::move(tasks.front().fn);
+                    tasks.pop();
+                    ++this->dropped;
+                    break;
+            }
+        }
+        tasks.push({std::move(fn), std::chrono::steady_clock::now()});
+        if (tasks.size() > peak) {
+            peak = tasks.size();
+        }
+        return true;
+    }
+
     template<class _Callable, class... Args>
     auto ThreadPool::enqueue(_Callable&& _f, Args&&... args)
         -> std::future< typename std::result_of<_Callable(Args...)>::type >
@@ -96,6 +234,9 @@ namespace LI {
         std::future<return_type> res = task->get_future();
         // std::future<return_type> res = task.get_future();
 
+        // 被拒绝或丢弃的任务在锁外析构
+        std::function<void(bool)> fn, dropped;
+        bool ok;
         {
             // 上锁
             std::unique_lock<std::mutex> lk(queue_mutex);
@@ -105,19 +246,107 @@ namespace LI {
             }
             // 这里使用值捕获, 会使 share_ptr 计数 + 1
             // 不能直接使用非指针类型的 task(std::packaged_task对象), 因为该类的 ctor 是 delete 的
-            tasks.emplace([task](){ (*task)(); });
+            // 任务被丢弃时 packaged_task 没有执行就析构, future 得到 broken_promise
+            fn = [task](bool run){ if (run) (*task)(); };
+            ok = Push(lk, std::move(fn), dropped);
         }
 
-        condv.notify_one(); // 唤醒一个worker线程
+        if (ok) {
+            condv.notify_one(); // 唤醒一个worker线程
+        }
+        // 被挤出的任务在锁外处理: enqueue 的任务在这里得到 broken_promise, try_post 的任务调用 reject 并归还内存
+        if (dropped) {
+            dropped(false);
+        }
         return res;
     }
 
+    template<class _Callable, class... Args>
+    bool ThreadPool::post(_Callable&& _f, Args&&... args) {
+        return try_post([]() {}, std::forward<_Callable>(_f), std::forward<Args>(args)...);
+    }
+
+    template<class _Reject, class _Callable, class... Args>
+    bool ThreadPool::try_post(_Reject&& reject, _Callable&& _f, Args&&... args) {
+        using task_type = decltype(std::bind(std::forward<_Callable>(_f), std::forward<Args>(args)...));
+        using reject_type = typename std::decay<_Reject>::type;
+        struct Holder {
+            task_type task;
+            reject_type reject;
+        };
+
+        // 绑定了参数的可调用对象放在内存池中, 队列里只保存一个指针
+        // 只捕获一个指针的 lambda 可以直接存放在 std::function 内部, 不需要再申请内存
+        Holder* holder = PoolNew<Holder>(Holder{std::bind(std::forward<_Callable>(_f), std::forward<Args>(args)...), std::forward<_Reject>(reject)});
+        std::function<void(bool)> fn = [holder](bool run) {
+            if (run) holder->task();
+            else holder->reject();
+            PoolDelete(holder); // 在执行任务的线程中归还
+        };
+
+        std::function<void(bool)> dropped;
+        bool ok;
+        {
+            std::unique_lock<std::mutex> lk(queue_mutex);
+            if (stop) {
+                PoolDelete(holder);
+                throw std::runtime_error("post on stopped ThreadPool");
+            }
+            ok = Push(lk, std::move(fn), dropped);
+        }
+
+        if (ok) {
+            condv.notify_one();
+        }
+        else {
+            fn(false);
+        }
+        // 被挤出的任务在锁外处理
+        if (dropped) {
+            dropped(false);
+        }
+        return ok;
+    }
+
+    bool ThreadPool::Idle() {
+        std::unique_lock<std::mutex> lk(queue_mutex);
+        return tasks.empty() && busy == 0;
+    }
+
+    size_t ThreadPool::Depth() {
+        std::unique_lock<std::mutex> lk(queue_mutex);
+        return tasks.size();
+    }
+
+    bool ThreadPool::Full() {
+        std::unique_lock<std::mutex> lk(queue_mutex);
+        return capacity > 0 && tasks.size() >= capacity;
+    }
+
+    size_t ThreadPool::TakePeakDepth() {
+        std::unique_lock<std::mutex> lk(queue_mutex);
+        size_t value = peak;
+        peak = tasks.size();
+        return value;
+    }
+
+    uint64_t ThreadPool::Rejected() {
+        std::unique_lock<std::mutex> lk(queue_mutex);
+        return rejected;
+    }
+
+    uint64_t ThreadPool::Dropped() {
+        std::unique_lock<std::mutex> lk(queue_mutex);
+        return dropped;
+    }
+
     ThreadPool::~ThreadPool() {
         {
             std::unique_lock<std::mutex> lk(queue_mutex);
             stop = true;
         }
         condv.notify_all(); // 唤醒所有线程
+        not_full.notify_all();
         for (std::thread& worker : workers) {
             worker.join();
         }
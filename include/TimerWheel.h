@@ -0,0 +1,89 @@
+// 分层时间轮定时器
+
+#ifndef TIMERWHEEL_H_
+#define TIMERWHEEL_H_
+
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+namespace LI {
+
+// 定时器编号, 高 32 位是版本号, 低 32 位是节点下标. 节点复用后旧编号自动失效, 0 表示无效编号
+using TimerId = uint64_t;
+
+// 分层时间轮(4 层, 256/64/64/64 个槽), 添加和取消定时器都是 O(1), 可以管理百万级定时器.
+// 不是线程安全的, 只在一个线程(epoll 线程)中使用
+class TimerWheel {
+public:
+    using Callback = std::function<void()>;
+
+    /// @brief 构造函数
+    /// @param tickms 时间轮的精度, 单位: ms, 缺省 100ms
+    TimerWheel(const int tickms = 100);
+
+    /// @brief 添加定时器, 到期后回调只执行一次
+    /// @param delayms 多少毫秒后到期
+    /// @param cb 到期时执行的回调
+    /// @return 定时器编号, 用于取消
+    TimerId AddTimer(const int64_t delayms, Callback cb);
+
+    /// @brief 取消定时器
+    /// @param id AddTimer 返回的编号
+    /// @return true-取消成功; false-定时器已经到期或已经取消
+    bool CancelTimer(const TimerId id);
+
+    /// @brief 执行所有已经到期的定时器
+    /// @return 执行的定时器个数
+    int Update();
+
+    /// @brief 距离下一次需要调用 Update 的时间, 用作 epoll_wait 的超时时间
+    /// @return 毫秒数, 没有定时器时返回 -1(无限等待)
+    int NextTimeout() const;
+
+    /// @brief 当前的定时器个数
+    size_t Size() const { return m_size; }
+
+    /// @brief 单调时钟的当前时间, 单位: ms
+    static int64_t NowMs();
+
+private:
+    static const int LEVELS = 4;
+    static const int ROOTBITS = 8;  // 第 0 层 256 个槽
+    static const int LEVELBITS = 6; // 其余每层 64 个槽
+    static const int ROOTSIZE = 1 << ROOTBITS;
+    static const int LEVELSIZE = 1 << LEVELBITS;
+    static const int NSLOT = ROOTSIZE + (LEVELS - 1) * LEVELSIZE;
+
+    // 定时器节点, 用下标组成双向链表
+    struct Node {
+        int32_t prev;
+        int32_t next;
+        int32_t slot;   // 所在的槽, -1 表示空闲
+        uint32_t gen;   // 版本号
+        uint64_t expire; // 到期的 tick
+        Callback cb;
+    };
+
+    // 按到期时间把节点放入对应的槽
+    void Place(const int32_t idx);
+    // 从所在的槽中摘除节点
+    void Unlink(const int32_t idx);
+    // 把高层的槽中的节点重新分配到低层
+    void Cascade(const int level, const int slot);
+    // 走过一个 tick, 执行到期的定时器
+    int Step();
+
+    const int m_tickms;
+    int64_t m_startms;            // 时间轮的起始时间
+    uint64_t m_tick;              // 当前的 tick
+    size_t m_size;                // 定时器个数
+    std::vector<Node> m_nodes;    // 节点数组
+    std::vector<int32_t> m_free;  // 空闲节点的下标
+    int32_t m_slots[NSLOT + 1];   // 每个槽的链表头, 最后一个是正在执行的到期链表
+};
+
+}
+
+#endif
@@ -0,0 +1,104 @@
+// TLS 传输: 基于 OpenSSL, 编译时没有定义 WITH_TLS 时所有连接都是明文
+
+#ifndef TLS_H_
+#define TLS_H_
+
+#include <sys/types.h>
+#include <cstddef>
+#include <mutex>
+#include <string>
+
+namespace LI {
+
+// TLS 上下文, 服务端或客户端各一个, 所有连接共用(线程安全).
+// 只允许 TLS 1.2 以上, 缺省优先使用 AES-GCM(有 AES-NI 时由 OpenSSL 自动使用), 客户端优先 ChaCha20 时服务端照顾客户端.
+// 服务端开启会话票据(session ticket), 客户端保存最近一次的会话, 重连时恢复会话, 省去证书交换和密钥协商
+class TlsContext {
+public:
+    TlsContext();
+    TlsContext(const TlsContext&) = delete;
+    TlsContext& operator=(const TlsContext&) = delete;
+
+    /// @brief 初始化服务端上下文
+    /// @param certfile PEM 格式的证书(链)文件
+    /// @param keyfile PEM 格式的私钥文件
+    /// @return true-成功; false-失败或编译时没有启用 TLS, 原因在 Error() 中
+    bool InitServer(const char* certfile, const char* keyfile);
+
+    /// @brief 初始化客户端上下文
+    /// @param cafile 校验服务端证书的 CA 文件, nullptr 表示不校验(只加密, 用于自签名证书的测试环境)
+    /// @return true-成功; false-失败或编译时没有启用 TLS
+    bool InitClient(const char* cafile);
+
+    /// @brief 是否已经初始化
+    bool Enabled() const { return m_ctx != nullptr; }
+
+    /// @brief 最近一次失败的原因
+    const std::string& Error() const { return m_error; }
+
+    ~TlsContext();
+
+private:
+    friend struct TlsAccess;
+    void* m_ctx;           // SSL_CTX*, 头文件不依赖 OpenSSL
+    bool m_verify;         // 客户端是否校验服务端证书
+    std::mutex m_lock;     // 保护 m_session
+    void* m_session;       // SSL_SESSION*, 客户端最近一次可以恢复的会话
+    std::string m_error;
+};
+
+/// @brief 服务端: 把已连接的 socket 注册为 TLS 连接, socket 设置为非阻塞.
+///        握手在后续的读取中进行, 之后 TcpWrite/TcpRead/Writen/Readn/SendSome/RecvBuffer::ReadFd 自动加解密
+/// @return true-成功; false-上下文没有初始化
+bool TlsAccept(TlsContext& ctx, const int sockfd);
+
+/// @brief 客户端: 在已连接的 socket 上完成 TLS 握手(阻塞), 有保存的会话时先尝试恢复.
+///        成功后 socket 是非阻塞的, TcpRead/TcpWrite/Readn/Writen 内部用 poll 等待, 仍然是阻塞的语义
+/// @param host 服务端的地址, 校验证书时用来匹配证书中的名字
+/// @param itimeout 握手的超时时间, 单位: s
+/// @return true-握手成功, 连接已注册; false-失败, socket 保持原样由调用者关闭
+bool TlsConnect(TlsContext& ctx, const int sockfd, const char* host, const int itimeout);
+
+/// @brief 客户端: 把已连接的非阻塞 socket 注册为 TLS 连接, 有保存的会话时先尝试恢复. 不进行握手,
+///        由事件循环在 socket 可读或可写时调用 TlsHandshake 推进, 不会阻塞
+/// @param host 服务端的地址, 校验证书时用来匹配证书中的名字
+/// @return true-成功, 连接已注册; false-上下文没有初始化
+bool TlsConnectStart(TlsContext& ctx, const int sockfd, const char* host);
+
+/// @brief 推进 TlsConnectStart 注册的连接的握手, 不阻塞
+/// @param want_write 握手没有完成时, true-等 socket 可写; false-等 socket 可读
+/// @return 1-握手完成; 0-还没有完成; -1-握手失败或不是 TLS 连接, 调用者注销并关闭连接
+int TlsHandshake(const int sockfd, bool* want_write);
+
+/// @brief socket 是否是 TLS 连接
+bool TlsActive(const int sockfd);
+
+/// @brief 最近一次握手是否恢复了会话
+/// @return true-恢复了会话; false-完整握手或不是 TLS 连接
+bool TlsResumed(const int sockfd);
+
+/// @brief OpenSSL 中是否有已经解密还没有读取的数据, 这时 socket 不可读, 用 poll 等待会错过这些数据
+bool TlsPending(const int sockfd);
+
+/// @brief 注销 TLS 连接, 在 close(sockfd) 之前调用; 不是 TLS 连接时什么也不做
+void TlsDetach(const int sockfd);
+
+/// @brief TLS 连接的读取, 语义同 read(2), 非阻塞时没有数据返回 -1 并设置 errno 为 EAGAIN
+/// @param nread 读取的结果
+/// @return true-是 TLS 连接, 结果在 nread 中; false-不是 TLS 连接, 调用者直接读 socket
+bool TlsRecv(const int sockfd, void* buffer, const size_t n, ssize_t* nread);
+
+/// @brief TLS 连接的发送, 语义同 write(2), 可能只发送一部分; 返回 EAGAIN 后必须用相同的数据重试
+/// @param nsent 发送的结果
+/// @return true-是 TLS 连接, 结果在 nsent 中; false-不是 TLS 连接, 调用者直接写 socket
+bool TlsSend(const int sockfd, const void* buffer, const size_t n, ssize_t* nsent);
+
+/// @brief TLS 连接的阻塞发送, 发送完 n 个字节才返回. 多个线程同时发送时按报文串行, 不会交错
+/// @param itimeout 发送的超时时间, 单位: ms
+/// @param ok 发送的结果, true-全部发送; false-超时或连接不可用
+/// @return true-是 TLS 连接, 结果在 ok 中; false-不是 TLS 连接, 调用者直接写 socket
+bool TlsWriteAll(const int sockfd, const void* buffer, const size_t n, const int itimeout, bool* ok);
+
+}
+
+#endif
@@ -0,0 +1,68 @@
+// 零拷贝发送: 大报文用 MSG_ZEROCOPY 发送, 内核直接引用用户内存, 不再复制到 socket 缓冲区
+
+#ifndef ZEROCOPY_H_
+#define ZEROCOPY_H_
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+namespace LI {
+
+// 一个 socket 上零拷贝发送的报文.
+// 内核在数据发送完成(对端确认)后才释放对用户内存的引用, 完成通知放在 socket 的错误队列中, epoll 报告 EPOLLERR.
+// 报文用 shared_ptr 共享持有, 一次广播的所有接收者共用一份, 最后一个通知到达后释放.
+// 只在一个线程中使用
+class ZeroCopyQueue {
+public:
+    ZeroCopyQueue();
+
+    /// @brief 打开 socket 的 SO_ZEROCOPY
+    /// @return true-成功; false-内核不支持(4.14 以前)或 socket 不支持
+    bool Enable(const int sockfd);
+
+    /// @brief 是否已经打开
+    bool Enabled() const { return m_enabled; }
+
+    /// @brief 阻塞发送一个完整的报文(已经带长度头), 语义同 Writen. 内核引用了报文时持有 frame 直到完成通知到达
+    /// @param itimeout 零拷贝部分的超时时间, 发送缓冲区满时等待可写, 超过后放弃, 单位: ms
+    /// @return true-全部发送; false-超时或连接不可用
+    bool Send(const int sockfd, const std::shared_ptr<const std::string>& frame, const int itimeout);
+
+    /// @brief 非阻塞发送报文(已经带长度头)的一部分, 语义同 SendSome, 不等待可写. 内核引用了报文时持有 frame 直到完成通知到达
+    /// @param offset 从报文的这个位置开始发送
+    /// @return 发送的字节数; -1-出错, 错误码在 errno 中, EAGAIN 表示发送缓冲区满
+    ssize_t SendSome(const int sockfd, const std::shared_ptr<const std::string>& frame, const size_t offset);
+
+    /// @brief 取出错误队列中的完成通知, 释放已经完成的报文, socket 报告 EPOLLERR 时调用
+    /// @param copied 通知中内核没有零拷贝而是复制了数据的个数(如本机回环), 可以为 nullptr
+    /// @return 取出的通知个数
+    int Reap(const int sockfd, int* copied = nullptr);
+
+    /// @brief 还在等待完成通知的报文个数
+    size_t Pending() const { return m_pending.size(); }
+
+    /// @brief 下一次发送的通知序号. 内核的计数属于 socket, 热重启时交给新进程, 否则新进程会把旧通知当作自己的
+    uint32_t Sequence() const { return m_next; }
+    void SetSequence(const uint32_t next) { m_next = next; }
+
+    /// @brief 连接关闭时取出还在等待的报文, 内核可能还在发送, 由调用者再保留一段时间
+    void Release(std::vector<std::shared_ptr<const std::string>>& out);
+
+private:
+    // 等待完成通知的报文
+    struct Entry {
+        uint32_t last;                              // 发送它的最后一次调用的通知序号
+        std::shared_ptr<const std::string> frame;
+    };
+    bool m_enabled;
+    uint32_t m_next;          // 下一次零拷贝发送的通知序号, 内核每次成功的 sendmsg 加一
+    std::deque<Entry> m_pending;
+};
+
+}
+
+#endif
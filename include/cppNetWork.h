@@ -15,18 +15,32 @@
 #include <fstream>
 #include <stdio.h>
 #include <stdarg.h>
-#include <sys/select.h>
+#include <poll.h>
 #include <sys/time.h>
+#include <sys/uio.h>
+#include <errno.h>
 #include <arpa/inet.h>
+#include <sys/un.h>
+#include <mutex>
+#include <vector>
+#include "MemoryPool.h"
 
 namespace LI {
 
+class TlsContext;
+
 /// @brief 从格式字符串里解析内容
 /// @param formBuffer 待解析的字符串
 /// @param labelname 字段的标签名
 /// @param RtnValue 解析结果
 bool GetStrFromXML(const char* formBuffer, const char* labelname, std::string& RtnValue);
 bool GetStrFromXML(const char* formBuffer, const char* labelname, int& RtnValue);
+bool GetStrFromXML(const char* formBuffer, const char* labelname, PoolString& RtnValue);
+
+/// @brief 选择 GetStrFromXML 查找标签的实现, 用于测试和性能比较. 缺省按 CPU 支持的指令集选择
+/// @param name "avx2", "sse2", "scalar" 或 "auto"(恢复缺省)
+/// @return false-名字不认识或 CPU 不支持
+bool SetXMLScanner(const char* name);
 
 /// @brief 把字符串形成 xml 格式
 /// @param message 字符串内容(引用原地修改)
@@ -40,6 +54,13 @@ void FormXML(std::string& message, const char* labelname);
 /// @param timetvl 时间偏移量, 单位: s, 表示要将当前时间偏移的时间量, 如: 30表示当前时间+30s, 缺省 0
 void LocalTime(char* stime, const int timetvl = 0);
 
+/// @brief 断线重连的等待时间: 指数退避加随机抖动, 避免大量客户端同时重连
+/// @param basems 第一次重连的等待时间, 单位: ms
+/// @param maxms 等待时间的上限, 单位: ms
+/// @param attempt 已经连续失败的次数, 从 0 开始
+/// @return 在 [d/2, d] 中随机取值, d = min(maxms, basems * 2^attempt)
+int BackoffMs(const int basems, const int maxms, const int attempt);
+
 
 // 日志文件操作类
 class LogFile {
@@ -130,13 +151,18 @@ public:
     int m_port;      // 与服务端通信的端口
     bool m_btimeout; // 调用 Read 和 Write 的超时标志
     int m_buflen;    // 调用 Read 方法后, 接收到的报文大小, 单位: bytes
+    TlsContext* m_tls; // 不为 nullptr 时连接后进行 TLS 握手, 缺省为明文
 
     TcpClient(); // 构造函数
 
+    /// @brief 使用 TLS 连接服务端, 在 ConnectToServer 之前调用. 同一个上下文保存最近的会话, 重新连接时恢复会话
+    /// @param tls 已经用 InitClient 初始化的上下文, 生命周期长于 TcpClient; nullptr 表示明文
+    void SetTls(TlsContext* tls);
+
     /// @brief 向服务端发起连接请求
     /// @param ip 服务端 ip 地址
     /// @param port 服务端 的端口
-    /// @return 是否成功连接
+    /// @return 是否成功连接, 使用 TLS 时还要握手成功
     bool ConnectToServer(const char* ip, const int port); 
 
     /// @brief 接收服务端发送过来的数据
@@ -170,17 +196,31 @@ public:
     int m_connfd;    // 客户端连接上来的 socket
     bool m_btimeout; // 调用 Read 和 Write 的超时标志
     int m_buflen;    // 调用 Read 方法后, 接收到的报文大小, 单位: bytes
+    TlsContext* m_tls; // 不为 nullptr 时接受的连接都是 TLS 连接, 缺省为明文
+    bool m_reuseport;  // 监听 socket 是否设置 SO_REUSEPORT, 缺省不设置
 
     TcpServer();  //构造函数
 
+    /// @brief 接受的连接使用 TLS, 握手在第一次读取时进行
+    /// @param tls 已经用 InitServer 初始化的上下文, 生命周期长于 TcpServer; nullptr 表示明文
+    void SetTls(TlsContext* tls);
+
+    /// @brief 监听 socket 设置 SO_REUSEPORT, 多个 socket 可以监听同一个端口, 内核把新连接分散到各个 socket. 在 InitServer 之前调用
+    void SetReusePort(const bool reuseport);
+
     /// @brief 服务端初始化
     /// @param ip 指定服务端的ip地址
     /// @param port 指定服务端用于监听的端口
     /// @return true-成功; false-失败, 一般情况下, 只要port设置正确, 没有被占用, 初始化都会成功.
     bool InitServer(const char* ip, const unsigned int port);
 
+    /// @brief 使用已经处于监听状态的 socket 初始化服务端, 用于热重启时接管旧进程的监听 socket
+    /// @param listenfd 监听 socket
+    /// @return true-成功; false-socket 无效
+    bool AttachListen(const int listenfd);
+
     /// @brief 阻塞等待客户端的连接请求
-    /// @return true-有新的客户端连接上来; false-失败, Accept被阻塞, 可以重新 Accept.
+    /// @return true-有新的客户端连接上来, 使用 TLS 时连接是非阻塞的; false-失败, Accept被阻塞, 可以重新 Accept.
     bool Accept();
 
     /// @brief 获取客户端的ip地址
@@ -209,9 +249,17 @@ public:
 
 };
 
+/// @brief 设置报文体长度的上限, 长度头超过上限的报文视为非法报文, 接收失败
+/// @param imaxlen 报文体的最大长度, 单位: bytes, 缺省值为 64KB
+void SetMaxMsgLen(const int imaxlen);
+
+/// @brief 获取报文体长度的上限
+/// @return 报文体的最大长度, 单位: bytes
+int GetMaxMsgLen();
+
 /// @brief 接收socket的另一端发送过来的数据
 /// @param sockfd 可用的socket连接
-/// @param buffer 接收数据缓冲区的地址
+/// @param buffer 接收数据缓冲区的地址, 大小至少为 GetMaxMsgLen() + 1, 报文后会补 '\0'
 /// @param ibuflen 成功接收数据的字节数
 /// @param itimeout 接收等待超时的时间, 单位: s, 缺省值是0-无限等待
 /// @return true-成功; false-失败, 如果失败有两种情况: 1)等待超时; 2)socket连接已不可用
@@ -221,8 +269,29 @@ bool TcpRead(const int sockfd, char* buffer, int* ibuflen, const int itimeout =
 /// @param sockfd 可用的socket连接
 /// @param buffer 待发送数据缓冲区的地址
 /// @param ibuflen 待发送数据的字节数, 如果发送的是ascii字符串, ibuflen取0, 如果是二进制流数据, ibuflen为二进制数据块的大小
+/// @param compressed buffer 是否是 CompressFrame 的结果, 是时长度头带压缩标志
 /// @return true-成功；false-失败，如果失败，表示socket连接已不可用
-bool TcpWrite(const int sockfd, const char* buffer, const int ibuflen = 0);
+bool TcpWrite(const int sockfd, const char* buffer, const int ibuflen = 0, const bool compressed = false);
+
+/// @brief 压缩报文体. 长度头的最高位是压缩标志, 压缩报文体为 "4字节原始长度 + LZ4 块".
+///        只有对端在登录时声明支持(<compress>1</compress>)才能发送压缩报文
+/// @param buffer 报文体的地址
+/// @param ibuflen 报文体的长度
+/// @param out 存放压缩后的报文体
+/// @return true-已压缩; false-报文太短或压缩后没有变短, 应当发送原报文
+bool CompressFrame(const char* buffer, const int ibuflen, std::string& out);
+
+/// @brief 把报文加上长度头追加到发送缓冲区, 用于非阻塞 socket 自己管理发送缓冲区的情况
+/// @param out 发送缓冲区
+/// @param buffer 报文体的地址
+/// @param ibuflen 报文体的长度
+/// @param compress 是否尝试压缩, 压缩后没有变短时追加原报文
+void AppendFrame(std::string& out, const char* buffer, const int ibuflen, const bool compress = false);
+
+/// @brief 在发送缓冲区后面追加一个已经压缩的报文, 长度头带压缩标志
+/// @param out 发送缓冲区
+/// @param packed CompressFrame 的结果
+void AppendPacked(std::string& out, const std::string& packed);
 
 /// @brief 从已经准备好的socket中读取数据
 /// @param sockfd 已经准备好的socket连接
@@ -238,6 +307,170 @@ bool Readn(const int sockfd, char* buffer, const size_t n);
 /// @return true-发送完n字节的数据; false-socket连接不可用
 bool Writen(const int sockfd, const char* buffer, const size_t n);
 
+/// @brief 非阻塞 socket 的发送, 能发多少发多少, 用于自己管理发送缓冲区的情况. TLS 连接自动加密
+/// @param sockfd 非阻塞的 socket 连接
+/// @param buffer 待发送数据的地址, 返回 EAGAIN 后下一次必须从同样的数据开始发送
+/// @param n 待发送数据的字节数
+/// @return 发送的字节数; -1-出错, 错误码在 errno 中, EAGAIN 表示发送缓冲区满
+ssize_t SendSome(const int sockfd, const char* buffer, const size_t n);
+
+/// @brief 创建 UNIX 域 socket(SOCK_SEQPACKET, 保留报文边界)并监听, 用于进程间交接文件描述符
+/// @param path socket 文件路径, 已经存在会先删除
+/// @return 监听 socket, -1 表示失败
+int UnixListen(const char* path);
+
+/// @brief 连接 UNIX 域 socket(SOCK_SEQPACKET)
+/// @param path socket 文件路径
+/// @return 连接的 socket, -1 表示失败
+int UnixConnect(const char* path);
+
+/// @brief 通过 UNIX 域 socket 发送一个文件描述符和附带的数据, 一次调用就是一个报文
+/// @param sockfd UNIX 域 socket
+/// @param fd 要发送的文件描述符, -1 表示只发送数据
+/// @param buffer 附带数据的地址
+/// @param ibuflen 附带数据的长度, 不能为 0
+/// @return true-成功; false-失败
+bool SendFd(const int sockfd, const int fd, const char* buffer, const int ibuflen);
+
+/// @brief 通过 UNIX 域 socket 接收一个文件描述符和附带的数据
+/// @param sockfd UNIX 域 socket
+/// @param fd 接收到的文件描述符, 没有时为 -1
+/// @param buffer 接收数据缓冲区的地址
+/// @param ibuflen 接收到的数据长度
+/// @param ibufsize 接收数据缓冲区的大小
+/// @param itimeout 等待数据的超时时间, 单位: s, 缺省值是0-无限等待
+/// @return true-成功; false-失败或超时
+bool RecvFd(const int sockfd, int* fd, char* buffer, int* ibuflen, const int ibufsize, const int itimeout = 0);
+
+/// @brief 通过 UNIX 域 socket 发送一个文件描述符和任意长度的数据. 一个报文的长度受 socket 发送缓冲区限制,
+///        数据分成多个报文发送: 第一个报文带文件描述符, 开头是 4 字节的数据总长度(网络字节序), 每个报文最多 64KB
+/// @param sockfd UNIX 域 socket
+/// @param fd 要发送的文件描述符, -1 表示只发送数据
+/// @param buffer 数据的地址
+/// @param n 数据的长度, 可以为 0
+/// @return true-成功; false-失败
+bool SendFdData(const int sockfd, const int fd, const char* buffer, const size_t n);
+
+/// @brief 接收 SendFdData 发送的文件描述符和数据, 把各个报文拼接起来
+/// @param sockfd UNIX 域 socket
+/// @param fd 接收到的文件描述符, 没有时为 -1; 失败时已经关闭
+/// @param data 存放数据
+/// @param itimeout 等待每个报文的超时时间, 单位: s, 缺省值是0-无限等待
+/// @return true-成功; false-失败, 超时或数据不完整
+bool RecvFdData(const int sockfd, int* fd, std::string& data, const int itimeout = 0);
+
+
+
+// 报文缓冲区池, 按 2 的幂大小分级缓存空闲缓冲区, 避免每个报文都 new/delete (线程安全)
+// 不超过 PoolMaxSize() 的缓冲区来自线程缓存的内存池, 更大的缓冲区在这里加锁缓存
+class BufferPool {
+public:
+    /// @brief 构造函数
+    /// @param maxfree 每个级别最多缓存的空闲缓冲区个数, 缺省 64
+    BufferPool(const size_t maxfree = 64);
+
+    /// @brief 取一块至少 n 字节的缓冲区
+    /// @param n 需要的字节数
+    /// @param cap 返回缓冲区的实际大小, 归还时原样传回
+    /// @return 缓冲区地址
+    char* Get(const size_t n, size_t* cap);
+
+    /// @brief 归还缓冲区
+    /// @param buffer Get 得到的缓冲区地址
+    /// @param cap Get 返回的缓冲区大小
+    void Put(char* buffer, const size_t cap);
+
+    ~BufferPool();
+
+private:
+    static const int MINSHIFT = 6;   // 最小级别 64B
+    static const int MAXSHIFT = 20;  // 最大级别 1MB, 更大的缓冲区直接 new/delete
+    size_t m_maxfree;
+    std::mutex m_lock;
+    std::vector<char*> m_free[MAXSHIFT - MINSHIFT + 1]; // 每个级别的空闲缓冲区
+};
+
+/// @brief 获取全局的报文缓冲区池
+BufferPool& DefaultBufferPool();
+
+// 一个完整的报文, 报文体存放在从缓冲区池取得的、与报文大小匹配的缓冲区中, 并以 '\0' 结尾
+class Frame {
+public:
+    Frame();
+    Frame(const Frame&) = delete;
+    Frame& operator=(const Frame&) = delete;
+
+    /// @brief 把报文体复制到池化缓冲区中
+    /// @param buffer 报文体地址
+    /// @param ilen 报文体长度
+    void Assign(const char* buffer, const int ilen);
+
+    const char* data() const { return m_buffer; }
+    int size() const { return m_len; }
+
+    /// @brief 解压报文体到池化缓冲区中
+    /// @param buffer 压缩报文体地址(4字节原始长度 + LZ4 块)
+    /// @param ilen 压缩报文体长度
+    /// @return true-成功; false-数据损坏或原始长度超过上限
+    bool AssignCompressed(const char* buffer, const int ilen);
+
+    /// @brief 把缓冲区归还给缓冲区池
+    void Release();
+
+    ~Frame();
+
+private:
+    char* m_buffer;
+    size_t m_cap;
+    int m_len;
+};
+
+// 连接的接收缓冲区, 按 "4字节长度头 + 报文体" 拆分报文, 解决 TCP 粘包和分包的问题, 并校验报文长度.
+// 每个连接一个, 不是线程安全的
+class RecvBuffer {
+public:
+    RecvBuffer();
+    RecvBuffer(const RecvBuffer&) = delete;
+    RecvBuffer& operator=(const RecvBuffer&) = delete;
+    RecvBuffer(RecvBuffer&& other);
+
+    /// @brief 从 socket 读取当前可读的数据, 用一次 readv 同时读入长度头和报文体.
+    ///        TLS 连接读到 OpenSSL 中没有解密数据为止, 握手还没有完成时返回 -1, errno 为 EAGAIN
+    /// @param sockfd 已经准备好的socket连接
+    /// @return >0-读到的字节数; 0-对端关闭连接; -1-出错, 错误码在 errno 中
+    ssize_t ReadFd(const int sockfd);
+
+    /// @brief 取出一个完整的报文
+    /// @param frame 存放报文的对象
+    /// @return 1-取到报文, 压缩报文已经解压; 0-报文不完整, 需要继续读取; -1-长度头非法或解压失败, 连接应当关闭
+    int NextFrame(Frame& frame);
+
+    /// @brief 缓冲区中未处理的字节数
+    size_t Readable() const { return m_wr - m_rd; }
+
+    /// @brief 未处理数据的地址, 长度为 Readable()
+    const char* Peek() const { return m_buffer + m_rd; }
+
+    /// @brief 追加数据到缓冲区, 空间不够时从缓冲区池换一块更大的
+    /// @param buffer 数据地址
+    /// @param n 数据长度
+    void Append(const char* buffer, const size_t n);
+
+    /// @brief 丢弃未处理的数据, 连接断开后重新连接时使用
+    void Clear();
+
+    ~RecvBuffer();
+
+private:
+    // 缓冲区为空时归还给缓冲区池, 空闲连接不占用内存
+    void Release();
+
+    char* m_buffer;
+    size_t m_cap;
+    size_t m_rd;  // 读位置
+    size_t m_wr;  // 写位置
+};
+
 
 }
 
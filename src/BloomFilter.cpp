@@ -0,0 +1,80 @@
+// 布隆过滤器实现
+#include "BloomFilter.h"
+#include "SessionToken.h"
+#include <algorithm>
+#include <cmath>
+#include <fcntl.h>
+#include <unistd.h>
+#include <random>
+
+namespace LI {
+
+#define MAXHASHES 16  // 每个元素最多设置的位数
+
+// ------------------ BloomFilter 类成员函数 ---------------------------
+BloomFilter::BloomFilter(const size_t capacity, const double fprate): m_count(0), m_set(0) {
+    // m = -n * ln(p) / ln(2)^2, k = m / n * ln(2)
+    const double n = (capacity > 0) ? (double)capacity : 1;
+    const double p = (fprate > 0 && fprate < 1) ? fprate : 0.01;
+    const double ln2 = std::log(2.0);
+    const size_t words = (size_t)std::ceil(-n * std::log(p) / (ln2 * ln2) / 64);
+    m_bits = std::max((size_t)1, words) * 64;
+    m_hashes = (int)std::lround((double)m_bits / n * ln2);
+    m_hashes = std::min(MAXHASHES, std::max(1, m_hashes));
+    m_words.reset(new std::atomic<uint64_t>[m_bits / 64]);
+    for (size_t i = 0; i < m_bits / 64; ++i) {
+        m_words[i].store(0, std::memory_order_relaxed);
+    }
+
+    // 优先使用 /dev/urandom, 打不开时使用 random_device
+    int fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+    if (fd < 0 || read(fd, m_key, sizeof(m_key)) != (ssize_t)sizeof(m_key)) {
+        std::random_device rd;
+        m_key[0] = ((uint64_t)rd() << 32) | rd();
+        m_key[1] = ((uint64_t)rd() << 32) | rd();
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+uint64_t BloomFilter::Hash(const char* data, const size_t len) const {
+    return SessionToken::SipHash(m_key, data, len);
+}
+
+void BloomFilter::Add(const char* data, const size_t len) {
+    const uint64_t h = Hash(data, len);
+    // 双重哈希: 第 i 个位置是 h1 + i * h2, h2 为奇数
+    const uint64_t h1 = h & 0xffffffff;
+    const uint64_t h2 = (h >> 32) | 1;
+    for (int i = 0; i < m_hashes; ++i) {
+        const uint64_t bit = (h1 + i * h2) % m_bits;
+        const uint64_t mask = (uint64_t)1 << (bit % 64);
+        if ((m_words[bit / 64].fetch_or(mask, std::memory_order_relaxed) & mask) == 0) {
+            m_set.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    m_count.fetch_add(1, std::memory_order_relaxed);
+    return;
+}
+
+bool BloomFilter::MayContain(const char* data, const size_t len) const {
+    const uint64_t h = Hash(data, len);
+    const uint64_t h1 = h & 0xffffffff;
+    const uint64_t h2 = (h >> 32) | 1;
+    for (int i = 0; i < m_hashes; ++i) {
+        const uint64_t bit = (h1 + i * h2) % m_bits;
+        if ((m_words[bit / 64].load(std::memory_order_relaxed) & ((uint64_t)1 << (bit % 64))) == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+double BloomFilter::EstimatedFalsePositiveRate() const {
+    // 不存在的元素的 k 个位置都已经置位的概率
+    return std::pow((double)m_set.load(std::memory_order_relaxed) / m_bits, m_hashes);
+}
+// ------------------ /BloomFilter 类成员函数 --------------------------
+
+}
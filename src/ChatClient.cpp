@@ -0,0 +1,596 @@
+// 无界面的聊天室客户端库实现
+#include "ChatClient.h"
+#include "Protocol.hpp"
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+namespace LI {
+
+// 加入房间时最多连续重定向的次数
+#define MAXREDIRECTS 3
+// 断线重连等待时间的上限, 单位: ms
+#define MAXRECONNECTMS (30 * 1000)
+
+// ------------------ ChatSession 类成员函数 ----------------------------
+ChatSession::ChatSession(ClientLoop* loop, const std::string& ip, const int port): m_loop(loop),
+                                                                                  m_ip(ip),
+                                                                                  m_port(port),
+                                                                                  m_sockfd(-1),
+                                                                                  m_state(DISCONNECTED),
+                                                                                  m_closed(false),
+                                                                                  m_want_write(false),
+                                                                                  m_reconnectms(1000),
+                                                                                  m_redirects(0),
+                                                                                  m_retries(0),
+                                                                                  m_compress(false)
+{
+}
+
+ChatSession::~ChatSession() {
+    if (m_sockfd != -1) {
+        close(m_sockfd);
+    }
+}
+
+void ChatSession::Register(const std::string& name, const std::string& password, ResultCallback cb) {
+    std::shared_ptr<ChatSession> self = shared_from_this();
+    m_loop->Post([self, name, password, cb]() {
+        // 注册为 0 cmd
+        const std::string message = name + " " + password;
+        proto::RegisterCmd msg;
+        msg.message = message;
+        self->Request(msg.Encode(), self->m_auth, cb);
+    });
+}
+
+std::future<bool> ChatSession::Register(const std::string& name, const std::string& password) {
+    std::shared_ptr<std::promise<bool>> promise = std::make_shared<std::promise<bool>>();
+    Register(name, password, [promise](bool ok) { promise->set_value(ok); });
+    return promise->get_future();
+}
+
+void ChatSession::Login(const std::string& name, const std::string& password, ResultCallback cb) {
+    std::shared_ptr<ChatSession> self = shared_from_this();
+    m_loop->Post([self, name, password, cb]() {
+        // 登录为 1 cmd, 声明能解压压缩报文
+        const std::string message = name + " " + password;
+        proto::LoginCmd msg;
+        msg.message = message;
+        msg.compress = 1;
+        const std::string data = msg.Encode();
+        ChatSession* s = self.get();
+        s->Request(data, s->m_auth, [s, name, data, cb](bool ok) {
+            if (ok) {
+                s->m_name = name;
+                s->m_login = data;
+                s->m_room.clear();
+                s->m_retries = 0;
+                s->SetState(LOGGEDIN);
+            }
+            if (cb) cb(ok);
+        });
+    });
+}
+
+std::future<bool> ChatSession::Login(const std::string& name, const std::string& password) {
+    std::shared_ptr<std::promise<bool>> promise = std::make_shared<std::promise<bool>>();
+    Login(name, password, [promise](bool ok) { promise->set_value(ok); });
+    return promise->get_future();
+}
+
+void ChatSession::Join(const std::string& room, ResultCallback cb) {
+    std::shared_ptr<ChatSession> self = shared_from_this();
+    m_loop->Post([self, room, cb]() {
+        // 房间名原样写入报文, 含有标签字符的服务端会拒绝
+        if (self->m_state != LOGGEDIN || proto::NeedsEscape(room)) {
+            if (cb) cb(false);
+            return;
+        }
+        self->m_redirects = 0;
+        self->SendJoin(room, cb);
+    });
+}
+
+std::future<bool> ChatSession::Join(const std::string& room) {
+    std::shared_ptr<std::promise<bool>> promise = std::make_shared<std::promise<bool>>();
+    Join(room, [promise](bool ok) { promise->set_value(ok); });
+    return promise->get_future();
+}
+
+void ChatSession::Send(const std::string& text, const int color) {
+    std::shared_ptr<ChatSession> self = shared_from_this();
+    m_loop->Post([self, text, color]() {
+        if (self->m_state != LOGGEDIN) return;
+        proto::ChatCmd msg; // 发信息是 2 cmd
+        msg.name = self->m_name;
+        msg.color = color;
+        msg.message = text;
+        const std::string data = msg.Encode();
+        // 超过长度上限的报文服务端会断开连接
+        if ((int)data.size() > GetMaxMsgLen()) return;
+        self->Write(data);
+    });
+}
+
+void ChatSession::Logout() {
+    std::shared_ptr<ChatSession> self = shared_from_this();
+    m_loop->Post([self]() {
+        if (self->m_state != LOGGEDIN) return;
+        self->Write("<cmd>3</cmd>"); // 退出登陆是 3 cmd
+        self->m_login.clear();
+        self->m_token.clear();
+        self->m_room.clear();
+        self->SetState(CONNECTED);
+    });
+}
+
+void ChatSession::Close() {
+    std::shared_ptr<ChatSession> self = shared_from_this();
+    m_loop->Post([self]() {
+        if (self->m_closed) return;
+        self->m_closed = true;
+        self->m_login.clear();
+        self->m_token.clear();
+        self->Disconnect();
+        self->SetState(CLOSED);
+        self->m_loop->m_sessions.erase(self);
+    });
+}
+
+void ChatSession::OnMessage(MessageCallback cb) {
+    std::shared_ptr<ChatSession> self = shared_from_this();
+    m_loop->Post([self, cb]() { self->m_onmessage = cb; });
+}
+
+void ChatSession::OnState(StateCallback cb) {
+    std::shared_ptr<ChatSession> self = shared_from_this();
+    m_loop->Post([self, cb]() { self->m_onstate = cb; });
+}
+
+void ChatSession::SetReconnect(const int ms) {
+    std::shared_ptr<ChatSession> self = shared_from_this();
+    m_loop->Post([self, ms]() { self->m_reconnectms = (ms > 0) ? ms : 0; });
+}
+
+void ChatSession::Connect() {
+    if (m_sockfd != -1 || m_closed) return;
+
+    struct sockaddr_in serveraddr;
+    memset(&serveraddr, 0, sizeof(serveraddr));
+    serveraddr.sin_family = AF_INET;
+    serveraddr.sin_port = htons(m_port);
+    if (inet_pton(AF_INET, m_ip.c_str(), &serveraddr.sin_addr) != 1) {
+        // 主机名需要解析, 会阻塞事件循环, 机器人应当使用 ip 地址
+        struct hostent* h = gethostbyname(m_ip.c_str());
+        if (h == nullptr) {
+            Disconnect();
+            return;
+        }
+        memcpy(&serveraddr.sin_addr, h->h_addr, h->h_length);
+    }
+
+    m_sockfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (m_sockfd < 0) {
+        m_sockfd = -1;
+        Disconnect();
+        return;
+    }
+    SetState(CONNECTING);
+    if (connect(m_sockfd, (struct sockaddr*)&serveraddr, sizeof(serveraddr)) == 0) {
+        m_loop->AddFd(m_sockfd, this, EPOLLIN);
+        OnConnected();
+        return;
+    }
+    if (errno != EINPROGRESS) {
+        Disconnect();
+        return;
+    }
+    // 连接完成时 socket 可写
+    m_loop->AddFd(m_sockfd, this, EPOLLOUT);
+    m_want_write = true;
+}
+
+void ChatSession::OnConnected() {
+    SetState(CONNECTED);
+    // 连接期间只关注可写事件, 现在开始接收, 缓冲区发送完后 Flush 取消可写事件
+    m_loop->ModFd(m_sockfd, EPOLLIN | EPOLLOUT);
+    m_want_write = true;
+    if (Flush() == false) {
+        Disconnect();
+    }
+}
+
+void ChatSession::OnEvent(const uint32_t events) {
+    if (m_state == CONNECTING) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if (getsockopt(m_sockfd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0) {
+            Disconnect();
+            return;
+        }
+        OnConnected();
+        return;
+    }
+
+    if ((events & EPOLLOUT) && Flush() == false) {
+        Disconnect();
+        return;
+    }
+    if (events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+        ssize_t n = m_recvbuf.ReadFd(m_sockfd);
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+            Disconnect();
+            return;
+        }
+
+        // 一次可能读到多个报文, 也可能只读到报文的一部分
+        Frame frame;
+        int iret;
+        const int sockfd = m_sockfd;
+        while ((iret = m_recvbuf.NextFrame(frame)) == 1) {
+            HandleFrame(frame.data());
+            // 报文处理中可能关闭或更换了连接, 剩下的数据属于旧连接
+            if (m_sockfd != sockfd) return;
+        }
+        if (iret != 0) {
+            Disconnect();
+        }
+    }
+}
+
+void ChatSession::HandleFrame(const char* buffer) {
+    int code = -1;
+    GetStrFromXML(buffer, "code", code);
+    switch (code) {
+        // 注册失败, 注册成功, 登录失败, 登录成功: 按顺序对应等待中的请求
+        case 0:
+        case 1:
+        case 2:
+        case 3: {
+                if (code == 3) {
+                    int compress = 0;
+                    GetStrFromXML(buffer, "token", m_token);
+                    GetStrFromXML(buffer, "compress", compress);
+                    m_compress = (compress == 1);
+                }
+                if (m_auth.empty()) break;
+                ResultCallback cb = std::move(m_auth.front());
+                m_auth.pop_front();
+                if (cb) cb(code == 1 || code == 3);
+                break;}
+        // 广播信息
+        case 4: {
+                if (!m_onmessage) break;
+                proto::BroadcastCode msg;
+                if (msg.Decode(buffer, strlen(buffer)) == false) break;
+                ChatMessage message;
+                proto::Unescape(msg.name, message.name);
+                message.color = (int)msg.color;
+                proto::Unescape(msg.message, message.text);
+                m_onmessage(message);
+                break;}
+        // 心跳回应
+        case 5: break;
+        // 服务端的心跳探测, 回应 pong
+        case 6: Write("<cmd>5</cmd>"); break;
+        // 加入房间成功
+        case 7: {
+                GetStrFromXML(buffer, "room", m_room);
+                m_redirects = 0;
+                if (m_joins.empty()) break;
+                ResultCallback cb = std::move(m_joins.front());
+                m_joins.pop_front();
+                if (cb) cb(true);
+                break;}
+        // 房间在其他节点
+        case 8: {
+                std::string node, room;
+                GetStrFromXML(buffer, "node", node);
+                GetStrFromXML(buffer, "room", room);
+                Redirect(node, room);
+                break;}
+        // 请求太频繁被服务端丢弃, 或服务端繁忙被拒绝
+        case 9:
+        case 10: {
+                int cmd = -1;
+                GetStrFromXML(buffer, "cmd", cmd);
+                if (cmd == 9 && !m_joins.empty()) {
+                    ResultCallback cb = std::move(m_joins.front());
+                    m_joins.pop_front();
+                    if (cb) cb(false);
+                }
+                else if (cmd == 0 || cmd == 1 || cmd == 10) {
+                    if (!m_login.empty()) {
+                        // 需要保持登录的会话断开, 按退避时间重连后再恢复登录
+                        Disconnect();
+                    }
+                    else if (!m_auth.empty()) {
+                        ResultCallback cb = std::move(m_auth.front());
+                        m_auth.pop_front();
+                        if (cb) cb(false);
+                    }
+                }
+                break;}
+        default: break;
+    }
+}
+
+void ChatSession::Write(const std::string& data) {
+    AppendFrame(m_outbuf, data.data(), data.size(), m_compress);
+    // 正在连接时先放在缓冲区中, 连接完成后发送
+    if (m_state == CONNECTED || m_state == LOGGEDIN) {
+        if (Flush() == false) {
+            Disconnect();
+        }
+    }
+}
+
+bool ChatSession::Flush() {
+    size_t nsent = 0;
+    while (nsent < m_outbuf.size()) {
+        ssize_t n = write(m_sockfd, m_outbuf.data() + nsent, m_outbuf.size() - nsent);
+        if (n > 0) {
+            nsent += n;
+            continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        return false;
+    }
+    m_outbuf.erase(0, nsent);
+
+    // 没写完的等可写事件, 写完后不再关注
+    const bool pending = !m_outbuf.empty();
+    if (pending != m_want_write) {
+        m_loop->ModFd(m_sockfd, pending ? (EPOLLIN | EPOLLOUT) : EPOLLIN);
+        m_want_write = pending;
+    }
+    return true;
+}
+
+void ChatSession::Request(const std::string& data, std::deque<ResultCallback>& queue, ResultCallback cb) {
+    if (m_closed) {
+        if (cb) cb(false);
+        return;
+    }
+    Connect();
+    if (m_sockfd == -1) {
+        // 连接失败, Disconnect 已经处理了等待中的请求
+        if (cb) cb(false);
+        return;
+    }
+    queue.push_back(std::move(cb));
+    Write(data);
+}
+
+void ChatSession::Relogin(ResultCallback after) {
+    // 有令牌时先凭令牌恢复登录, 服务端不需要访问数据库
+    if (!m_token.empty()) {
+        const std::string data = "<cmd>10</cmd><token>" + m_token + "</token><compress>1</compress>"; // 凭令牌恢复登录是 10 cmd
+        Request(data, m_auth, [this, after](bool ok) {
+            if (ok) {
+                m_retries = 0;
+                SetState(LOGGEDIN);
+            }
+            else if (m_sockfd != -1) {
+                // 令牌无效(过期或节点的密钥不同), 改用密码登录
+                m_token.clear();
+                Relogin(after);
+                return;
+            }
+            if (after) after(ok);
+        });
+        return;
+    }
+
+    const std::string login = m_login;
+    Request(login, m_auth, [this, after](bool ok) {
+        if (ok) {
+            m_retries = 0;
+            SetState(LOGGEDIN);
+        }
+        else if (m_sockfd != -1) {
+            // 服务端拒绝登录(密码已经修改或账号不存在), 不再重连; 连接失败时继续按间隔重连
+            m_login.clear();
+        }
+        if (after) after(ok);
+    });
+}
+
+void ChatSession::SendJoin(const std::string& room, ResultCallback cb) {
+    std::string data = "<cmd>9</cmd><room>" + room + "</room>"; // 加入房间是 9 cmd
+    Request(data, m_joins, cb);
+}
+
+void ChatSession::CloseSocket() {
+    if (m_sockfd != -1) {
+        m_loop->DelFd(m_sockfd);
+        close(m_sockfd);
+        m_sockfd = -1;
+    }
+    m_recvbuf.Clear();
+    m_outbuf.clear();
+    m_want_write = false;
+    m_compress = false;
+}
+
+void ChatSession::Disconnect() {
+    CloseSocket();
+
+    // 等待回应的请求都失败, 回调中可能发起新的请求, 先取出来
+    std::deque<ResultCallback> auth, joins;
+    auth.swap(m_auth);
+    joins.swap(m_joins);
+    if (!m_closed) {
+        SetState(DISCONNECTED);
+    }
+    for (auto& cb : auth) if (cb) cb(false);
+    for (auto& cb : joins) if (cb) cb(false);
+
+    // 已登录的会话退避后重连, 重连成功后恢复登录并加入原来的房间
+    if (m_closed || m_login.empty() || m_reconnectms == 0 || m_sockfd != -1) {
+        return;
+    }
+    std::shared_ptr<ChatSession> self = shared_from_this();
+    m_loop->m_timers.AddTimer(BackoffMs(m_reconnectms, MAXRECONNECTMS, m_retries++), [self]() {
+        if (self->m_closed || self->m_sockfd != -1 || self->m_login.empty()) return;
+        ChatSession* s = self.get();
+        s->Relogin([s](bool ok) {
+            if (ok && !s->m_room.empty()) {
+                s->SendJoin(s->m_room, nullptr);
+            }
+        });
+    });
+}
+
+void ChatSession::Redirect(const std::string& node, const std::string& room) {
+    // 等待回应的加入房间请求, 在新的节点上完成
+    ResultCallback cb;
+    if (!m_joins.empty()) {
+        cb = std::move(m_joins.front());
+        m_joins.pop_front();
+    }
+    size_t pos = node.rfind(':');
+    if (pos == std::string::npos || ++m_redirects > MAXREDIRECTS || m_login.empty()) {
+        if (cb) cb(false);
+        return;
+    }
+
+    std::deque<ResultCallback> joins;
+    joins.swap(m_joins);
+    CloseSocket();
+    for (auto& join : joins) if (join) join(false);
+
+    m_ip = node.substr(0, pos);
+    m_port = atoi(node.c_str() + pos + 1);
+    m_room = room;
+    Relogin([this, room, cb](bool ok) {
+        if (ok) {
+            SendJoin(room, cb);
+        }
+        else if (cb) {
+            cb(false);
+        }
+    });
+}
+
+void ChatSession::SetState(const State state) {
+    if (m_state == state) return;
+    m_state = state;
+    if (m_onstate) m_onstate(state);
+}
+// ------------------ /ChatSession 类成员函数 ---------------------------
+
+
+// ------------------ ClientLoop 类成员函数 -----------------------------
+ClientLoop::ClientLoop(): m_epollfd(epoll_create1(EPOLL_CLOEXEC)),
+                          m_wakefd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+                          m_running(false)
+{
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(struct epoll_event));
+    ev.data.fd = m_wakefd;
+    ev.events = EPOLLIN;
+    epoll_ctl(m_epollfd, EPOLL_CTL_ADD, m_wakefd, &ev);
+}
+
+ClientLoop::~ClientLoop() {
+    // 会话可能还被使用者持有, 只关闭连接
+    for (const auto& session : m_sessions) {
+        session->m_closed = true;
+        session->CloseSocket();
+    }
+    m_sessions.clear();
+    close(m_wakefd);
+    close(m_epollfd);
+}
+
+std::shared_ptr<ChatSession> ClientLoop::NewSession(const std::string& ip, const int port) {
+    std::shared_ptr<ChatSession> session(new ChatSession(this, ip, port));
+    Post([this, session]() { m_sessions.insert(session); });
+    return session;
+}
+
+void ClientLoop::Post(std::function<void()> task) {
+    {
+        std::unique_lock<std::mutex> lk(m_lock);
+        m_tasks.push_back(std::move(task));
+    }
+    uint64_t one = 1;
+    ssize_t n = write(m_wakefd, &one, sizeof(one));
+    (void)n;
+}
+
+void ClientLoop::Stop() {
+    m_running = false;
+    uint64_t one = 1;
+    ssize_t n = write(m_wakefd, &one, sizeof(one));
+    (void)n;
+}
+
+void ClientLoop::RunTasks() {
+    uint64_t cnt;
+    ssize_t n = read(m_wakefd, &cnt, sizeof(cnt));
+    (void)n;
+
+    std::vector<std::function<void()>> tasks;
+    {
+        std::unique_lock<std::mutex> lk(m_lock);
+        tasks.swap(m_tasks);
+    }
+    for (auto& task : tasks) {
+        task();
+    }
+}
+
+void ClientLoop::Run() {
+    m_running = true;
+    const int MAXEVENTS = 256;
+    struct epoll_event events[MAXEVENTS];
+    while (m_running) {
+        int infds = epoll_wait(m_epollfd, events, MAXEVENTS, m_timers.NextTimeout());
+        if (infds < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        for (int i = 0; i < infds; ++i) {
+            const int fd = events[i].data.fd;
+            if (fd == m_wakefd) {
+                RunTasks();
+                continue;
+            }
+            // 前面的事件处理中可能已经关闭了这个 socket
+            auto it = m_fds.find(fd);
+            if (it != m_fds.end()) {
+                it->second->OnEvent(events[i].events);
+            }
+        }
+        m_timers.Update();
+    }
+}
+
+void ClientLoop::AddFd(const int fd, ChatSession* session, const uint32_t events) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(struct epoll_event));
+    ev.data.fd = fd;
+    ev.events = events;
+    epoll_ctl(m_epollfd, EPOLL_CTL_ADD, fd, &ev);
+    m_fds[fd] = session;
+}
+
+void ClientLoop::ModFd(const int fd, const uint32_t events) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(struct epoll_event));
+    ev.data.fd = fd;
+    ev.events = events;
+    epoll_ctl(m_epollfd, EPOLL_CTL_MOD, fd, &ev);
+}
+
+void ClientLoop::DelFd(const int fd) {
+    epoll_ctl(m_epollfd, EPOLL_CTL_DEL, fd, nullptr);
+    m_fds.erase(fd);
+}
+// ------------------ /ClientLoop 类成员函数 ----------------------------
+
+}
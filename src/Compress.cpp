@@ -0,0 +1,194 @@
+// 报文压缩实现
+#include "Compress.h"
+#include <cstdint>
+#include <cstring>
+
+namespace LI {
+
+#define MINMATCH 4      // 最短的匹配长度
+#define LASTLITERALS 5  // 最后 5 个字节必须是字面量
+#define MFLIMIT 12      // 距离结尾不到 12 个字节时不再查找匹配
+#define MAXOFFSET 65535 // 匹配的最大距离, 偏移用 2 个字节表示
+#define HASHLOG 12      // 哈希表 4096 项, 放在栈上
+
+static inline uint32_t Read32(const unsigned char* p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static inline uint32_t Hash(const uint32_t v) {
+    return (v * 2654435761U) >> (32 - HASHLOG);
+}
+
+// 写长度的扩展部分: 每个 255 一个字节, 最后写余数
+static inline unsigned char* WriteLength(unsigned char* op, size_t len) {
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (unsigned char)len;
+    return op;
+}
+
+// 一个序列: token(字面量长度 4 位, 匹配长度 4 位) + 字面量长度扩展 + 字面量 + 偏移 + 匹配长度扩展.
+// matchlen 为 0 表示最后一个序列, 只有字面量. 放不下时返回 nullptr
+static unsigned char* WriteSequence(unsigned char* op, unsigned char* oend, const unsigned char* literal,
+                                    const size_t litlen, const size_t offset, const size_t matchlen) {
+    // token + 长度扩展 + 偏移的最大长度
+    if ((size_t)(oend - op) < 1 + litlen + litlen / 255 + 1 + 2 + matchlen / 255 + 1) {
+        return nullptr;
+    }
+    unsigned char* token = op++;
+    *token = (unsigned char)((litlen >= 15 ? 15 : litlen) << 4);
+    if (litlen >= 15) {
+        op = WriteLength(op, litlen - 15);
+    }
+    memcpy(op, literal, litlen);
+    op += litlen;
+    if (matchlen == 0) {
+        return op;
+    }
+
+    *op++ = (unsigned char)(offset & 0xff);
+    *op++ = (unsigned char)(offset >> 8);
+    const size_t mlen = matchlen - MINMATCH;
+    *token |= (unsigned char)(mlen >= 15 ? 15 : mlen);
+    if (mlen >= 15) {
+        op = WriteLength(op, mlen - 15);
+    }
+    return op;
+}
+
+size_t LZBound(const size_t n) {
+    return n + n / 255 + 16;
+}
+
+size_t LZCompress(const char* src, const size_t n, char* dst, const size_t cap) {
+    const unsigned char* const base = (const unsigned char*)src;
+    const unsigned char* const iend = base + n;
+    const unsigned char* ip = base;
+    const unsigned char* anchor = base;  // 还没有输出的字面量的开头
+    unsigned char* op = (unsigned char*)dst;
+    unsigned char* const oend = op + cap;
+
+    if (n >= MFLIMIT + 1) {
+        // 哈希表存放位置 + 1, 0 表示空
+        uint32_t table[1 << HASHLOG];
+        memset(table, 0, sizeof(table));
+        const unsigned char* const mflimit = iend - MFLIMIT;
+        const unsigned char* const matchlimit = iend - LASTLITERALS;
+
+        while (ip < mflimit) {
+            const uint32_t seq = Read32(ip);
+            const uint32_t h = Hash(seq);
+            const uint32_t pos = table[h];
+            table[h] = (uint32_t)(ip - base) + 1;
+            const unsigned char* ref = (pos == 0) ? nullptr : base + pos - 1;
+            if (ref == nullptr || ip - ref > MAXOFFSET || Read32(ref) != seq) {
+                // 连续没有匹配时加大步长, 不可压缩的数据很快跳过
+                ip += 1 + ((ip - anchor) >> 6);
+                continue;
+            }
+
+            // 向前扩展匹配
+            const unsigned char* mp = ip + MINMATCH;
+            const unsigned char* mr = ref + MINMATCH;
+            while (mp < matchlimit && *mp == *mr) {
+                ++mp;
+                ++mr;
+            }
+            // 向后扩展匹配, 吃掉前面的字面量
+            while (ip > anchor && ref > base && ip[-1] == ref[-1]) {
+                --ip;
+                --ref;
+            }
+
+            op = WriteSequence(op, oend, anchor, ip - anchor, ip - ref, mp - ip);
+            if (op == nullptr) {
+                return 0;
+            }
+            ip = mp;
+            anchor = ip;
+            // 匹配中间的位置也放入哈希表, 提高后面的匹配率
+            if (ip - 2 >= base && ip < mflimit) {
+                table[Hash(Read32(ip - 2))] = (uint32_t)(ip - 2 - base) + 1;
+            }
+        }
+    }
+
+    op = WriteSequence(op, oend, anchor, iend - anchor, 0, 0);
+    if (op == nullptr) {
+        return 0;
+    }
+    return op - (unsigned char*)dst;
+}
+
+bool LZDecompress(const char* src, const size_t n, char* dst, const size_t rawlen) {
+    const unsigned char* ip = (const unsigned char*)src;
+    const unsigned char* const iend = ip + n;
+    unsigned char* op = (unsigned char*)dst;
+    unsigned char* const oend = op + rawlen;
+
+    while (ip < iend) {
+        const unsigned token = *ip++;
+
+        // 字面量
+        size_t litlen = token >> 4;
+        if (litlen == 15) {
+            unsigned char b;
+            do {
+                if (ip >= iend) return false;
+                b = *ip++;
+                litlen += b;
+            } while (b == 255);
+        }
+        if ((size_t)(iend - ip) < litlen || (size_t)(oend - op) < litlen) {
+            return false;
+        }
+        memcpy(op, ip, litlen);
+        ip += litlen;
+        op += litlen;
+        // 最后一个序列没有匹配
+        if (ip == iend) {
+            break;
+        }
+
+        // 匹配
+        if (iend - ip < 2) {
+            return false;
+        }
+        const size_t offset = ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - (unsigned char*)dst)) {
+            return false;
+        }
+        size_t matchlen = token & 15;
+        if (matchlen == 15) {
+            unsigned char b;
+            do {
+                if (ip >= iend) return false;
+                b = *ip++;
+                matchlen += b;
+            } while (b == 255);
+        }
+        matchlen += MINMATCH;
+        if ((size_t)(oend - op) < matchlen) {
+            return false;
+        }
+        // 匹配可能与输出重叠(偏移小于长度), 逐字节复制
+        const unsigned char* ref = op - offset;
+        if (offset >= matchlen) {
+            memcpy(op, ref, matchlen);
+            op += matchlen;
+        }
+        else {
+            for (size_t i = 0; i < matchlen; ++i) {
+                *op++ = *ref++;
+            }
+        }
+    }
+    return op == oend;
+}
+
+}
@@ -0,0 +1,77 @@
+// 一致性哈希环实现
+#include "HashRing.h"
+#include <algorithm>
+
+namespace LI {
+
+// ------------------ HashRing 类成员函数 -------------------------------
+HashRing::HashRing(const int vnodes): m_vnodes(vnodes > 0 ? vnodes : 1) {}
+
+uint64_t HashRing::Hash(const char* data, const size_t len) {
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; ++i) {
+        h ^= (unsigned char)data[i];
+        h *= 1099511628211ULL;
+    }
+    // FNV 的低位分布较差, 再混合一次
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+void HashRing::AddNode(const std::string& node) {
+    auto it = std::lower_bound(m_nodes.begin(), m_nodes.end(), node);
+    if (it != m_nodes.end() && *it == node) return;
+    m_nodes.insert(it, node);
+    Rebuild();
+}
+
+void HashRing::RemoveNode(const std::string& node) {
+    auto it = std::lower_bound(m_nodes.begin(), m_nodes.end(), node);
+    if (it == m_nodes.end() || *it != node) return;
+    m_nodes.erase(it);
+    Rebuild();
+}
+
+bool HashRing::HasNode(const std::string& node) const {
+    return std::binary_search(m_nodes.begin(), m_nodes.end(), node);
+}
+
+const std::string& HashRing::Owner(const char* key, const size_t len) const {
+    static const std::string empty;
+    if (m_ring.empty()) return empty;
+
+    // 顺时针方向的第一个虚拟节点
+    const uint64_t h = Hash(key, len);
+    auto it = std::lower_bound(m_ring.begin(), m_ring.end(), h,
+                               [](const VNode& v, uint64_t value) { return v.hash < value; });
+    if (it == m_ring.end()) {
+        it = m_ring.begin();
+    }
+    return m_nodes[it->node];
+}
+
+void HashRing::Rebuild() {
+    m_ring.clear();
+    m_ring.reserve(m_nodes.size() * m_vnodes);
+    std::string key;
+    for (uint32_t i = 0; i < m_nodes.size(); ++i) {
+        for (int j = 0; j < m_vnodes; ++j) {
+            // 虚拟节点的键: 节点标识#序号
+            key.assign(m_nodes[i]);
+            key.push_back('#');
+            key.append(std::to_string(j));
+            m_ring.push_back({Hash(key.data(), key.size()), i});
+        }
+    }
+    // 哈希值相同时按节点排序, 保证各节点的结果一致
+    std::sort(m_ring.begin(), m_ring.end(), [](const VNode& a, const VNode& b) {
+        return a.hash != b.hash ? a.hash < b.hash : a.node < b.node;
+    });
+}
+// ------------------ /HashRing 类成员函数 ------------------------------
+
+}
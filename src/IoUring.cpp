@@ -0,0 +1,375 @@
+// io_uring 的封装实现
+#include "IoUring.h"
+#include <cstring>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <linux/time_types.h>
+
+namespace LI {
+
+// 需要的内核接口: 多次触发的 recv(6.0), 提供的缓冲区环(5.19), 带超时的等待(5.11).
+// IORING_REGISTER_PBUF_RING 是枚举值, 不能用 #ifdef 检查, 有 IORING_RECV_MULTISHOT 的头文件一定有它
+#if defined(IORING_RECV_MULTISHOT) && defined(IORING_ACCEPT_MULTISHOT) && defined(IORING_ENTER_EXT_ARG)
+#define URINGSUPPORTED 1
+#endif
+
+// 提供的缓冲区的组号, 每个实例只有一组
+#define BUFGROUP 0
+
+#ifdef URINGSUPPORTED
+// 缓冲区环的尾和第一个缓冲区的 resv 字段重叠. 头文件中的 io_uring_buf_ring 用 __DECLARE_FLEX_ARRAY 声明,
+// C++ 中空结构体占 1 个字节, bufs 的偏移和内核不一致, 所以直接按 io_uring_buf 数组访问
+static inline struct io_uring_buf* RingBufs(void* ring) {
+    return (struct io_uring_buf*)ring;
+}
+
+static inline __u16* RingTail(void* ring) {
+    return &RingBufs(ring)[0].resv;
+}
+
+static int SysSetup(const unsigned entries, struct io_uring_params* p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int SysEnter(const int fd, const unsigned submit, const unsigned waitnr, const unsigned flags, void* arg, const size_t argsz) {
+    return (int)syscall(__NR_io_uring_enter, fd, submit, waitnr, flags, arg, argsz);
+}
+
+static int SysRegister(const int fd, const unsigned opcode, void* arg, const unsigned nr) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr);
+}
+#endif
+
+// ------------------ IoEvent 成员函数 ---------------------------
+bool IoEvent::More() const {
+#ifdef URINGSUPPORTED
+    return (flags & IORING_CQE_F_MORE) != 0;
+#else
+    return false;
+#endif
+}
+
+bool IoEvent::HasBuffer() const {
+#ifdef URINGSUPPORTED
+    return (flags & IORING_CQE_F_BUFFER) != 0;
+#else
+    return false;
+#endif
+}
+
+uint16_t IoEvent::BufferId() const {
+#ifdef URINGSUPPORTED
+    return (uint16_t)(flags >> IORING_CQE_BUFFER_SHIFT);
+#else
+    return 0;
+#endif
+}
+// ------------------ /IoEvent 成员函数 --------------------------
+
+// ------------------ IoUring 类成员函数 ---------------------------
+IoUring::IoUring(): m_ringfd(-1), m_sqentries(0), m_sqtail(0), m_submitted(0),
+                    m_sqring(nullptr), m_sqringsize(0), m_sqhead(nullptr), m_sqktail(nullptr), m_sqmask(0), m_sqarray(nullptr),
+                    m_sqes(nullptr), m_sqessize(0), m_cqring(nullptr), m_cqringsize(0), m_cqhead(nullptr), m_cqtail(nullptr),
+                    m_cqmask(0), m_cqes(nullptr), m_bufring(nullptr), m_bufringsize(0), m_bufcount(0), m_bufsize(0),
+                    m_buftail(0), m_buffers(nullptr) { }
+
+bool IoUring::Init(const unsigned entries) {
+#ifdef URINGSUPPORTED
+    Close();
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    // 只有本线程提交, 完成事件在进入内核时才处理, 减少中断其他工作
+    p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_COOP_TASKRUN;
+    p.cq_entries = entries * 4;
+    int fd = SysSetup(entries, &p);
+    if (fd < 0 && errno == EINVAL) {
+        // 6.0 以前的内核不支持 SINGLE_ISSUER
+        memset(&p, 0, sizeof(p));
+        p.flags = IORING_SETUP_CQSIZE;
+        p.cq_entries = entries * 4;
+        fd = SysSetup(entries, &p);
+    }
+    if (fd < 0) {
+        return false;
+    }
+    if ((p.features & IORING_FEAT_EXT_ARG) == 0) {
+        close(fd);
+        return false;
+    }
+    m_ringfd = fd;
+    m_sqentries = p.sq_entries;
+
+    m_sqringsize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    m_cqringsize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    const bool single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single && m_cqringsize > m_sqringsize) {
+        m_sqringsize = m_cqringsize;
+    }
+    m_sqring = mmap(nullptr, m_sqringsize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (m_sqring == MAP_FAILED) {
+        m_sqring = nullptr;
+        Close();
+        return false;
+    }
+    void* cq = m_sqring;
+    if (!single) {
+        m_cqring = mmap(nullptr, m_cqringsize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (m_cqring == MAP_FAILED) {
+            m_cqring = nullptr;
+            Close();
+            return false;
+        }
+        cq = m_cqring;
+    }
+    m_sqessize = p.sq_entries * sizeof(struct io_uring_sqe);
+    m_sqes = mmap(nullptr, m_sqessize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (m_sqes == MAP_FAILED) {
+        m_sqes = nullptr;
+        Close();
+        return false;
+    }
+
+    char* sq = (char*)m_sqring;
+    m_sqhead = (unsigned*)(sq + p.sq_off.head);
+    m_sqktail = (unsigned*)(sq + p.sq_off.tail);
+    m_sqmask = *(unsigned*)(sq + p.sq_off.ring_mask);
+    m_sqarray = (unsigned*)(sq + p.sq_off.array);
+    m_sqtail = m_submitted = *m_sqktail;
+    m_cqhead = (unsigned*)((char*)cq + p.cq_off.head);
+    m_cqtail = (unsigned*)((char*)cq + p.cq_off.tail);
+    m_cqmask = *(unsigned*)((char*)cq + p.cq_off.ring_mask);
+    m_cqes = (char*)cq + p.cq_off.cqes;
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool IoUring::SetupBuffers(const unsigned count, const unsigned size) {
+#ifdef URINGSUPPORTED
+    if (m_ringfd == -1 || m_bufring != nullptr || count == 0 || count > 32768 || (count & (count - 1)) != 0) {
+        return false;
+    }
+    m_bufringsize = count * sizeof(struct io_uring_buf);
+    m_bufring = mmap(nullptr, m_bufringsize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (m_bufring == MAP_FAILED) {
+        m_bufring = nullptr;
+        return false;
+    }
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)m_bufring;
+    reg.ring_entries = count;
+    reg.bgid = BUFGROUP;
+    if (SysRegister(m_ringfd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+        munmap(m_bufring, m_bufringsize);
+        m_bufring = nullptr;
+        return false;
+    }
+    m_bufcount = count;
+    m_bufsize = size;
+    m_buffers = new char[(size_t)count * size];
+    m_buftail = 0;
+    for (unsigned i = 0; i < count; ++i) {
+        RecycleBuffer(i);
+    }
+    __atomic_store_n(RingTail(m_bufring), m_buftail, __ATOMIC_RELEASE);
+    return true;
+#else
+    return false;
+#endif
+}
+
+void IoUring::RecycleBuffer(const uint16_t bid) {
+#ifdef URINGSUPPORTED
+    struct io_uring_buf* buf = &RingBufs(m_bufring)[m_buftail & (m_bufcount - 1)];
+    buf->addr = (uint64_t)(uintptr_t)Buffer(bid);
+    buf->len = m_bufsize;
+    buf->bid = bid;
+    ++m_buftail;
+#endif
+}
+
+void* IoUring::GetSqe() {
+#ifdef URINGSUPPORTED
+    if (m_sqtail - __atomic_load_n(m_sqhead, __ATOMIC_ACQUIRE) >= m_sqentries) {
+        Submit();
+    }
+    const unsigned idx = m_sqtail & m_sqmask;
+    struct io_uring_sqe* sqe = (struct io_uring_sqe*)m_sqes + idx;
+    memset(sqe, 0, sizeof(*sqe));
+    m_sqarray[idx] = idx;
+    ++m_sqtail;
+    return sqe;
+#else
+    return nullptr;
+#endif
+}
+
+void IoUring::AcceptMultishot(const int fd, const uint64_t user_data) {
+#ifdef URINGSUPPORTED
+    struct io_uring_sqe* sqe = (struct io_uring_sqe*)GetSqe();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = user_data;
+#endif
+}
+
+void IoUring::RecvMultishot(const int fd, const uint64_t user_data) {
+#ifdef URINGSUPPORTED
+    struct io_uring_sqe* sqe = (struct io_uring_sqe*)GetSqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUFGROUP;
+    sqe->user_data = user_data;
+#endif
+}
+
+void IoUring::PollOnce(const int fd, const uint32_t events, const uint64_t user_data) {
+#ifdef URINGSUPPORTED
+    struct io_uring_sqe* sqe = (struct io_uring_sqe*)GetSqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = events;
+    sqe->user_data = user_data;
+#endif
+}
+
+void IoUring::Send(const int fd, const void* buffer, const size_t len, const uint64_t user_data, const bool nowait) {
+#ifdef URINGSUPPORTED
+    struct io_uring_sqe* sqe = (struct io_uring_sqe*)GetSqe();
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)buffer;
+    sqe->len = len;
+    sqe->msg_flags = (nowait ? MSG_DONTWAIT : MSG_WAITALL) | MSG_NOSIGNAL;
+    sqe->user_data = user_data;
+#endif
+}
+
+void IoUring::CancelFd(const int fd, const uint64_t user_data) {
+#ifdef URINGSUPPORTED
+    struct io_uring_sqe* sqe = (struct io_uring_sqe*)GetSqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = fd;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+    sqe->user_data = user_data;
+#endif
+}
+
+void IoUring::CancelAll(const uint64_t user_data) {
+#ifdef URINGSUPPORTED
+    struct io_uring_sqe* sqe = (struct io_uring_sqe*)GetSqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_ANY;
+    sqe->user_data = user_data;
+#endif
+}
+
+int IoUring::Submit(const unsigned waitnr, const int timeout) {
+#ifdef URINGSUPPORTED
+    if (m_ringfd == -1) {
+        errno = EBADF;
+        return -1;
+    }
+    // 归还的缓冲区和准备的请求一起发布
+    if (m_bufring != nullptr) {
+        __atomic_store_n(RingTail(m_bufring), m_buftail, __ATOMIC_RELEASE);
+    }
+    const unsigned submit = m_sqtail - m_submitted;
+    __atomic_store_n(m_sqktail, m_sqtail, __ATOMIC_RELEASE);
+    m_submitted = m_sqtail;
+    if (submit == 0 && waitnr == 0) {
+        return 0;
+    }
+
+    unsigned flags = 0;
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+    memset(&arg, 0, sizeof(arg));
+    if (waitnr > 0) {
+        flags |= IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+        if (timeout >= 0) {
+            ts.tv_sec = timeout / 1000;
+            ts.tv_nsec = (long long)(timeout % 1000) * 1000000;
+            arg.ts = (uint64_t)(uintptr_t)&ts;
+        }
+    }
+    int ret = SysEnter(m_ringfd, submit, waitnr, flags, waitnr > 0 ? &arg : nullptr, waitnr > 0 ? sizeof(arg) : 0);
+    if (ret < 0 && errno == ETIME) {
+        return 0;
+    }
+    return ret < 0 ? -1 : 0;
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+size_t IoUring::Reap(IoEvent* events, const size_t max) {
+#ifdef URINGSUPPORTED
+    if (m_ringfd == -1) {
+        return 0;
+    }
+    unsigned head = *m_cqhead;
+    const unsigned tail = __atomic_load_n(m_cqtail, __ATOMIC_ACQUIRE);
+    size_t n = 0;
+    while (head != tail && n < max) {
+        const struct io_uring_cqe* cqe = (const struct io_uring_cqe*)m_cqes + (head & m_cqmask);
+        events[n].user_data = cqe->user_data;
+        events[n].res = cqe->res;
+        events[n].flags = cqe->flags;
+        ++n;
+        ++head;
+    }
+    __atomic_store_n(m_cqhead, head, __ATOMIC_RELEASE);
+    return n;
+#else
+    return 0;
+#endif
+}
+
+void IoUring::Close() {
+    if (m_sqes != nullptr) {
+        munmap(m_sqes, m_sqessize);
+        m_sqes = nullptr;
+    }
+    if (m_cqring != nullptr) {
+        munmap(m_cqring, m_cqringsize);
+        m_cqring = nullptr;
+    }
+    if (m_sqring != nullptr) {
+        munmap(m_sqring, m_sqringsize);
+        m_sqring = nullptr;
+    }
+    // 先关闭 io_uring, 内核不再使用缓冲区后再释放
+    if (m_ringfd != -1) {
+        close(m_ringfd);
+        m_ringfd = -1;
+    }
+    if (m_bufring != nullptr) {
+        munmap(m_bufring, m_bufringsize);
+        m_bufring = nullptr;
+    }
+    delete[] m_buffers;
+    m_buffers = nullptr;
+    m_bufcount = 0;
+    m_sqentries = 0;
+    m_sqtail = m_submitted = 0;
+}
+
+IoUring::~IoUring() {
+    Close();
+}
+// ------------------ /IoUring 类成员函数 --------------------------
+
+}
@@ -0,0 +1,201 @@
+// 线程缓存的内存池实现
+#include "MemoryPool.h"
+#include <atomic>
+#include <mutex>
+
+namespace LI {
+
+// 大小级别: 2^MINSHIFT ~ 2^MAXSHIFT
+#define MINSHIFT 4
+#define MAXSHIFT 16
+#define NCLASS (MAXSHIFT - MINSHIFT + 1)
+// 线程缓存和全局仓库之间一次交换的节点个数
+#define BATCH 32
+// 每次向系统申请的 slab 大小
+#define SLABSIZE (256 * 1024)
+
+// 空闲节点, 复用空闲内存本身存放链表指针
+struct FreeNode {
+    FreeNode* next;
+};
+
+// 空闲链表
+struct FreeList {
+    FreeNode* head;
+    size_t count;
+};
+
+// 已经申请的 slab 总大小
+static std::atomic<size_t> slab_bytes(0);
+
+// 计算所属级别
+static int SizeClass(const size_t n) {
+    int shift = MINSHIFT;
+    while (((size_t)1 << shift) < n) {
+        ++shift;
+    }
+    return shift - MINSHIFT;
+}
+
+// 从链表头部摘下最多 cnt 个节点, 组成一条新的链表
+static FreeList TakeBatch(FreeList& list, size_t cnt) {
+    FreeList batch = {list.head, 0};
+    FreeNode* tail = nullptr;
+    while (list.head != nullptr && batch.count < cnt) {
+        tail = list.head;
+        list.head = list.head->next;
+        --list.count;
+        ++batch.count;
+    }
+    if (tail != nullptr) {
+        tail->next = nullptr;
+    }
+    else {
+        batch.head = nullptr;
+    }
+    return batch;
+}
+
+// 把一条链表接到另一条链表的头部
+static void PushBatch(FreeList& list, FreeList& batch) {
+    if (batch.head == nullptr) return;
+    FreeNode* tail = batch.head;
+    while (tail->next != nullptr) {
+        tail = tail->next;
+    }
+    tail->next = list.head;
+    list.head = batch.head;
+    list.count += batch.count;
+    batch.head = nullptr;
+    batch.count = 0;
+}
+
+// ------------------ 全局仓库 -----------------------------------------
+// 线程缓存不足或过多时与仓库批量交换, 只有这里需要加锁
+class Depot {
+public:
+    static Depot& Instance() {
+        static Depot depot;
+        return depot;
+    }
+
+    // 取一批节点, 仓库为空时切分一块新的 slab
+    FreeList Take(const int cls) {
+        std::unique_lock<std::mutex> lk(m_lock);
+        if (m_lists[cls].head == nullptr) {
+            Carve(cls);
+        }
+        return TakeBatch(m_lists[cls], BATCH);
+    }
+
+    // 归还一批节点
+    void Give(const int cls, FreeList& batch) {
+        std::unique_lock<std::mutex> lk(m_lock);
+        PushBatch(m_lists[cls], batch);
+    }
+
+private:
+    Depot() {
+        for (int i = 0; i < NCLASS; ++i) {
+            m_lists[i].head = nullptr;
+            m_lists[i].count = 0;
+        }
+    }
+
+    // 向系统申请一块 slab 并切分为节点. slab 在进程生命周期内不归还系统:
+    // 节点释放后可能分散在各个线程缓存和仓库中, 没有记录一块 slab 的节点是否全部空闲
+    void Carve(const int cls) {
+        const size_t size = (size_t)1 << (cls + MINSHIFT);
+        const size_t slabsize = (size * BATCH > SLABSIZE) ? size * BATCH : SLABSIZE;
+        char* slab = static_cast<char*>(::operator new(slabsize));
+        slab_bytes.fetch_add(slabsize, std::memory_order_relaxed);
+        for (size_t off = 0; off + size <= slabsize; off += size) {
+            FreeNode* node = reinterpret_cast<FreeNode*>(slab + off);
+            node->next = m_lists[cls].head;
+            m_lists[cls].head = node;
+            ++m_lists[cls].count;
+        }
+    }
+
+    std::mutex m_lock;
+    FreeList m_lists[NCLASS];
+};
+// ------------------ /全局仓库 ----------------------------------------
+
+// ------------------ 线程缓存 -----------------------------------------
+class ThreadCache {
+public:
+    ThreadCache() {
+        for (int i = 0; i < NCLASS; ++i) {
+            m_lists[i].head = nullptr;
+            m_lists[i].count = 0;
+        }
+    }
+
+    void* Alloc(const int cls) {
+        FreeList& list = m_lists[cls];
+        if (list.head == nullptr) {
+            FreeList batch = Depot::Instance().Take(cls);
+            PushBatch(list, batch);
+        }
+        FreeNode* node = list.head;
+        list.head = node->next;
+        --list.count;
+        return node;
+    }
+
+    void Free(void* ptr, const int cls) {
+        FreeList& list = m_lists[cls];
+        FreeNode* node = static_cast<FreeNode*>(ptr);
+        node->next = list.head;
+        list.head = node;
+        ++list.count;
+        // 缓存过多时归还一批给仓库, 避免在一个线程分配、另一个线程释放时无限堆积
+        if (list.count > 2 * BATCH) {
+            FreeList batch = TakeBatch(list, BATCH);
+            Depot::Instance().Give(cls, batch);
+        }
+    }
+
+    // 线程退出时把缓存全部归还仓库
+    ~ThreadCache() {
+        for (int i = 0; i < NCLASS; ++i) {
+            Depot::Instance().Give(i, m_lists[i]);
+        }
+    }
+
+private:
+    FreeList m_lists[NCLASS];
+};
+
+static ThreadCache& LocalCache() {
+    static thread_local ThreadCache cache;
+    return cache;
+}
+// ------------------ /线程缓存 ----------------------------------------
+
+void* PoolAlloc(const size_t n) {
+    if (n > PoolMaxSize()) {
+        return ::operator new(n);
+    }
+    return LocalCache().Alloc(SizeClass(n));
+}
+
+void PoolFree(void* ptr, const size_t n) {
+    if (ptr == nullptr) return;
+    if (n > PoolMaxSize()) {
+        ::operator delete(ptr);
+        return;
+    }
+    LocalCache().Free(ptr, SizeClass(n));
+}
+
+size_t PoolMaxSize() {
+    return (size_t)1 << MAXSHIFT;
+}
+
+size_t PoolSlabBytes() {
+    return slab_bytes.load(std::memory_order_relaxed);
+}
+
+}
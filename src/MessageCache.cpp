@@ -0,0 +1,265 @@
+// 客户端的消息缓存实现
+#include "MessageCache.h"
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+namespace LI {
+
+// 索引文件的格式标识
+static const char INDEXMAGIC[8] = {'L', 'I', 'M', 'C', 'I', 'D', 'X', '1'};
+// 数据文件中记录头的长度: 4字节长度 + 8字节时间
+#define RECORDHEAD 12
+// 一条记录的最大长度, 超过时认为数据文件损坏
+#define MAXRECORD (16 * 1024 * 1024)
+// 索引文件每次扩大的项数
+#define INDEXGROW 1024
+
+// 逐级创建 path 所在的目录
+static bool MakeDirs(const std::string& path) {
+    for (size_t pos = path.find('/', 1); pos != std::string::npos; pos = path.find('/', pos + 1)) {
+        const std::string dir = path.substr(0, pos);
+        if (mkdir(dir.c_str(), 0700) != 0 && errno != EEXIST) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// 读满 n 个字节
+static bool PreadFull(const int fd, void* buffer, const size_t n, const uint64_t offset) {
+    size_t done = 0;
+    while (done < n) {
+        ssize_t r = pread(fd, (char*)buffer + done, n - done, offset + done);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return false;
+        done += r;
+    }
+    return true;
+}
+
+// ------------------ MessageCache 类成员函数 ---------------------------
+MessageCache::MessageCache(): m_datafd(-1), m_indexfd(-1), m_header(nullptr), m_capacity(0), m_datasize(0) { }
+
+bool MessageCache::Open(const std::string& path) {
+    Close();
+    if (MakeDirs(path) == false) {
+        return false;
+    }
+    m_path = path;
+    m_datafd = open((path + ".log").c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    m_indexfd = open((path + ".idx").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    struct stat st;
+    if (m_datafd < 0 || m_indexfd < 0 || fstat(m_datafd, &st) != 0) {
+        Close();
+        return false;
+    }
+    m_datasize = st.st_size;
+
+    // 索引文件的长度决定映射的大小, 新文件或格式不对时重建
+    if (fstat(m_indexfd, &st) != 0) {
+        Close();
+        return false;
+    }
+    const size_t entries = st.st_size > (off_t)sizeof(IndexHeader) ? (st.st_size - sizeof(IndexHeader)) / sizeof(IndexEntry) : 0;
+    if (Map(entries > 0 ? entries : INDEXGROW) == false) {
+        Close();
+        return false;
+    }
+    if (memcmp(m_header->magic, INDEXMAGIC, sizeof(INDEXMAGIC)) != 0 || m_header->count > m_capacity) {
+        if (Rebuild() == false) {
+            Close();
+            return false;
+        }
+        return true;
+    }
+
+    // 崩溃时可能写了数据还没写索引, 截掉没有索引的部分; 索引指向数据文件之外时重建
+    uint64_t end = 0;
+    if (m_header->count > 0) {
+        uint32_t len = 0;
+        const uint64_t offset = Entry(m_header->count - 1)->offset;
+        if (offset + RECORDHEAD > m_datasize || PreadFull(m_datafd, &len, sizeof(len), offset) == false ||
+            offset + RECORDHEAD + len > m_datasize) {
+            if (Rebuild() == false) {
+                Close();
+                return false;
+            }
+            return true;
+        }
+        end = offset + RECORDHEAD + len;
+    }
+    if (end < m_datasize) {
+        if (ftruncate(m_datafd, end) != 0) {
+            Close();
+            return false;
+        }
+        m_datasize = end;
+    }
+    return true;
+}
+
+bool MessageCache::Map(const size_t entries) {
+    const size_t size = sizeof(IndexHeader) + entries * sizeof(IndexEntry);
+    struct stat st;
+    if (fstat(m_indexfd, &st) != 0) {
+        return false;
+    }
+    if ((size_t)st.st_size < size && ftruncate(m_indexfd, size) != 0) {
+        return false;
+    }
+    void* addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_indexfd, 0);
+    if (addr == MAP_FAILED) {
+        return false;
+    }
+    if (m_header != nullptr) {
+        munmap(m_header, sizeof(IndexHeader) + m_capacity * sizeof(IndexEntry));
+    }
+    m_header = (IndexHeader*)addr;
+    m_capacity = entries;
+    return true;
+}
+
+bool MessageCache::Rebuild() {
+    m_header->count = 0;
+    uint64_t offset = 0;
+    int64_t last = 0;
+    while (offset + RECORDHEAD <= m_datasize) {
+        char head[RECORDHEAD];
+        uint32_t len;
+        int64_t time;
+        if (PreadFull(m_datafd, head, RECORDHEAD, offset) == false) {
+            break;
+        }
+        memcpy(&len, head, sizeof(len));
+        memcpy(&time, head + sizeof(len), sizeof(time));
+        // 长度越界或时间没有递增, 从这里开始的数据都不要
+        if (len > MAXRECORD || offset + RECORDHEAD + len > m_datasize || time <= last) {
+            break;
+        }
+        if (m_header->count == m_capacity && Map(m_capacity + INDEXGROW) == false) {
+            return false;
+        }
+        Entry(m_header->count)->time = time;
+        Entry(m_header->count)->offset = offset;
+        ++m_header->count;
+        last = time;
+        offset += RECORDHEAD + len;
+    }
+    if (offset < m_datasize) {
+        if (ftruncate(m_datafd, offset) != 0) {
+            return false;
+        }
+        m_datasize = offset;
+    }
+    memcpy(m_header->magic, INDEXMAGIC, sizeof(INDEXMAGIC));
+    return true;
+}
+
+void MessageCache::Close() {
+    if (m_header != nullptr) {
+        munmap(m_header, sizeof(IndexHeader) + m_capacity * sizeof(IndexEntry));
+        m_header = nullptr;
+    }
+    if (m_datafd != -1) {
+        close(m_datafd);
+        m_datafd = -1;
+    }
+    if (m_indexfd != -1) {
+        close(m_indexfd);
+        m_indexfd = -1;
+    }
+    m_capacity = 0;
+    m_datasize = 0;
+    m_path.clear();
+}
+
+bool MessageCache::Append(const int64_t time, const char* data, const size_t len) {
+    if (m_header == nullptr || time <= LastTime() || len > MAXRECORD) {
+        return false;
+    }
+    if (m_header->count == m_capacity && Map(m_capacity + INDEXGROW) == false) {
+        return false;
+    }
+
+    // 先写数据, 一次 writev 写入记录头和内容
+    char head[RECORDHEAD];
+    const uint32_t len32 = len;
+    memcpy(head, &len32, sizeof(len32));
+    memcpy(head + sizeof(len32), &time, sizeof(time));
+    struct iovec iov[2];
+    iov[0].iov_base = head;
+    iov[0].iov_len = RECORDHEAD;
+    iov[1].iov_base = const_cast<char*>(data);
+    iov[1].iov_len = len;
+    ssize_t n;
+    do {
+        n = writev(m_datafd, iov, 2);
+    } while (n < 0 && errno == EINTR);
+    if (n != (ssize_t)(RECORDHEAD + len)) {
+        // 写了一部分时截掉, 保持数据文件和索引一致
+        if (n > 0 && ftruncate(m_datafd, m_datasize) != 0) {
+            return false;
+        }
+        return false;
+    }
+
+    // 再写索引, 最后增加条数
+    Entry(m_header->count)->time = time;
+    Entry(m_header->count)->offset = m_datasize;
+    m_datasize += n;
+    ++m_header->count;
+    return true;
+}
+
+size_t MessageCache::Count() const {
+    return m_header == nullptr ? 0 : m_header->count;
+}
+
+int64_t MessageCache::LastTime() const {
+    return Count() == 0 ? 0 : Entry(m_header->count - 1)->time;
+}
+
+size_t MessageCache::Lower(const int64_t since) const {
+    size_t lo = 0, hi = Count();
+    while (lo < hi) {
+        const size_t mid = lo + (hi - lo) / 2;
+        if (Entry(mid)->time > since) {
+            hi = mid;
+        }
+        else {
+            lo = mid + 1;
+        }
+    }
+    return lo;
+}
+
+bool MessageCache::Read(const size_t index, std::string& data, int64_t* time) const {
+    if (index >= Count()) {
+        return false;
+    }
+    const uint64_t offset = Entry(index)->offset;
+    uint32_t len = 0;
+    if (PreadFull(m_datafd, &len, sizeof(len), offset) == false || len > MAXRECORD) {
+        return false;
+    }
+    data.resize(len);
+    if (len > 0 && PreadFull(m_datafd, &data[0], len, offset + RECORDHEAD) == false) {
+        return false;
+    }
+    if (time != nullptr) {
+        *time = Entry(index)->time;
+    }
+    return true;
+}
+
+MessageCache::~MessageCache() {
+    Close();
+}
+// ------------------ /MessageCache 类成员函数 --------------------------
+
+}
@@ -0,0 +1,78 @@
+// 运行指标实现
+#include "Metrics.h"
+
+namespace LI {
+
+// ------------------ LatencyHistogram 类成员函数 -----------------------
+LatencyHistogram::LatencyHistogram() {
+    Reset();
+}
+
+void LatencyHistogram::Record(const int64_t us) {
+    const uint64_t value = (us > 0) ? (uint64_t)us : 0;
+    // 计算所在区间: 最高位的位置
+    int idx = 0;
+    while (idx < NBUCKET - 1 && (value >> idx) != 0) {
+        ++idx;
+    }
+    m_buckets[idx].fetch_add(1, std::memory_order_relaxed);
+    m_count.fetch_add(1, std::memory_order_relaxed);
+    m_sum.fetch_add(value, std::memory_order_relaxed);
+
+    // 更新最大值
+    int64_t curmax = m_max.load(std::memory_order_relaxed);
+    while ((int64_t)value > curmax &&
+           !m_max.compare_exchange_weak(curmax, (int64_t)value, std::memory_order_relaxed)) { }
+}
+
+uint64_t LatencyHistogram::Count() const {
+    return m_count.load(std::memory_order_relaxed);
+}
+
+int64_t LatencyHistogram::Max() const {
+    return m_max.load(std::memory_order_relaxed);
+}
+
+int64_t LatencyHistogram::Mean() const {
+    const uint64_t cnt = Count();
+    if (cnt == 0) return 0;
+    return (int64_t)(m_sum.load(std::memory_order_relaxed) / cnt);
+}
+
+int64_t LatencyHistogram::Percentile(const double p) const {
+    const uint64_t cnt = Count();
+    if (cnt == 0) return 0;
+    // 第 target 个记录所在的区间
+    uint64_t target = (uint64_t)(p * cnt);
+    if (target >= cnt) target = cnt - 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < NBUCKET; ++i) {
+        seen += m_buckets[i].load(std::memory_order_relaxed);
+        if (seen > target) {
+            return ((int64_t)1 << i) - 1;
+        }
+    }
+    return Max();
+}
+
+std::string LatencyHistogram::Summary() const {
+    std::string summary("count=");
+    summary.append(std::to_string(Count()));
+    summary.append(" mean=").append(std::to_string(Mean())).append("us");
+    summary.append(" p50=").append(std::to_string(Percentile(0.5))).append("us");
+    summary.append(" p99=").append(std::to_string(Percentile(0.99))).append("us");
+    summary.append(" max=").append(std::to_string(Max())).append("us");
+    return summary;
+}
+
+void LatencyHistogram::Reset() {
+    for (int i = 0; i < NBUCKET; ++i) {
+        m_buckets[i].store(0, std::memory_order_relaxed);
+    }
+    m_count.store(0, std::memory_order_relaxed);
+    m_sum.store(0, std::memory_order_relaxed);
+    m_max.store(0, std::memory_order_relaxed);
+}
+// ------------------ /LatencyHistogram 类成员函数 ----------------------
+
+}
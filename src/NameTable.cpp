@@ -0,0 +1,54 @@
+// 用户名表实现
+#include "NameTable.h"
+
+namespace LI {
+
+// ------------------ NameTable 类成员函数 ---------------------------
+NameTable::NameTable(): m_size(0) {
+    for (size_t i = 0; i < kSegments; ++i) {
+        m_segments[i].store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+NameTable::~NameTable() {
+    for (size_t i = 0; i < kSegments; ++i) {
+        delete[] m_segments[i].load(std::memory_order_relaxed);
+    }
+}
+
+uint32_t NameTable::Intern(const char* name, const size_t len) {
+    const std::string key(name, len);
+    std::lock_guard<std::mutex> lock(m_lock);
+    auto it = m_ids.find(&key);
+    if (it != m_ids.end()) {
+        return it->second;
+    }
+
+    const uint32_t id = m_size.load(std::memory_order_relaxed) + 1;
+    size_t segment = 0, offset = 0;
+    Locate(id, &segment, &offset);
+    if (segment >= kSegments) {
+        return 0;
+    }
+    std::string* names = m_segments[segment].load(std::memory_order_relaxed);
+    if (names == nullptr) {
+        names = new std::string[kFirstSize << segment];
+        m_segments[segment].store(names, std::memory_order_release);
+    }
+    std::string& slot = names[offset];
+    slot = key;
+    m_ids.emplace(&slot, id);
+    // 发布之后其他线程才能用这个编号查找用户名
+    m_size.store(id, std::memory_order_release);
+    return id;
+}
+
+uint32_t NameTable::Find(const char* name, const size_t len) const {
+    const std::string key(name, len);
+    std::lock_guard<std::mutex> lock(m_lock);
+    auto it = m_ids.find(&key);
+    return (it != m_ids.end()) ? it->second : 0;
+}
+// ------------------ /NameTable 类成员函数 --------------------------
+
+}
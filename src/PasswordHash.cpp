@@ -0,0 +1,431 @@
+// 口令哈希实现
+#include "PasswordHash.h"
+#include "SessionToken.h"
+#include <cstring>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <random>
+
+namespace LI {
+
+#define SALTLEN 16          // 盐的长度, 单位: bytes
+#define HASHLEN 32          // 哈希的长度, 单位: bytes
+#define MAXMEMORY (1 << 30) // scrypt 最多使用的内存, 单位: bytes
+
+// 十六进制字符
+static const char HEXDIGITS[] = "0123456789abcdef";
+
+static std::string ToHex(const uint8_t* data, const size_t len) {
+    std::string hex(len * 2, '0');
+    for (size_t i = 0; i < len; ++i) {
+        hex[2 * i] = HEXDIGITS[data[i] >> 4];
+        hex[2 * i + 1] = HEXDIGITS[data[i] & 0xf];
+    }
+    return hex;
+}
+
+// 解析十六进制字符串, 格式不正确返回 false
+static bool FromHex(const std::string& hex, std::vector<uint8_t>& out) {
+    if (hex.size() % 2 != 0) {
+        return false;
+    }
+    out.resize(hex.size() / 2);
+    for (size_t i = 0; i < hex.size(); ++i) {
+        const char c = hex[i];
+        int d;
+        if (c >= '0' && c <= '9') d = c - '0';
+        else if (c >= 'a' && c <= 'f') d = c - 'a' + 10;
+        else return false;
+        out[i / 2] = (uint8_t)((i % 2 == 0) ? (d << 4) : (out[i / 2] | d));
+    }
+    return true;
+}
+
+// 读取随机字节, 优先使用 /dev/urandom, 打不开时使用 random_device
+static void RandomBytes(uint8_t* out, const size_t len) {
+    int fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+    if (fd < 0 || read(fd, out, len) != (ssize_t)len) {
+        std::random_device rd;
+        for (size_t i = 0; i < len; ++i) {
+            out[i] = (uint8_t)rd();
+        }
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+static inline uint32_t Rotr(const uint32_t x, const int b) {
+    return (x >> b) | (x << (32 - b));
+}
+
+static inline uint32_t Rotl(const uint32_t x, const int b) {
+    return (x << b) | (x >> (32 - b));
+}
+
+static inline uint32_t Load32BE(const uint8_t* p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static inline void Store32BE(uint8_t* p, const uint32_t v) {
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+static inline uint32_t Load32LE(const uint8_t* p) {
+    return ((uint32_t)p[3] << 24) | ((uint32_t)p[2] << 16) | ((uint32_t)p[1] << 8) | p[0];
+}
+
+static inline void Store32LE(uint8_t* p, const uint32_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+// SHA-256(FIPS 180-4)
+struct Sha256 {
+    uint32_t state[8];
+    uint64_t bytes;     // 已经输入的字节数
+    uint8_t block[64];  // 不满一块的输入
+
+    Sha256() {
+        static const uint32_t init[8] = {
+            0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+        };
+        memcpy(state, init, sizeof(state));
+        bytes = 0;
+    }
+
+    void Compress(const uint8_t* p) {
+        static const uint32_t k[64] = {
+            0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+            0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+            0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+            0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+            0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+            0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+            0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+            0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+        };
+        uint32_t w[64];
+        for (int i = 0; i < 16; ++i) {
+            w[i] = Load32BE(p + 4 * i);
+        }
+        for (int i = 16; i < 64; ++i) {
+            const uint32_t s0 = Rotr(w[i - 15], 7) ^ Rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            const uint32_t s1 = Rotr(w[i - 2], 17) ^ Rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+        for (int i = 0; i < 64; ++i) {
+            const uint32_t t1 = h + (Rotr(e, 6) ^ Rotr(e, 11) ^ Rotr(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+            const uint32_t t2 = (Rotr(a, 2) ^ Rotr(a, 13) ^ Rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g; g = f; f = e; e = d + t1;
+            d = c; c = b; b = a; a = t1 + t2;
+        }
+        state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+        state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+    }
+
+    void Update(const uint8_t* data, size_t len) {
+        size_t used = bytes % 64;
+        bytes += len;
+        if (used > 0) {
+            const size_t n = (len < 64 - used) ? len : 64 - used;
+            memcpy(block + used, data, n);
+            data += n;
+            len -= n;
+            used += n;
+            if (used < 64) return;
+            Compress(block);
+        }
+        for (; len >= 64; data += 64, len -= 64) {
+            Compress(data);
+        }
+        memcpy(block, data, len);
+    }
+
+    void Final(uint8_t out[32]) {
+        const uint64_t bits = bytes * 8;
+        uint8_t pad[72] = {0x80};
+        const size_t used = bytes % 64;
+        const size_t padlen = (used < 56) ? 56 - used : 120 - used;
+        for (int i = 0; i < 8; ++i) {
+            pad[padlen + i] = (uint8_t)(bits >> (56 - 8 * i));
+        }
+        Update(pad, padlen + 8);
+        for (int i = 0; i < 8; ++i) {
+            Store32BE(out + 4 * i, state[i]);
+        }
+    }
+};
+
+// HMAC-SHA256, 密钥处理过的内外两个状态可以重复使用
+struct HmacSha256 {
+    Sha256 inner;
+    Sha256 outer;
+
+    HmacSha256(const uint8_t* key, size_t klen) {
+        uint8_t hashed[32];
+        if (klen > 64) {
+            Sha256 h;
+            h.Update(key, klen);
+            h.Final(hashed);
+            key = hashed;
+            klen = 32;
+        }
+        uint8_t pad[64];
+        for (size_t i = 0; i < 64; ++i) {
+            pad[i] = (uint8_t)((i < klen ? key[i] : 0) ^ 0x36);
+        }
+        inner.Update(pad, 64);
+        for (size_t i = 0; i < 64; ++i) {
+            pad[i] = (uint8_t)((i < klen ? key[i] : 0) ^ 0x5c);
+        }
+        outer.Update(pad, 64);
+    }
+};
+
+// PBKDF2-HMAC-SHA256, scrypt 只用迭代次数 1
+static void Pbkdf2Sha256(const uint8_t* pass, const size_t plen, const uint8_t* salt, const size_t slen,
+                         uint8_t* out, size_t outlen) {
+    const HmacSha256 hmac(pass, plen);
+    for (uint32_t i = 1; outlen > 0; ++i) {
+        uint8_t counter[4];
+        Store32BE(counter, i);
+        Sha256 inner = hmac.inner;
+        inner.Update(salt, slen);
+        inner.Update(counter, 4);
+        uint8_t digest[32];
+        inner.Final(digest);
+        Sha256 outer = hmac.outer;
+        outer.Update(digest, 32);
+        outer.Final(digest);
+
+        const size_t n = (outlen < 32) ? outlen : 32;
+        memcpy(out, digest, n);
+        out += n;
+        outlen -= n;
+    }
+}
+
+// Salsa20/8 核心, b = b + 8 轮变换(b)
+static void Salsa208(uint32_t b[16]) {
+    uint32_t x[16];
+    memcpy(x, b, sizeof(x));
+    for (int i = 0; i < 8; i += 2) {
+        // 列
+        x[ 4] ^= Rotl(x[ 0] + x[12],  7); x[ 8] ^= Rotl(x[ 4] + x[ 0],  9);
+        x[12] ^= Rotl(x[ 8] + x[ 4], 13); x[ 0] ^= Rotl(x[12] + x[ 8], 18);
+        x[ 9] ^= Rotl(x[ 5] + x[ 1],  7); x[13] ^= Rotl(x[ 9] + x[ 5],  9);
+        x[ 1] ^= Rotl(x[13] + x[ 9], 13); x[ 5] ^= Rotl(x[ 1] + x[13], 18);
+        x[14] ^= Rotl(x[10] + x[ 6],  7); x[ 2] ^= Rotl(x[14] + x[10],  9);
+        x[ 6] ^= Rotl(x[ 2] + x[14], 13); x[10] ^= Rotl(x[ 6] + x[ 2], 18);
+        x[ 3] ^= Rotl(x[15] + x[11],  7); x[ 7] ^= Rotl(x[ 3] + x[15],  9);
+        x[11] ^= Rotl(x[ 7] + x[ 3], 13); x[15] ^= Rotl(x[11] + x[ 7], 18);
+        // 行
+        x[ 1] ^= Rotl(x[ 0] + x[ 3],  7); x[ 2] ^= Rotl(x[ 1] + x[ 0],  9);
+        x[ 3] ^= Rotl(x[ 2] + x[ 1], 13); x[ 0] ^= Rotl(x[ 3] + x[ 2], 18);
+        x[ 6] ^= Rotl(x[ 5] + x[ 4],  7); x[ 7] ^= Rotl(x[ 6] + x[ 5],  9);
+        x[ 4] ^= Rotl(x[ 7] + x[ 6], 13); x[ 5] ^= Rotl(x[ 4] + x[ 7], 18);
+        x[11] ^= Rotl(x[10] + x[ 9],  7); x[ 8] ^= Rotl(x[11] + x[10],  9);
+        x[ 9] ^= Rotl(x[ 8] + x[11], 13); x[10] ^= Rotl(x[ 9] + x[ 8], 18);
+        x[12] ^= Rotl(x[15] + x[14],  7); x[13] ^= Rotl(x[12] + x[15],  9);
+        x[14] ^= Rotl(x[13] + x[12], 13); x[15] ^= Rotl(x[14] + x[13], 18);
+    }
+    for (int i = 0; i < 16; ++i) {
+        b[i] += x[i];
+    }
+}
+
+// BlockMix: in 是 2r 个 64 字节的块(16 个字), 结果的偶数块放在前半, 奇数块放在后半
+static void BlockMix(const uint32_t* in, uint32_t* out, const uint32_t r) {
+    uint32_t x[16];
+    memcpy(x, in + (2 * r - 1) * 16, 64);
+    for (uint32_t i = 0; i < 2 * r; ++i) {
+        for (int j = 0; j < 16; ++j) {
+            x[j] ^= in[i * 16 + j];
+        }
+        Salsa208(x);
+        memcpy(out + ((i & 1) * r + i / 2) * 16, x, 64);
+    }
+}
+
+// ROMix: 对 128r 字节的 b 做 N 次顺序写和 N 次随机读, v 是 N 个块的工作区
+static void ROMix(uint8_t* b, const uint32_t r, const uint64_t n, uint32_t* v, uint32_t* x, uint32_t* y) {
+    const size_t words = 32 * r;
+    for (size_t i = 0; i < words; ++i) {
+        x[i] = Load32LE(b + 4 * i);
+    }
+    for (uint64_t i = 0; i < n; ++i) {
+        memcpy(v + i * words, x, words * 4);
+        BlockMix(x, y, r);
+        std::swap(x, y);
+    }
+    for (uint64_t i = 0; i < n; ++i) {
+        // Integerify: 最后一个 64 字节块的前 8 个字节, n 是 2 的幂, 取低位即可
+        const uint64_t j = (x[(2 * r - 1) * 16] | ((uint64_t)x[(2 * r - 1) * 16 + 1] << 32)) & (n - 1);
+        const uint32_t* vj = v + j * words;
+        for (size_t k = 0; k < words; ++k) {
+            x[k] ^= vj[k];
+        }
+        BlockMix(x, y, r);
+        std::swap(x, y);
+    }
+    for (size_t i = 0; i < words; ++i) {
+        Store32LE(b + 4 * i, x[i]);
+    }
+}
+
+bool Scrypt(const char* pass, const size_t plen, const uint8_t* salt, const size_t slen,
+            const ScryptParams& params, uint8_t* out, const size_t outlen) {
+    if (params.logn < 1 || params.logn > 30 || params.r == 0 || params.p == 0) {
+        return false;
+    }
+    const uint64_t n = (uint64_t)1 << params.logn;
+    const uint64_t block = 128 * (uint64_t)params.r;
+    if (block * n > MAXMEMORY || block * params.p > MAXMEMORY) {
+        return false;
+    }
+
+    std::vector<uint8_t> b(block * params.p);
+    Pbkdf2Sha256((const uint8_t*)pass, plen, salt, slen, b.data(), b.size());
+    std::vector<uint32_t> v(n * block / 4);
+    std::vector<uint32_t> xy(block / 2);
+    for (uint32_t i = 0; i < params.p; ++i) {
+        ROMix(b.data() + i * block, params.r, n, v.data(), xy.data(), xy.data() + block / 4);
+    }
+    Pbkdf2Sha256((const uint8_t*)pass, plen, b.data(), b.size(), out, outlen);
+    return true;
+}
+
+std::string HashPassword(const char* password, const size_t len, const ScryptParams& params) {
+    uint8_t salt[SALTLEN];
+    RandomBytes(salt, SALTLEN);
+    uint8_t hash[HASHLEN];
+    if (Scrypt(password, len, salt, SALTLEN, params, hash, HASHLEN) == false) {
+        return std::string();
+    }
+    return "$scrypt$" + std::to_string(params.logn) + "$" + std::to_string(params.r) + "$" + std::to_string(params.p) +
+           "$" + ToHex(salt, SALTLEN) + "$" + ToHex(hash, HASHLEN);
+}
+
+// 解析 HashPassword 的结果, 格式不正确返回 false
+static bool ParseHash(const std::string& stored, ScryptParams* params, std::vector<uint8_t>& salt, std::vector<uint8_t>& hash) {
+    if (stored.compare(0, 8, "$scrypt$") != 0) {
+        return false;
+    }
+    // 依次是 logn, r, p, 盐, 哈希, 用 '$' 分隔
+    std::string fields[5];
+    size_t pos = 8;
+    for (int i = 0; i < 5; ++i) {
+        const size_t end = (i < 4) ? stored.find('$', pos) : stored.size();
+        if (end == std::string::npos || end == pos) {
+            return false;
+        }
+        fields[i] = stored.substr(pos, end - pos);
+        pos = end + 1;
+    }
+    for (int i = 0; i < 3; ++i) {
+        if (fields[i].size() > 9 || fields[i].find_first_not_of("0123456789") != std::string::npos) {
+            return false;
+        }
+    }
+    params->logn = std::stoi(fields[0]);
+    params->r = (uint32_t)std::stoul(fields[1]);
+    params->p = (uint32_t)std::stoul(fields[2]);
+    return FromHex(fields[3], salt) && FromHex(fields[4], hash) && hash.size() > 0;
+}
+
+// 比较两段内存, 耗时只和长度有关
+static bool ConstantTimeEqual(const uint8_t* a, const uint8_t* b, const size_t len) {
+    uint8_t diff = 0;
+    for (size_t i = 0; i < len; ++i) {
+        diff |= a[i] ^ b[i];
+    }
+    return diff == 0;
+}
+
+bool VerifyPassword(const char* password, const size_t len, const std::string& stored) {
+    ScryptParams params;
+    std::vector<uint8_t> salt, hash;
+    if (ParseHash(stored, &params, salt, hash) == false) {
+        // 旧版本保存的明文
+        return len == stored.size() && ConstantTimeEqual((const uint8_t*)password, (const uint8_t*)stored.data(), len);
+    }
+    std::vector<uint8_t> computed(hash.size());
+    if (Scrypt(password, len, salt.data(), salt.size(), params, computed.data(), computed.size()) == false) {
+        return false;
+    }
+    return ConstantTimeEqual(computed.data(), hash.data(), hash.size());
+}
+
+bool NeedsRehash(const std::string& stored, const ScryptParams& params) {
+    ScryptParams old;
+    std::vector<uint8_t> salt, hash;
+    if (ParseHash(stored, &old, salt, hash) == false) {
+        return true;
+    }
+    return old.logn < params.logn || old.r < params.r || old.p < params.p;
+}
+
+// ------------------ CredentialCache 类成员函数 ---------------------------
+CredentialCache::CredentialCache(const size_t capacity, const int64_t ttl): m_capacity(capacity), m_ttl(ttl) {
+    RandomBytes((uint8_t*)m_key, sizeof(m_key));
+}
+
+uint64_t CredentialCache::Fingerprint(const std::string& name, const char* password, const size_t len, const std::string& stored) const {
+    // 各部分前面加上长度, 避免不同的切分得到相同的输入
+    std::string data;
+    data.reserve(name.size() + len + stored.size() + 24);
+    for (const std::string& part : {name, std::string(password, len), stored}) {
+        const uint64_t size = part.size();
+        data.append((const char*)&size, sizeof(size));
+        data.append(part);
+    }
+    return SessionToken::SipHash(m_key, data.data(), data.size());
+}
+
+bool CredentialCache::Lookup(const std::string& name, const char* password, const size_t len, const std::string& stored, const int64_t now) {
+    if (m_capacity == 0) {
+        return false;
+    }
+    const uint64_t fp = Fingerprint(name, password, len, stored);
+    std::lock_guard<std::mutex> lock(m_lock);
+    auto it = m_entries.find(name);
+    if (it == m_entries.end()) {
+        return false;
+    }
+    if (it->second.expire <= now) {
+        m_entries.erase(it);
+        return false;
+    }
+    return it->second.fingerprint == fp;
+}
+
+void CredentialCache::Insert(const std::string& name, const char* password, const size_t len, const std::string& stored, const int64_t now) {
+    if (m_capacity == 0) {
+        return;
+    }
+    const uint64_t fp = Fingerprint(name, password, len, stored);
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (m_entries.size() >= m_capacity && m_entries.find(name) == m_entries.end()) {
+        for (auto it = m_entries.begin(); it != m_entries.end();) {
+            if (it->second.expire <= now) it = m_entries.erase(it);
+            else ++it;
+        }
+        if (m_entries.size() >= m_capacity) {
+            m_entries.erase(m_entries.begin());
+        }
+    }
+    m_entries[name] = Entry{fp, now + m_ttl};
+    return;
+}
+// ------------------ /CredentialCache 类成员函数 --------------------------
+
+}
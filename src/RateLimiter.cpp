@@ -0,0 +1,28 @@
+// 令牌桶限速实现
+#include "RateLimiter.h"
+
+namespace LI {
+
+// ------------------ TokenBucket 类成员函数 ----------------------------
+bool TokenBucket::Take(const RateSpec& spec, const int64_t nowms) {
+    if (spec.rate <= 0) return true;
+
+    if (m_tokens < 0) {
+        m_tokens = spec.burst;
+    }
+    else if (nowms > m_last) {
+        // 按经过的时间补充令牌, 不超过桶的容量
+        m_tokens += (nowms - m_last) * spec.rate / 1000.0;
+        if (m_tokens > spec.burst) m_tokens = spec.burst;
+    }
+    m_last = nowms;
+
+    if (m_tokens < 1) {
+        return false;
+    }
+    m_tokens -= 1;
+    return true;
+}
+// ------------------ /TokenBucket 类成员函数 ---------------------------
+
+}
@@ -0,0 +1,103 @@
+// 发送队列实现
+#include "SendQueue.h"
+#include "cppNetWork.h"
+#include <errno.h>
+
+namespace LI {
+
+// 发送完后队列的容量超过这个值时释放, 积压过的连接不一直占用内存, 单位: bytes
+#define SENDQUEUEKEEP (64 * 1024)
+
+// ------------------ SendQueue 类成员函数 ---------------------------
+SendQueue::SendQueue(const int sockfd, const size_t limit): m_sockfd(sockfd), m_limit(limit), m_offset(0), m_closed(false) { }
+
+SendQueue::Result SendQueue::Push(const char* data, const size_t len, const Sender& send) {
+    std::unique_lock<std::mutex> lk(m_lock);
+    if (m_closed) {
+        return CLOSED;
+    }
+    if (m_offset < m_buf.size()) {
+        // 前面还有没有发送的数据, 排在后面, 由 Flush 发送
+        m_buf.append(data, len);
+        if (m_buf.size() - m_offset > m_limit) {
+            Close(lk);
+            return FAILED;
+        }
+        return PENDING;
+    }
+
+    size_t sent = 0;
+    while (sent < len) {
+        const ssize_t n = send ? send(data + sent, len - sent) : SendSome(m_sockfd, data + sent, len - sent);
+        if (n > 0) {
+            sent += n;
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        Close(lk);
+        return FAILED;
+    }
+    if (sent == len) {
+        return DONE;
+    }
+    m_buf.assign(data + sent, len - sent);
+    m_offset = 0;
+    if (m_buf.size() > m_limit) {
+        Close(lk);
+        return FAILED;
+    }
+    return QUEUED;
+}
+
+SendQueue::Result SendQueue::Flush() {
+    std::unique_lock<std::mutex> lk(m_lock);
+    if (m_closed) {
+        return CLOSED;
+    }
+    while (m_offset < m_buf.size()) {
+        const ssize_t n = SendSome(m_sockfd, m_buf.data() + m_offset, m_buf.size() - m_offset);
+        if (n > 0) {
+            m_offset += n;
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        Close(lk);
+        return FAILED;
+    }
+    if (m_offset == m_buf.size()) {
+        m_offset = 0;
+        if (m_buf.capacity() > SENDQUEUEKEEP) std::string().swap(m_buf);
+        else m_buf.clear();
+        return DONE;
+    }
+    // TLS 连接重试时数据的位置可以改变(SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER), 内容不变
+    if (m_offset > m_buf.size() / 2) {
+        m_buf.erase(0, m_offset);
+        m_offset = 0;
+    }
+    return PENDING;
+}
+
+void SendQueue::Close() {
+    std::unique_lock<std::mutex> lk(m_lock);
+    Close(lk);
+}
+
+bool SendQueue::Empty() {
+    std::unique_lock<std::mutex> lk(m_lock);
+    return m_offset == m_buf.size();
+}
+
+void SendQueue::Unsent(std::string& out) {
+    std::unique_lock<std::mutex> lk(m_lock);
+    out.assign(m_buf, m_offset, std::string::npos);
+}
+
+void SendQueue::Close(std::unique_lock<std::mutex>&) {
+    m_closed = true;
+    m_offset = 0;
+    std::string().swap(m_buf);
+}
+// ------------------ /SendQueue 类成员函数 --------------------------
+
+}
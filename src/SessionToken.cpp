@@ -0,0 +1,177 @@
+// 会话令牌实现
+#include "SessionToken.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <random>
+
+namespace LI {
+
+// 十六进制字符
+static const char HEXDIGITS[] = "0123456789abcdef";
+
+// 把 64 位整数写成 16 个十六进制字符
+static void ToHex(uint64_t value, char* out) {
+    for (int i = 15; i >= 0; --i) {
+        out[i] = HEXDIGITS[value & 0xf];
+        value >>= 4;
+    }
+}
+
+// 解析 16 个十六进制字符, 格式不正确返回 false
+static bool FromHex(const char* in, uint64_t* value) {
+    uint64_t v = 0;
+    for (int i = 0; i < 16; ++i) {
+        const char c = in[i];
+        int d;
+        if (c >= '0' && c <= '9') d = c - '0';
+        else if (c >= 'a' && c <= 'f') d = c - 'a' + 10;
+        else return false;
+        v = (v << 4) | d;
+    }
+    *value = v;
+    return true;
+}
+
+static inline uint64_t Rotl(const uint64_t x, const int b) {
+    return (x << b) | (x >> (64 - b));
+}
+
+#define SIPROUND                                              \
+    do {                                                      \
+        v0 += v1; v1 = Rotl(v1, 13); v1 ^= v0; v0 = Rotl(v0, 32); \
+        v2 += v3; v3 = Rotl(v3, 16); v3 ^= v2;                \
+        v0 += v3; v3 = Rotl(v3, 21); v3 ^= v0;                \
+        v2 += v1; v1 = Rotl(v1, 17); v1 ^= v2; v2 = Rotl(v2, 32); \
+    } while (0)
+
+// ------------------ SessionToken 类成员函数 ---------------------------
+SessionToken::SessionToken() {
+    // 优先使用 /dev/urandom, 打不开时使用 random_device
+    int fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+    if (fd < 0 || read(fd, m_key, sizeof(m_key)) != (ssize_t)sizeof(m_key)) {
+        std::random_device rd;
+        m_key[0] = ((uint64_t)rd() << 32) | rd();
+        m_key[1] = ((uint64_t)rd() << 32) | rd();
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+void SessionToken::SetSecret(const std::string& secret) {
+    // 用两个固定的密钥对口令做哈希, 得到 128 位密钥
+    static const uint64_t k0[2] = {0x53657373696f6e54ULL, 0x6f6b656e4b657930ULL};
+    static const uint64_t k1[2] = {0x53657373696f6e54ULL, 0x6f6b656e4b657931ULL};
+    m_key[0] = SipHash(k0, secret.data(), secret.size());
+    m_key[1] = SipHash(k1, secret.data(), secret.size());
+}
+
+std::string SessionToken::ExportKey() const {
+    std::string hex(32, '0');
+    ToHex(m_key[0], &hex[0]);
+    ToHex(m_key[1], &hex[16]);
+    return hex;
+}
+
+bool SessionToken::ImportKey(const std::string& hex) {
+    uint64_t key[2];
+    if (hex.size() != 32 || !FromHex(hex.data(), &key[0]) || !FromHex(hex.data() + 16, &key[1])) {
+        return false;
+    }
+    m_key[0] = key[0];
+    m_key[1] = key[1];
+    return true;
+}
+
+uint64_t SessionToken::Sign(const char* expire, const size_t elen, const char* name, const size_t nlen) const {
+    std::string data;
+    data.reserve(elen + nlen + 1);
+    data.append(expire, elen);
+    data.push_back('.');
+    data.append(name, nlen);
+    return SipHash(m_key, data.data(), data.size());
+}
+
+std::string SessionToken::Issue(const char* name, const size_t len, const int64_t expire) const {
+    const std::string e = std::to_string(expire);
+    char mac[16];
+    ToHex(Sign(e.data(), e.size(), name, len), mac);
+
+    std::string token;
+    token.reserve(e.size() + len + 18);
+    token.append(e);
+    token.push_back('.');
+    token.append(mac, 16);
+    token.push_back('.');
+    token.append(name, len);
+    return token;
+}
+
+bool SessionToken::Verify(const char* token, const size_t len, const int64_t now, std::string* name) const {
+    // 过期时间: 1~19 个数字, 19 个 9 不会超出 uint64_t, 超出 int64_t 的不是签发的令牌
+    size_t elen = 0;
+    uint64_t expire = 0;
+    while (elen < len && elen < 19 && token[elen] >= '0' && token[elen] <= '9') {
+        expire = expire * 10 + (uint64_t)(token[elen] - '0');
+        ++elen;
+    }
+    // 然后是 '.', 16 个十六进制字符的签名, '.', 至少一个字符的用户名
+    if (elen == 0 || expire > (uint64_t)INT64_MAX || len < elen + 19 || token[elen] != '.' || token[elen + 17] != '.') {
+        return false;
+    }
+    uint64_t mac;
+    if (FromHex(token + elen + 1, &mac) == false) {
+        return false;
+    }
+    const char* user = token + elen + 18;
+    const size_t ulen = len - elen - 18;
+    // 签名解析成整数后再比较, 耗时与签名的内容无关
+    if (Sign(token, elen, user, ulen) != mac || (int64_t)expire <= now) {
+        return false;
+    }
+    if (name != nullptr) {
+        name->assign(user, ulen);
+    }
+    return true;
+}
+
+uint64_t SessionToken::SipHash(const uint64_t key[2], const char* data, const size_t len) {
+    uint64_t v0 = key[0] ^ 0x736f6d6570736575ULL;
+    uint64_t v1 = key[1] ^ 0x646f72616e646f6dULL;
+    uint64_t v2 = key[0] ^ 0x6c7967656e657261ULL;
+    uint64_t v3 = key[1] ^ 0x7465646279746573ULL;
+
+    const unsigned char* p = (const unsigned char*)data;
+    const size_t nblocks = len / 8;
+    for (size_t i = 0; i < nblocks; ++i, p += 8) {
+        // 按小端序读取, 结果与平台无关
+        uint64_t m = 0;
+        for (int j = 7; j >= 0; --j) {
+            m = (m << 8) | p[j];
+        }
+        v3 ^= m;
+        SIPROUND;
+        SIPROUND;
+        v0 ^= m;
+    }
+
+    // 剩下的字节和长度组成最后一个块
+    uint64_t b = (uint64_t)len << 56;
+    for (int j = (int)(len & 7) - 1; j >= 0; --j) {
+        b |= (uint64_t)p[j] << (8 * j);
+    }
+    v3 ^= b;
+    SIPROUND;
+    SIPROUND;
+    v0 ^= b;
+
+    v2 ^= 0xff;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+// ------------------ /SessionToken 类成员函数 --------------------------
+
+}
@@ -0,0 +1,191 @@
+// 分层时间轮定时器实现
+#include "TimerWheel.h"
+#include <chrono>
+
+namespace LI {
+
+// 到期链表: 正在执行的定时器放在这个额外的槽中, 回调里取消其他定时器也能正确摘除
+#define EXPIREDSLOT NSLOT
+
+// ------------------ TimerWheel 类成员函数 -----------------------------
+TimerWheel::TimerWheel(const int tickms): m_tickms(tickms > 0 ? tickms : 1),
+                                          m_startms(NowMs()),
+                                          m_tick(0),
+                                          m_size(0)
+{
+    for (int i = 0; i <= NSLOT; ++i) {
+        m_slots[i] = -1;
+    }
+}
+
+int64_t TimerWheel::NowMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+TimerId TimerWheel::AddTimer(const int64_t delayms, Callback cb) {
+    // 取一个空闲节点
+    int32_t idx;
+    if (!m_free.empty()) {
+        idx = m_free.back();
+        m_free.pop_back();
+    }
+    else {
+        idx = (int32_t)m_nodes.size();
+        m_nodes.emplace_back();
+        m_nodes[idx].gen = 1; // 版本号从 1 开始, 编号 0 永远无效
+    }
+
+    // 向上取整, 保证不会提前到期
+    const int64_t delay = (delayms > 0) ? delayms : 0;
+    Node& node = m_nodes[idx];
+    node.expire = (uint64_t)((NowMs() - m_startms + delay + m_tickms - 1) / m_tickms);
+    node.cb = std::move(cb);
+    node.prev = node.next = -1;
+    Place(idx);
+    ++m_size;
+
+    return ((TimerId)node.gen << 32) | (uint32_t)idx;
+}
+
+bool TimerWheel::CancelTimer(const TimerId id) {
+    const int32_t idx = (int32_t)(id & 0xffffffff);
+    const uint32_t gen = (uint32_t)(id >> 32);
+    if (idx < 0 || idx >= (int32_t)m_nodes.size()) return false;
+
+    Node& node = m_nodes[idx];
+    if (node.gen != gen || node.slot < 0) return false;
+
+    Unlink(idx);
+    node.slot = -1;
+    node.cb = nullptr;
+    ++node.gen; // 旧编号失效
+    m_free.push_back(idx);
+    --m_size;
+    return true;
+}
+
+int TimerWheel::Update() {
+    const uint64_t target = (uint64_t)((NowMs() - m_startms) / m_tickms);
+    // 没有定时器时直接跳到当前时间
+    if (m_size == 0) {
+        if (m_tick <= target) m_tick = target + 1;
+        return 0;
+    }
+
+    int cnt = 0;
+    while (m_tick <= target) {
+        cnt += Step();
+    }
+    return cnt;
+}
+
+int TimerWheel::NextTimeout() const {
+    if (m_size == 0) return -1;
+    const int64_t wait = m_startms + (int64_t)m_tick * m_tickms - NowMs();
+    return (wait > 0) ? (int)wait : 0;
+}
+
+void TimerWheel::Place(const int32_t idx) {
+    Node& node = m_nodes[idx];
+    // 已经到期的放在当前槽, 下一个 tick 执行
+    if (node.expire < m_tick) {
+        node.expire = m_tick;
+    }
+    uint64_t delta = node.expire - m_tick;
+
+    int slot;
+    if (delta < (uint64_t)ROOTSIZE) {
+        slot = (int)(node.expire & (ROOTSIZE - 1));
+    }
+    else {
+        // 超过时间轮范围的按最大值处理, 到期时重新计算
+        const uint64_t maxdelta = ((uint64_t)1 << (ROOTBITS + (LEVELS - 1) * LEVELBITS)) - 1;
+        if (delta > maxdelta) {
+            node.expire = m_tick + maxdelta;
+            delta = maxdelta;
+        }
+        int level = 1;
+        while (delta >= ((uint64_t)1 << (ROOTBITS + level * LEVELBITS))) {
+            ++level;
+        }
+        const int shift = ROOTBITS + (level - 1) * LEVELBITS;
+        slot = ROOTSIZE + (level - 1) * LEVELSIZE + (int)((node.expire >> shift) & (LEVELSIZE - 1));
+    }
+
+    // 插入链表头部
+    node.slot = slot;
+    node.prev = -1;
+    node.next = m_slots[slot];
+    if (node.next != -1) {
+        m_nodes[node.next].prev = idx;
+    }
+    m_slots[slot] = idx;
+}
+
+void TimerWheel::Unlink(const int32_t idx) {
+    Node& node = m_nodes[idx];
+    if (node.prev != -1) {
+        m_nodes[node.prev].next = node.next;
+    }
+    else {
+        m_slots[node.slot] = node.next;
+    }
+    if (node.next != -1) {
+        m_nodes[node.next].prev = node.prev;
+    }
+    node.prev = node.next = -1;
+}
+
+void TimerWheel::Cascade(const int level, const int slot) {
+    const int s = ROOTSIZE + (level - 1) * LEVELSIZE + slot;
+    int32_t idx = m_slots[s];
+    m_slots[s] = -1;
+    while (idx != -1) {
+        const int32_t next = m_nodes[idx].next;
+        Place(idx);
+        idx = next;
+    }
+}
+
+int TimerWheel::Step() {
+    const int idx = (int)(m_tick & (ROOTSIZE - 1));
+    // 第 0 层转完一圈, 把上一层对应的槽分配下来
+    if (idx == 0) {
+        for (int level = 1; level < LEVELS; ++level) {
+            const int slot = (int)((m_tick >> (ROOTBITS + (level - 1) * LEVELBITS)) & (LEVELSIZE - 1));
+            Cascade(level, slot);
+            if (slot != 0) break;
+        }
+    }
+
+    // 把当前槽的节点移到到期链表
+    int32_t head = m_slots[idx];
+    m_slots[idx] = -1;
+    for (int32_t i = head; i != -1; i = m_nodes[i].next) {
+        m_nodes[i].slot = EXPIREDSLOT;
+    }
+    m_slots[EXPIREDSLOT] = head;
+    ++m_tick;
+
+    // 逐个执行, 回调中可以添加或取消定时器
+    int cnt = 0;
+    while (m_slots[EXPIREDSLOT] != -1) {
+        const int32_t i = m_slots[EXPIREDSLOT];
+        Unlink(i);
+        Node& node = m_nodes[i];
+        Callback cb = std::move(node.cb);
+        node.cb = nullptr;
+        node.slot = -1;
+        ++node.gen;
+        m_free.push_back(i);
+        --m_size;
+
+        cb();
+        ++cnt;
+    }
+    return cnt;
+}
+// ------------------ /TimerWheel 类成员函数 ----------------------------
+
+}
@@ -0,0 +1,433 @@
+// TLS 传输实现
+#include "Tls.h"
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+#include <unistd.h>
+#include <chrono>
+#ifdef WITH_TLS
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#endif
+
+namespace LI {
+
+#ifdef WITH_TLS
+
+// TLS 1.3 的密码套件, AES-GCM 在前, 有 AES-NI 时最快; 没有 AES 指令的客户端把 ChaCha20 排在前面时服务端照顾客户端
+#define TLS13CIPHERS "TLS_AES_128_GCM_SHA256:TLS_AES_256_GCM_SHA384:TLS_CHACHA20_POLY1305_SHA256"
+// TLS 1.2 只用前向安全的 AEAD 套件
+#define TLS12CIPHERS "ECDHE+AESGCM:ECDHE+CHACHA20"
+// 会话缓存的标识, 服务端恢复会话时要求一致
+#define SESSIONIDCTX "chatroom"
+
+// 一个 TLS 连接
+struct TlsConn {
+    SSL* ssl;
+    std::mutex lock;    // SSL 对象不是线程安全的, 每次调用 OpenSSL 都要加锁
+    std::mutex wlock;   // 串行化完整报文的发送, 一个报文没有发完之前其他线程不能写
+    bool resumed = false;
+    explicit TlsConn(SSL* s): ssl(s) { }
+    ~TlsConn() { SSL_free(ssl); }
+};
+
+// 以 fd 为下标的连接表. 读写时复制 shared_ptr, 注销时正在使用的连接等最后一个使用者结束后释放
+static std::mutex g_lock;
+static std::vector<std::shared_ptr<TlsConn>> g_conns;
+static std::atomic<int> g_active(0); // 注册的连接数, 为 0 时不加锁直接返回, 明文连接没有额外开销
+
+static std::shared_ptr<TlsConn> Find(const int sockfd) {
+    if (g_active.load(std::memory_order_acquire) == 0 || sockfd < 0) {
+        return nullptr;
+    }
+    std::unique_lock<std::mutex> lk(g_lock);
+    return (size_t)sockfd < g_conns.size() ? g_conns[sockfd] : nullptr;
+}
+
+static void Register(const int sockfd, std::shared_ptr<TlsConn> conn) {
+    std::unique_lock<std::mutex> lk(g_lock);
+    if ((size_t)sockfd >= g_conns.size()) {
+        g_conns.resize(sockfd + 1);
+    }
+    if (g_conns[sockfd] == nullptr) {
+        g_active.fetch_add(1, std::memory_order_release);
+    }
+    g_conns[sockfd] = std::move(conn);
+}
+
+static void SetNonBlock(const int sockfd) {
+    fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL) | O_NONBLOCK);
+}
+
+// 把 OpenSSL 的结果转换为 read/write 的语义
+static ssize_t MapResult(SSL* ssl, const int ret) {
+    if (ret > 0) {
+        return ret;
+    }
+    switch (SSL_get_error(ssl, ret)) {
+        case SSL_ERROR_WANT_READ:
+        case SSL_ERROR_WANT_WRITE:
+            errno = EAGAIN;
+            return -1;
+        case SSL_ERROR_ZERO_RETURN:
+            return 0; // 对端发送了 close_notify
+        case SSL_ERROR_SYSCALL:
+            ERR_clear_error();
+            if (errno == 0) errno = ECONNRESET;
+            return ret == 0 ? 0 : -1;
+        default:
+            ERR_clear_error();
+            errno = EPROTO;
+            return -1;
+    }
+}
+
+// 取 OpenSSL 错误队列中的第一个错误
+static std::string LastError(const char* what) {
+    char buf[256];
+    const unsigned long e = ERR_get_error();
+    ERR_clear_error();
+    if (e == 0) {
+        return what;
+    }
+    ERR_error_string_n(e, buf, sizeof(buf));
+    return std::string(what) + ": " + buf;
+}
+
+// TlsContext 的私有成员只在本文件中访问
+struct TlsAccess {
+    static SSL_CTX* Ctx(TlsContext& ctx) { return (SSL_CTX*)ctx.m_ctx; }
+    static bool Verify(TlsContext& ctx) { return ctx.m_verify; }
+
+    // 接管 session 的引用, 返回 1 告诉 OpenSSL 不要释放
+    static int Save(TlsContext& ctx, SSL_SESSION* session) {
+        std::unique_lock<std::mutex> lk(ctx.m_lock);
+        if (ctx.m_session != nullptr) {
+            SSL_SESSION_free((SSL_SESSION*)ctx.m_session);
+        }
+        ctx.m_session = session;
+        return 1;
+    }
+
+    // 取保存的会话, 增加引用计数, 由调用者释放
+    static SSL_SESSION* Load(TlsContext& ctx) {
+        std::unique_lock<std::mutex> lk(ctx.m_lock);
+        SSL_SESSION* session = (SSL_SESSION*)ctx.m_session;
+        if (session != nullptr) {
+            SSL_SESSION_up_ref(session);
+        }
+        return session;
+    }
+
+    // 创建 SSL_CTX 并设置双方共同的参数
+    static bool Create(TlsContext& ctx, const bool server) {
+        SSL_CTX* c = SSL_CTX_new(server ? TLS_server_method() : TLS_client_method());
+        if (c == nullptr) {
+            ctx.m_error = LastError("SSL_CTX_new");
+            return false;
+        }
+        SSL_CTX_set_min_proto_version(c, TLS1_2_VERSION);
+        if (SSL_CTX_set_ciphersuites(c, TLS13CIPHERS) != 1 || SSL_CTX_set_cipher_list(c, TLS12CIPHERS) != 1) {
+            ctx.m_error = LastError("cipher");
+            SSL_CTX_free(c);
+            return false;
+        }
+        // 非阻塞 socket 上 SSL_write 返回 WANT_WRITE 后, 重试时发送缓冲区的地址可能已经改变(std::string 扩容)
+        SSL_CTX_set_mode(c, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER | SSL_MODE_ENABLE_PARTIAL_WRITE);
+        // 一次 read 尽量多读, 不用先读 5 字节的记录头再读记录体
+        SSL_CTX_set_read_ahead(c, 1);
+        SSL_CTX_set_app_data(c, &ctx);
+        ctx.m_ctx = c;
+        return true;
+    }
+};
+
+// 客户端收到新的会话(TLS 1.3 在握手之后才收到票据), 保存下来供下一次连接恢复
+static int NewSession(SSL* ssl, SSL_SESSION* session) {
+    TlsContext* ctx = (TlsContext*)SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl));
+    if (ctx == nullptr) {
+        return 0;
+    }
+    return TlsAccess::Save(*ctx, session);
+}
+
+// ------------------ TlsContext 类成员函数 ---------------------------
+TlsContext::TlsContext(): m_ctx(nullptr), m_verify(false), m_session(nullptr) { }
+
+bool TlsContext::InitServer(const char* certfile, const char* keyfile) {
+    if (m_ctx != nullptr || TlsAccess::Create(*this, true) == false) {
+        return false;
+    }
+    SSL_CTX* c = (SSL_CTX*)m_ctx;
+    if (SSL_CTX_use_certificate_chain_file(c, certfile) != 1 ||
+        SSL_CTX_use_PrivateKey_file(c, keyfile, SSL_FILETYPE_PEM) != 1 ||
+        SSL_CTX_check_private_key(c) != 1) {
+        m_error = LastError("certificate");
+        SSL_CTX_free(c);
+        m_ctx = nullptr;
+        return false;
+    }
+    SSL_CTX_set_options(c, SSL_OP_CIPHER_SERVER_PREFERENCE | SSL_OP_PRIORITIZE_CHACHA);
+    // 会话票据缺省开启, 服务端不保存会话状态; 每个连接只发一张票据, 客户端只保存最近一张
+    SSL_CTX_set_num_tickets(c, 1);
+    SSL_CTX_set_session_id_context(c, (const unsigned char*)SESSIONIDCTX, sizeof(SESSIONIDCTX) - 1);
+    return true;
+}
+
+bool TlsContext::InitClient(const char* cafile) {
+    if (m_ctx != nullptr || TlsAccess::Create(*this, false) == false) {
+        return false;
+    }
+    SSL_CTX* c = (SSL_CTX*)m_ctx;
+    if (cafile != nullptr) {
+        if (SSL_CTX_load_verify_locations(c, cafile, nullptr) != 1) {
+            m_error = LastError("cafile");
+            SSL_CTX_free(c);
+            m_ctx = nullptr;
+            return false;
+        }
+        SSL_CTX_set_verify(c, SSL_VERIFY_PEER, nullptr);
+        m_verify = true;
+    }
+    // 会话由 NewSession 保存在上下文中, 不使用 OpenSSL 内部的客户端缓存
+    SSL_CTX_set_session_cache_mode(c, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(c, NewSession);
+    return true;
+}
+
+TlsContext::~TlsContext() {
+    if (m_session != nullptr) {
+        SSL_SESSION_free((SSL_SESSION*)m_session);
+    }
+    if (m_ctx != nullptr) {
+        SSL_CTX_free((SSL_CTX*)m_ctx);
+    }
+}
+// ------------------ /TlsContext 类成员函数 --------------------------
+
+// ------------------ 全局函数 ------------------------------------------
+bool TlsAccept(TlsContext& ctx, const int sockfd) {
+    if (ctx.Enabled() == false) {
+        return false;
+    }
+    SSL* ssl = SSL_new(TlsAccess::Ctx(ctx));
+    if (ssl == nullptr || SSL_set_fd(ssl, sockfd) != 1) {
+        SSL_free(ssl);
+        ERR_clear_error();
+        return false;
+    }
+    SSL_set_accept_state(ssl);
+    SetNonBlock(sockfd);
+    Register(sockfd, std::make_shared<TlsConn>(ssl));
+    return true;
+}
+
+bool TlsConnect(TlsContext& ctx, const int sockfd, const char* host, const int itimeout) {
+    // 非阻塞握手, 用 poll 等待, 整个握手不超过 itimeout
+    const int flags = fcntl(sockfd, F_GETFL);
+    SetNonBlock(sockfd);
+    if (TlsConnectStart(ctx, sockfd, host) == false) {
+        fcntl(sockfd, F_SETFL, flags);
+        return false;
+    }
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(itimeout);
+    bool want_write = false;
+    int ret;
+    while ((ret = TlsHandshake(sockfd, &want_write)) == 0) {
+        const int left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+        struct pollfd pfd;
+        pfd.fd = sockfd;
+        pfd.events = want_write ? POLLOUT : POLLIN;
+        pfd.revents = 0;
+        if (left <= 0 || poll(&pfd, 1, left) <= 0) {
+            break;
+        }
+    }
+    if (ret != 1) {
+        // 握手没有完成, 不发送 close_notify, socket 保持原样
+        TlsDetach(sockfd);
+        fcntl(sockfd, F_SETFL, flags);
+        return false;
+    }
+    return true;
+}
+
+bool TlsConnectStart(TlsContext& ctx, const int sockfd, const char* host) {
+    if (ctx.Enabled() == false) {
+        return false;
+    }
+    SSL* ssl = SSL_new(TlsAccess::Ctx(ctx));
+    if (ssl == nullptr || SSL_set_fd(ssl, sockfd) != 1) {
+        SSL_free(ssl);
+        ERR_clear_error();
+        return false;
+    }
+    SSL_set_tlsext_host_name(ssl, host);
+    if (TlsAccess::Verify(ctx)) {
+        SSL_set1_host(ssl, host);
+    }
+    SSL_SESSION* session = TlsAccess::Load(ctx);
+    if (session != nullptr) {
+        SSL_set_session(ssl, session);
+        SSL_SESSION_free(session);
+    }
+    SSL_set_connect_state(ssl);
+    Register(sockfd, std::make_shared<TlsConn>(ssl));
+    return true;
+}
+
+int TlsHandshake(const int sockfd, bool* want_write) {
+    std::shared_ptr<TlsConn> conn = Find(sockfd);
+    if (conn == nullptr) {
+        return -1;
+    }
+    std::unique_lock<std::mutex> lk(conn->lock);
+    const int ret = SSL_do_handshake(conn->ssl);
+    if (ret == 1) {
+        conn->resumed = SSL_session_reused(conn->ssl) == 1;
+        return 1;
+    }
+    const int err = SSL_get_error(conn->ssl, ret);
+    if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
+        *want_write = (err == SSL_ERROR_WANT_WRITE);
+        return 0;
+    }
+    ERR_clear_error();
+    return -1;
+}
+
+bool TlsActive(const int sockfd) {
+    return Find(sockfd) != nullptr;
+}
+
+bool TlsResumed(const int sockfd) {
+    std::shared_ptr<TlsConn> conn = Find(sockfd);
+    return conn != nullptr && conn->resumed;
+}
+
+bool TlsPending(const int sockfd) {
+    std::shared_ptr<TlsConn> conn = Find(sockfd);
+    if (conn == nullptr) {
+        return false;
+    }
+    std::unique_lock<std::mutex> lk(conn->lock);
+    return SSL_has_pending(conn->ssl) == 1;
+}
+
+void TlsDetach(const int sockfd) {
+    std::shared_ptr<TlsConn> conn;
+    {
+        std::unique_lock<std::mutex> lk(g_lock);
+        if (sockfd < 0 || (size_t)sockfd >= g_conns.size() || g_conns[sockfd] == nullptr) {
+            return;
+        }
+        conn.swap(g_conns[sockfd]);
+        g_active.fetch_sub(1, std::memory_order_release);
+    }
+    // 尽力发送 close_notify, 不等待对端; 握手没有完成时不发送
+    std::unique_lock<std::mutex> lk(conn->lock);
+    if (SSL_is_init_finished(conn->ssl)) {
+        SSL_shutdown(conn->ssl);
+    }
+    ERR_clear_error();
+}
+
+bool TlsRecv(const int sockfd, void* buffer, const size_t n, ssize_t* nread) {
+    std::shared_ptr<TlsConn> conn = Find(sockfd);
+    if (conn == nullptr) {
+        return false;
+    }
+    std::unique_lock<std::mutex> lk(conn->lock);
+    // 握手在第一次读取时进行, 完成后记录是否恢复了会话
+    const bool handshaking = !SSL_is_init_finished(conn->ssl);
+    errno = 0;
+    *nread = MapResult(conn->ssl, SSL_read(conn->ssl, buffer, n));
+    if (handshaking && SSL_is_init_finished(conn->ssl)) {
+        conn->resumed = SSL_session_reused(conn->ssl) == 1;
+    }
+    return true;
+}
+
+bool TlsSend(const int sockfd, const void* buffer, const size_t n, ssize_t* nsent) {
+    std::shared_ptr<TlsConn> conn = Find(sockfd);
+    if (conn == nullptr) {
+        return false;
+    }
+    std::unique_lock<std::mutex> lk(conn->lock);
+    errno = 0;
+    *nsent = MapResult(conn->ssl, SSL_write(conn->ssl, buffer, n));
+    return true;
+}
+
+bool TlsWriteAll(const int sockfd, const void* buffer, const size_t n, const int itimeout, bool* ok) {
+    std::shared_ptr<TlsConn> conn = Find(sockfd);
+    if (conn == nullptr) {
+        return false;
+    }
+    std::unique_lock<std::mutex> wlk(conn->wlock);
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(itimeout);
+    size_t done = 0;
+    *ok = true;
+    while (done < n) {
+        int err = SSL_ERROR_NONE;
+        {
+            std::unique_lock<std::mutex> lk(conn->lock);
+            const int ret = SSL_write(conn->ssl, (const char*)buffer + done, n - done);
+            if (ret > 0) {
+                done += ret;
+                continue;
+            }
+            err = SSL_get_error(conn->ssl, ret);
+            ERR_clear_error();
+        }
+        // 等待期间不持有 SSL 的锁, epoll 线程可以继续读取
+        const int left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+        struct pollfd pfd;
+        pfd.fd = sockfd;
+        pfd.events = (err == SSL_ERROR_WANT_READ) ? POLLIN : POLLOUT;
+        pfd.revents = 0;
+        if ((err != SSL_ERROR_WANT_READ && err != SSL_ERROR_WANT_WRITE) || left <= 0 || poll(&pfd, 1, left) <= 0) {
+            *ok = false;
+            break;
+        }
+    }
+    return true;
+}
+
+#else
+
+// ------------------ TlsContext 类成员函数 ---------------------------
+TlsContext::TlsContext(): m_ctx(nullptr), m_verify(false), m_session(nullptr) { }
+
+bool TlsContext::InitServer(const char* certfile, const char* keyfile) {
+    m_error = "built without TLS support";
+    return false;
+}
+
+bool TlsContext::InitClient(const char* cafile) {
+    m_error = "built without TLS support";
+    return false;
+}
+
+TlsContext::~TlsContext() { }
+// ------------------ /TlsContext 类成员函数 --------------------------
+
+// ------------------ 全局函数 ------------------------------------------
+bool TlsAccept(TlsContext& ctx, const int sockfd) { return false; }
+bool TlsConnect(TlsContext& ctx, const int sockfd, const char* host, const int itimeout) { return false; }
+bool TlsConnectStart(TlsContext& ctx, const int sockfd, const char* host) { return false; }
+int TlsHandshake(const int sockfd, bool* want_write) { return -1; }
+bool TlsActive(const int sockfd) { return false; }
+bool TlsResumed(const int sockfd) { return false; }
+bool TlsPending(const int sockfd) { return false; }
+void TlsDetach(const int sockfd) { }
+bool TlsRecv(const int sockfd, void* buffer, const size_t n, ssize_t* nread) { return false; }
+bool TlsSend(const int sockfd, const void* buffer, const size_t n, ssize_t* nsent) { return false; }
+bool TlsWriteAll(const int sockfd, const void* buffer, const size_t n, const int itimeout, bool* ok) { return false; }
+
+#endif
+
+}
@@ -0,0 +1,118 @@
+// 零拷贝发送实现
+#include "ZeroCopy.h"
+#include "cppNetWork.h"
+#include <chrono>
+#include <cstring>
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <linux/errqueue.h>
+
+namespace LI {
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+
+// ------------------ ZeroCopyQueue 类成员函数 ---------------------------
+ZeroCopyQueue::ZeroCopyQueue(): m_enabled(false), m_next(0) { }
+
+bool ZeroCopyQueue::Enable(const int sockfd) {
+    const int one = 1;
+    m_enabled = (setsockopt(sockfd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0);
+    return m_enabled;
+}
+
+bool ZeroCopyQueue::Send(const int sockfd, const std::shared_ptr<const std::string>& frame, const int itimeout) {
+    // 连接是阻塞的 socket, 用 MSG_DONTWAIT 发送, 发送缓冲区满时用 poll 等待, 整个发送不超过 itimeout
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(itimeout);
+    const char* data = frame->data();
+    size_t left = frame->size();
+    bool referenced = false;  // 内核是否引用了报文的内存
+    while (left > 0 && m_enabled) {
+        ssize_t n = send(sockfd, data, left, MSG_ZEROCOPY | MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && errno == ENOBUFS) break;  // 超过了锁定内存的限制(optmem_max), 剩下的部分复制发送
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            const int wait = (int)std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+            struct pollfd pfd;
+            pfd.fd = sockfd;
+            pfd.events = POLLOUT;
+            pfd.revents = 0;
+            if (wait > 0 && poll(&pfd, 1, wait) > 0) continue;
+        }
+        if (n <= 0) {
+            // 已经发送的部分仍被内核引用
+            if (referenced) m_pending.push_back(Entry{m_next - 1, frame});
+            return false;
+        }
+        ++m_next;
+        referenced = true;
+        data += n;
+        left -= n;
+    }
+    if (referenced) {
+        m_pending.push_back(Entry{m_next - 1, frame});
+    }
+    return left == 0 || Writen(sockfd, data, left);
+}
+
+ssize_t ZeroCopyQueue::SendSome(const int sockfd, const std::shared_ptr<const std::string>& frame, const size_t offset) {
+    ssize_t n;
+    do {
+        n = send(sockfd, frame->data() + offset, frame->size() - offset, MSG_ZEROCOPY | MSG_NOSIGNAL | MSG_DONTWAIT);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0 && errno == ENOBUFS) {
+        // 超过了锁定内存的限制(optmem_max), 这一次复制发送
+        do {
+            n = send(sockfd, frame->data() + offset, frame->size() - offset, MSG_NOSIGNAL | MSG_DONTWAIT);
+        } while (n < 0 && errno == EINTR);
+        return n;
+    }
+    if (n > 0) {
+        m_pending.push_back(Entry{m_next++, frame});
+    }
+    return n;
+}
+
+int ZeroCopyQueue::Reap(const int sockfd, int* copied) {
+    int count = 0;
+    while (true) {
+        char control[128];
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(sockfd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            break;
+        }
+        for (struct cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm != nullptr; cm = CMSG_NXTHDR(&msg, cm)) {
+            const struct sock_extended_err* err = (const struct sock_extended_err*)CMSG_DATA(cm);
+            if (err->ee_errno != 0 || err->ee_origin != SO_EE_ORIGIN_ZEROCOPY) continue;
+            // 通知是序号区间 [ee_info, ee_data], TCP 上按顺序到达
+            const uint32_t hi = err->ee_data;
+            while (!m_pending.empty() && (int32_t)(m_pending.front().last - hi) <= 0) {
+                m_pending.pop_front();
+            }
+            if (copied != nullptr && (err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)) {
+                ++*copied;
+            }
+            ++count;
+        }
+    }
+    return count;
+}
+
+void ZeroCopyQueue::Release(std::vector<std::shared_ptr<const std::string>>& out) {
+    for (auto& entry : m_pending) {
+        out.push_back(std::move(entry.frame));
+    }
+    m_pending.clear();
+    return;
+}
+// ------------------ /ZeroCopyQueue 类成员函数 --------------------------
+
+}
@@ -1,83 +1,372 @@
 #include "cppNetWork.h"
-#include <thread>
+#include "TimerWheel.h"
+#include "MessageCache.h"
+#include "Tls.h"
+#include "Protocol.hpp"
 #include <string>
 #include <iostream>
 #include <vector>
+#include <memory>
 #include <signal.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
 
 // 字体颜色
 // 红 绿 黄 蓝 紫 青
 std::vector<std::string> colors = {"\033[31m", "\033[32m", "\033[33m", "\033[34m", "\033[35m", "\033[36m"};
 std::string def_col = "\033[0m";
 
-void catch_ctrl_c(int sig);
-
+// 加入房间时最多连续重定向的次数, 防止节点的哈希环不一致时来回重定向
+#define MAXREDIRECTS 3
+// 断线重连: 第一次等待的时间和等待时间的上限, 单位: ms; 连续失败多少次后放弃
+#define RECONNECTBASE 500
+#define RECONNECTMAX (30 * 1000)
+#define MAXRETRIES 10
+// 进入房间时显示缓存中最近的多少条信息
+#define HISTORYSHOW 20
+
+// 单线程客户端: 终端输入, socket 和信号都在一个 epoll 循环中处理.
+// socket 是非阻塞的, 接收的数据按报文拆分, 发送的数据先放入发送缓冲区, 写不完时等待可写事件
 class ChatRoomClient {
 public:
-    friend void catch_ctrl_c(int sig);
+    ChatRoomClient(const char* ip, const int port);
+    // 使用 TLS 连接服务端, cafile 为 nullptr 时不校验服务端证书
+    bool EnableTls(const char* cafile);
+    // 运行接口
+    void Run();
 
-    LI::TcpClient tcp_client;    // 客户端对象
-    bool is_connected;           // 连接标记
-    const std::string m_ip;      // 服务端 ip 地址
-    const int m_port;            // 服务端端口号
-    std::thread thread_Input;    // 键入信息线程
-    bool exit_flag;              // 退出标记
-    std::string m_Username;      // 用户名
-    int m_colorIndex;            // 字体颜色
+    ~ChatRoomClient();
 
-    ChatRoomClient(const char* ip, const int port);
-    // 接收信息
-    void RecvMessage();
-    // 输入要发送的信息
-    void InputMessage();
-    // 注册用户
-    void RegisterUser();
-    // 用户登陆
-    void Login();
-    // 连接客户端
-    bool Connect();
-    // 菜单
-    void Menu();
+private:
+    // 客户端的状态, 决定终端输入的一行如何处理
+    enum State {
+        MENU,       // 选择功能
+        REGNAME,    // 输入注册的用户名
+        REGPASS,    // 输入注册的密码
+        LOGINNAME,  // 输入登录的用户名
+        LOGINPASS,  // 输入登录的密码
+        WAITREPLY,  // 等待服务端回应注册或登录
+        COLOR,      // 选择字体颜色
+        CHAT        // 聊天
+    };
+
+    // 处理终端输入的一行
+    void OnInput(const std::string& line);
+    // 处理服务端的一个报文
+    void OnFrame(const char* buffer);
+    // socket 可读: 读取数据并处理完整的报文, 返回 false 表示连接已经断开
+    bool OnReadable();
+    // 终端可读: 读取数据并按行处理
+    void OnStdin();
+    // 处理已经输入的完整的行, 等待服务端回应时暂不处理
+    void ProcessInput();
+    // 连接服务端, socket 设置为非阻塞并加入 epoll
+    bool Connect(const char* ip, const int port);
     // 关闭连接
     void Close();
-    // 运行接口
-    void Run();
+    // 连接断开: 回到菜单
+    void Disconnected(const char* reason);
+    // 连接意外断开: 已登录时按退避时间重连, 否则回到菜单
+    void ConnectionLost();
+    // 重连定时器到期: 重新连接并恢复登录
+    void Reconnect();
+    // 恢复登录: 有令牌时凭令牌, 否则用密码
+    bool Resume();
+    // 发送报文: 加上长度头放入发送缓冲区, 然后尽量发送
+    bool Send(const std::string& data);
+    // 发送缓冲区中的数据, 写不完时关注可写事件
+    bool Flush();
+    // 发送加入房间的请求
+    bool JoinRoom(const std::string& room);
+    // 重定向到房间的归属节点: 重新连接并登录, 登录成功后再加入房间
+    bool Redirect(const std::string& node, const std::string& room);
+    // 打开当前房间的缓存, 显示缓存中最近的信息, 再向服务端取缓存之后的部分
+    void OpenHistory();
+    // 当前房间的缓存文件名: $HOME/.chatroom/服务端/用户名/房间名
+    std::string CachePath() const;
+    // 显示一条 code 4 信息, 时间比缓存中的新时写入缓存
+    void ShowMessage(const char* buffer, const size_t len);
+    // 输出一条 code 4 信息
+    void PrintMessage(const char* buffer);
+    // 菜单
+    void Menu();
+    // 输出当前状态的提示
+    void Prompt();
     // 删除输出的字符
     void EraseTextInTerminal(int cnt);
 
-    ~ChatRoomClient();
+    LI::TcpClient tcp_client;    // 客户端对象
+    const std::string m_ip;      // 服务端 ip 地址
+    const int m_port;            // 服务端端口号
+    int epollfd;                 // epollfd
+    int sigfd;                   // 接收 SIGINT/SIGTERM 的 signalfd
+    bool running;                // 事件循环是否继续
+    State state;                 // 当前状态
+    LI::RecvBuffer recvbuf;      // 接收缓冲区
+    std::string outbuf;          // 发送缓冲区, 每个报文已经带长度头
+    bool want_write;             // 是否在等待可写事件
+    std::string inbuf;           // 终端输入中还没有处理的数据
+    bool input_eof;              // 终端输入是否已经结束
+    std::string m_Username;      // 用户名
+    std::string m_input;         // 注册或登录时已经输入的用户名
+    int m_colorIndex;            // 字体颜色
+    std::string m_login;         // 登录报文, 重定向到其他节点后重新登录
+    std::string m_room;          // 所在的房间, 空表示大厅
+    int m_redirects;             // 连续重定向的次数
+    std::string m_token;         // 服务端签发的会话令牌, 重连或重定向时凭令牌恢复登录
+    bool m_resuming;             // 是否在等待凭令牌恢复登录的回应
+    int m_retries;               // 连续重连失败的次数
+    bool m_compress;             // 服务端在登录回应中声明能解压, 发送的大报文可以压缩
+    LI::MessageCache m_cache;    // 当前房间收到的信息, 重启后不用从服务端重新取
+    bool m_syncing;              // 是否在等待 cmd 11 的回应, 期间收到的信息会包含在回应中
+    LI::TimerWheel timer_wheel;  // 重连定时器
+    LI::TlsContext m_tls;        // 初始化后用 TLS 连接服务端, 重连时恢复上一次的 TLS 会话
 };
 
-ChatRoomClient::ChatRoomClient(const char* ip, const int port): is_connected(false), m_ip(ip), m_port(port), exit_flag(false) {}
+ChatRoomClient::ChatRoomClient(const char* ip, const int port): m_ip(ip), m_port(port), epollfd(-1), sigfd(-1), running(false), state(MENU), want_write(false), input_eof(false), m_colorIndex(0), m_redirects(0), m_resuming(false), m_retries(0), m_compress(false), m_syncing(false) {}
 
 ChatRoomClient::~ChatRoomClient() {
     Close();
-    if (thread_Input.joinable()) {
-        thread_Input.join();
+    if (sigfd != -1) {
+        close(sigfd);
+    }
+    if (epollfd != -1) {
+        close(epollfd);
+    }
+}
+
+bool ChatRoomClient::EnableTls(const char* cafile) {
+    if (m_tls.InitClient(cafile) == false) {
+        printf("TLS: %s\n", m_tls.Error().c_str());
+        return false;
     }
+    tcp_client.SetTls(&m_tls);
+    return true;
 }
 
 void ChatRoomClient::Close() {
-    if (is_connected) {
+    if (tcp_client.m_sockfd != -1) {
+        epoll_ctl(epollfd, EPOLL_CTL_DEL, tcp_client.m_sockfd, nullptr);
         tcp_client.Close();
-        is_connected = false;
     }
+    recvbuf.Clear();
+    outbuf.clear();
+    want_write = false;
     return;
 }
-// 连接服务端并开始读线程
-bool ChatRoomClient::Connect() {
-    // 如果有先关闭
-    if (is_connected) {
-        Close();
-    }
-    // 连接
-    if (tcp_client.ConnectToServer(m_ip.c_str(), m_port) == false) {
+
+bool ChatRoomClient::Connect(const char* ip, const int port) {
+    Close();
+    m_compress = false; // 新的连接重新协商
+    m_syncing = false;
+    if (tcp_client.ConnectToServer(ip, port) == false) {
         return false;
     }
-    is_connected = true;
+    // 连接建立后再设置为非阻塞, TLS 握手已经在 ConnectToServer 中完成
+    fcntl(tcp_client.m_sockfd, F_SETFL, fcntl(tcp_client.m_sockfd, F_GETFL) | O_NONBLOCK);
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(struct epoll_event));
+    ev.data.fd = tcp_client.m_sockfd;
+    ev.events = EPOLLIN;
+    epoll_ctl(epollfd, EPOLL_CTL_ADD, tcp_client.m_sockfd, &ev);
     return true;
 }
 
+void ChatRoomClient::Disconnected(const char* reason) {
+    Close();
+    m_room.clear();
+    m_resuming = false;
+    state = MENU;
+    system("clear"); // 清屏
+    Menu();
+    std::cout << reason << std::endl;
+    Prompt();
+    return;
+}
+
+void ChatRoomClient::ConnectionLost() {
+    // 没有登录时不需要恢复, 下次注册或登录时重新连接
+    if ((state != COLOR && state != CHAT) || m_login.empty()) {
+        Disconnected("Disconnected.");
+        return;
+    }
+    Close();
+    if (m_retries >= MAXRETRIES) {
+        Disconnected("Reconnect failed.");
+        return;
+    }
+    // 服务端重启或网络抖动时大量客户端同时断开, 随机的等待时间把重连分散开
+    const int delay = LI::BackoffMs(RECONNECTBASE, RECONNECTMAX, m_retries++);
+    EraseTextInTerminal(5);
+    std::cout << "Connection lost, reconnecting in " << delay << " ms." << std::endl;
+    Prompt();
+    timer_wheel.AddTimer(delay, [this]() { Reconnect(); });
+    return;
+}
+
+void ChatRoomClient::Reconnect() {
+    // 等待期间已经回到菜单或已经重新连接
+    if ((state != COLOR && state != CHAT) || tcp_client.m_sockfd != -1) {
+        return;
+    }
+    m_redirects = 0;
+    if (Connect(m_ip.c_str(), m_port) == false || Resume() == false) {
+        ConnectionLost();
+    }
+    return;
+}
+
+bool ChatRoomClient::Resume() {
+    if (m_token.empty()) {
+        m_resuming = false;
+        return Send(m_login);
+    }
+    std::string data("10"); // 凭令牌恢复登录是 10 cmd
+    LI::FormXML(data, "cmd");
+    data.append("<token>");
+    data.append(m_token);
+    data.append("</token>");
+    data.append("<compress>1</compress>");
+    m_resuming = true;
+    return Send(data);
+}
+
+bool ChatRoomClient::Send(const std::string& data) {
+    if (tcp_client.m_sockfd == -1) {
+        return false;
+    }
+    LI::AppendFrame(outbuf, data.data(), data.size(), m_compress);
+    return Flush();
+}
+
+bool ChatRoomClient::Flush() {
+    size_t nsent = 0;
+    while (nsent < outbuf.size()) {
+        ssize_t n = LI::SendSome(tcp_client.m_sockfd, outbuf.data() + nsent, outbuf.size() - nsent);
+        if (n > 0) {
+            nsent += n;
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        return false;
+    }
+    outbuf.erase(0, nsent);
+
+    // 没写完的等可写事件, 写完后不再关注
+    const bool pending = !outbuf.empty();
+    if (pending != want_write) {
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(struct epoll_event));
+        ev.data.fd = tcp_client.m_sockfd;
+        ev.events = pending ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+        epoll_ctl(epollfd, EPOLL_CTL_MOD, tcp_client.m_sockfd, &ev);
+        want_write = pending;
+    }
+    return true;
+}
+
+bool ChatRoomClient::JoinRoom(const std::string& room) {
+    std::string data("9"); // 加入房间是 9 cmd
+    LI::FormXML(data, "cmd");
+    data.append("<room>");
+    data.append(room);
+    data.append("</room>");
+    return Send(data);
+}
+
+bool ChatRoomClient::Redirect(const std::string& node, const std::string& room) {
+    size_t pos = node.rfind(':');
+    if (pos == std::string::npos || ++m_redirects > MAXREDIRECTS) {
+        return false;
+    }
+    m_room = room;
+    if (Connect(node.substr(0, pos).c_str(), atoi(node.c_str() + pos + 1)) == false) {
+        return false;
+    }
+    return Resume();
+}
+
+void ChatRoomClient::OpenHistory() {
+    if (state != CHAT) {
+        return;
+    }
+    // 换了房间或第一次进入时打开缓存并显示, 重连后只取错过的部分
+    const std::string path = CachePath();
+    if (path != m_cache.Path()) {
+        if (path.empty() || m_cache.Open(path) == false) {
+            m_cache.Close();
+        }
+        const size_t count = m_cache.Count();
+        std::string entry;
+        EraseTextInTerminal(5);
+        for (size_t i = (count > HISTORYSHOW ? count - HISTORYSHOW : 0); i < count; ++i) {
+            if (m_cache.Read(i, entry) == false) break;
+            PrintMessage(entry.c_str());
+        }
+    }
+
+    std::string data("11"); // 取最近的广播是 11 cmd
+    LI::FormXML(data, "cmd");
+    data.append("<since>");
+    data.append(std::to_string(m_cache.LastTime()));
+    data.append("</since>");
+    m_syncing = Send(data);
+    return;
+}
+
+std::string ChatRoomClient::CachePath() const {
+    const char* home = getenv("HOME");
+    if (home == nullptr || home[0] == '\0') {
+        return std::string();
+    }
+    // 用户名和房间名中除字母数字外的字符都转义, 不会跨出目录
+    auto escape = [](const std::string& name) {
+        std::string out;
+        char hex[4];
+        for (const unsigned char c : name) {
+            if (isalnum(c) || c == '-' || c == '_') {
+                out.push_back(c);
+            }
+            else {
+                snprintf(hex, sizeof(hex), "%%%02x", c);
+                out.append(hex);
+            }
+        }
+        return out;
+    };
+    return std::string(home) + "/.chatroom/" + escape(m_ip) + "_" + std::to_string(m_port) + "/" + escape(m_Username) + "/" +
+           (m_room.empty() ? std::string("lobby") : "room_" + escape(m_room));
+}
+
+void ChatRoomClient::PrintMessage(const char* buffer) {
+    LI::proto::BroadcastCode msg;
+    if (msg.Decode(buffer, strlen(buffer)) == false) return;
+    const int other_color = (msg.color < 0 || msg.color >= (LI::proto::Int)colors.size()) ? 0 : (int)msg.color;
+    std::cout << colors[other_color];
+    std::string name, text;
+    LI::proto::Unescape(msg.name, name);
+    LI::proto::Unescape(msg.message, text);
+    std::cout << name << ": " << def_col << text << std::endl;
+    return;
+}
+
+void ChatRoomClient::ShowMessage(const char* buffer, const size_t len) {
+    // 没有时间的是旧服务端的信息, 只显示不缓存; 不比缓存新的已经显示过
+    std::string time;
+    LI::GetStrFromXML(buffer, "time", time);
+    const int64_t t = strtoll(time.c_str(), nullptr, 10);
+    if (t > 0 && t <= m_cache.LastTime()) {
+        return;
+    }
+    PrintMessage(buffer);
+    if (t > 0) {
+        m_cache.Append(t, buffer, len);
+    }
+    return;
+}
+
 void ChatRoomClient::Menu() {
     std::cout << "============== Welcome ChatRoom ==============" << std::endl;
     std::cout << "=====          0. Register               =====" << std::endl;
@@ -87,197 +376,342 @@ void ChatRoomClient::Menu() {
     return;
 }
 
-// 接收信息线程函数
-void ChatRoomClient::RecvMessage() {
-    while (1) {
+void ChatRoomClient::Prompt() {
+    switch (state) {
+        case MENU:      std::cout << "Your Choice: "; break;
+        case REGNAME:   std::cout << "Create name: "; break;
+        case REGPASS:   std::cout << "Create password: "; break;
+        case LOGINNAME: std::cout << "Your name: "; break;
+        case LOGINPASS: std::cout << "Your password: "; break;
+        case COLOR:     std::cout << "Select color(0 - 5): "; break;
+        case CHAT:      std::cout << colors[m_colorIndex] << "You: " << def_col; break;
+        default: break;
+    }
+    fflush(stdout);
+    return;
+}
 
-        char message_buffer[1024];
-        memset(message_buffer, 0, sizeof(message_buffer));
-        
-        if (tcp_client.Read(message_buffer) == false) {
-            break;
-        }
-        if (exit_flag) break;
-
-        int code = -1;
-        LI::GetStrFromXML(message_buffer, "code", code); // 获取信息类型
-        std::string message;
-        std::string other_name;
-        int other_color;
-        switch(code) {
-            case 0: {
-                    system("clear"); // 清屏
-                    Menu();
-                    std::cout << "Register Failed." << std::endl;  // 注册失败
-                    return;}
-            case 1: {  // 注册成功
-                    system("clear"); // 清屏
-                    Menu(); 
-                    std::cout << "Register Success." << std::endl; 
-                    return;}
-            case 2: {
-                    system("clear");
-                    Menu();
-                    std::cout << "Login Failed." << std::endl;  // 登录失败
-                    return;}
-            case 3: {std::cout << "Login Success." << std::endl;  // 登录成功
-                    std::cout << "Select color(0 - 5): ";
-                    std::cin >> m_colorIndex;
-                    std::cout << "====== ChatRoom ======" << std::endl;
-                    std::thread t(&ChatRoomClient::InputMessage, this);
-                    thread_Input = std::move(t); // 创建输入线程
-                    break;}
-            case 4: {LI::GetStrFromXML(message_buffer, "message", message); // 收到信息
-                    LI::GetStrFromXML(message_buffer, "name", other_name);
-                    LI::GetStrFromXML(message_buffer, "color", other_color);
-                    EraseTextInTerminal(5);
-                    std::cout << colors[other_color] << other_name << ": " << def_col << message << std::endl;
-                    std::cout << colors[m_colorIndex] << "You: " << def_col;
-                    fflush(stdout);
+// 处理服务端的报文
+void ChatRoomClient::OnFrame(const char* message_buffer) {
+    int code = -1;
+    LI::GetStrFromXML(message_buffer, "code", code); // 获取信息类型
+    // 回到菜单时断开连接, 下次注册或登录时重新连接, 避免在菜单停留时被服务端的心跳检测断开
+    switch(code) {
+        case 0: {Disconnected("Register Failed."); break;}   // 注册失败
+        case 1: {Disconnected("Register Success."); break;}  // 注册成功
+        case 2: {if (m_resuming) {  // 令牌无效(过期或节点的密钥不同), 改用密码登录
+                    m_resuming = false;
+                    m_token.clear();
+                    if (Send(m_login)) break;
+                }
+                Disconnected("Login Failed."); break;}      // 登录失败
+        case 3: {LI::GetStrFromXML(message_buffer, "token", m_token);
+                int compress = 0;
+                LI::GetStrFromXML(message_buffer, "compress", compress);
+                m_compress = (compress == 1);
+                m_resuming = false;
+                m_retries = 0;
+                if (state == WAITREPLY) {
+                    std::cout << "Login Success." << std::endl;  // 登录成功
+                    state = COLOR;
+                    Prompt();
                     break;
+                }
+                // 重连或重定向后恢复了登录, 回到原来的房间
+                if (!m_room.empty()) {
+                    JoinRoom(m_room);
+                    break;
+                }
+                EraseTextInTerminal(5);
+                std::cout << "Reconnected." << std::endl;
+                Prompt();
+                // 取断线期间错过的信息
+                OpenHistory();
+                break;}
+        case 4: {if (m_syncing) break; // 收到信息, 等待 cmd 11 的回应时不处理, 回应中会包含这条信息
+                EraseTextInTerminal(5);
+                ShowMessage(message_buffer, strlen(message_buffer));
+                Prompt();
+                break;}
+        case 5: break; // 服务端回应的心跳
+        case 6: {  // 服务端的心跳探测, 回应 pong
+                std::string data("5"); // 心跳回应是 5 cmd
+                LI::FormXML(data, "cmd");
+                Send(data);
+                break;}
+        case 7: {  // 加入房间成功
+                LI::GetStrFromXML(message_buffer, "room", m_room);
+                m_redirects = 0;
+                EraseTextInTerminal(5);
+                std::cout << (m_room.empty() ? std::string("Back to lobby.") : "Joined room " + m_room + ".") << std::endl;
+                Prompt();
+                OpenHistory();
+                break;}
+        case 8: {  // 房间在其他节点, 重定向
+                std::string node, room;
+                LI::GetStrFromXML(message_buffer, "node", node);
+                LI::GetStrFromXML(message_buffer, "room", room);
+                if (Redirect(node, room) == false) {
+                    Disconnected(("Redirect to " + node + " failed.").c_str());
+                }
+                break;}
+        case 9:    // 请求太频繁, 被服务端丢弃
+        case 10: { // 服务端繁忙, 请求被拒绝
+                int cmd = -1;
+                LI::GetStrFromXML(message_buffer, "cmd", cmd);
+                if (cmd == 0 || cmd == 1 || cmd == 10) {
+                    if (state == WAITREPLY) {
+                        Disconnected(code == 9 ? "Too many requests, try again later." : "Server busy, try again later.");
                     }
-            default: return;
-        }
-        
+                    else {
+                        // 重连时恢复登录被限速, 稍后再试
+                        m_resuming = false;
+                        ConnectionLost();
+                    }
+                    break;
+                }
+                EraseTextInTerminal(5);
+                if (cmd == 11) {
+                    m_syncing = false;
+                    break;
+                }
+                std::cout << (cmd == 9 ? "Too many joins, ignored." : "Too fast, message dropped.") << std::endl;
+                Prompt();
+                break;}
+        case 11: {  // 最近的信息: <item> 中是 code 4 报文, 比缓存新的显示并写入缓存
+                std::string room;
+                LI::GetStrFromXML(message_buffer, "room", room);
+                if (room != m_room) break; // 回应到达前已经换了房间
+                m_syncing = false;
+                EraseTextInTerminal(5);
+                const char* item = message_buffer;
+                while ((item = strstr(item, "<item>")) != nullptr) {
+                    item += 6;
+                    const char* end = strstr(item, "</item>");
+                    if (end == nullptr) break;
+                    std::string entry(item, end - item);
+                    ShowMessage(entry.c_str(), entry.size());
+                    item = end + 7;
+                }
+                Prompt();
+                break;}
+        default: break;
     }
-
-    Close();
     return;
 }
 
-// 发送信息线程函数
-void ChatRoomClient::InputMessage() {
-    std::string message;
-    std::getline(std::cin, message); // 清空输入缓冲区
-    while (1) 
-    {
-        std::cout << colors[m_colorIndex] << "You: " << def_col;
-        fflush(stdout);
-        std::getline(std::cin, message);
-
-        if (message == "#exit") {
-            exit_flag = true;
-            // 形成格式
-            std::string data("3"); // 退出登陆是 3 cmd
-            LI::FormXML(data, "cmd");
-            if (tcp_client.Write(data.c_str()) == false) {
-                break;
-            };
-            catch_ctrl_c(SIGINT);
-        } // 输入 exit 退出
-        
-        // 形成格式
-        LI::FormXML(message, "message");
-        std::string data("2"); // 发信息是 2 cmd
-        LI::FormXML(data, "cmd");
-        data.append("<name>");
-        data.append(m_Username);
-        data.append("</name>");
-        data.append("<color>");
-        data.append(std::to_string(m_colorIndex));
-        data.append("</color>");
-        data.append(message);
-
-        // 发送
-        if (tcp_client.Write(data.c_str()) == false) {
-            break;
-        };
+// 处理终端输入
+void ChatRoomClient::OnInput(const std::string& line) {
+    switch (state) {
+        case MENU: {
+                if (line == "0") state = REGNAME;
+                else if (line == "1") state = LOGINNAME;
+                else if (line == "2") {
+                    std::cout << "See you again." << std::endl;
+                    running = false;
+                    return;
+                }
+                else if (!line.empty()) std::cout << "Input error! Input again." << std::endl;
+                break;}
+        case REGNAME:
+        case LOGINNAME: {
+                if (line.empty()) break;
+                m_input = line;
+                state = (state == REGNAME) ? REGPASS : LOGINPASS;
+                break;}
+        case REGPASS:
+        case LOGINPASS: {
+                if (line.empty()) break;
+                // 形成xml格式, 注册为 0 cmd, 登录为 1 cmd
+                const std::string message = m_input + " " + line;
+                std::string data;
+                if (state == REGPASS) {
+                    LI::proto::RegisterCmd msg;
+                    msg.message = message;
+                    msg.AppendTo(data);
+                }
+                else {
+                    // 声明能解压, 服务端给本客户端的大报文可以压缩
+                    LI::proto::LoginCmd msg;
+                    msg.message = message;
+                    msg.compress = 1;
+                    msg.AppendTo(data);
+                    m_Username = m_input;
+                    m_login = data;
+                    m_token.clear();
+                    m_room.clear();
+                    m_redirects = 0;
+                    m_retries = 0;
+                }
+                // 连接并发送给服务端
+                if (Connect(m_ip.c_str(), m_port) == false || Send(data) == false) {
+                    perror("connect.");
+                    Close();
+                    state = MENU;
+                    break;
+                }
+                state = WAITREPLY;
+                return;}
+        case WAITREPLY: return; // 不会出现, 等待回应时输入留在 inbuf 中
+        case COLOR: {
+                int color = -1;
+                if (!line.empty() && line.find_first_not_of("0123456789") == std::string::npos) color = atoi(line.c_str());
+                if (color < 0 || color >= (int)colors.size()) break;
+                m_colorIndex = color;
+                std::cout << "====== ChatRoom ======" << std::endl;
+                state = CHAT;
+                OpenHistory();
+                break;}
+        case CHAT: {
+                // 输入 #exit 退出
+                if (line == "#exit") {
+                    std::string data("3"); // 退出登陆是 3 cmd
+                    LI::FormXML(data, "cmd");
+                    Send(data);
+                    Flush();
+                    running = false;
+                    return;
+                }
+                // #join 房间名 加入房间, #leave 回到大厅
+                if (line.compare(0, 6, "#join ") == 0 || line == "#leave") {
+                    const std::string room = line == "#leave" ? std::string() : line.substr(6);
+                    if (LI::proto::NeedsEscape(room)) {
+                        std::cout << "Room name cannot contain '<', '>' or '&'." << std::endl;
+                        break;
+                    }
+                    JoinRoom(room);
+                    break;
+                }
+
+                // 形成格式, 发信息是 2 cmd
+                LI::proto::ChatCmd msg;
+                msg.name = m_Username;
+                msg.color = m_colorIndex;
+                msg.message = line;
+                const std::string data = msg.Encode();
+
+                // 超过长度上限的报文服务端会断开连接
+                if ((int)data.size() > LI::GetMaxMsgLen()) {
+                    std::cout << "Message too long." << std::endl;
+                    break;
+                }
+                if (tcp_client.m_sockfd == -1) {
+                    std::cout << "Not connected, message dropped." << std::endl;
+                    break;
+                }
+                Send(data);
+                break;}
     }
-
-    Close();
+    Prompt();
     return;
 }
-// 注册用户
-void ChatRoomClient::RegisterUser() {
-    std::string message;
-    // 输入信息
-    std::string getStr;
-    std::cout << "Create name: " ;
-    std::cin >> getStr;
-    message.assign(getStr);
-    message += " ";
-    std::cout << "Create password: " ;
-    std::cin >> getStr;
-    message.append(getStr);
-
-    // 形成xml格式
-    LI::FormXML(message, "message");
-    // 添加 cmd label
-    std::string data("0"); // 注册为 0 cmd
-    LI::FormXML(data, "cmd");
-    // 合成总的报文
-    data.append(message);
-    // 发送给客户端
-    if (is_connected == false) {
-        if(Connect() == false) {
-            perror("connect.");
-            return;
-        }
+
+bool ChatRoomClient::OnReadable() {
+    ssize_t n = recvbuf.ReadFd(tcp_client.m_sockfd);
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+        return false;
     }
-    if (tcp_client.Write(data.c_str()) == false) {
-        perror("connect.");
-        return;
-    } 
 
-    return;
+    // 一次可能读到多个报文, 也可能只读到报文的一部分
+    LI::Frame frame;
+    int iret;
+    const int sockfd = tcp_client.m_sockfd;
+    while ((iret = recvbuf.NextFrame(frame)) == 1) {
+        OnFrame(frame.data());
+        // 报文处理中可能关闭或更换了连接, 剩下的数据属于旧连接
+        if (tcp_client.m_sockfd != sockfd) return true;
+    }
+    return iret == 0;
 }
-// 登录
-void ChatRoomClient::Login() {
-    std::string message;
-    // 输入信息
-    std::string getStr;
-    std::cout << "Your name: " ;
-    std::cin >> getStr;
-    m_Username = getStr; // 用户名
-    message.assign(getStr);
-    message += " ";
-    std::cout << "Your password: " ;
-    std::cin >> getStr;
-    message.append(getStr);
-
-    // 形成xml格式
-    LI::FormXML(message, "message");
-    // 添加 cmd label
-    std::string data("1"); // 登录为 1 cmd
-    LI::FormXML(data, "cmd");
-    // 合成总的报文
-    data.append(message);
-    // 发送给客户端
-    if (is_connected == false) {
-        if(Connect() == false) {
-            perror("connect.");
-            return;
-        }
+
+void ChatRoomClient::OnStdin() {
+    char buffer[4096];
+    ssize_t n = read(STDIN_FILENO, buffer, sizeof(buffer));
+    if (n <= 0) {
+        // 输入结束, 处理完剩下的行后退出
+        epoll_ctl(epollfd, EPOLL_CTL_DEL, STDIN_FILENO, nullptr);
+        input_eof = true;
     }
-    if (tcp_client.Write(data.c_str()) == false) {
-        perror("Write.");
-        return;
+    else {
+        inbuf.append(buffer, n);
     }
+    ProcessInput();
+    return;
+}
 
+void ChatRoomClient::ProcessInput() {
+    size_t pos;
+    while (running && state != WAITREPLY && (pos = inbuf.find('\n')) != std::string::npos) {
+        std::string line = inbuf.substr(0, pos);
+        inbuf.erase(0, pos + 1);
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        OnInput(line);
+    }
+    if (input_eof && state != WAITREPLY && inbuf.find('\n') == std::string::npos) {
+        running = false;
+    }
     return;
 }
 
 void ChatRoomClient::Run() {
+    epollfd = epoll_create(1);
+
+    // SIGINT/SIGTERM 在 main 中已经被屏蔽, 通过 signalfd 在事件循环中处理
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigfd = signalfd(-1, &mask, SFD_CLOEXEC);
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(struct epoll_event));
+    ev.data.fd = sigfd;
+    ev.events = EPOLLIN;
+    epoll_ctl(epollfd, EPOLL_CTL_ADD, sigfd, &ev);
+    ev.data.fd = STDIN_FILENO;
+    epoll_ctl(epollfd, EPOLL_CTL_ADD, STDIN_FILENO, &ev);
 
     system("clear");
     Menu(); // 展示菜单
+    Prompt();
+
+    running = true;
+    while (running) {
+        struct epoll_event events[8];
+        // 超时时间由重连定时器决定
+        int infds = epoll_wait(epollfd, events, 8, timer_wheel.NextTimeout());
+        if (infds < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait()");
+            break;
+        }
 
-    while (1) {
-        int choice = -1;
-        std::cout << "Your Choice: ";
-        std::cin >> choice;
-
-        switch (choice) {
-            case 0: {RegisterUser(); RecvMessage(); break;}
-            case 1: {Login(); RecvMessage(); break;}
-
-            case 2: {std::cout << "See you again." << std::endl; return;}
-            
-            default: {
-                    std::cout << "Input error! Input again." << std::endl;
-                    break;}
+        for (int i = 0; i < infds && running; ++i) {
+            const int fd = events[i].data.fd;
+            if (fd == sigfd) {
+                running = false;
+            }
+            else if (fd == STDIN_FILENO) {
+                OnStdin();
+            }
+            else if (fd == tcp_client.m_sockfd) {
+                if ((events[i].events & EPOLLOUT) && Flush() == false) {
+                    ConnectionLost();
+                    continue;
+                }
+                if ((events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) && OnReadable() == false) {
+                    ConnectionLost();
+                }
+                // 收到回应后处理等待中的输入
+                ProcessInput();
+            }
         }
+
+        // 执行到期的重连定时器
+        timer_wheel.Update();
     }
+
+    Close();
     return;
 }
 
@@ -288,31 +722,33 @@ void ChatRoomClient::EraseTextInTerminal(int cnt) {
     }
 }
 
-std::shared_ptr<ChatRoomClient> crc_ptr;
-
 int main(int argc, char const *argv[])
 {
-    if (argc != 3) {
-        printf("No ip and port\nUsing example: ./client 192.168.32.116 5000");
+    // 可选参数: tls 使用 TLS 但不校验服务端证书; tls=CA文件 使用 TLS 并校验服务端证书
+    const char* tls = nullptr;
+    if (argc == 4 && (strcmp(argv[3], "tls") == 0 || strncmp(argv[3], "tls=", 4) == 0)) {
+        tls = argv[3];
+    }
+    if (argc != 3 && tls == nullptr) {
+        printf("No ip and port\nUsing example: ./client 192.168.32.116 5000\nTLS: ./client 192.168.32.116 5000 tls[=ca.crt]\n");
+        return -1;
+    }
+    signal(SIGPIPE, SIG_IGN); // 对端关闭后写 socket 不退出
+
+    // 屏蔽 SIGINT/SIGTERM, 由事件循环中的 signalfd 处理
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigprocmask(SIG_BLOCK, &mask, nullptr);
+
+    std::shared_ptr<ChatRoomClient> crc_ptr = std::make_shared<ChatRoomClient>(argv[1], atoi(argv[2]));
+    if (tls != nullptr && crc_ptr->EnableTls(tls[3] == '=' ? tls + 4 : nullptr) == false) {
         return -1;
     }
-    signal(SIGINT, catch_ctrl_c);
-    signal(SIGTERM, catch_ctrl_c);
-    // ChatRoomClient crc(argv[1], atoi(argv[2]));
-    crc_ptr = std::make_shared<ChatRoomClient>(argv[1], atoi(argv[2]));
 
     crc_ptr->Run();
 
 
     return 0;
 }
-
-// 线程退出函数
-void catch_ctrl_c(int sig) {
-    crc_ptr->Close();
-    crc_ptr->exit_flag = true;
-    if (crc_ptr->thread_Input.joinable()) {
-        crc_ptr->thread_Input.detach();
-    }
-    exit(sig);
-}
\ No newline at end of file
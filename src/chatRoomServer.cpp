@@ -1,10 +1,34 @@
 #include "ThreadPool.hpp"
 #include "cppNetWork.h"
+#include "Metrics.h"
+#include "TimerWheel.h"
+#include "HashRing.h"
+#include "SessionToken.h"
+#include "RateLimiter.h"
+#include "Tls.h"
+#include "IoUring.h"
+#include "ZeroCopy.h"
+#include "SendQueue.h"
+#include "SpscRing.hpp"
+#include "PasswordHash.h"
+#include "BloomFilter.h"
+#include "NameTable.h"
+#include "Protocol.hpp"
 #include <iostream>
+#include <chrono>
 #include <sys/epoll.h>
 #include <set>
+#include <map>
 #include <sstream>
+#include <deque>
 #include <signal.h>
+#include <sys/signalfd.h>
+#include <sys/eventfd.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <atomic>
+#include <vector>
+#include <memory>
 #include <mysql/mysql.h>
 
 // ---------------------- 用户信息文件类 ---------------------------
@@ -16,6 +40,9 @@ private:
     MYSQL* mysql_h;    // 连接句柄
     MYSQL_RES* result; // 查询结果
     bool is_connect;   // 连接标记
+
+    // 把值转义后加上单引号追加到 sql 语句, 值中的引号和反斜杠不会结束字符串
+    void AppendValue(std::string& sql_sentence, const char* value);
 public:
     
     UserSQL();
@@ -41,6 +68,22 @@ public:
     /// @param password 待增加的密码
     /// @return true-成功, false-失败
     bool AddUser(const char* name, const char* password);
+
+    /// @brief 批量增加用户: 先用一条多行 insert 写入; 失败时(有用户名已存在)在一个事务中逐行写入, 得到每一行的结果
+    /// @param users 待增加的用户名和密码
+    /// @param results 存放每一行是否成功
+    void AddUsers(const std::vector<std::pair<const char*, const char*>>& users, std::vector<bool>& results);
+
+    /// @brief 修改用户的密码
+    /// @param name 用户名
+    /// @param password 新的密码
+    /// @return true-成功, false-失败
+    bool UpdatePassword(const char* name, const char* password);
+
+    /// @brief 逐行读取所有用户名, 不把整个结果集放在内存中
+    /// @param fn 每个用户名调用一次, 参数是用户名和长度
+    /// @return 是否读取完整
+    bool ForEachUser(const std::function<void(const char*, size_t)>& fn);
 };
 
 UserSQL::UserSQL() : is_connect(false){
@@ -71,6 +114,17 @@ bool UserSQL::Connect(const std::string& user, const std::string& password, cons
     return true;
 }
 
+void UserSQL::AppendValue(std::string& sql_sentence, const char* value) {
+    const size_t len = strlen(value);
+    const size_t pos = sql_sentence.size();
+    // 每个字符最多转义成两个, 加上结尾的 0
+    sql_sentence.resize(pos + 2 * len + 2);
+    sql_sentence[pos] = '\'';
+    const unsigned long n = mysql_real_escape_string(mysql_h, &sql_sentence[pos + 1], value, len);
+    sql_sentence.resize(pos + 1 + n);
+    sql_sentence.push_back('\'');
+}
+
 std::string UserSQL::SearchUser(const char* name) {
     std::string passwd;
     if (Connect() == false) {
@@ -79,9 +133,7 @@ std::string UserSQL::SearchUser(const char* name) {
     is_connect = true;
 
     std::string sql_sentence = "select password from infor where username = ";
-    sql_sentence += "'";
-    sql_sentence.append(name);
-    sql_sentence += "'";
+    AppendValue(sql_sentence, name);
 
     if (mysql_query(mysql_h, sql_sentence.c_str()) != 0) {
         return passwd;
@@ -92,7 +144,9 @@ std::string UserSQL::SearchUser(const char* name) {
     }
     
     MYSQL_ROW r = mysql_fetch_row(result); // 取出第一行记录
-    passwd.append(r[0]);
+    if (r != nullptr && r[0] != nullptr) { // 用户名不存在时没有记录
+        passwd.append(r[0]);
+    }
     mysql_free_result(result);
     Close();
     return passwd;
@@ -105,11 +159,95 @@ bool UserSQL::AddUser(const char* name, const char* password) {
     is_connect = true;
 
     std::string sql_sentence = "insert into infor(username, password) value";
-    sql_sentence.append("('");
-    sql_sentence.append(name);
-    sql_sentence.append("','");
-    sql_sentence.append(password);
-    sql_sentence.append("')");
+    sql_sentence.append("(");
+    AppendValue(sql_sentence, name);
+    sql_sentence.append(",");
+    AppendValue(sql_sentence, password);
+    sql_sentence.append(")");
+
+    if (mysql_query(mysql_h, sql_sentence.c_str()) != 0) {
+        return false;
+    }
+    Close();
+    return true;
+}
+
+void UserSQL::AddUsers(const std::vector<std::pair<const char*, const char*>>& users, std::vector<bool>& results) {
+    results.assign(users.size(), false);
+    if (users.empty() || Connect() == false) {
+        return;
+    }
+    is_connect = true;
+
+    std::string sql_sentence = "insert into infor(username, password) values";
+    for (size_t i = 0; i < users.size(); ++i) {
+        sql_sentence.append(i == 0 ? "(" : ",(");
+        AppendValue(sql_sentence, users[i].first);
+        sql_sentence.append(",");
+        AppendValue(sql_sentence, users[i].second);
+        sql_sentence.append(")");
+    }
+    if (mysql_query(mysql_h, sql_sentence.c_str()) == 0) {
+        results.assign(users.size(), true);
+        Close();
+        return;
+    }
+    if (users.size() == 1) {
+        Close();
+        return;
+    }
+
+    // 逐行写入, 重复的用户名只使这一行失败, 一次提交
+    mysql_autocommit(mysql_h, 0);
+    for (size_t i = 0; i < users.size(); ++i) {
+        sql_sentence = "insert into infor(username, password) value(";
+        AppendValue(sql_sentence, users[i].first);
+        sql_sentence.append(",");
+        AppendValue(sql_sentence, users[i].second);
+        sql_sentence.append(")");
+        results[i] = (mysql_query(mysql_h, sql_sentence.c_str()) == 0);
+    }
+    if (mysql_commit(mysql_h) != 0) {
+        results.assign(users.size(), false);
+    }
+    Close();
+    return;
+}
+
+bool UserSQL::ForEachUser(const std::function<void(const char*, size_t)>& fn) {
+    if (Connect() == false) {
+        return false;
+    }
+    is_connect = true;
+
+    if (mysql_query(mysql_h, "select username from infor") != 0) {
+        return false;
+    }
+    result = mysql_use_result(mysql_h); // 逐行从服务器取
+    if (result == nullptr) {
+        return false;
+    }
+    MYSQL_ROW r;
+    while ((r = mysql_fetch_row(result)) != nullptr) {
+        if (r[0] != nullptr) {
+            fn(r[0], strlen(r[0]));
+        }
+    }
+    mysql_free_result(result);
+    Close();
+    return true;
+}
+
+bool UserSQL::UpdatePassword(const char* name, const char* password) {
+    if (Connect() == false) {
+        return false;
+    }
+    is_connect = true;
+
+    std::string sql_sentence = "update infor set password = ";
+    AppendValue(sql_sentence, password);
+    sql_sentence.append(" where username = ");
+    AppendValue(sql_sentence, name);
 
     if (mysql_query(mysql_h, sql_sentence.c_str()) != 0) {
         return false;
@@ -121,47 +259,722 @@ bool UserSQL::AddUser(const char* name, const char* password) {
 
 // ---------------------- /用户信息文件类 ---------------------------
 
-void Catch_ctrl_c(int sig);
+// 命令的个数
+#define NCMD 12
+// 统计信息写入日志的间隔, 单位: s
+#define STATINTERVAL 60
+// 连接空闲多久后发送心跳探测, 单位: s
+#define HEARTBEAT 30
+// 发送心跳探测后等待回应的时间, 超时断开连接, 单位: s
+#define HEARTBEATTIMEOUT 10
+// 连接后必须在多长时间内登录成功, 否则断开连接, 单位: s
+#define LOGINTIMEOUT 60
+// 退出或交接前等待线程池任务完成的最长时间, 单位: s
+#define DRAINTIMEOUT 10
+// 热重启交接连接的 UNIX 域 socket 路径格式, %u 为服务端端口
+#define HANDOFFPATH "/tmp/chatRoomServer.%u.sock"
+// 集群节点断线后重连的间隔, 单位: s
+#define PEERRETRY 3
+// 发给集群节点的报文先攒在缓冲区中, 每轮事件循环结束时一起发送; 超过这个大小立即发送, 单位: bytes
+#define PEERBATCH (64 * 1024)
+// 到集群节点的出站连接(包括 TLS 握手)的超时时间, 超时后关闭, 由 ConnectPeers 重连, 单位: s
+#define PEERCONNECTTIMEOUT 5
+// 发给集群节点的报文积压的上限, 超过时(对方不读取)关闭出站连接, 单位: bytes
+#define PEEROUTMAX (16 * 1024 * 1024)
+// 每个连接的发送队列积压的上限, 超过时(客户端不读取)断开连接, 单位: bytes
+#define SENDQUEUEMAX (4 * 1024 * 1024)
+// 会话令牌的有效期, 客户端在这段时间内断线可以凭令牌恢复登录, 单位: s
+#define TOKENTTL (24 * 3600)
+// 线程池任务队列的缺省容量
+#define QUEUECAPACITY 1024
+// 暂停读取的连接每隔多久检查一次能否恢复, 单位: ms
+#define RESUMEINTERVAL 100
+// 每个房间(包括大厅)保留的最近广播条数, 客户端用 cmd 11 取缓存之后的部分
+#define HISTORYSIZE 100
+// TLS 记录的第一个字节(握手记录的类型), 明文报文的第一个字节是长度头的最高字节, 不超过报文长度上限时不会是这个值
+#define TLSRECORD 0x16
+// io_uring 后端: 提交队列的大小
+#define URINGENTRIES 256
+// io_uring 后端: 接收用的缓冲区个数和每个的大小, 单位: bytes. 数据到达时才占用, 复制到接收缓冲区后立即归还
+#define URINGBUFCOUNT 1024
+#define URINGBUFSIZE 4096
+// io_uring 后端: 一次取出的完成事件数
+#define URINGBATCH 128
+// io_uring 后端: 一批广播发送的超时时间, 超时后取消还没有完成的发送, 剩下的部分放入发送队列, 单位: ms
+#define URINGSENDTIMEOUT (5 * 1000)
+// io_uring 后端: 请求的类型, 放在 user_data 的低 4 位
+#define URINGLISTEN 1   // 监听 socket 的多次触发 accept
+#define URINGCLIENT 2   // 客户端连接的多次触发 recv
+#define URINGPOLL 3     // 其他 fd 的一次性 poll
+#define URINGCANCEL 4   // 取消请求, 完成事件忽略
+#define URINGWRITE 5    // 客户端连接发送队列不为空时的一次性 poll(POLLOUT)
+// io_uring 后端: 请求的 user_data, 高 32 位是 fd 的代数, 低 32 位是 fd 和请求类型
+#define URINGDATA(gen, fd, kind) (((uint64_t)(gen) << 32) | ((uint64_t)(fd) << 4) | (kind))
+// 分片模式: 每对分片之间转发广播的环的容量
+#define SHARDRING 1024
+// 分片模式: 最多的分片个数
+#define MAXSHARDS 64
+// 分片模式: 环满时暂存的广播每隔多久重试, 单位: ms
+#define SHARDRETRY 1
+// 口令哈希: scrypt 的参数 N = 2^14, r = 8, p = 1, 每次约 16MB 内存
+#define SCRYPTLOGN 14
+#define SCRYPTR 8
+#define SCRYPTP 1
+// 口令哈希线程池的队列容量, 满时 Register/LogIN 回应 code 10
+#define HASHQUEUE 16
+// 注册的批量写入: 一批最多的行数和第一行到达后最多等待多久, 单位: ms. 0 表示不等待, 写入期间到达的注册合并到下一批
+#define BATCHROWS 100
+#define BATCHWINDOW 0
+// 已有用户名的布隆过滤器: 缺省预计的用户数和目标误判率
+#define BLOOMCAPACITY (1 << 20)
+#define BLOOMFPRATE 0.01
+// 校验过的口令的缓存: 最多的用户数和有效期, 单位: s
+#define CREDCACHESIZE 10000
+#define CREDCACHETTL 600
+
+// 命令的分类
+// 阻塞命令(需要访问数据库)交给线程池执行; 非阻塞命令在 epoll 线程中直接执行, 省去入队、唤醒线程和分配任务的开销
+// 分类依据是日志中各命令的延迟统计
+// 限速: 每个连接和每个用户(同一用户的所有连接合计)各有一个令牌桶, 在 epoll 线程中入队之前检查, 集群节点的连接不限速.
+// 超限的命令被丢弃并回应 code 9; 不需要回应的命令只在连续超限的第一次回应, 避免回应本身成为洪水
+struct CmdEntry {
+    const char* name;  // 命令名, 用于统计信息
+    bool blocking;     // true-阻塞命令, false-非阻塞命令
+    LI::RateSpec conn; // 每个连接的缺省限速, 每秒个数和突发个数
+    LI::RateSpec user; // 每个用户的缺省限速
+    bool reply;        // 命令是否等待回应, 是则每次超限都回应 code 9
+};
+
+static const CmdEntry cmd_table[NCMD] = {
+    {"Register", true,  {0.2, 3},  {0, 0},   true},   // 0 注册账号: UserSQL::AddUser
+    {"LogIN",    true,  {0.5, 5},  {0, 0},   true},   // 1 登陆: UserSQL::SearchUser
+    {"Message",  false, {10, 20},  {20, 40}, false},  // 2 发信息: 遍历 set_connfd 广播
+    {"LogOUT",   false, {0, 0},    {0, 0},   false},  // 3 退出登陆: 从 set_connfd 删除
+    {"Ping",     false, {1, 5},    {0, 0},   false},  // 4 客户端心跳探测: 回应 pong
+    {"Pong",     false, {0, 0},    {0, 0},   false},  // 5 客户端回应服务端的心跳探测: 只刷新活跃时间
+    {"NodeHello",   false, {0, 0}, {0, 0},   false},  // 6 集群节点握手: 标记为节点连接
+    {"NodeRelay",   false, {0, 0}, {0, 0},   false},  // 7 其他节点转发的广播: 只广播给本节点的用户
+    {"NodeMembers", false, {0, 0}, {0, 0},   false},  // 8 其他节点的在线人数: 更新 peers
+    {"JoinRoom",    false, {2, 10}, {5, 20}, true},   // 9 加入房间: 由一致性哈希决定房间的归属节点, 不在本节点的重定向
+    {"Resume",      false, {0.5, 5}, {0, 0}, true},   // 10 凭令牌恢复登录: 只在内存中校验签名, 不访问数据库
+    {"History",     false, {1, 5},   {0, 0}, true},   // 11 取最近的广播: 从内存中的 history 取, 一个报文批量回应
+};
+
+// 一个用户的令牌桶, 同一用户的所有连接共用, 只在 epoll 线程中访问
+struct UserLimit {
+    LI::TokenBucket buckets[NCMD];
+    int conns = 0;                // 引用它的连接数, 为 0 的在写统计信息时删除
+};
+
+// 连接的状态, 只在 epoll 线程中访问
+struct Connection {
+    uint64_t id = 0;              // 连接的编号, 每个新连接不同. fd 关闭后会被新连接复用, 线程池的任务凭编号确认连接还是原来的
+    LI::RecvBuffer recvbuf;       // 接收缓冲区
+    int64_t last_active = 0;      // 最后一次收到数据的时间, 单位: ms
+    bool pinged = false;          // 是否已经发送心跳探测, 正在等待回应
+    LI::TimerId idle_timer = 0;   // 空闲检测定时器
+    LI::TimerId login_timer = 0;  // 登录期限定时器
+    int peer = -1;                // 对端是集群节点时, 是它在 peers 中的下标
+    LI::PoolString room;          // 所在的房间, 空表示大厅
+    LI::TokenBucket buckets[NCMD]; // 每个命令的限速
+    UserLimit* user = nullptr;    // 登录用户的令牌桶, 第一次需要时查找
+    uint32_t uid = 0;             // 登录用户的编号, 第一次需要时查找, 0 表示还没有查找或没有登录
+    bool throttled = false;       // 上一个命令是否因为限速被丢弃
+    bool paused = false;          // 线程池的队列满, 暂停读取
+    bool compress = false;        // 客户端在登录时声明能解压压缩报文
+    bool tls_checked = true;      // 是否已经识别出明文还是 TLS, 同时接受两种连接时在第一次可读时识别
+    bool armed = false;           // io_uring 后端: 多次触发的 recv 是否还在进行
+    // 发送队列不为空, 在等可写: epoll 后端是否关注了 EPOLLOUT; io_uring 后端是否有还没有完成的 poll(POLLOUT)
+    bool want_write = false;
+    LI::ZeroCopyQueue zerocopy;   // 大报文的零拷贝发送, 启用零拷贝时打开
+    // 发送队列, socket 是非阻塞的. 分发线程也持有它, 可以在任何线程中放入
+    std::shared_ptr<LI::SendQueue> out;
+};
+
+// 热重启时从旧进程接收到的连接
+struct HandoffConn {
+    int fd;               // 客户端 socket
+    bool login;           // 是否已经登录
+    std::string pending;  // 旧进程接收缓冲区中还没有处理的数据
+    std::string unsent;   // 旧进程发送队列中还没有发送的数据, 接着发送
+    std::string node;     // 对端是集群节点时, 是节点的地址
+    std::string room;     // 所在的房间
+    std::string user;     // 登录的用户名
+    bool compress;        // 客户端能解压压缩报文
+    bool checked;         // 旧进程已经识别为明文连接, TLS 连接不交接
+    uint32_t zcseq;       // 零拷贝发送的下一个通知序号
+};
+
+// 集群中的其他节点
+// 每个节点主动连接所有其他节点(全连接), 出站连接只用于发送, 入站连接只用于接收, 两个方向互不影响
+struct PeerNode {
+    // 出站连接的状态, 连接和握手都不阻塞事件循环
+    enum State {
+        DISCONNECTED,  // 没有连接, 由 ConnectPeers 重连
+        CONNECTING,    // 非阻塞 connect 还没有完成
+        HANDSHAKING,   // TLS 握手还没有完成
+        CONNECTED      // 可以发送
+    };
+    std::string addr;       // 节点地址 ip:port, 也是节点的标识
+    std::string ip;         // 节点的 ip 地址
+    int port = 0;           // 节点的端口
+    int sockfd = -1;        // 到该节点的出站连接, 非阻塞
+    State state = DISCONNECTED;
+    int64_t deadline = 0;   // 连接和握手的期限, 单位: ms
+    bool want_write = false; // 在等可写: epoll 后端是否关注了 EPOLLOUT; io_uring 后端是否有还没有完成的 poll(POLLOUT)
+    std::string outbuf;     // 等待发送的报文, 每个报文已经带长度头. 连接建立之前放入的握手报文在连接后发送
+    int members = 0;        // 该节点已经登录的用户数, 为 0 时不向它转发广播
+    int inbound = -1;       // 该节点连过来的入站连接, 在线人数通过它通告
+};
+
+// connfd 的集合
+using FdSet = std::set<int, std::less<int>, LI::PoolAllocator<int>>;
+
+// 一条广播, 保存在房间的最近广播中
+struct HistoryEntry {
+    int64_t time;         // 广播的时间, unix 时间戳, 单位: ms, 同一个房间中严格递增
+    LI::PoolString data;  // code 4 报文
+};
+using History = std::deque<HistoryEntry, LI::PoolAllocator<HistoryEntry>>;
+
+// io_uring 后端中还没有完成的广播发送, 发送不完整时剩下的部分放入连接的发送队列
+struct PendingSend {
+    int fd;
+    const char* data;   // 报文(带长度头)中还没有发送的部分, 在 FlushSends 返回之前有效
+    size_t len;
+};
+
+// 等待批量写入数据库的注册
+struct PendingUser {
+    std::string name;
+    std::string password;  // 口令哈希
+    int sockfd;            // 写入后回应的连接
+    uint64_t conn_id;      // 连接的编号
+};
+
+// 线程池的任务交给事件循环执行的操作, 连接的编号不同(已经关闭, fd 可能被新连接复用)时不执行
+struct LoopTask {
+    int sockfd;
+    uint64_t conn_id;
+    std::function<void()> fn;
+};
+
+// 交给分发线程的广播, 一次广播的所有分块共用一份
+struct FanoutMsg {
+    std::string data;     // code 4 报文, 带长度头
+    std::string packed;   // 压缩报文, 带长度头, 没有能解压的接收者或不值得压缩时为空
+    std::chrono::steady_clock::time_point start; // 形成广播的时间
+};
+
+// 分发线程发送的一个接收者. 连接关闭时发送队列也关闭, 之后排队的报文不再发送
+struct FanoutTarget {
+    int fd;
+    uint64_t conn_id;                     // 连接的编号, 交给事件循环的操作凭它确认连接
+    std::shared_ptr<LI::SendQueue> out;
+    bool compress;                        // 能否解压
+};
+
+// 分片模式中转发给其他分片的广播, 所有目标分片共用一份, 最后一个取出的分片释放
+struct ShardMsg {
+    LI::PoolString room;  // 房间名, 空表示大厅
+    int64_t time;         // 广播的时间
+    LI::PoolString data;  // code 4 报文
+};
+using ShardMsgPtr = std::shared_ptr<const ShardMsg>;
+
+// 一个分片到另一个分片的单向通道
+struct ShardLink {
+    LI::SpscRing<ShardMsgPtr> ring;   // 源分片放入, 目标分片取出
+    std::deque<ShardMsgPtr> backlog;  // 环满时暂存, 每轮事件循环结束时重试, 只在源分片中访问
+    bool wake = false;                // 本轮有新的广播, 事件循环结束时唤醒目标分片, 只在源分片中访问
+    ShardLink(): ring(SHARDRING) { }
+};
+
+// 分片模式: 一个进程中有多个分片, 每个分片有自己的事件循环、线程池、连接、房间和定时器, 绑定在一个 CPU 上.
+// 分片的监听 socket 监听同一个端口(SO_REUSEPORT), 由内核分配新连接. 分片之间不共享锁,
+// 广播通过每对分片之间的单生产者单消费者环转发, 用 eventfd 唤醒目标分片. 启动后只读
+struct ShardGroup {
+    size_t count;                 // 分片个数
+    std::vector<int> wakefd;      // 每个分片的 eventfd
+    std::vector<std::unique_ptr<ShardLink>> links; // from * count + to, from == to 的为空
+    std::string token_key;        // 第一个分片的令牌密钥, 其他分片导入, 令牌在所有分片上有效
+
+    explicit ShardGroup(const size_t n);
+    ~ShardGroup();
+    ShardLink& Link(const size_t from, const size_t to) { return *links[from * count + to]; }
+};
+
+ShardGroup::ShardGroup(const size_t n): count(n), wakefd(n, -1), links(n * n) {
+    for (size_t i = 0; i < n; ++i) {
+        wakefd[i] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        for (size_t j = 0; j < n; ++j) {
+            if (i != j) links[i * n + j].reset(new ShardLink);
+        }
+    }
+}
+
+ShardGroup::~ShardGroup() {
+    for (const int fd : wakefd) {
+        if (fd != -1) close(fd);
+    }
+}
 
 class ChatRoomServer {
 private:
     LI::LogFile logfile;         // 日志文件
     LI::TcpServer tcp_server;    // 服务端对象
-    LI::ThreadPool thread_pool;  // 线程池对象
+    // 口令哈希线程池, 只计算 scrypt, 线程数限制了占用的 CPU 和内存. 线程池的任务提交后等待结果, 所以先于 thread_pool 声明, 后析构
+    std::unique_ptr<LI::ThreadPool> hash_pool;
+    LI::ThreadPool thread_pool;  // 线程池对象, 只执行阻塞命令
     const size_t MAXENENTS;      // epoll一次能返回的最大的事件数
-    std::set<int> set_connfd;    // 已连接的 connfd 容器
+    FdSet set_connfd;            // 已连接的 connfd 容器
+    // 每个连接的状态, 只在 epoll 线程中访问
+    std::map<int, Connection, std::less<int>, LI::PoolAllocator<std::pair<const int, Connection>>> map_conn;
+    uint64_t next_conn_id;       // 下一个连接的编号, 只在 epoll 线程中访问
+    // 线程池的任务不直接回应和修改登录状态, 放入 loop_tasks 后写 taskfd 唤醒事件循环, 由事件循环确认连接的编号后执行
+    int taskfd;                  // eventfd
+    std::mutex loop_lock;        // 保护 loop_tasks 和 taskfd
+    std::vector<LoopTask> loop_tasks;
+    std::thread::id loop_thread; // 事件循环所在的线程
+    LI::TimerWheel timer_wheel;  // 定时器, 只在 epoll 线程中访问
     int epollfd;                 // epollfd
     // 锁
     std::mutex set_lock;
+    LI::LatencyHistogram cmd_latency[NCMD]; // 每个命令从收到报文到处理完成的延迟
+    LI::LatencyHistogram compress_latency;  // 每次压缩广播报文的耗时
+    int64_t compress_raw;        // 以压缩报文发送的广播, 压缩前的字节数, 只在 epoll 线程中访问
+    int64_t compress_wire;       // 以上广播实际发送的字节数
+    int sigfd;                   // 接收 SIGINT/SIGTERM 的 signalfd
+    int ctlfd;                   // 热重启时新进程连接的 UNIX 域 socket
+    std::string ctl_path;        // ctlfd 的文件路径
+    bool running;                // 事件循环是否继续
+    bool draining;               // 是否处于退出前的排空状态
+    bool handed_off;             // 连接是否已经交给新进程
+    int64_t drain_deadline;      // 排空的最后期限, 单位: ms
+    std::vector<HandoffConn> handoff_conns; // 从旧进程接收到的连接, 在 runServer 中加入 epoll
+    std::string node_addr;       // 本节点的地址 ip:port, 握手时告诉其他节点
+    std::vector<std::unique_ptr<PeerNode>> peers; // 集群中的其他节点, 只在 epoll 线程中访问
+    std::map<int, size_t> map_peerfd; // 出站连接的 fd 到 peers 下标的映射
+    long announced;              // 上一次通告给其他节点的在线人数, -1 表示还没有通告
+    // 本节点负责的房间和房间中的连接, 只在 epoll 线程中访问
+    std::map<LI::PoolString, FdSet, std::less<LI::PoolString>, LI::PoolAllocator<std::pair<const LI::PoolString, FdSet>>> rooms;
+    // 每个房间最近的广播, 空房间名是大厅; 房间没有人时删除, 只在 epoll 线程中访问
+    std::map<LI::PoolString, History, std::less<LI::PoolString>, LI::PoolAllocator<std::pair<const LI::PoolString, History>>> history;
+    LI::HashRing ring;           // 房间的归属, 由本节点和出站连接正常的节点组成
+    LI::SessionToken session_token; // 签发和校验会话令牌, 启动后只读
+    LI::ScryptParams scrypt;     // 新保存的口令哈希使用的参数, 较弱的在登录成功后重新哈希
+    LI::CredentialCache cred_cache; // 校验过的口令, 重复登录时不再计算 scrypt
+    std::atomic<long> cred_hits; // 命中 cred_cache 的登录数, 写统计信息后清零
+    LI::LatencyHistogram hash_latency; // 口令哈希从提交到得到结果的时间, 包括排队
+    // 注册的批量写入(group commit): 线程池的任务把注册放入 reg_pending 后返回, 由其中一个任务写入一批并回应
+    std::mutex reg_lock;         // 保护 reg_pending 和 reg_leader
+    std::condition_variable reg_cond; // 等待窗口内凑满一批时唤醒负责写入的任务
+    std::vector<PendingUser> reg_pending; // 等待写入的注册
+    bool reg_leader;             // 是否有任务正在负责写入
+    size_t batch_rows;           // 一批最多的行数, 1 表示逐个写入
+    int batch_window;            // 第一行到达后最多等待多久再写入, 单位: ms
+    std::atomic<long> reg_batches; // 写入的批数, 写统计信息后清零
+    std::atomic<long> reg_rows;  // 写入的行数
+    // 已有用户名的布隆过滤器, 所有分片共用, nullptr 表示不使用. 一定不存在的用户名登录时不查询数据库, 注册时不必先查询
+    std::shared_ptr<LI::BloomFilter> user_filter;
+    std::atomic<long> bloom_negative; // 过滤器判断一定不存在的次数, 写统计信息后清零
+    std::atomic<long> bloom_false; // 过滤器判断可能存在而数据库中不存在的次数(误判)
+    LI::RateSpec conn_limits[NCMD]; // 每个连接的限速, 缺省值来自 cmd_table
+    LI::RateSpec user_limits[NCMD]; // 每个用户的限速
+    long limited[NCMD];          // 各命令因为限速被丢弃的次数, 写统计信息后清零
+    // 用户名表, 登录时给用户名分配编号, 连接和令牌桶只保存编号, 广播时按编号取用户名. 编号不发给客户端; 用户名不删除
+    LI::NameTable names;
+    // 已登录连接的用户编号, 键是连接的编号(fd 会被新连接复用), 和 set_connfd 一起由 set_lock 保护
+    std::map<uint64_t, uint32_t, std::less<uint64_t>, LI::PoolAllocator<std::pair<const uint64_t, uint32_t>>> conn_user;
+    // 每个用户的令牌桶, 键是用户编号, 只在 epoll 线程中访问
+    std::map<uint32_t, UserLimit, std::less<uint32_t>, LI::PoolAllocator<std::pair<const uint32_t, UserLimit>>> user_limit;
+    bool pause_when_full;        // 队列满时暂停读取(BLOCK 策略), 不阻塞 epoll 线程
+    FdSet paused_conns;          // 暂停读取的连接, 只在 epoll 线程中访问
+    LI::TlsContext tls_ctx;      // 客户端连接的 TLS 上下文, 没有初始化时只接受明文连接
+    LI::TlsContext peer_tls;     // 到集群节点的出站连接的 TLS 上下文, 保存会话, 重连时恢复
+    bool tls_optional;           // 同时接受明文连接, 按第一个字节识别
+    bool use_uring;              // 使用 io_uring 后端, 初始化失败时退回 epoll
+    LI::IoUring uring;           // io_uring 后端: 接收, 监听 socket 和客户端连接用多次触发的请求, 其他 fd 用一次性 poll
+    LI::IoUring send_ring;       // io_uring 后端: 广播的批量发送, 和接收分开, 等待发送完成时不会取到接收事件
+    std::vector<uint32_t> fd_gen; // io_uring 后端: 每个 fd 的代数, 停止监视时加一, 代数不同的完成事件属于已经关闭的 fd
+    bool receiving;              // io_uring 后端: 是否在接收, 交接期间停止, 收到的数据只放入接收缓冲区
+    bool handoff_requested;      // io_uring 后端: ctlfd 可读, 处理完这一批事件后交接
+    long uring_sends;            // io_uring 后端: 广播发送的次数, 写统计信息后清零
+    long uring_batches;          // io_uring 后端: 广播提交的批数
+    std::vector<PendingSend> pending_sends; // io_uring 后端: 已经准备还没有完成的广播发送, 下标加一是 user_data
+    size_t zerocopy_min;         // 不小于这个长度(带长度头)的广播和历史回应用零拷贝发送, 0 表示不使用, 单位: bytes
+    long zc_sends;               // 零拷贝发送的次数, 写统计信息后清零
+    int64_t zc_bytes;            // 零拷贝发送的字节数
+    long zc_copied;              // 内核没有零拷贝而是复制了数据的通知数(本机回环总是复制)
+    // 关闭的连接上还没有完成通知的报文, 内核可能还在发送, 保留一到两个统计周期后释放
+    std::vector<std::shared_ptr<const std::string>> zc_retired, zc_retired_old;
+    ShardGroup* shards;          // 分片模式的分片组, nullptr 表示只有一个事件循环
+    size_t shard_id;             // 分片模式: 本分片的编号
+    int shard_cpu;               // 分片模式: 事件循环和线程池绑定的 CPU, -1 表示不绑定
+    int wakefd;                  // 分片模式: 本分片的 eventfd, 其他分片转发广播或 main 线程转来信号时可读
+    std::atomic<int> shard_signal; // 分片模式: main 线程转来的信号, 在事件循环中处理
+    bool shard_retry;            // 分片模式: 已经设置了重试暂存广播的定时器
+    long shard_out;              // 分片模式: 转发给其他分片的广播数(每个目标分片算一次), 写统计信息后清零
+    long shard_in;               // 分片模式: 其他分片转发来的广播数
+    size_t fanout_min;           // 不少于这个人数的房间(或大厅)的广播分块交给分发线程, 0 表示不使用
+    // 还没有发送完的分块和回应数, 不为 0 时所有广播和回应都交给分发线程, 保持每个连接收到的顺序.
+    // 只有 epoll 线程增加, 它看到 0 时分发线程已经放入了之前的所有报文
+    std::atomic<long> fanout_pending;
+    long fanout_broadcasts;      // 交给分发线程的广播数, 写统计信息后清零, 只在 epoll 线程中访问
+    long fanout_chunks;          // 交给分发线程的分块数
+    LI::LatencyHistogram fanout_latency; // 从形成广播到一个分块发送完的时间
+    // 分发线程, 每个一个线程, 连接按 fd 取模归属其中一个, 同一个连接的报文按顺序发送. 最先析构, 析构时发送完剩下的分块
+    std::vector<std::unique_ptr<LI::ThreadPool>> fanout;
     
 public:
-    friend void Catch_ctrl_c(int sig);
-
-    ChatRoomServer(const size_t threads = 5 ,const size_t maxenents = 10);
+    /// @brief 构造函数
+    /// @param threads 线程池的线程个数
+    /// @param maxenents epoll一次能返回的最大的事件数
+    /// @param maxmsglen 报文体的最大长度, 单位: bytes, 超过的报文视为非法报文并断开连接
+    ChatRoomServer(const size_t threads = 5 ,const size_t maxenents = 10, const int maxmsglen = 64 * 1024);
     // 初始化服务端
     bool InitServer(const char* ip, const unsigned int port);
+    /// @brief 热重启: 从正在运行的旧进程接管监听 socket 和所有客户端连接, 代替 InitServer
+    /// @param ip 旧进程的监听地址, 作为本节点在集群中的地址
+    /// @param port 旧进程的监听端口
+    /// @return true-接管成功, 旧进程已经退出; false-失败, 旧进程继续运行
+    bool TakeOver(const char* ip, const unsigned int port);
     // 初始化日志文件
     bool InitLogFile(const char* filename, std::ios::openmode openmode = std::ios::app, bool bBackup = true, bool bEnbuffer = false, const size_t MaxLogSize = 100);
+    /// @brief 添加集群中的其他节点, 在 runServer 之前调用. 所有节点的配置应当对称
+    /// @param addr 节点地址, 格式 ip:port, 也就是该节点服务端的监听地址
+    /// @return 地址格式是否正确
+    bool AddPeer(const char* addr);
+    /// @brief 设置签发会话令牌的口令, 集群中的节点使用相同的口令时令牌在所有节点上有效.
+    /// 不设置时使用随机密钥(热重启时继承旧进程的密钥), 令牌只在本节点有效
+    void SetSecret(const std::string& secret);
+    /// @brief 修改命令的限速, 在 runServer 之前调用
+    /// @param spec 格式 命令名:每秒个数:突发个数, 如 Message:10:20, 每秒个数为 0 表示不限速
+    /// @param user true-每个用户的限速; false-每个连接的限速
+    /// @return 格式是否正确
+    bool SetLimit(const char* spec, const bool user);
+    /// @brief 设置线程池任务队列的容量和队列满时的策略, 在 runServer 之前调用. 缺省容量 QUEUECAPACITY, 策略 BLOCK
+    /// @param capacity 容量, 0 表示不限制
+    /// @param policy REJECT-立即回应 code 10; BLOCK-暂停读取客户端连接, 队列降到一半以下后恢复;
+    ///               DROPOLDEST-丢弃最早的任务, 给它的客户端回应 code 10
+    void SetQueue(const size_t capacity, const LI::ThreadPool::Overflow policy);
+    /// @brief 启用 TLS, 在 runServer 之前调用. 到集群节点的出站连接也使用 TLS, 但不校验节点的证书
+    /// @param spec 格式 证书文件:私钥文件[:optional], optional 表示同时接受明文连接, 按第一个字节自动识别
+    /// @return 格式是否正确, 证书和私钥是否加载成功
+    bool SetTls(const char* spec);
+    /// @brief 选择事件循环的后端, 在 runServer 之前调用. 缺省 epoll
+    /// @param name epoll 或 uring; uring 不支持 TLS, 内核不支持时退回 epoll
+    /// @return 名字是否正确
+    bool SetBackend(const char* name);
+    /// @brief 启用零拷贝发送(MSG_ZEROCOPY), 在 runServer 之前调用. 只用于 epoll 后端的明文连接.
+    /// 小报文的零拷贝比复制更慢(要锁定页面并处理完成通知), 本机回环上内核总是复制
+    /// @param minbytes 使用零拷贝的最小报文长度, 0 表示不使用, 单位: bytes
+    void SetZeroCopy(const size_t minbytes);
+    /// @brief 大房间的广播并行发送, 在 runServer 之前调用. 只用于 epoll 后端.
+    /// 接收者按归属的分发线程分块, 每个分发线程发送自己的一块, 不使用零拷贝
+    /// @param members 房间(或大厅)的人数不少于这个值时并行发送, 0 表示不使用
+    /// @param threads 分发线程的个数
+    void SetFanout(const size_t members, const size_t threads);
+    /// @brief 设置口令哈希线程池, 在 runServer 之前调用. Register/LogIN 在线程池中执行, 把 scrypt 交给口令哈希线程池计算并等待结果,
+    /// 同时计算的个数不超过 threads, 不会占满 CPU 而拖慢 epoll 线程中的广播
+    /// @param threads 口令哈希线程的个数, 每个同时计算时约占用 16MB 内存
+    /// @param queue 排队的个数超过这个值时拒绝, Register/LogIN 回应 code 10
+    void SetHashPool(const size_t threads, const size_t queue);
+    /// @brief 设置注册的批量写入, 在 runServer 之前调用. 同时到达的注册合并成一条多行 insert 写入数据库
+    /// @param rows 一批最多的行数, 1 表示逐个写入
+    /// @param window 第一行到达后最多等待多久再写入, 0 表示不等待, 单位: ms
+    void SetBatch(const size_t rows, const int window);
+    /// @brief 设置已有用户名的布隆过滤器, 在 InitLogFile 之后、runServer 之前调用. 分片模式中所有分片设置同一个.
+    /// 过滤器只知道本进程注册的和启动时读取的用户名, 集群的其他节点或其他程序写入数据库的用户在重启之前无法登录
+    void SetUserFilter(const std::shared_ptr<LI::BloomFilter>& filter);
+    /// @brief 加入分片组, 在 InitServer 之前按编号依次调用. 监听 socket 设置 SO_REUSEPORT, 不接受热重启的交接请求;
+    /// 信号由 main 线程用 PostSignal 转来
+    /// @param group 分片组, 生命周期长于本对象
+    /// @param id 本分片的编号, 0 ~ group->count - 1
+    /// @param cpu 事件循环和线程池绑定的 CPU, -1 表示不绑定
+    void JoinShards(ShardGroup* group, const size_t id, const int cpu);
+    /// @brief 分片模式: 把 main 线程收到的信号转给本分片的事件循环, 可以在任何线程中调用
+    void PostSignal(const int signo);
 
     void runServer();
 
     ~ChatRoomServer();
 
 private:
-    // 接收并广播信息
-    void broadcastMessage(const std::string& name, const std::string& str, int colorIndex, int sockfd);
-    // 注册操作
-    void Register(const std::string& str, int sockfd);
-    // 登陆操作
-    void LogIN(const std::string& str, int sockfd);
+    // 接收并广播信息: 发送者在房间中时只广播给房间中的连接, 否则广播给大厅中的连接.
+    // uid 不为 0 时用户名取自用户名表, 否则用 name(集群节点转发的广播)
+    void broadcastMessage(const uint32_t uid, const LI::PoolString& name, const LI::PoolString& str, int colorIndex, int sockfd);
+    // 注册操作, 在线程池中执行, conn_id 是发出命令的连接的编号
+    void Register(const LI::PoolString& str, int sockfd, uint64_t conn_id);
+    // 登陆操作, 在线程池中执行
+    void LogIN(const LI::PoolString& str, int sockfd, uint64_t conn_id);
+    // 把注册放入等待写入的一批, 没有任务负责写入时由当前任务写入, 直到没有等待的注册
+    void CommitUser(PendingUser&& user);
+    // 在口令哈希线程池中执行 fn 并等待结果, 返回 1-true, 0-false, -1-队列满被拒绝
+    int RunHash(const std::function<bool()>& fn);
+    // 凭令牌恢复登录
+    void Resume(const LI::PoolString& token, int sockfd);
+    // 登录成功: 加入已登录的集合, 回应登录成功和新的令牌. 在事件循环中执行
+    void LoginSuccess(const char* name, size_t len, int sockfd);
+    // 在事件循环中执行 fn, 可以在任何线程中调用. 连接 sockfd 的编号不是 conn_id 时(已经关闭, fd 可能被新连接复用)不执行
+    void RunInLoop(int sockfd, uint64_t conn_id, std::function<void()> fn);
+    // 同 RunInLoop, 但总是放入 loop_tasks, 在事件循环中调用时也推迟到本轮事件处理完. 用于关闭连接等不能在遍历连接时执行的操作
+    void PostToLoop(int sockfd, uint64_t conn_id, std::function<void()> fn);
+    // 执行其他线程交给事件循环的操作, taskfd 可读时调用
+    void RunLoopTasks();
+    // 线程池的任务回应连接: 交给事件循环发送, 连接已经不是原来的时丢弃
+    void ReplyTo(int sockfd, uint64_t conn_id, const char* data);
     // 退出登陆操作
     void LogOUT(int sockfd);
+    // 回应客户端的心跳探测
+    void Ping(int sockfd);
+    // 解析并分发一个完整的报文, 返回 false 表示报文非法, 连接应当关闭
+    bool HandleFrame(const LI::Frame& frame, int sockfd);
+    // 关闭客户端连接
+    void CloseClient(int sockfd);
+    // 把客户端连接加入 epoll, 并设置定时器
+    void AddClient(int connfd);
+    // 处理接收缓冲区中所有完整的报文
+    void ProcessFrames(int sockfd);
+    // 处理 signalfd 收到的信号
+    void HandleSignal();
+    // 处理信号: 第一次开始排空, 排空时再次收到立即退出
+    void OnSignal(int signo);
+    // 进入排空状态: 不再接受新连接, 等线程池的任务完成后退出
+    void StartDrain();
+    // 排空检查定时器: 任务完成或超时后结束事件循环
+    void CheckDrain();
+    // 等待线程池的任务完成, 最多等待 DRAINTIMEOUT
+    bool WaitTasks();
+    // 热重启: 把监听 socket 和客户端连接交给新进程
+    void HandOff();
+    // 按命令的分类直接执行或交给线程池执行, 并记录延迟. 任务被拒绝或丢弃时给 sockfd 回应 code 10
+    template<class _Callable, class... Args>
+    void Dispatch(const int cmd, int sockfd, _Callable&& _f, Args&&... args);
+    // 把各命令的延迟统计写入日志, 然后重新设置定时器
+    void WriteStats();
+    // 空闲检测定时器到期: 发送心跳探测或断开没有回应的连接
+    void CheckIdle(int sockfd);
+    // 登录期限定时器到期: 断开没有登录的连接
+    void CheckLogin(int sockfd);
+    // 按地址查找集群节点, 返回 peers 中的下标, 没有找到返回 -1
+    int FindPeer(const LI::PoolString& addr) const;
+    // 入站连接是集群节点: 取消登录期限和空闲检测
+    void NodeHello(int peer, int sockfd);
+    // 更新集群节点的在线人数
+    void NodeMembers(int members, int sockfd);
+    // 非阻塞地连接所有断开的集群节点, 关闭连接或握手超时的, 然后重新设置定时器
+    void ConnectPeers();
+    // 到集群节点的 TCP 连接完成: 需要时开始 TLS 握手
+    void PeerConnected(size_t idx);
+    // 推进到集群节点的 TLS 握手
+    void PeerHandshake(size_t idx);
+    // 到集群节点的出站连接可以发送了, 发送连接期间积攒的报文
+    void PeerReady(size_t idx);
+    // 开始或停止等待出站连接可写
+    void PeerWantWrite(size_t idx, const bool on);
+    // 关闭到集群节点的出站连接, 由 ConnectPeers 重连
+    void ClosePeer(size_t idx);
+    // 把报文加上长度头放入节点的发送缓冲区
+    void AppendFrame(PeerNode& peer, const char* data, size_t len);
+    // 把本节点用户发送的信息转发给其他节点, 每个节点只转发一次
+    void ForwardToPeers(const LI::PoolString& name, const LI::PoolString& str, int colorIndex);
+    // 发送一个节点的发送缓冲区, 发送不完时等可写, 积压超过上限时关闭连接. 不会阻塞
+    void FlushPeer(size_t idx);
+    // 通告在线人数的变化, 然后发送所有节点的发送缓冲区
+    void FlushPeers();
+    // 加入房间, 房间名为空表示回到大厅
+    void JoinRoom(const LI::PoolString& room, int sockfd);
+    // 离开所在的房间
+    void LeaveRoom(int sockfd);
+    // 回应所在房间中时间大于 since 的最近广播
+    void SendHistory(int64_t since, int sockfd);
+    // 用配置的节点建立哈希环, 把不属于本节点的房间中的连接重定向到归属节点(热重启时配置可能改变)
+    void UpdateRing();
+    // 限速检查, 超限时按命令回应 code 9, 返回 false 表示命令应当丢弃
+    bool Admit(const int cmd, int sockfd);
+    // 连接的登录用户的令牌桶, 没有登录返回 nullptr
+    UserLimit* UserOf(Connection& conn);
+    // 查找登录用户的编号, 没有登录返回 0
+    uint32_t UserIdOf(Connection& conn);
+    // 连接不再引用用户的令牌桶
+    void ReleaseUser(Connection& conn);
+    // 登录和恢复登录时记录客户端是否能解压压缩报文
+    void AcceptCompress(const char* buffer, int sockfd);
+    // 暂停读取连接, 直到线程池的队列降下来
+    void PauseReading(int sockfd);
+    // 检查暂停读取的连接能否恢复, 不能恢复时重新设置定时器
+    void ResumeReading();
+    // 开始监视 fd 的可读事件, kind 是 io_uring 后端的请求类型 URINGLISTEN/URINGCLIENT/URINGPOLL
+    void WatchFd(int fd, int kind);
+    // 停止监视 fd, 在 close 之前调用
+    void UnwatchFd(int fd);
+    // epoll 后端的事件循环
+    void EpollLoop();
+    // io_uring 后端的事件循环
+    void UringLoop();
+    // io_uring 后端: 处理一个完成事件
+    void OnUringEvent(const LI::IoEvent& ev);
+    // io_uring 后端: 处理客户端连接的 recv 完成事件, 数据已经放入接收缓冲区
+    void OnUringRecv(int sockfd, const LI::IoEvent& ev);
+    // io_uring 后端: 提交客户端连接的多次触发 recv
+    void ArmRecv(int sockfd);
+    // io_uring 后端: 交接前停止接收, 等所有 recv 结束, 保证之后到达的数据留在 socket 中由新进程读取
+    void StopReceiving(std::vector<LI::IoEvent>& deferred);
+    // io_uring 后端: 交接失败后恢复接收, 处理停止期间收到的数据和推迟的事件
+    void StartReceiving(std::vector<LI::IoEvent>& deferred);
+    // io_uring 后端: 准备一个广播发送, 提交队列满时先发送已经准备的
+    void QueueSend(int connfd, const char* frame, size_t len);
+    // io_uring 后端: 一次提交准备的广播发送并等待全部完成, 没有发送完的部分放入发送队列, 返回时报文已经交给内核或发送队列
+    void FlushSends();
+    // 零拷贝发送带长度头的报文, 返回 false 表示连接不能零拷贝或前面还有排队的数据, 调用者改用 SendFrame
+    bool ZeroCopyWrite(int connfd, const std::shared_ptr<const std::string>& frame);
+    // 把带长度头的报文放入连接的发送队列, 队列为空时直接发送(send 不为 nullptr 时用它发送), 不会阻塞
+    void SendFrame(int sockfd, const char* frame, size_t len, const LI::SendQueue::Sender& send = nullptr);
+    // 处理放入发送队列的结果: 开始排队时关注可写, 积压超过上限或出错时关闭连接. 可以在任何线程中调用
+    void OnSendResult(int sockfd, uint64_t conn_id, LI::SendQueue::Result result);
+    // 客户端连接可写: 继续发送发送队列
+    void OnWritable(int sockfd);
+    // 开始或停止等待客户端连接可写
+    void WantWrite(int sockfd, const bool on);
+    // epoll 后端: 按暂停读取和等待可写的状态设置客户端连接关注的事件
+    void SetEvents(int sockfd, const Connection& conn);
+    // 新的客户端连接
+    void AcceptClient(int connfd);
+    // 出站的集群节点连接可读: 推进握手, 或者连接被断开
+    void OnPeerReadable(int fd);
+    // 出站的集群节点连接可写: 连接完成, 推进握手, 或者继续发送
+    void OnPeerWritable(int fd);
+    // 客户端连接读取了 n 个字节: 0 或出错时关闭连接, 否则处理完整的报文
+    void OnClientData(int sockfd, ssize_t n);
+    // 广播的时间: 不早于墙上时钟且比房间中最近的广播晚; 分片模式中按分片个数取模等于分片编号, 各分片的广播时间不会相同
+    int64_t BroadcastTime(const History& hist) const;
+    // 把 code 4 报文发给本分片中房间(members 不为 nullptr)或大厅中的连接, 不发给 sockfd
+    void Deliver(const FdSet* members, const LI::PoolString& data, int sockfd);
+    // 把广播按接收者归属的分发线程分块, 交给分发线程发送
+    void FanOut(const FdSet* members, const LI::PoolString& data, int sockfd);
+    // 给一个客户端连接发送报文(已经压缩的报文 compressed 为 true), len 为 0 时是字符串.
+    // 分发线程中还有没有发送完的报文时交给连接所属的分发线程, 排在前面的广播之后, 不会先到
+    void Reply(int sockfd, const char* data, size_t len = 0, const bool compressed = false);
+    // 分片模式: 把本分片形成的广播转发给其他分片
+    void RelayToShards(const LI::PoolString& room, int64_t time, const LI::PoolString& data);
+    // 分片模式: eventfd 可读, 处理转来的信号和其他分片转发的广播
+    void OnShardWake();
+    // 分片模式: 暂存的广播放入环, 然后唤醒本轮有新广播的分片
+    void FlushShards();
 };
 
-ChatRoomServer::ChatRoomServer(const size_t threads, const size_t maxenents): thread_pool(threads), MAXENENTS(maxenents), epollfd(-1) { }
+ChatRoomServer::ChatRoomServer(const size_t threads, const size_t maxenents, const int maxmsglen): thread_pool(threads), MAXENENTS(maxenents), next_conn_id(1), taskfd(-1), epollfd(-1), compress_raw(0), compress_wire(0), sigfd(-1), ctlfd(-1), running(false), draining(false), handed_off(false), drain_deadline(0), announced(-1), cred_cache(CREDCACHESIZE, CREDCACHETTL), cred_hits(0), reg_leader(false), batch_rows(BATCHROWS), batch_window(BATCHWINDOW), reg_batches(0), reg_rows(0), bloom_negative(0), bloom_false(0), pause_when_full(true), tls_optional(false), use_uring(false), receiving(true), handoff_requested(false), uring_sends(0), uring_batches(0), zerocopy_min(0), zc_sends(0), zc_bytes(0), zc_copied(0), shards(nullptr), shard_id(0), shard_cpu(-1), wakefd(-1), shard_signal(0), shard_retry(false), shard_out(0), shard_in(0), fanout_min(0), fanout_pending(0), fanout_broadcasts(0), fanout_chunks(0) { 
+    scrypt = LI::ScryptParams{SCRYPTLOGN, SCRYPTR, SCRYPTP};
+    taskfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    SetHashPool(std::max(1u, std::thread::hardware_concurrency() / 2), HASHQUEUE);
+    LI::SetMaxMsgLen(maxmsglen);
+    thread_pool.SetCapacity(QUEUECAPACITY, LI::ThreadPool::BLOCK);
+    for (int i = 0; i < NCMD; ++i) {
+        conn_limits[i] = cmd_table[i].conn;
+        user_limits[i] = cmd_table[i].user;
+        limited[i] = 0;
+    }
+}
 
 bool ChatRoomServer::InitServer(const char* ip, const unsigned int port) {
-    return tcp_server.InitServer(ip, port);
+    if (tcp_server.InitServer(ip, port) == false) {
+        return false;
+    }
+    node_addr = std::string(ip) + ":" + std::to_string(port);
+    // 分片不能单独交接
+    if (shards != nullptr) {
+        return true;
+    }
+
+    // 监听热重启的交接请求
+    char path[108];
+    snprintf(path, sizeof(path), HANDOFFPATH, port);
+    ctl_path = path;
+    ctlfd = LI::UnixListen(path);
+    return true;
+}
+
+bool ChatRoomServer::TakeOver(const char* ip, const unsigned int port) {
+    node_addr = std::string(ip) + ":" + std::to_string(port);
+    char path[108];
+    snprintf(path, sizeof(path), HANDOFFPATH, port);
+    int sockfd = LI::UnixConnect(path);
+    if (sockfd < 0) {
+        return false;
+    }
+
+    // 依次接收: 监听 socket, 每个客户端连接, 结束标记. 连接的未处理数据可能有多个报文, 由 RecvFdData 拼接
+    std::string message;
+    int fd = -1;
+    bool finished = false;
+    while (LI::RecvFdData(sockfd, &fd, message, DRAINTIMEOUT + 5) == true) {
+        const char* buffer = message.c_str();
+        std::string type;
+        LI::GetStrFromXML(buffer, "type", type);
+        if (type == "listen") {
+            tcp_server.AttachListen(fd);
+            // 继承旧进程的令牌密钥, 已经签发的令牌继续有效
+            std::string key;
+            LI::GetStrFromXML(buffer, "key", key);
+            session_token.ImportKey(key);
+        }
+        else if (type == "conn" && fd >= 0) {
+            int login = 0;
+            LI::GetStrFromXML(buffer, "login", login);
+            // 附带的未处理数据在 XML 之后的 '\0' 后面
+            size_t metalen = strlen(buffer) + 1;
+            if (metalen > message.size()) metalen = message.size();
+            HandoffConn conn = {fd, login == 1, message.substr(metalen), "", "", "", "", false, false, 0};
+            // 未处理数据的最后 unsent 字节是旧进程还没有发送的数据
+            int unsent = 0;
+            LI::GetStrFromXML(buffer, "unsent", unsent);
+            if (unsent < 0 || (size_t)unsent > conn.pending.size()) unsent = 0;
+            conn.unsent = conn.pending.substr(conn.pending.size() - unsent);
+            conn.pending.resize(conn.pending.size() - unsent);
+            LI::GetStrFromXML(buffer, "node", conn.node);
+            LI::GetStrFromXML(buffer, "room", conn.room);
+            LI::GetStrFromXML(buffer, "user", conn.user);
+            int compress = 0;
+            LI::GetStrFromXML(buffer, "compress", compress);
+            conn.compress = (compress == 1);
+            int checked = 0;
+            LI::GetStrFromXML(buffer, "checked", checked);
+            conn.checked = (checked == 1);
+            std::string zcseq;
+            if (LI::GetStrFromXML(buffer, "zcseq", zcseq)) {
+                conn.zcseq = strtoul(zcseq.c_str(), nullptr, 10);
+            }
+            handoff_conns.push_back(std::move(conn));
+        }
+        else if (type == "end") {
+            finished = true;
+            break;
+        }
+    }
+
+    if (finished == false || tcp_server.m_listenfd == -1) {
+        // 交接不完整, 旧进程会恢复服务, 收到的 socket 只关闭本进程的副本
+        for (const auto& conn : handoff_conns) {
+            close(conn.fd);
+        }
+        handoff_conns.clear();
+        tcp_server.CloseListen();
+        close(sockfd);
+        return false;
+    }
+
+    // 确认接管, 等旧进程关闭连接(退出)后再监听交接路径
+    LI::SendFd(sockfd, -1, "<type>ack</type>", strlen("<type>ack</type>"));
+    char buffer[64];
+    int ibuflen = 0;
+    LI::RecvFd(sockfd, &fd, buffer, &ibuflen, sizeof(buffer), DRAINTIMEOUT + 5);
+    close(sockfd);
+
+    ctl_path = path;
+    ctlfd = LI::UnixListen(path);
+    logfile.Write("took over", handoff_conns.size(), "connections.");
+    return true;
 }
 
 bool ChatRoomServer::InitLogFile(const char* filename, std::ios::openmode openmode, bool bBackup, bool bEnbuffer, const size_t MaxLogSize) {
@@ -173,219 +986,2656 @@ ChatRoomServer::~ChatRoomServer() {
     if (epollfd != -1) {
         close(epollfd);
     }
+    {
+        // 线程池在析构函数之后才停止, 之后完成的任务不再唤醒
+        std::unique_lock<std::mutex> lk(loop_lock);
+        if (taskfd != -1) close(taskfd);
+        taskfd = -1;
+    }
+    if (sigfd != -1) {
+        close(sigfd);
+    }
+    if (ctlfd != -1) {
+        close(ctlfd);
+    }
 }
 
 void ChatRoomServer::runServer() {
-    // 创建一个 epoll 描述符
-    epollfd = epoll_create(1);
+    if (shards != nullptr) {
+        // 先绑定再初始化, 事件循环中分配的内存都在本核所在的 NUMA 节点上(首次访问时分配)
+        if (shard_cpu >= 0) {
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            CPU_SET(shard_cpu, &cpus);
+            pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+        }
+        logfile.Write("shard", shard_id, "of", shards->count, "cpu", shard_cpu);
+    }
+    if (use_uring && (uring.Init(URINGENTRIES) == false || uring.SetupBuffers(URINGBUFCOUNT, URINGBUFSIZE) == false ||
+                      send_ring.Init(URINGENTRIES) == false)) {
+        logfile.Write("io_uring unavailable, use epoll.");
+        uring.Close();
+        send_ring.Close();
+        use_uring = false;
+    }
+    if (use_uring == false) {
+        // 创建一个 epoll 描述符
+        epollfd = epoll_create(1);
+    }
+    logfile.Write("backend", use_uring ? "io_uring" : "epoll");
+    loop_thread = std::this_thread::get_id();
 
     // 添加监听描述符事件
-    struct epoll_event ev;
-    ev.data.fd = tcp_server.m_listenfd;
-    ev.events = EPOLLIN; // 读事件
-    epoll_ctl(epollfd, EPOLL_CTL_ADD, tcp_server.m_listenfd, &ev); // 添加fd和对应的事件
+    WatchFd(tcp_server.m_listenfd, URINGLISTEN);
+    // 线程池的任务交给事件循环的操作
+    WatchFd(taskfd, URINGPOLL);
 
-    while (1) {
+    if (shards == nullptr) {
+        // SIGINT/SIGTERM 在 main 中已经被屏蔽, 通过 signalfd 在事件循环中处理
+        sigset_t mask;
+        sigemptyset(&mask);
+        sigaddset(&mask, SIGINT);
+        sigaddset(&mask, SIGTERM);
+        sigfd = signalfd(-1, &mask, SFD_CLOEXEC);
+        WatchFd(sigfd, URINGPOLL);
+    }
+    else {
+        // 分片模式的信号由 main 线程转来, 和其他分片转发的广播一起通过 eventfd 唤醒
+        WatchFd(wakefd, URINGPOLL);
+    }
+
+    // 热重启的交接请求
+    if (ctlfd != -1) {
+        WatchFd(ctlfd, URINGPOLL);
+    }
+
+    // 从旧进程接管的连接
+    for (auto& handoff : handoff_conns) {
+        AddClient(handoff.fd);
+        if (!handoff.unsent.empty()) {
+            SendFrame(handoff.fd, handoff.unsent.data(), handoff.unsent.size());
+        }
+        map_conn[handoff.fd].compress = handoff.compress;
+        if (handoff.checked) {
+            map_conn[handoff.fd].tls_checked = true;
+        }
+        map_conn[handoff.fd].zerocopy.SetSequence(handoff.zcseq);
+        if (handoff.login) {
+            const uint32_t uid = handoff.user.empty() ? 0 : names.Intern(handoff.user.c_str(), handoff.user.size());
+            std::unique_lock<std::mutex> lk(set_lock);
+            set_connfd.insert(handoff.fd);
+            if (uid != 0) {
+                conn_user[map_conn[handoff.fd].id] = uid;
+            }
+        }
+        int peer = handoff.node.empty() ? -1 : FindPeer(LI::PoolString(handoff.node.c_str(), handoff.node.size()));
+        if (peer >= 0) {
+            NodeHello(peer, handoff.fd);
+        }
+        if (handoff.login && !handoff.room.empty()) {
+            Connection& conn = map_conn[handoff.fd];
+            conn.room.assign(handoff.room.c_str(), handoff.room.size());
+            rooms[conn.room].insert(handoff.fd);
+        }
+        if (!handoff.pending.empty()) {
+            map_conn[handoff.fd].recvbuf.Append(handoff.pending.data(), handoff.pending.size());
+            ProcessFrames(handoff.fd);
+        }
+    }
+    handoff_conns.clear();
+
+    // 定期把统计信息写入日志
+    timer_wheel.AddTimer(STATINTERVAL * 1000, [this]() { WriteStats(); });
+
+    // 连接集群中的其他节点, 哈希环先只有本节点
+    UpdateRing();
+    if (!peers.empty()) {
+        ConnectPeers();
+    }
+
+    running = true;
+    if (use_uring) {
+        UringLoop();
+    }
+    else {
+        EpollLoop();
+    }
+
+    // 关闭所有客户端连接. 已经交给新进程的连接只关闭本进程的副本, 不影响客户端
+    while (!map_conn.empty()) {
+        int sockfd = map_conn.begin()->first;
+        if (handed_off && LI::TlsActive(sockfd) == false) {
+            map_conn.erase(map_conn.begin());
+            close(sockfd);
+        }
+        else {
+            CloseClient(sockfd);
+        }
+    }
+    for (size_t i = 0; i < peers.size(); ++i) {
+        ClosePeer(i);
+    }
+    WriteStats();
+    if (!handed_off && ctlfd != -1) {
+        unlink(ctl_path.c_str());
+    }
+    logfile.Write(handed_off ? "handed off, exit." : "exit.");
+
+    if (epollfd != -1) {
+        close(epollfd);
+        epollfd = -1;
+    }
+    uring.Close();
+    send_ring.Close();
+    return;
+}
+
+// epoll 事件循环
+void ChatRoomServer::EpollLoop() {
+    while (running) {
         struct epoll_event events[MAXENENTS]; // 存放发生事件的结构数组
 
-        // 等待监视的 socket 有事件发生
-        int infds = epoll_wait(epollfd, events, MAXENENTS, -1); // 无限等待不超时
+        // 等待监视的 socket 有事件发生, 超时时间由最近的定时器决定
+        int infds = epoll_wait(epollfd, events, MAXENENTS, timer_wheel.NextTimeout());
         // 返回失败
         if (infds < 0) {
+            if (errno == EINTR) continue; // 被信号中断
             perror("epoll_wait()");
             break;
         }
-        else if (infds == 0) { // 无限等待不会超时
-            printf("epoll_wait() timeout.\n");
-            continue;
-        }
 
         // 遍历所有发生事件的结构数组
-        for (int i = 0; i < infds; ++i) {
-            if ((events[i].data.fd == tcp_server.m_listenfd) && (events[i].events & EPOLLIN)) {
+        for (int i = 0; i < infds && running; ++i) {
+            if (events[i].data.fd == sigfd) {
+                HandleSignal();
+                continue;
+            }
+            else if (events[i].data.fd == wakefd) {
+                OnShardWake();
+                continue;
+            }
+            else if (events[i].data.fd == taskfd) {
+                RunLoopTasks();
+                continue;
+            }
+            else if (events[i].data.fd == ctlfd) {
+                HandOff();
+                continue;
+            }
+            else if (map_peerfd.count(events[i].data.fd) > 0) {
+                const int fd = events[i].data.fd;
+                if (events[i].events & EPOLLOUT) {
+                    OnPeerWritable(fd);
+                }
+                if ((events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) && map_peerfd.count(fd) > 0) {
+                    OnPeerReadable(fd);
+                }
+                continue;
+            }
+            else if ((events[i].data.fd == tcp_server.m_listenfd) && (events[i].events & EPOLLIN)) {
                 // 如果发生的事件是 listenfd , 表示有新的客户端连上来
                 if (tcp_server.Accept() == false) {
                     printf("accept() failed.\n");
                     continue;
                 }
 
-                // 把新的客户端添加到 epoll 中
-                memset(&ev, 0, sizeof(struct epoll_event));
-                ev.data.fd = tcp_server.m_connfd;
-                ev.events = EPOLLIN;
-                epoll_ctl(epollfd, EPOLL_CTL_ADD, tcp_server.m_connfd, &ev);
-
-                logfile.Write(tcp_server.m_connfd, "connected.");
+                AcceptClient(tcp_server.m_connfd);
 
                 continue;
             }
-            else if (events[i].events & EPOLLIN) {
-                // 客户端有数据过来或客户端的socket连接被断开
-                char buffer[1024];
-                memset(buffer,0,sizeof(buffer));
-
-                int isize = 0;
+            else if (events[i].events & (EPOLLIN | EPOLLOUT | EPOLLERR | EPOLLHUP)) {
+                // 客户端有数据过来或客户端的socket连接被断开. 暂停读取的连接不关注 EPOLLIN, 但仍然会收到 EPOLLERR/EPOLLHUP
                 int sockfd = events[i].data.fd;
-                LI::TcpRead(sockfd, buffer, &isize);
+                if (events[i].events & EPOLLOUT) {
+                    // 发送队列不为空时才关注 EPOLLOUT
+                    OnWritable(sockfd);
+                    if ((events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) == 0 || map_conn.count(sockfd) == 0) continue;
+                }
+                Connection& conn = map_conn[sockfd];
 
-                if (isize <= 0) {
-                    logfile.Write(events[i].data.fd, "disconnected.");
-                    close(sockfd);
-                    continue;
+                if (conn.tls_checked == false) {
+                    // 第一个字节是 TLS 握手记录时按 TLS 连接处理, 握手在下面的读取中进行
+                    conn.tls_checked = true;
+                    unsigned char first = 0;
+                    if (recv(sockfd, &first, 1, MSG_PEEK | MSG_DONTWAIT) == 1 && first == TLSRECORD) {
+                        LI::TlsAccept(tls_ctx, sockfd);
+                    }
                 }
 
-                // 解析字符串
-                int cmd = -1;
-                LI::GetStrFromXML(buffer, "cmd", cmd);
-                std::string message;
-                std::string name;
-                int colorInd;
-                switch (cmd) {
-                    // 注册账号
-                    case 0: {LI::GetStrFromXML(buffer, "message", message); 
-                            thread_pool.enqueue(&ChatRoomServer::Register, this, message, sockfd); break;}
-                    // 登陆
-                    case 1: {LI::GetStrFromXML(buffer, "message", message);
-                            thread_pool.enqueue(&ChatRoomServer::LogIN, this, message, sockfd); break;}
-                    // 发信息
-                    case 2: {LI::GetStrFromXML(buffer, "message", message);
-                            LI::GetStrFromXML(buffer, "name", name);
-                            LI::GetStrFromXML(buffer, "color", colorInd);
-                            thread_pool.enqueue(&ChatRoomServer::broadcastMessage, this, name, message, colorInd, sockfd); break;}
-                    // 退出登陆
-                    case 3: {thread_pool.enqueue(&ChatRoomServer::LogOUT, this, sockfd); break;}
-
-                    // 其他
-                    default:{
-                        close(sockfd);
-                        break;}
+                if ((events[i].events & EPOLLERR) && conn.zerocopy.Enabled()) {
+                    // 零拷贝的完成通知在错误队列中, 只有通知时不需要读取
+                    int copied = 0;
+                    conn.zerocopy.Reap(sockfd, &copied);
+                    zc_copied += copied;
+                    if ((events[i].events & (EPOLLIN | EPOLLHUP)) == 0) {
+                        int err = 0;
+                        socklen_t len = sizeof(err);
+                        getsockopt(sockfd, SOL_SOCKET, SO_ERROR, &err, &len);
+                        if (err == 0) continue;
+                        errno = err;
+                        OnClientData(sockfd, -1);
+                        continue;
+                    }
                 }
 
+                OnClientData(sockfd, conn.recvbuf.ReadFd(sockfd));
+
                 continue;
             }
         }
-    }
+        // 连接已经交给新进程, 不再执行定时器: 恢复读取会把已经交接的数据再处理一次
+        if (handed_off) break;
 
-    close(epollfd);
-    epollfd = -1;
+        // 执行到期的定时器
+        timer_wheel.Update();
+
+        // 本轮要转发给其他节点的报文一起发送
+        FlushPeers();
+        FlushShards();
+    }
     return;
 }
-// 广播信息
-void ChatRoomServer::broadcastMessage(const std::string& name, const std::string& str, int colorIndex, int sockfd) {
-    {
-        // 形成信息
-        std::string message(str);
-        LI::FormXML(message, "message");
-        std::string message_name(name);
-        LI::FormXML(message_name, "name");
-        
-        std::string data("4"); // 发送信息是 4 cmd
-        LI::FormXML(data, "code");
-        data.append(message_name);
-        data.append("<color>");
-        data.append(std::to_string(colorIndex));
-        data.append("</color>");
-        data.append(message); // 形成 xml
-        std::unique_lock<std::mutex> lk(set_lock);
-        for (const auto& connfd : set_connfd) {
-            if (connfd == sockfd) continue; // 不广播给自己
-            LI::TcpWrite(connfd, data.c_str(), data.size());
+
+// io_uring 事件循环
+void ChatRoomServer::UringLoop() {
+    LI::IoEvent events[URINGBATCH];
+    while (running) {
+        // 提交上一轮准备的请求(重新提交的 recv、归还的缓冲区等)并等待事件, 超时时间由最近的定时器决定
+        if (uring.Submit(1, timer_wheel.NextTimeout()) != 0) {
+            if (errno == EINTR) continue; // 被信号中断
+            perror("io_uring_enter()");
+            break;
+        }
+
+        const size_t n = uring.Reap(events, URINGBATCH);
+        for (size_t i = 0; i < n && running; ++i) {
+            OnUringEvent(events[i]);
+        }
+
+        // 交接时要先停止接收, 这一批中排在后面的事件必须先处理, 否则收到的数据会乱序
+        if (handoff_requested && running) {
+            handoff_requested = false;
+            HandOff();
+            if (running) {
+                uring.PollOnce(ctlfd, POLLIN, URINGDATA(fd_gen[ctlfd], ctlfd, URINGPOLL));
+            }
         }
+        // 连接已经交给新进程, 不再执行定时器: 恢复读取会把已经交接的数据再处理一次
+        if (handed_off) break;
+
+        // 执行到期的定时器
+        timer_wheel.Update();
+
+        // 本轮要转发给其他节点的报文一起发送
+        FlushPeers();
+        FlushShards();
     }
     return;
 }
 
-// 注册操作
-void ChatRoomServer::Register(const std::string& str, int sockfd) {
-    if (str.size() == 0) {
-        // LI::TcpWrite(sockfd, "<code>0</code><message>Register Failed.</message>");
-        LI::TcpWrite(sockfd, "<code>0</code>");
-        return;
+// 处理 io_uring 完成事件
+void ChatRoomServer::OnUringEvent(const LI::IoEvent& ev) {
+    const int kind = ev.user_data & 0xF;
+    const int fd = (ev.user_data >> 4) & 0xFFFFFFF;
+    const uint32_t gen = ev.user_data >> 32;
+    if (kind == URINGCANCEL) return;
+    // 已经关闭的 fd 的事件只归还缓冲区
+    const bool stale = ((size_t)fd >= fd_gen.size() || fd_gen[fd] != gen);
+    if (ev.HasBuffer()) {
+        if (!stale && kind == URINGCLIENT && ev.res > 0) {
+            map_conn[fd].recvbuf.Append(uring.Buffer(ev.BufferId()), ev.res);
+        }
+        uring.RecycleBuffer(ev.BufferId());
     }
-    
-    // 在用户信息文件添加用户
-    int pos = str.find(' ');
-    // 反馈信息
-    UserSQL insert_obj;
-    if (insert_obj.AddUser(str.substr(0, pos).c_str(), str.substr(pos + 1).c_str()) == true ) {
-        LI::TcpWrite(sockfd, "<code>1</code>");
+    if (stale) return;
+
+    if (kind == URINGLISTEN) {
+        if (ev.res >= 0) {
+            AcceptClient(ev.res);
+        }
+        else if (ev.res != -ECANCELED) {
+            printf("accept() failed.\n");
+        }
+        // 出错时多次触发的 accept 结束, 重新提交; 被取消的(排空或交接)由取消的一方负责
+        if (!ev.More() && ev.res != -ECANCELED && receiving && tcp_server.m_listenfd == fd) {
+            uring.AcceptMultishot(fd, ev.user_data);
+        }
+        return;
     }
-    else {
-        LI::TcpWrite(sockfd, "<code>0</code>");
+    if (kind == URINGCLIENT) {
+        OnUringRecv(fd, ev);
+        return;
     }
-
-    return;
-}
-// 登陆操作
-void ChatRoomServer::LogIN(const std::string& str, int sockfd) {
-    if (str.size() == 0) {
-        // LI::TcpWrite(sockfd, "<code>2</code><message>LogIN Failed.</message>");
-        LI::TcpWrite(sockfd, "<code>2</code>");
+    if (kind == URINGWRITE && map_peerfd.count(fd) > 0) {
+        peers[map_peerfd[fd]]->want_write = false;
+        OnPeerWritable(fd);
         return;
     }
-    int pos = str.find(' ');
-    std::string name = str.substr(0, pos);
-    std::string InPassword = str.substr(pos + 1);
-    // 查找用户名
-    UserSQL search_obj;
-    std::string password = search_obj.SearchUser(name.c_str()); 
-    // 密码正确
-    if (password.size() > 0 && password == InPassword) {
-        {
-            std::unique_lock<std::mutex> lk(set_lock); // 上锁
-            set_connfd.insert(sockfd); // 把 sockfd 插入 set
+    if (kind == URINGWRITE) {
+        // 暂停读取时取消了这个连接的所有请求, 被取消的 poll 也由 OnWritable 按需要重新提交
+        auto it = map_conn.find(fd);
+        if (it != map_conn.end()) {
+            it->second.want_write = false;
+            OnWritable(fd);
         }
-        // LI::TcpWrite(sockfd, "<code>0</code><message>LogIN Success.</message>");
-        LI::TcpWrite(sockfd, "<code>3</code>");
         return;
     }
 
-    // LI::TcpWrite(sockfd, "<code>2</code><message>LogIN Failed.</message>");
-    LI::TcpWrite(sockfd, "<code>2</code>");
+    // 一次性 poll, 处理后重新提交; 处理中停止监视的 fd 代数已经改变, 不再提交
+    if (fd == sigfd) {
+        HandleSignal();
+    }
+    else if (fd == wakefd) {
+        OnShardWake();
+    }
+    else if (fd == taskfd) {
+        RunLoopTasks();
+    }
+    else if (fd == ctlfd) {
+        handoff_requested = true; // 交接之后再重新提交
+        return;
+    }
+    else if (map_peerfd.count(fd) > 0) {
+        OnPeerReadable(fd);
+    }
+    if (running && fd_gen[fd] == gen) {
+        uring.PollOnce(fd, POLLIN, ev.user_data);
+    }
     return;
 }
 
-// 退出登陆操作
-void ChatRoomServer::LogOUT(int sockfd) {
-    {
-        std::unique_lock<std::mutex> lk(set_lock); // 上锁
-        set_connfd.erase(sockfd); // 将 sockfd 删除
+// 处理 recv 完成事件
+void ChatRoomServer::OnUringRecv(int sockfd, const LI::IoEvent& ev) {
+    auto it = map_conn.find(sockfd);
+    if (it == map_conn.end()) return;
+    Connection& conn = it->second;
+    if (!ev.More()) {
+        // 请求已经结束: 缓冲区用完(ENOBUFS)、被取消(暂停读取)或内核结束了多次触发, 没有暂停时重新提交
+        conn.armed = false;
+        if ((ev.res > 0 || ev.res == -ENOBUFS || ev.res == -ECANCELED) && receiving && !conn.paused) {
+            ArmRecv(sockfd);
+        }
     }
-    return; 
+    if (ev.res == -ENOBUFS || ev.res == -ECANCELED) return;
+    // 交接期间只接收数据, 断开的连接也交给新进程处理
+    if (!receiving) return;
+    if (ev.res < 0) {
+        errno = -ev.res;
+    }
+    OnClientData(sockfd, ev.res > 0 ? ev.res : (ev.res == 0 ? 0 : -1));
+    return;
 }
 
-std::shared_ptr<ChatRoomServer> crs_ptr;
-
+// 提交多次触发的 recv
+void ChatRoomServer::ArmRecv(int sockfd) {
+    map_conn[sockfd].armed = true;
+    uring.RecvMultishot(sockfd, URINGDATA(fd_gen[sockfd], sockfd, URINGCLIENT));
+    return;
+}
 
-int main(int argc, char const *argv[])
-{
-    if (argc != 3) {
-        std::cout << "No ip and port" << std::endl;
-        std::cout << "Using example: ./chatRoomServer 192.168.1.101 5005 " << std::endl;
-        return -1;
+// 开始监视 fd
+void ChatRoomServer::WatchFd(int fd, int kind) {
+    if (use_uring == false) {
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(struct epoll_event));
+        ev.data.fd = fd;
+        ev.events = EPOLLIN; // 读事件
+        epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &ev); // 添加fd和对应的事件
+        return;
     }
-    signal(SIGINT, Catch_ctrl_c);
-    signal(SIGTERM, Catch_ctrl_c);
-
-    crs_ptr = std::make_shared<ChatRoomServer>();
-
-    crs_ptr->InitLogFile("../log/test.log", std::ios::app);
-    crs_ptr->InitServer(argv[1], atoi(argv[2]));
-
-    crs_ptr->runServer();
-
-
-    return 0;
+    if ((size_t)fd >= fd_gen.size()) {
+        fd_gen.resize(fd + 1024, 0);
+    }
+    const uint64_t user_data = URINGDATA(fd_gen[fd], fd, kind);
+    if (kind == URINGLISTEN) {
+        uring.AcceptMultishot(fd, user_data);
+    }
+    else if (kind == URINGCLIENT) {
+        // 交接期间接受的连接先不接收, 交接失败时再提交
+        if (receiving) ArmRecv(fd);
+    }
+    else {
+        uring.PollOnce(fd, POLLIN, user_data);
+    }
+    return;
+}
+
+// 停止监视 fd
+void ChatRoomServer::UnwatchFd(int fd) {
+    if (use_uring == false) {
+        epoll_ctl(epollfd, EPOLL_CTL_DEL, fd, nullptr);
+        return;
+    }
+    if ((size_t)fd >= fd_gen.size()) return;
+    // 请求持有 socket 的引用, 关闭 fd 不会结束请求, 必须在关闭之前取消
+    ++fd_gen[fd];
+    uring.CancelFd(fd, URINGCANCEL);
+    uring.Submit();
+    return;
+}
+
+// 停止接收
+void ChatRoomServer::StopReceiving(std::vector<LI::IoEvent>& deferred) {
+    receiving = false;
+    if (tcp_server.m_listenfd != -1) {
+        uring.CancelFd(tcp_server.m_listenfd, URINGCANCEL);
+    }
+    for (auto& conn : map_conn) {
+        if (conn.second.armed) uring.CancelFd(conn.first, URINGCANCEL);
+    }
+    // 取消是异步的, 等所有 recv 的最后一个事件; 之前的事件中的数据照常放入接收缓冲区, 其他事件推迟
+    LI::IoEvent events[URINGBATCH];
+    const int64_t deadline = LI::TimerWheel::NowMs() + DRAINTIMEOUT * 1000;
+    bool armed = true;
+    while (armed && LI::TimerWheel::NowMs() < deadline) {
+        uring.Submit(1, 100);
+        const size_t n = uring.Reap(events, URINGBATCH);
+        for (size_t i = 0; i < n; ++i) {
+            if ((events[i].user_data & 0xF) == URINGPOLL) deferred.push_back(events[i]);
+            else OnUringEvent(events[i]);
+        }
+        armed = false;
+        for (const auto& conn : map_conn) {
+            if (conn.second.armed) {
+                armed = true;
+                break;
+            }
+        }
+    }
+    return;
+}
+
+// 恢复接收
+void ChatRoomServer::StartReceiving(std::vector<LI::IoEvent>& deferred) {
+    receiving = true;
+    if (tcp_server.m_listenfd != -1) {
+        WatchFd(tcp_server.m_listenfd, URINGLISTEN);
+    }
+    std::vector<int> fds;
+    for (const auto& conn : map_conn) {
+        fds.push_back(conn.first);
+    }
+    for (const int sockfd : fds) {
+        auto it = map_conn.find(sockfd);
+        if (it == map_conn.end() || it->second.paused) continue;
+        if (!it->second.armed) ArmRecv(sockfd);
+        ProcessFrames(sockfd);
+    }
+    for (const auto& ev : deferred) {
+        OnUringEvent(ev);
+    }
+    deferred.clear();
+    return;
+}
+
+// 准备广播发送
+void ChatRoomServer::QueueSend(int connfd, const char* frame, size_t len) {
+    // 完成队列是提交队列的 4 倍, 还没有完成的发送不超过提交队列的大小就不会溢出
+    if (pending_sends.size() >= send_ring.Entries()) {
+        FlushSends();
+    }
+    pending_sends.push_back(PendingSend{connfd, frame, len});
+    send_ring.Send(connfd, frame, len, pending_sends.size(), true);
+    return;
+}
+
+// 发送准备的广播
+void ChatRoomServer::FlushSends() {
+    if (pending_sends.empty()) return;
+    ++uring_batches;
+    uring_sends += pending_sends.size();
+
+    // socket 是非阻塞的, 发送缓冲区满时 send 立即以 EAGAIN 完成; 超时取消只是防止整批发送一直等待
+    const int64_t deadline = LI::TimerWheel::NowMs() + URINGSENDTIMEOUT;
+    bool cancelled = false;
+    size_t done = 0;
+    LI::IoEvent events[URINGBATCH];
+    while (done < pending_sends.size()) {
+        int timeout = (int)(deadline - LI::TimerWheel::NowMs());
+        if (timeout <= 0 && !cancelled) {
+            send_ring.CancelAll(0);
+            cancelled = true;
+        }
+        if (send_ring.Submit(1, cancelled ? -1 : timeout) != 0 && errno != EINTR) {
+            perror("io_uring_enter()");
+            break;
+        }
+        const size_t n = send_ring.Reap(events, URINGBATCH);
+        for (size_t i = 0; i < n; ++i) {
+            if (events[i].user_data == 0) continue; // 取消请求
+            PendingSend& send = pending_sends[events[i].user_data - 1];
+            ++done;
+            // 发送缓冲区满、被信号打断或超时取消时没有发送完, 剩下的部分放入发送队列, 保持报文完整, 可写时继续发送.
+            // 其他错误说明连接已经断开, 由事件循环关闭
+            const int res = events[i].res;
+            if (res >= 0 || res == -EAGAIN || res == -ECANCELED || res == -EINTR) {
+                const size_t sent = (res > 0) ? (size_t)res : 0;
+                if (sent < send.len) SendFrame(send.fd, send.data + sent, send.len - sent);
+            }
+        }
+    }
+    pending_sends.clear();
+    return;
+}
+
+// 零拷贝发送
+bool ChatRoomServer::ZeroCopyWrite(int connfd, const std::shared_ptr<const std::string>& frame) {
+    auto it = map_conn.find(connfd);
+    if (it == map_conn.end() || it->second.zerocopy.Enabled() == false || LI::TlsActive(connfd) || it->second.out->Empty() == false) {
+        return false;
+    }
+    // 队列为空时零拷贝发送, 发送缓冲区满时剩下的部分复制到发送队列中
+    LI::ZeroCopyQueue& zerocopy = it->second.zerocopy;
+    SendFrame(connfd, frame->data(), frame->size(), [&zerocopy, connfd, &frame](const char* data, size_t) {
+        return zerocopy.SendSome(connfd, frame, data - frame->data());
+    });
+    ++zc_sends;
+    zc_bytes += frame->size();
+    return true;
+}
+
+// 放入发送队列
+void ChatRoomServer::SendFrame(int sockfd, const char* frame, size_t len, const LI::SendQueue::Sender& send) {
+    auto it = map_conn.find(sockfd);
+    if (it == map_conn.end()) return;
+    OnSendResult(sockfd, it->second.id, it->second.out->Push(frame, len, send));
+    return;
+}
+
+// 处理放入发送队列的结果
+void ChatRoomServer::OnSendResult(int sockfd, uint64_t conn_id, LI::SendQueue::Result result) {
+    if (result == LI::SendQueue::QUEUED) {
+        RunInLoop(sockfd, conn_id, [this, sockfd]() { WantWrite(sockfd, true); });
+    }
+    else if (result == LI::SendQueue::FAILED) {
+        // 可能正在遍历连接(广播), 推迟关闭
+        PostToLoop(sockfd, conn_id, [this, sockfd]() {
+            logfile.Write(sockfd, "send failed or backlog over", SENDQUEUEMAX, "bytes.");
+            CloseClient(sockfd);
+        });
+    }
+    return;
+}
+
+// 客户端连接可写
+void ChatRoomServer::OnWritable(int sockfd) {
+    auto it = map_conn.find(sockfd);
+    if (it == map_conn.end()) return;
+    const LI::SendQueue::Result result = it->second.out->Flush();
+    if (result == LI::SendQueue::FAILED) {
+        logfile.Write(sockfd, "send failed.");
+        CloseClient(sockfd);
+        return;
+    }
+    WantWrite(sockfd, result == LI::SendQueue::PENDING);
+    return;
+}
+
+// 等待可写
+void ChatRoomServer::WantWrite(int sockfd, const bool on) {
+    auto it = map_conn.find(sockfd);
+    if (it == map_conn.end() || it->second.want_write == on) return;
+    it->second.want_write = on;
+    if (use_uring) {
+        // 一次性 poll, 完成时 OnUringEvent 清除 want_write
+        if (on) uring.PollOnce(sockfd, POLLOUT, URINGDATA(fd_gen[sockfd], sockfd, URINGWRITE));
+        return;
+    }
+    SetEvents(sockfd, it->second);
+    return;
+}
+
+// 设置关注的事件
+void ChatRoomServer::SetEvents(int sockfd, const Connection& conn) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(struct epoll_event));
+    ev.data.fd = sockfd;
+    ev.events = (conn.paused ? 0 : EPOLLIN) | (conn.want_write ? EPOLLOUT : 0);
+    epoll_ctl(epollfd, EPOLL_CTL_MOD, sockfd, &ev);
+    return;
+}
+
+// 新的客户端连接
+void ChatRoomServer::AcceptClient(int connfd) {
+    AddClient(connfd);
+    logfile.Write(connfd, "connected.");
+    return;
+}
+
+// 出站的集群节点连接可读
+void ChatRoomServer::OnPeerReadable(int fd) {
+    const size_t idx = map_peerfd[fd];
+    PeerNode& peer = *peers[idx];
+    if (peer.state == PeerNode::HANDSHAKING) {
+        PeerHandshake(idx);
+        return;
+    }
+    if (peer.state == PeerNode::CONNECTING) {
+        // 连接失败时也报告可读(POLLERR/POLLHUP), 连接完成由可写事件处理
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0) {
+            ClosePeer(idx);
+        }
+        return;
+    }
+    // 出站连接只用于发送, 可读表示连接被断开
+    // TLS 连接要经过 OpenSSL 读取, 对端在握手之后发来的会话票据在这里处理
+    char buffer[256];
+    ssize_t n;
+    if (LI::TlsRecv(fd, buffer, sizeof(buffer), &n) == false) {
+        n = recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+    }
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+        ClosePeer(idx);
+    }
+    return;
+}
+
+// 出站的集群节点连接可写
+void ChatRoomServer::OnPeerWritable(int fd) {
+    const size_t idx = map_peerfd[fd];
+    PeerNode& peer = *peers[idx];
+    if (peer.state == PeerNode::CONNECTING) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0) {
+            ClosePeer(idx);
+            return;
+        }
+        PeerConnected(idx);
+        return;
+    }
+    if (peer.state == PeerNode::HANDSHAKING) {
+        PeerHandshake(idx);
+        return;
+    }
+    FlushPeer(idx);
+    return;
+}
+
+// 客户端连接收到数据
+void ChatRoomServer::OnClientData(int sockfd, ssize_t n) {
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+        logfile.Write(sockfd, "disconnected.");
+        CloseClient(sockfd);
+        return;
+    }
+    if (n < 0) return; // TLS 握手还没有完成
+    // 收到任何数据都说明连接是活的, 空闲检测定时器到期时再比较时间, 不需要每次都重新设置
+    Connection& conn = map_conn[sockfd];
+    conn.last_active = LI::TimerWheel::NowMs();
+    conn.pinged = false;
+    // io_uring 后端暂停期间仍可能收到取消之前的数据, 留在接收缓冲区中等恢复时处理
+    if (conn.paused) return;
+
+    ProcessFrames(sockfd);
+    return;
+}
+
+// 加入客户端连接
+void ChatRoomServer::AddClient(int connfd) {
+    // 设置空闲检测和登录期限定时器
+    Connection& conn = map_conn[connfd];
+    conn.id = next_conn_id++;
+    conn.last_active = LI::TimerWheel::NowMs();
+    conn.tls_checked = !(tls_ctx.Enabled() && tls_optional);
+    // 发送缓冲区满时不等待, 剩下的部分留在发送队列中, 可写时由事件循环继续发送
+    fcntl(connfd, F_SETFL, fcntl(connfd, F_GETFL) | O_NONBLOCK);
+    conn.out = std::make_shared<LI::SendQueue>(connfd, SENDQUEUEMAX);
+    if (zerocopy_min > 0) {
+        conn.zerocopy.Enable(connfd);
+    }
+    conn.idle_timer = timer_wheel.AddTimer(HEARTBEAT * 1000, [this, connfd]() { CheckIdle(connfd); });
+    conn.login_timer = timer_wheel.AddTimer(LOGINTIMEOUT * 1000, [this, connfd]() { CheckLogin(connfd); });
+
+    // 把新的客户端添加到 epoll 或 io_uring 中
+    WatchFd(connfd, URINGCLIENT);
+    return;
+}
+
+// 处理完整的报文
+void ChatRoomServer::ProcessFrames(int sockfd) {
+    Connection& conn = map_conn[sockfd];
+    LI::RecvBuffer& recvbuf = conn.recvbuf;
+
+    // 一次可能读到多个报文, 也可能只读到报文的一部分
+    LI::Frame frame;
+    int iret;
+    while (true) {
+        // 线程池的队列满时暂停读取, 剩下的报文留在接收缓冲区中, 客户端继续发送会被 TCP 流量控制挡住
+        if (pause_when_full && conn.peer < 0 && recvbuf.Readable() > 0 && thread_pool.Full()) {
+            PauseReading(sockfd);
+            return;
+        }
+        if ((iret = recvbuf.NextFrame(frame)) != 1) break;
+        if (HandleFrame(frame, sockfd) == false) break;
+    }
+    if (iret != 0) {
+        logfile.Write(sockfd, "invalid message.");
+        CloseClient(sockfd);
+    }
+    return;
+}
+
+// 处理信号
+void ChatRoomServer::HandleSignal() {
+    struct signalfd_siginfo info;
+    if (read(sigfd, &info, sizeof(info)) != sizeof(info)) {
+        return;
+    }
+    OnSignal(info.ssi_signo);
+    return;
+}
+
+// 处理信号
+void ChatRoomServer::OnSignal(int signo) {
+    logfile.Write("signal", signo);
+    if (draining) {
+        running = false; // 排空时再次收到信号, 立即退出
+        return;
+    }
+    StartDrain();
+    return;
+}
+
+// 开始排空
+void ChatRoomServer::StartDrain() {
+    draining = true;
+    drain_deadline = LI::TimerWheel::NowMs() + DRAINTIMEOUT * 1000;
+
+    // 不再接受新连接
+    UnwatchFd(tcp_server.m_listenfd);
+    tcp_server.CloseListen();
+    logfile.Write("draining.");
+
+    CheckDrain();
+    return;
+}
+
+// 检查排空是否完成
+void ChatRoomServer::CheckDrain() {
+    if (thread_pool.Idle() || LI::TimerWheel::NowMs() >= drain_deadline) {
+        running = false;
+        return;
+    }
+    timer_wheel.AddTimer(100, [this]() { CheckDrain(); });
+    return;
+}
+
+// 等待任务完成
+bool ChatRoomServer::WaitTasks() {
+    const int64_t deadline = LI::TimerWheel::NowMs() + DRAINTIMEOUT * 1000;
+    while (thread_pool.Idle() == false || fanout_pending.load() > 0) {
+        if (LI::TimerWheel::NowMs() >= deadline) {
+            return false;
+        }
+        usleep(10 * 1000);
+    }
+    return true;
+}
+
+// 交接连接
+void ChatRoomServer::HandOff() {
+    int sockfd = accept(ctlfd, nullptr, nullptr);
+    if (sockfd < 0) {
+        return;
+    }
+    logfile.Write("handoff started.");
+
+    // 交接期间 epoll 线程不处理事件, 先等线程池中的任务完成, 保证登录状态不再变化
+    std::string data = "<type>listen</type><key>" + session_token.ExportKey() + "</key>";
+    bool ok = WaitTasks();
+    // 完成的任务交给事件循环的登录和回应先执行
+    RunLoopTasks();
+    // io_uring 的 recv 会继续从 socket 中取数据, 先停止接收, 收到的数据作为未处理的数据交接
+    std::vector<LI::IoEvent> deferred;
+    if (use_uring) {
+        StopReceiving(deferred);
+    }
+    ok = ok && LI::SendFdData(sockfd, tcp_server.m_listenfd, data.data(), data.size());
+
+    // 每个连接: <type>conn</type><login>是否登录</login> + '\0' + 接收缓冲区中未处理的数据 + 发送队列中还没有发送的数据.
+    // 暂停读取的连接可能积压了多个最大长度的报文, SendFdData 分成多个 UNIX 域报文发送.
+    // TLS 的会话状态在本进程的 OpenSSL 中, 无法交接, 由本进程关闭, 客户端凭令牌重连并恢复 TLS 会话
+    for (auto it = map_conn.begin(); ok && it != map_conn.end(); ++it) {
+        if (LI::TlsActive(it->first)) continue;
+        int login;
+        LI::PoolString user;
+        {
+            std::unique_lock<std::mutex> lk(set_lock);
+            login = set_connfd.count(it->first) > 0 ? 1 : 0;
+            auto found = conn_user.find(it->second.id);
+            if (found != conn_user.end()) user.assign(names.Name(found->second).c_str());
+        }
+        data.assign("<type>conn</type><login>");
+        data.append(std::to_string(login));
+        data.append("</login>");
+        if (!user.empty()) {
+            data.append("<user>");
+            data.append(user.c_str(), user.size());
+            data.append("</user>");
+        }
+        if (!it->second.room.empty()) {
+            data.append("<room>");
+            data.append(it->second.room.c_str(), it->second.room.size());
+            data.append("</room>");
+        }
+        if (it->second.compress) {
+            data.append("<compress>1</compress>");
+        }
+        if (it->second.tls_checked) {
+            data.append("<checked>1</checked>");
+        }
+        if (it->second.zerocopy.Sequence() != 0) {
+            data.append("<zcseq>");
+            data.append(std::to_string(it->second.zerocopy.Sequence()));
+            data.append("</zcseq>");
+        }
+        if (it->second.peer >= 0) {
+            data.append("<node>");
+            data.append(peers[it->second.peer]->addr);
+            data.append("</node>");
+        }
+        // 发送队列中可能有半个报文, 新进程先发送完它, 客户端收到的报文才完整
+        std::string unsent;
+        it->second.out->Unsent(unsent);
+        if (!unsent.empty()) {
+            data.append("<unsent>");
+            data.append(std::to_string(unsent.size()));
+            data.append("</unsent>");
+        }
+        data.push_back('\0');
+        data.append(it->second.recvbuf.Peek(), it->second.recvbuf.Readable());
+        data.append(unsent);
+        ok = LI::SendFdData(sockfd, it->first, data.data(), data.size());
+    }
+    ok = ok && LI::SendFdData(sockfd, -1, "<type>end</type>", strlen("<type>end</type>"));
+
+    // 等待新进程确认
+    char buffer[64];
+    int fd = -1, ibuflen = 0;
+    if (ok && LI::RecvFd(sockfd, &fd, buffer, &ibuflen, sizeof(buffer) - 1, DRAINTIMEOUT) == true) {
+        buffer[ibuflen] = '\0';
+        std::string type;
+        LI::GetStrFromXML(buffer, "type", type);
+        ok = (type == "ack");
+    }
+    else {
+        ok = false;
+    }
+
+    if (ok) {
+        // 新进程已经接管, 退出事件循环. 交接路径由新进程重新监听, 本进程不再删除
+        handed_off = true;
+        running = false;
+        logfile.Write("handoff finished,", map_conn.size(), "connections.");
+    }
+    else {
+        // 新进程没有确认, 继续提供服务
+        logfile.Write("handoff failed, resume.");
+        if (use_uring) {
+            StartReceiving(deferred);
+        }
+    }
+    close(sockfd);
+    return;
+}
+
+// 解析并分发报文
+bool ChatRoomServer::HandleFrame(const LI::Frame& frame, int sockfd) {
+    const char* buffer = frame.data();
+
+    // 解析字符串, 字符串和任务节点都从内存池分配
+    int cmd = -1;
+    LI::GetStrFromXML(buffer, "cmd", cmd);
+    // 在入队之前限速, 超限的命令不占用线程池和广播的带宽
+    if (cmd >= 0 && cmd < NCMD && Admit(cmd, sockfd) == false) {
+        return true;
+    }
+    LI::PoolString message;
+    LI::PoolString name;
+    int colorInd;
+    switch (cmd) {
+        // 注册账号
+        case 0: {LI::GetStrFromXML(buffer, "message", message); 
+                LI::proto::Unescape(message);
+                Dispatch(cmd, sockfd, &ChatRoomServer::Register, std::move(message), sockfd, map_conn[sockfd].id); break;}
+        // 登陆
+        case 1: {LI::GetStrFromXML(buffer, "message", message);
+                LI::proto::Unescape(message);
+                ReleaseUser(map_conn[sockfd]); // 登录的用户可能改变
+                AcceptCompress(buffer, sockfd);
+                Dispatch(cmd, sockfd, &ChatRoomServer::LogIN, std::move(message), sockfd, map_conn[sockfd].id); break;}
+        // 发信息
+        case 2: {LI::proto::ChatCmd msg;
+                // 缺少字段或值中有没有转义的标签字符的报文丢弃
+                if (msg.Decode(buffer, frame.size()) == false) break;
+                // 还原转义的文本, 广播时重新转义, 信息中的标签文本不会变成字段
+                LI::proto::Unescape(msg.message, message);
+                colorInd = (int)msg.color;
+                // 登录的连接用用户名表中的用户名, 不复制报文中的 <name>
+                Connection& conn = map_conn[sockfd];
+                const uint32_t uid = UserIdOf(conn);
+                if (uid == 0) LI::proto::Unescape(msg.name, name);
+                // 大厅中的信息转发给其他节点, 房间只在归属节点上广播
+                if (!peers.empty() && conn.room.empty()) {
+                    if (uid != 0) name.assign(names.Name(uid).c_str());
+                    ForwardToPeers(name, message, colorInd);
+                }
+                Dispatch(cmd, sockfd, &ChatRoomServer::broadcastMessage, uid, std::move(name), std::move(message), colorInd, sockfd); break;}
+        // 退出登陆
+        case 3: {Dispatch(cmd, sockfd, &ChatRoomServer::LogOUT, sockfd); break;}
+        // 心跳探测
+        case 4: {Dispatch(cmd, sockfd, &ChatRoomServer::Ping, sockfd); break;}
+        // 心跳回应, 收到数据时已经刷新了活跃时间
+        case 5: break;
+        // 集群节点握手, 只接受配置中的节点
+        case 6: {LI::GetStrFromXML(buffer, "node", name);
+                int peer = FindPeer(name);
+                if (peer < 0) return false;
+                Dispatch(cmd, sockfd, &ChatRoomServer::NodeHello, peer, sockfd); break;}
+        // 其他节点转发的广播, 本节点的用户都要收到, 不再转发
+        case 7: {if (map_conn[sockfd].peer < 0) return false;
+                LI::proto::RelayCmd msg;
+                if (msg.Decode(buffer, frame.size()) == false) break;
+                LI::proto::Unescape(msg.message, message);
+                LI::proto::Unescape(msg.name, name);
+                colorInd = (int)msg.color;
+                Dispatch(cmd, sockfd, &ChatRoomServer::broadcastMessage, (uint32_t)0, std::move(name), std::move(message), colorInd, -1); break;}
+        // 其他节点的在线人数
+        case 8: {if (map_conn[sockfd].peer < 0) return false;
+                int members = 0;
+                LI::GetStrFromXML(buffer, "members", members);
+                Dispatch(cmd, sockfd, &ChatRoomServer::NodeMembers, members, sockfd); break;}
+        // 加入房间
+        case 9: {LI::GetStrFromXML(buffer, "room", name);
+                Dispatch(cmd, sockfd, &ChatRoomServer::JoinRoom, std::move(name), sockfd); break;}
+        // 凭令牌恢复登录
+        case 10: {LI::GetStrFromXML(buffer, "token", message);
+                ReleaseUser(map_conn[sockfd]);
+                AcceptCompress(buffer, sockfd);
+                Dispatch(cmd, sockfd, &ChatRoomServer::Resume, std::move(message), sockfd); break;}
+        // 取最近的广播
+        case 11: {LI::GetStrFromXML(buffer, "since", message);
+                const int64_t since = strtoll(message.c_str(), nullptr, 10);
+                Dispatch(cmd, sockfd, &ChatRoomServer::SendHistory, since, sockfd); break;}
+
+        // 其他
+        default: return false;
+    }
+    return true;
+}
+
+// 分发命令
+template<class _Callable, class... Args>
+void ChatRoomServer::Dispatch(const int cmd, int sockfd, _Callable&& _f, Args&&... args) {
+    using clock = std::chrono::steady_clock;
+    const clock::time_point start = clock::now();
+    auto task = std::bind(std::forward<_Callable>(_f), this, std::forward<Args>(args)...);
+
+    if (cmd_table[cmd].blocking) {
+        // 队列满被拒绝(REJECT)或被新任务挤出队列(DROPOLDEST)时, 告诉客户端服务端繁忙.
+        // 被挤出的任务可能是已经关闭的连接的, fd 已经被新连接复用, 按编号确认
+        const uint64_t conn_id = map_conn[sockfd].id;
+        auto busy = [this, sockfd, conn_id, cmd]() {
+            std::string data = "<code>10</code><cmd>" + std::to_string(cmd) + "</cmd>";
+            ReplyTo(sockfd, conn_id, data.c_str());
+        };
+        // 延迟包括在任务队列中等待的时间
+        thread_pool.try_post(busy, [this, cmd, start, task]() mutable {
+            task();
+            cmd_latency[cmd].Record(std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - start).count());
+        });
+    }
+    else {
+        task();
+        cmd_latency[cmd].Record(std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - start).count());
+    }
+    return;
+}
+
+// 写统计信息
+void ChatRoomServer::WriteStats() {
+    for (int i = 0; i < NCMD; ++i) {
+        if (cmd_latency[i].Count() == 0) continue;
+        logfile.Write("stat", cmd_table[i].name, (cmd_table[i].blocking ? "blocking" : "inline"), cmd_latency[i].Summary());
+    }
+    logfile.Write("pool", "depth", thread_pool.Depth(), "peak", thread_pool.TakePeakDepth(), "capacity", thread_pool.Capacity(),
+                  "rejected", thread_pool.Rejected(), "dropped", thread_pool.Dropped(), "paused", paused_conns.size(),
+                  "wait", thread_pool.WaitTime().Summary());
+    if (use_uring) {
+        logfile.Write("uring", "sends", uring_sends, "batches", uring_batches);
+        uring_sends = uring_batches = 0;
+    }
+    if (zerocopy_min > 0) {
+        logfile.Write("zerocopy", "sends", zc_sends, "bytes", zc_bytes, "copied", zc_copied, "retired", zc_retired.size() + zc_retired_old.size());
+        zc_sends = zc_bytes = zc_copied = 0;
+        zc_retired_old.swap(zc_retired);
+        zc_retired.clear();
+    }
+    if (!fanout.empty()) {
+        logfile.Write("fanout", "broadcasts", fanout_broadcasts, "chunks", fanout_chunks, "pending", fanout_pending.load(), "time", fanout_latency.Summary());
+        fanout_broadcasts = fanout_chunks = 0;
+    }
+    if (hash_latency.Count() > 0) {
+        logfile.Write("hash", "depth", hash_pool->Depth(), "rejected", hash_pool->Rejected(), "cached", cred_hits.exchange(0),
+                      "time", hash_latency.Summary());
+    }
+    if (user_filter) {
+        // 误判率: 数据库中不存在的用户名中, 过滤器没有排除的比例
+        const long negative = bloom_negative.exchange(0), falsepos = bloom_false.exchange(0);
+        logfile.Write("bloom", "users", user_filter->Count(), "estimated", user_filter->EstimatedFalsePositiveRate(),
+                      "negative", negative, "false", falsepos, "fprate", (negative + falsepos > 0) ? (double)falsepos / (negative + falsepos) : 0.0);
+    }
+    if (reg_batches.load() > 0) {
+        logfile.Write("register", "batches", reg_batches.exchange(0), "rows", reg_rows.exchange(0));
+    }
+    if (compress_latency.Count() > 0) {
+        logfile.Write("compress", "raw", compress_raw, "wire", compress_wire, "time", compress_latency.Summary());
+    }
+    for (int i = 0; i < NCMD; ++i) {
+        if (limited[i] == 0) continue;
+        logfile.Write("limit", cmd_table[i].name, "rejected", limited[i]);
+        limited[i] = 0;
+    }
+    // 删除没有连接引用的用户令牌桶
+    for (auto it = user_limit.begin(); it != user_limit.end(); ) {
+        if (it->second.conns == 0) it = user_limit.erase(it);
+        else ++it;
+    }
+    if (shards != nullptr) {
+        size_t backlog = 0;
+        for (size_t to = 0; to < shards->count; ++to) {
+            if (to != shard_id) backlog += shards->Link(shard_id, to).backlog.size();
+        }
+        logfile.Write("shard", shard_id, "cpu", shard_cpu, "relayed", shard_out, "received", shard_in, "backlog", backlog);
+        shard_out = shard_in = 0;
+    }
+    for (const auto& peer : peers) {
+        logfile.Write("node", peer->addr, (peer->state == PeerNode::CONNECTED ? "connected" : "disconnected"), "members", peer->members);
+    }
+    timer_wheel.AddTimer(STATINTERVAL * 1000, [this]() { WriteStats(); });
+    return;
+}
+
+// 空闲检测
+void ChatRoomServer::CheckIdle(int sockfd) {
+    auto it = map_conn.find(sockfd);
+    if (it == map_conn.end()) return;
+    Connection& conn = it->second;
+    conn.idle_timer = 0;
+    if (conn.paused) {
+        // 暂停读取时收不到心跳回应, 不算空闲
+        conn.last_active = LI::TimerWheel::NowMs();
+        conn.pinged = false;
+    }
+
+    const int64_t idle = LI::TimerWheel::NowMs() - conn.last_active;
+    if (idle < HEARTBEAT * 1000) {
+        // 期间收到过数据, 按剩余的时间重新设置
+        conn.idle_timer = timer_wheel.AddTimer(HEARTBEAT * 1000 - idle, [this, sockfd]() { CheckIdle(sockfd); });
+    }
+    else if (conn.pinged == false) {
+        // 空闲太久, 发送心跳探测
+        conn.pinged = true;
+        Reply(sockfd, "<code>6</code>");
+        conn.idle_timer = timer_wheel.AddTimer(HEARTBEATTIMEOUT * 1000, [this, sockfd]() { CheckIdle(sockfd); });
+    }
+    else {
+        // 心跳探测没有回应
+        logfile.Write(sockfd, "heartbeat timeout.");
+        CloseClient(sockfd);
+    }
+    return;
+}
+
+// 登录期限
+void ChatRoomServer::CheckLogin(int sockfd) {
+    auto it = map_conn.find(sockfd);
+    if (it == map_conn.end()) return;
+    it->second.login_timer = 0;
+    if (it->second.paused) {
+        // 登录请求可能还在队列中, 恢复读取后再计时
+        it->second.login_timer = timer_wheel.AddTimer(LOGINTIMEOUT * 1000, [this, sockfd]() { CheckLogin(sockfd); });
+        return;
+    }
+
+    {
+        std::unique_lock<std::mutex> lk(set_lock);
+        if (set_connfd.count(sockfd) > 0) return; // 已经登录
+    }
+    logfile.Write(sockfd, "login timeout.");
+    CloseClient(sockfd);
+    return;
+}
+
+// 关闭客户端连接
+void ChatRoomServer::CloseClient(int sockfd) {
+    LogOUT(sockfd); // 已登录的连接不再接收广播
+    auto it = map_conn.find(sockfd);
+    if (it != map_conn.end()) {
+        if (it->second.peer >= 0 && peers[it->second.peer]->inbound == sockfd) {
+            // 在线人数通过这个连接通告, 节点重新连接后会再次通告
+            peers[it->second.peer]->members = 0;
+            peers[it->second.peer]->inbound = -1;
+            logfile.Write("node", peers[it->second.peer]->addr, "inbound closed.");
+        }
+        timer_wheel.CancelTimer(it->second.idle_timer);
+        timer_wheel.CancelTimer(it->second.login_timer);
+        it->second.zerocopy.Release(zc_retired);
+        // 分发线程中可能还有发给这个连接的报文: 关闭发送队列后它们不再写这个 fd, 之后 fd 可以被新连接复用
+        it->second.out->Close();
+        map_conn.erase(it);
+        paused_conns.erase(sockfd);
+    }
+    UnwatchFd(sockfd);
+    LI::TlsDetach(sockfd);
+    close(sockfd);
+    return;
+}
+
+// 广播信息
+void ChatRoomServer::broadcastMessage(const uint32_t uid, const LI::PoolString& name, const LI::PoolString& str, int colorIndex, int sockfd) {
+    // 房间中的信息只广播给房间中的连接
+    auto conn = map_conn.find(sockfd);
+    const bool inroom = (conn != map_conn.end() && !conn->second.room.empty());
+    auto room = rooms.end();
+    if (inroom) {
+        room = rooms.find(conn->second.room);
+        if (room == rooms.end()) return;
+    }
+
+    // 广播的时间用墙上时钟, 客户端缓存的时间在服务端重启后仍然可比; 同一个房间中严格递增, 用作增量同步的位置
+    History& hist = history[inroom ? conn->second.room : LI::PoolString()];
+    const int64_t now = BroadcastTime(hist);
+
+    // 形成信息, 报文的长度先算好, 只申请一次内存
+    LI::proto::BroadcastCode msg;
+    if (uid != 0) msg.name = names.Name(uid);
+    else msg.name = name;
+    msg.color = colorIndex;
+    msg.message = str;
+    msg.time = now;
+    LI::PoolString data;
+    msg.AppendTo(data);
+
+    hist.push_back(HistoryEntry{now, data});
+    if (hist.size() > HISTORYSIZE) hist.pop_front();
+
+    // 其他分片中同一个房间(或大厅)的连接由它们自己发送
+    if (shards != nullptr) {
+        RelayToShards(inroom ? room->first : LI::PoolString(), now, data);
+    }
+    Deliver(inroom ? &room->second : nullptr, data, sockfd);
+    return;
+}
+
+// 并行发送
+void ChatRoomServer::FanOut(const FdSet* members, const LI::PoolString& data, int sockfd) {
+    // 分块: 下标是分发线程
+    const size_t nthreads = fanout.size();
+    std::vector<std::vector<FanoutTarget>> chunks(nthreads);
+    size_t ncompress = 0;
+    auto add = [&](int connfd, const Connection& conn) {
+        chunks[connfd % nthreads].push_back(FanoutTarget{connfd, conn.id, conn.out, conn.compress});
+        if (conn.compress) ++ncompress;
+    };
+    if (members != nullptr) {
+        for (const auto& connfd : *members) {
+            if (connfd == sockfd) continue; // 不广播给自己
+            add(connfd, map_conn[connfd]);
+        }
+    }
+    else {
+        std::unique_lock<std::mutex> lk(set_lock);
+        for (const auto& connfd : set_connfd) {
+            if (connfd == sockfd) continue; // 不广播给自己
+            auto it = map_conn.find(connfd);
+            if (it == map_conn.end() || !it->second.room.empty()) continue; // 在房间中的不接收大厅的信息
+            add(connfd, it->second);
+        }
+    }
+
+    // 压缩和加长度头在 epoll 线程中进行一次, 分发线程只发送
+    std::shared_ptr<FanoutMsg> msg = std::make_shared<FanoutMsg>();
+    LI::AppendFrame(msg->data, data.data(), data.size());
+    msg->start = std::chrono::steady_clock::now();
+    if (ncompress > 0) {
+        std::string packed;
+        if (LI::CompressFrame(data.data(), data.size(), packed)) {
+            LI::AppendPacked(msg->packed, packed);
+            compress_raw += data.size() * ncompress;
+            compress_wire += packed.size() * ncompress;
+        }
+        compress_latency.Record(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - msg->start).count());
+    }
+
+    ++fanout_broadcasts;
+    for (size_t i = 0; i < nthreads; ++i) {
+        if (chunks[i].empty()) continue;
+        ++fanout_pending;
+        ++fanout_chunks;
+        std::shared_ptr<const FanoutMsg> shared = msg;
+        fanout[i]->post([this, shared](const std::vector<FanoutTarget>& targets) {
+            for (const auto& target : targets) {
+                const std::string& frame = (target.compress && !shared->packed.empty()) ? shared->packed : shared->data;
+                OnSendResult(target.fd, target.conn_id, target.out->Push(frame.data(), frame.size()));
+            }
+            fanout_latency.Record(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - shared->start).count());
+            --fanout_pending;
+        }, std::move(chunks[i]));
+    }
+    return;
+}
+
+// 回应一个连接
+void ChatRoomServer::Reply(int sockfd, const char* data, size_t len, const bool compressed) {
+    if (len == 0) len = strlen(data);
+    auto it = map_conn.find(sockfd);
+    if (it == map_conn.end()) return;
+    std::string frame;
+    if (compressed) LI::AppendPacked(frame, std::string(data, len));
+    else LI::AppendFrame(frame, data, len);
+    if (fanout.empty() || fanout_pending.load() == 0) {
+        SendFrame(sockfd, frame.data(), frame.size());
+        return;
+    }
+    // 和广播一样计入还没有发送完的个数, 之后的广播也排在它后面
+    ++fanout_pending;
+    const uint64_t conn_id = it->second.id;
+    std::shared_ptr<LI::SendQueue> out = it->second.out;
+    fanout[sockfd % fanout.size()]->post([this, sockfd, conn_id, out](const std::string& frame) {
+        OnSendResult(sockfd, conn_id, out->Push(frame.data(), frame.size()));
+        --fanout_pending;
+    }, std::move(frame));
+    return;
+}
+
+// 广播的时间
+int64_t ChatRoomServer::BroadcastTime(const History& hist) const {
+    int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    if (!hist.empty() && now <= hist.back().time) now = hist.back().time + 1;
+    if (shards != nullptr) {
+        // 不共享时钟也不会和其他分片的广播同时, 最多晚分片个数减一毫秒
+        const int64_t count = (int64_t)shards->count;
+        now += ((int64_t)shard_id - now % count + count) % count;
+    }
+    return now;
+}
+
+// 发给本分片的连接
+void ChatRoomServer::Deliver(const FdSet* members, const LI::PoolString& data, int sockfd) {
+    if (!fanout.empty()) {
+        size_t count;
+        if (members != nullptr) {
+            count = members->size();
+        }
+        else {
+            std::unique_lock<std::mutex> lk(set_lock);
+            count = set_connfd.size();
+        }
+        // 前面的广播或回应还没有交给发送队列时这一条也交给分发线程, 否则可能比前面的先到.
+        // 直接发送也只放入发送队列, 不会阻塞事件循环
+        if (count >= fanout_min || fanout_pending.load() > 0) {
+            FanOut(members, data, sockfd);
+            return;
+        }
+    }
+
+    // 第一个能解压的接收者需要时才压缩, 压缩结果所有接收者共用
+    std::string packed;
+    int state = 0; // 0-还没有压缩; 1-已压缩; -1-不值得压缩
+    // 带长度头的报文只生成一次, 所有接收者共用. [0]-原报文; [1]-压缩报文
+    std::shared_ptr<const std::string> frames[2];
+    auto frame_of = [&](const bool packed_frame) -> const std::shared_ptr<const std::string>& {
+        if (!frames[packed_frame]) {
+            std::shared_ptr<std::string> frame = std::make_shared<std::string>();
+            if (packed_frame) LI::AppendPacked(*frame, packed);
+            else LI::AppendFrame(*frame, data.data(), data.size());
+            frames[packed_frame] = std::move(frame);
+        }
+        return frames[packed_frame];
+    };
+    auto write = [&](int connfd, const bool compress) {
+        if (compress && state == 0) {
+            const auto start = std::chrono::steady_clock::now();
+            state = LI::CompressFrame(data.data(), data.size(), packed) ? 1 : -1;
+            compress_latency.Record(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+        }
+        const bool use_packed = (compress && state == 1);
+        if (use_packed) {
+            compress_raw += data.size();
+            compress_wire += packed.size();
+        }
+        const std::shared_ptr<const std::string>& frame = frame_of(use_packed);
+        if (use_uring) {
+            // 前面还有排队的数据时放在队列后面, 否则批量提交
+            auto it = map_conn.find(connfd);
+            if (it != map_conn.end() && it->second.out->Empty()) QueueSend(connfd, frame->data(), frame->size());
+            else SendFrame(connfd, frame->data(), frame->size());
+            return;
+        }
+        if (zerocopy_min > 0 && frame->size() >= zerocopy_min && ZeroCopyWrite(connfd, frame)) {
+            return;
+        }
+        SendFrame(connfd, frame->data(), frame->size());
+    };
+
+    if (members != nullptr) {
+        for (const auto& connfd : *members) {
+            if (connfd == sockfd) continue; // 不广播给自己
+            write(connfd, map_conn[connfd].compress);
+        }
+        FlushSends();
+        return;
+    }
+
+    std::unique_lock<std::mutex> lk(set_lock);
+    for (const auto& connfd : set_connfd) {
+        if (connfd == sockfd) continue; // 不广播给自己
+        auto it = map_conn.find(connfd);
+        if (it != map_conn.end() && !it->second.room.empty()) continue; // 在房间中的不接收大厅的信息
+        write(connfd, it != map_conn.end() && it->second.compress);
+    }
+    FlushSends();
+    return;
+}
+
+// 注册操作
+void ChatRoomServer::Register(const LI::PoolString& str, int sockfd, uint64_t conn_id) {
+    if (str.size() == 0) {
+        // LI::TcpWrite(sockfd, "<code>0</code><message>Register Failed.</message>");
+        ReplyTo(sockfd, conn_id, "<code>0</code>");
+        return;
+    }
+    
+    // 在用户信息文件添加用户
+    int pos = str.find(' ');
+    const LI::PoolString name = str.substr(0, pos);
+    // 用户名原样写入令牌和交接信息, 不能含有标签字符
+    if (name.empty() || LI::proto::NeedsEscape(name)) {
+        ReplyTo(sockfd, conn_id, "<code>0</code>");
+        return;
+    }
+    if (user_filter) {
+        // 可能已存在时查询数据库, 已存在的不再计算口令哈希; 一定不存在的直接写入
+        if (user_filter->MayContain(name.data(), name.size())) {
+            if (UserSQL().SearchUser(name.c_str()).size() > 0) {
+                ReplyTo(sockfd, conn_id, "<code>0</code>");
+                return;
+            }
+            ++bloom_false;
+        }
+        else {
+            ++bloom_negative;
+        }
+    }
+    // 保存加盐的口令哈希, 不保存明文
+    const LI::PoolString password = str.substr(pos + 1);
+    std::string hash;
+    if (RunHash([&]() { hash = LI::HashPassword(password.data(), password.size(), scrypt); return hash.size() > 0; }) < 0) {
+        ReplyTo(sockfd, conn_id, "<code>10</code><cmd>0</cmd>");
+        return;
+    }
+    if (hash.size() == 0) {
+        ReplyTo(sockfd, conn_id, "<code>0</code>");
+        return;
+    }
+    // 写入数据库后反馈信息
+    CommitUser(PendingUser{std::string(name.data(), name.size()), std::move(hash), sockfd, conn_id});
+    return;
+}
+
+// 批量写入注册
+void ChatRoomServer::CommitUser(PendingUser&& user) {
+    std::unique_lock<std::mutex> lk(reg_lock);
+    reg_pending.push_back(std::move(user));
+    if (reg_leader) {
+        if (reg_pending.size() >= batch_rows) {
+            reg_cond.notify_one();
+        }
+        return;
+    }
+
+    reg_leader = true;
+    while (reg_pending.empty() == false) {
+        if (batch_window > 0) {
+            reg_cond.wait_for(lk, std::chrono::milliseconds(batch_window), [this]() { return reg_pending.size() >= batch_rows; });
+        }
+        std::vector<PendingUser> rows;
+        if (reg_pending.size() <= batch_rows) {
+            rows.swap(reg_pending);
+        }
+        else {
+            rows.assign(std::make_move_iterator(reg_pending.begin()), std::make_move_iterator(reg_pending.begin() + batch_rows));
+            reg_pending.erase(reg_pending.begin(), reg_pending.begin() + batch_rows);
+        }
+        // 写入期间到达的注册放入 reg_pending, 下一轮写入
+        lk.unlock();
+        // 写入之前加入过滤器, 写入后立即登录不会被判断为不存在; 写入失败的只增加误判
+        std::vector<std::pair<const char*, const char*>> users;
+        users.reserve(rows.size());
+        for (const PendingUser& row : rows) {
+            users.emplace_back(row.name.c_str(), row.password.c_str());
+            if (user_filter) user_filter->Add(row.name.data(), row.name.size());
+        }
+        std::vector<bool> results;
+        UserSQL().AddUsers(users, results);
+        for (size_t i = 0; i < rows.size(); ++i) {
+            ReplyTo(rows[i].sockfd, rows[i].conn_id, results[i] ? "<code>1</code>" : "<code>0</code>");
+        }
+        ++reg_batches;
+        reg_rows += rows.size();
+        lk.lock();
+    }
+    reg_leader = false;
+    return;
+}
+// 登陆操作
+void ChatRoomServer::LogIN(const LI::PoolString& str, int sockfd, uint64_t conn_id) {
+    if (str.size() == 0) {
+        // LI::TcpWrite(sockfd, "<code>2</code><message>LogIN Failed.</message>");
+        ReplyTo(sockfd, conn_id, "<code>2</code>");
+        return;
+    }
+    int pos = str.find(' ');
+    LI::PoolString name = str.substr(0, pos);
+    LI::PoolString InPassword = str.substr(pos + 1);
+    // 以前注册的含有标签字符的用户名不能登录, 它会破坏令牌报文
+    if (LI::proto::NeedsEscape(name)) {
+        ReplyTo(sockfd, conn_id, "<code>2</code>");
+        return;
+    }
+    // 一定不存在的用户名不查询数据库
+    if (user_filter && user_filter->MayContain(name.data(), name.size()) == false) {
+        ++bloom_negative;
+        ReplyTo(sockfd, conn_id, "<code>2</code>");
+        return;
+    }
+    // 查找用户名
+    UserSQL search_obj;
+    std::string password = search_obj.SearchUser(name.c_str()); 
+    if (password.size() == 0 && user_filter) {
+        ++bloom_false;
+    }
+    if (password.size() > 0) {
+        const std::string user(name.data(), name.size());
+        const int64_t now = time(nullptr);
+        int verified = 1;
+        if (cred_cache.Lookup(user, InPassword.data(), InPassword.size(), password, now)) {
+            ++cred_hits;
+        }
+        else {
+            verified = RunHash([&]() { return LI::VerifyPassword(InPassword.data(), InPassword.size(), password); });
+            if (verified < 0) {
+                ReplyTo(sockfd, conn_id, "<code>10</code><cmd>1</cmd>");
+                return;
+            }
+            // 旧版本保存的明文或较弱的参数: 重新哈希后保存, 失败时下次登录再试
+            std::string hash;
+            if (verified == 1 && LI::NeedsRehash(password, scrypt) &&
+                RunHash([&]() { hash = LI::HashPassword(InPassword.data(), InPassword.size(), scrypt); return hash.size() > 0; }) == 1 &&
+                UserSQL().UpdatePassword(name.c_str(), hash.c_str())) {
+                password = hash;
+            }
+            if (verified == 1) {
+                cred_cache.Insert(user, InPassword.data(), InPassword.size(), password, now);
+            }
+        }
+        // 密码正确: 在事件循环中登录, 连接在校验期间关闭时不登录 fd 复用后的新连接
+        if (verified == 1) {
+            RunInLoop(sockfd, conn_id, [this, user, sockfd]() { LoginSuccess(user.data(), user.size(), sockfd); });
+            return;
+        }
+    }
+
+    // LI::TcpWrite(sockfd, "<code>2</code><message>LogIN Failed.</message>");
+    ReplyTo(sockfd, conn_id, "<code>2</code>");
+    return;
+}
+
+// 在口令哈希线程池中计算
+int ChatRoomServer::RunHash(const std::function<bool()>& fn) {
+    using clock = std::chrono::steady_clock;
+    const clock::time_point start = clock::now();
+    int result = -1;
+    try {
+        // 被拒绝时任务没有执行就析构, future 得到 broken_promise
+        std::future<bool> res = hash_pool->enqueue(fn);
+        result = res.get() ? 1 : 0;
+    }
+    catch (const std::exception&) {
+        return -1;
+    }
+    hash_latency.Record(std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - start).count());
+    return result;
+}
+
+// 恢复登录
+void ChatRoomServer::Resume(const LI::PoolString& token, int sockfd) {
+    std::string name;
+    if (session_token.Verify(token.data(), token.size(), time(nullptr), &name) == false) {
+        // 令牌无效或过期, 客户端改用密码登录
+        Reply(sockfd, "<code>2</code>");
+        return;
+    }
+    LoginSuccess(name.data(), name.size(), sockfd);
+    return;
+}
+
+// 登录成功
+void ChatRoomServer::LoginSuccess(const char* name, size_t len, int sockfd) {
+    const uint32_t uid = names.Intern(name, len);
+    {
+        std::unique_lock<std::mutex> lk(set_lock); // 上锁
+        set_connfd.insert(sockfd); // 把 sockfd 插入 set
+        // 用户名表满时没有编号, 广播使用报文中的用户名, 不按用户限速
+        if (uid != 0) conn_user[map_conn[sockfd].id] = uid;
+        else conn_user.erase(map_conn[sockfd].id);
+    }
+    // 每次登录都签发新的令牌, 有效期重新计算
+    // <compress>1</compress> 告诉客户端服务端能解压, 客户端可以发送压缩报文
+    std::string data = "<code>3</code><token>" + session_token.Issue(name, len, time(nullptr) + TOKENTTL) + "</token><compress>1</compress>";
+    Reply(sockfd, data.c_str(), data.size());
+    return;
+}
+
+// 交给事件循环执行
+void ChatRoomServer::RunInLoop(int sockfd, uint64_t conn_id, std::function<void()> fn) {
+    if (std::this_thread::get_id() == loop_thread) {
+        auto it = map_conn.find(sockfd);
+        if (it != map_conn.end() && it->second.id == conn_id) fn();
+        return;
+    }
+    PostToLoop(sockfd, conn_id, std::move(fn));
+    return;
+}
+
+// 推迟到事件循环执行
+void ChatRoomServer::PostToLoop(int sockfd, uint64_t conn_id, std::function<void()> fn) {
+    std::unique_lock<std::mutex> lk(loop_lock);
+    loop_tasks.push_back(LoopTask{sockfd, conn_id, std::move(fn)});
+    // 事件循环每次取走全部, 只在从空变为非空时唤醒
+    if (loop_tasks.size() == 1 && taskfd != -1) {
+        const uint64_t one = 1;
+        if (write(taskfd, &one, sizeof(one)) != sizeof(one)) {
+            // 计数器满时已经可读
+        }
+    }
+    return;
+}
+
+// 执行交给事件循环的操作
+void ChatRoomServer::RunLoopTasks() {
+    uint64_t count;
+    if (read(taskfd, &count, sizeof(count)) != sizeof(count)) {
+        // 非阻塞, 计数已经被上一次读取清零
+    }
+    std::vector<LoopTask> tasks;
+    {
+        std::unique_lock<std::mutex> lk(loop_lock);
+        tasks.swap(loop_tasks);
+    }
+    for (auto& task : tasks) {
+        auto it = map_conn.find(task.sockfd);
+        if (it == map_conn.end() || it->second.id != task.conn_id) continue;
+        task.fn();
+    }
+    return;
+}
+
+// 线程池的任务回应
+void ChatRoomServer::ReplyTo(int sockfd, uint64_t conn_id, const char* data) {
+    std::string frame(data);
+    RunInLoop(sockfd, conn_id, [this, sockfd, frame]() { Reply(sockfd, frame.data(), frame.size()); });
+    return;
+}
+
+// 回应心跳探测
+void ChatRoomServer::Ping(int sockfd) {
+    Reply(sockfd, "<code>5</code>");
+    return;
+}
+
+// 退出登陆操作
+void ChatRoomServer::LogOUT(int sockfd) {
+    auto it = map_conn.find(sockfd);
+    {
+        std::unique_lock<std::mutex> lk(set_lock); // 上锁
+        set_connfd.erase(sockfd); // 将 sockfd 删除
+        // CloseClient 先调用这里, 之后才关闭 fd
+        if (it != map_conn.end()) conn_user.erase(it->second.id);
+    }
+    if (it != map_conn.end()) {
+        ReleaseUser(it->second);
+    }
+    LeaveRoom(sockfd);
+    return; 
+}
+
+// 加入房间
+void ChatRoomServer::JoinRoom(const LI::PoolString& room, int sockfd) {
+    {
+        std::unique_lock<std::mutex> lk(set_lock);
+        if (set_connfd.count(sockfd) == 0) return; // 登录后才能加入房间
+    }
+    std::string data;
+    // 房间名原样写入回复和转发报文, 含有标签字符时拒绝, 留在原来的房间
+    if (LI::proto::NeedsEscape(room)) {
+        data = std::string("<code>7</code><room>") + map_conn[sockfd].room.c_str() + "</room>";
+        Reply(sockfd, data.c_str(), data.size());
+        return;
+    }
+    LeaveRoom(sockfd);
+
+    if (room.size() > 0) {
+        const std::string& owner = ring.Owner(room.data(), room.size());
+        if (owner != node_addr) {
+            // 房间不在本节点, 客户端重新连接归属节点
+            data = "<code>8</code><node>" + owner + "</node><room>" + room.c_str() + "</room>";
+            Reply(sockfd, data.c_str(), data.size());
+            return;
+        }
+        Connection& conn = map_conn[sockfd];
+        conn.room = room;
+        rooms[conn.room].insert(sockfd);
+    }
+    data = std::string("<code>7</code><room>") + room.c_str() + "</room>";
+    Reply(sockfd, data.c_str(), data.size());
+    return;
+}
+
+// 离开房间
+void ChatRoomServer::LeaveRoom(int sockfd) {
+    auto conn = map_conn.find(sockfd);
+    if (conn == map_conn.end() || conn->second.room.empty()) return;
+    auto room = rooms.find(conn->second.room);
+    if (room != rooms.end()) {
+        room->second.erase(sockfd);
+        if (room->second.empty()) {
+            history.erase(room->first);
+            rooms.erase(room);
+        }
+    }
+    conn->second.room.clear();
+    return;
+}
+
+// 回应最近的广播
+void ChatRoomServer::SendHistory(int64_t since, int sockfd) {
+    {
+        std::unique_lock<std::mutex> lk(set_lock);
+        if (set_connfd.count(sockfd) == 0) return; // 登录后才能取
+    }
+    const Connection& conn = map_conn[sockfd];
+    auto it = history.find(conn.room);
+
+    // 从最新的往前取, 放不进一个报文时只回应较新的部分
+    const size_t limit = LI::GetMaxMsgLen() - 64;
+    size_t first = (it == history.end()) ? 0 : it->second.size();
+    size_t size = 0;
+    while (first > 0) {
+        const HistoryEntry& entry = it->second[first - 1];
+        if (entry.time <= since || size + entry.data.size() + 13 > limit) break;
+        size += entry.data.size() + 13;
+        --first;
+    }
+
+    // <code>11</code><room>房间名</room><count>n</count> 后面是 n 个 <item>code 4 报文</item>
+    const size_t count = (it == history.end()) ? 0 : it->second.size() - first;
+    std::string data = std::string("<code>11</code><room>") + conn.room.c_str() + "</room><count>" + std::to_string(count) + "</count>";
+    data.reserve(data.size() + size);
+    for (size_t i = first; count > 0 && i < it->second.size(); ++i) {
+        data.append("<item>");
+        data.append(it->second[i].data.c_str(), it->second[i].data.size());
+        data.append("</item>");
+    }
+
+    // 批量回应压缩效果最好
+    std::string packed;
+    const bool use_packed = conn.compress && LI::CompressFrame(data.data(), data.size(), packed);
+    if (zerocopy_min > 0 && (use_packed ? packed.size() : data.size()) + 4 >= zerocopy_min) {
+        std::shared_ptr<std::string> frame = std::make_shared<std::string>();
+        if (use_packed) LI::AppendPacked(*frame, packed);
+        else LI::AppendFrame(*frame, data.data(), data.size());
+        if (ZeroCopyWrite(sockfd, frame)) return;
+    }
+    if (use_packed) {
+        Reply(sockfd, packed.data(), packed.size(), true);
+    }
+    else {
+        Reply(sockfd, data.c_str(), data.size());
+    }
+    return;
+}
+
+// 更新哈希环
+void ChatRoomServer::UpdateRing() {
+    // 哈希环由配置的所有节点组成, 不随连接的断开和恢复变化. 各节点的配置相同时看到的归属一致,
+    // 不会因为对连接状态的看法不同而互相重定向; 归属节点不可用时它的房间暂时不能加入
+    ring.AddNode(node_addr);
+    for (const auto& peer : peers) {
+        ring.AddNode(peer->addr);
+    }
+
+    // 重新分配房间: 归属改变的房间, 连接都重定向到新的归属节点
+    std::string data;
+    for (auto it = rooms.begin(); it != rooms.end(); ) {
+        const std::string& owner = ring.Owner(it->first.data(), it->first.size());
+        if (owner == node_addr) {
+            ++it;
+            continue;
+        }
+        data = "<code>8</code><node>" + owner + "</node><room>" + it->first.c_str() + "</room>";
+        for (const auto& connfd : it->second) {
+            map_conn[connfd].room.clear();
+            Reply(connfd, data.c_str(), data.size());
+        }
+        logfile.Write("room", it->first.c_str(), "moved to", owner, it->second.size(), "connections.");
+        history.erase(it->first);
+        it = rooms.erase(it);
+    }
+    return;
+}
+
+// 设置令牌口令
+void ChatRoomServer::SetSecret(const std::string& secret) {
+    session_token.SetSecret(secret);
+    return;
+}
+
+// 启用 TLS
+bool ChatRoomServer::SetTls(const char* spec) {
+    std::vector<std::string> fields;
+    std::stringstream ss(spec);
+    std::string field;
+    while (std::getline(ss, field, ':')) {
+        fields.push_back(field);
+    }
+    if (fields.size() < 2 || fields.size() > 3 || (fields.size() == 3 && fields[2] != "optional")) {
+        return false;
+    }
+    if (tls_ctx.InitServer(fields[0].c_str(), fields[1].c_str()) == false) {
+        std::cout << tls_ctx.Error() << std::endl;
+        return false;
+    }
+    peer_tls.InitClient(nullptr);
+    tls_optional = (fields.size() == 3);
+    // 只接受 TLS 时在 accept 后立即注册, 否则在第一次可读时识别
+    tcp_server.SetTls(tls_optional ? nullptr : &tls_ctx);
+    return true;
+}
+
+// 选择后端
+bool ChatRoomServer::SetBackend(const char* name) {
+    if (strcmp(name, "epoll") != 0 && strcmp(name, "uring") != 0) {
+        return false;
+    }
+    use_uring = (strcmp(name, "uring") == 0);
+    return true;
+}
+
+// 启用零拷贝发送
+void ChatRoomServer::SetZeroCopy(const size_t minbytes) {
+    zerocopy_min = minbytes;
+    return;
+}
+
+// 大房间并行发送
+void ChatRoomServer::SetFanout(const size_t members, const size_t threads) {
+    fanout_min = members;
+    fanout.clear();
+    for (size_t i = 0; members > 0 && i < threads; ++i) {
+        fanout.emplace_back(new LI::ThreadPool(1));
+    }
+    return;
+}
+
+// 设置口令哈希线程池
+void ChatRoomServer::SetHashPool(const size_t threads, const size_t queue) {
+    hash_pool.reset(new LI::ThreadPool(threads));
+    hash_pool->SetCapacity(queue, LI::ThreadPool::REJECT);
+    return;
+}
+
+// 设置注册的批量写入
+void ChatRoomServer::SetBatch(const size_t rows, const int window) {
+    batch_rows = std::max((size_t)1, rows);
+    batch_window = window;
+    return;
+}
+
+// 设置已有用户名的布隆过滤器
+void ChatRoomServer::SetUserFilter(const std::shared_ptr<LI::BloomFilter>& filter) {
+    user_filter = filter;
+    if (user_filter) {
+        logfile.Write("bloom", "users", user_filter->Count(), "bits", user_filter->Bits(), "estimated", user_filter->EstimatedFalsePositiveRate());
+    }
+    return;
+}
+
+// 修改限速
+bool ChatRoomServer::SetLimit(const char* spec, const bool user) {
+    const char* colon = strchr(spec, ':');
+    if (colon == nullptr) return false;
+    const std::string name(spec, colon - spec);
+    double rate = 0, burst = 0;
+    char tail = 0;
+    if (sscanf(colon + 1, "%lf:%lf%c", &rate, &burst, &tail) != 2 || rate < 0 || (rate > 0 && burst < 1)) {
+        return false;
+    }
+    for (int i = 0; i < NCMD; ++i) {
+        if (name != cmd_table[i].name) continue;
+        LI::RateSpec& limit = user ? user_limits[i] : conn_limits[i];
+        limit.rate = rate;
+        limit.burst = burst;
+        return true;
+    }
+    return false;
+}
+
+// 限速检查
+bool ChatRoomServer::Admit(const int cmd, int sockfd) {
+    Connection& conn = map_conn[sockfd];
+    if (conn.peer >= 0) return true; // 集群节点不限速
+
+    const int64_t now = LI::TimerWheel::NowMs();
+    bool ok = conn.buckets[cmd].Take(conn_limits[cmd], now);
+    if (ok && user_limits[cmd].rate > 0) {
+        UserLimit* user = UserOf(conn);
+        if (user != nullptr) {
+            ok = user->buckets[cmd].Take(user_limits[cmd], now);
+        }
+    }
+    if (ok) {
+        conn.throttled = false;
+        return true;
+    }
+
+    ++limited[cmd];
+    if (cmd_table[cmd].reply || conn.throttled == false) {
+        std::string data = "<code>9</code><cmd>" + std::to_string(cmd) + "</cmd>";
+        Reply(sockfd, data.c_str(), data.size());
+    }
+    conn.throttled = true;
+    return false;
+}
+
+// 查找用户的令牌桶
+UserLimit* ChatRoomServer::UserOf(Connection& conn) {
+    if (conn.user != nullptr) return conn.user;
+
+    const uint32_t uid = UserIdOf(conn);
+    if (uid == 0) return nullptr;
+    conn.user = &user_limit[uid];
+    ++conn.user->conns;
+    return conn.user;
+}
+
+// 查找登录用户的编号
+uint32_t ChatRoomServer::UserIdOf(Connection& conn) {
+    if (conn.uid != 0) return conn.uid;
+
+    // 编号在第一次需要时查找一次, 之后缓存在连接中
+    std::unique_lock<std::mutex> lk(set_lock);
+    auto it = conn_user.find(conn.id);
+    if (it != conn_user.end()) conn.uid = it->second;
+    return conn.uid;
+}
+
+// 释放用户的令牌桶
+void ChatRoomServer::ReleaseUser(Connection& conn) {
+    conn.uid = 0;
+    if (conn.user == nullptr) return;
+    --conn.user->conns;
+    conn.user = nullptr;
+    return;
+}
+
+// 设置任务队列
+void ChatRoomServer::SetQueue(const size_t capacity, const LI::ThreadPool::Overflow policy) {
+    // BLOCK 策略由 epoll 线程暂停读取实现, epoll 线程本身不会阻塞在 post 上
+    thread_pool.SetCapacity(capacity, policy);
+    pause_when_full = (policy == LI::ThreadPool::BLOCK);
+    return;
+}
+
+// 记录客户端是否能解压
+void ChatRoomServer::AcceptCompress(const char* buffer, int sockfd) {
+    int compress = 0;
+    LI::GetStrFromXML(buffer, "compress", compress);
+    map_conn[sockfd].compress = (compress == 1);
+    return;
+}
+
+// 暂停读取
+void ChatRoomServer::PauseReading(int sockfd) {
+    Connection& conn = map_conn[sockfd];
+    if (conn.paused) return;
+    conn.paused = true;
+
+    if (use_uring) {
+        // 取消 recv 但不改变代数, 取消之前收到的数据照常放入接收缓冲区
+        uring.CancelFd(sockfd, URINGCANCEL);
+    }
+    else {
+        SetEvents(sockfd, conn);
+    }
+
+    if (paused_conns.empty()) {
+        timer_wheel.AddTimer(RESUMEINTERVAL, [this]() { ResumeReading(); });
+        logfile.Write("task queue full, pause reading.");
+    }
+    paused_conns.insert(sockfd);
+    return;
+}
+
+// 恢复读取
+void ChatRoomServer::ResumeReading() {
+    if (paused_conns.empty()) return;
+    // 降到一半以下再恢复, 避免在满和不满之间来回切换
+    if (thread_pool.Depth() > thread_pool.Capacity() / 2) {
+        timer_wheel.AddTimer(RESUMEINTERVAL, [this]() { ResumeReading(); });
+        return;
+    }
+
+    FdSet conns;
+    conns.swap(paused_conns);
+    logfile.Write("resume reading", conns.size(), "connections.");
+    for (const int sockfd : conns) {
+        auto it = map_conn.find(sockfd);
+        if (it == map_conn.end()) continue;
+        it->second.paused = false;
+
+        if (use_uring) {
+            // 取消还没有完成时 armed 仍为 true, 取消完成后由 OnUringRecv 重新提交
+            if (!it->second.armed && receiving) ArmRecv(sockfd);
+        }
+        else {
+            SetEvents(sockfd, it->second);
+        }
+        // 先处理缓冲区中已经收到的报文, 队列又满时会再次暂停
+        ProcessFrames(sockfd);
+    }
+    return;
+}
+
+// 添加集群节点
+bool ChatRoomServer::AddPeer(const char* addr) {
+    const char* colon = strrchr(addr, ':');
+    if (colon == nullptr || colon == addr || atoi(colon + 1) <= 0) {
+        return false;
+    }
+    std::unique_ptr<PeerNode> peer(new PeerNode);
+    peer->addr = addr;
+    peer->ip.assign(addr, colon - addr);
+    peer->port = atoi(colon + 1);
+    peers.push_back(std::move(peer));
+    return true;
+}
+
+// 查找集群节点
+int ChatRoomServer::FindPeer(const LI::PoolString& addr) const {
+    for (size_t i = 0; i < peers.size(); ++i) {
+        if (addr.compare(peers[i]->addr.c_str()) == 0) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+// 集群节点握手
+void ChatRoomServer::NodeHello(int peer, int sockfd) {
+    Connection& conn = map_conn[sockfd];
+    conn.peer = peer;
+    // 节点之间不需要登录, 连接的存活由对方的出站连接负责检测
+    timer_wheel.CancelTimer(conn.idle_timer);
+    timer_wheel.CancelTimer(conn.login_timer);
+    conn.idle_timer = conn.login_timer = 0;
+    peers[peer]->inbound = sockfd; // 节点重新连接时旧的连接作废
+    logfile.Write(sockfd, "node", peers[peer]->addr, "connected.");
+    return;
+}
+
+// 更新集群节点的在线人数
+void ChatRoomServer::NodeMembers(int members, int sockfd) {
+    PeerNode& peer = *peers[map_conn[sockfd].peer];
+    if (peer.inbound != sockfd) return;
+    peer.members = members;
+    return;
+}
+
+// 连接集群节点
+void ChatRoomServer::ConnectPeers() {
+    long members;
+    {
+        std::unique_lock<std::mutex> lk(set_lock);
+        members = (long)set_connfd.size();
+    }
+    const int64_t now = LI::TimerWheel::NowMs();
+    for (size_t i = 0; i < peers.size(); ++i) {
+        PeerNode& peer = *peers[i];
+        if (peer.state == PeerNode::CONNECTING || peer.state == PeerNode::HANDSHAKING) {
+            if (now >= peer.deadline) {
+                logfile.Write("node", peer.addr, "outbound connect timeout.");
+                ClosePeer(i);
+            }
+            continue;
+        }
+        if (peer.state != PeerNode::DISCONNECTED) continue;
+
+        struct sockaddr_in serveraddr;
+        memset(&serveraddr, 0, sizeof(serveraddr));
+        serveraddr.sin_family = AF_INET;
+        serveraddr.sin_port = htons(peer.port);
+        if (inet_pton(AF_INET, peer.ip.c_str(), &serveraddr.sin_addr) != 1) {
+            // 主机名需要解析, 会阻塞事件循环, 集群节点应当配置 ip 地址
+            struct hostent* h = gethostbyname(peer.ip.c_str());
+            if (h == nullptr) continue;
+            memcpy(&serveraddr.sin_addr, h->h_addr, h->h_length);
+        }
+        const int sockfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (sockfd < 0) continue;
+        peer.sockfd = sockfd;
+        peer.state = PeerNode::CONNECTING;
+        peer.deadline = now + PEERCONNECTTIMEOUT * 1000;
+        WatchFd(sockfd, URINGPOLL);
+        map_peerfd[sockfd] = i;
+
+        // 握手, 然后通告当前的在线人数, 连接建立后发送
+        std::string data = "<cmd>6</cmd><node>" + node_addr + "</node>";
+        AppendFrame(peer, data.data(), data.size());
+        data = "<cmd>8</cmd><members>" + std::to_string(members) + "</members>";
+        AppendFrame(peer, data.data(), data.size());
+
+        if (connect(sockfd, (struct sockaddr*)&serveraddr, sizeof(serveraddr)) == 0) {
+            PeerConnected(i);
+        }
+        else if (errno == EINPROGRESS) {
+            // 连接完成时 socket 可写
+            PeerWantWrite(i, true);
+        }
+        else {
+            ClosePeer(i);
+        }
+    }
+    timer_wheel.AddTimer(PEERRETRY * 1000, [this]() { ConnectPeers(); });
+    return;
+}
+
+// TCP 连接完成
+void ChatRoomServer::PeerConnected(size_t idx) {
+    PeerNode& peer = *peers[idx];
+    if (peer_tls.Enabled() == false) {
+        PeerReady(idx);
+        return;
+    }
+    // 有上一次连接的会话时恢复会话, 握手由可读可写事件推进
+    if (LI::TlsConnectStart(peer_tls, peer.sockfd, peer.ip.c_str()) == false) {
+        ClosePeer(idx);
+        return;
+    }
+    peer.state = PeerNode::HANDSHAKING;
+    PeerHandshake(idx);
+    return;
+}
+
+// 推进 TLS 握手
+void ChatRoomServer::PeerHandshake(size_t idx) {
+    PeerNode& peer = *peers[idx];
+    bool want_write = false;
+    const int ret = LI::TlsHandshake(peer.sockfd, &want_write);
+    if (ret < 0) {
+        logfile.Write("node", peer.addr, "TLS handshake failed.");
+        ClosePeer(idx);
+        return;
+    }
+    if (ret == 0) {
+        // 要读时等可读, 可读事件一直在关注
+        PeerWantWrite(idx, want_write);
+        return;
+    }
+    PeerReady(idx);
+    return;
+}
+
+// 出站连接可以发送
+void ChatRoomServer::PeerReady(size_t idx) {
+    PeerNode& peer = *peers[idx];
+    peer.state = PeerNode::CONNECTED;
+    logfile.Write("node", peer.addr, "outbound connected.");
+    FlushPeer(idx);
+    return;
+}
+
+// 等待出站连接可写
+void ChatRoomServer::PeerWantWrite(size_t idx, const bool on) {
+    PeerNode& peer = *peers[idx];
+    if (peer.sockfd == -1 || peer.want_write == on) return;
+    peer.want_write = on;
+    if (use_uring) {
+        // 一次性 poll, 完成时 OnUringEvent 清除 want_write
+        if (on) uring.PollOnce(peer.sockfd, POLLOUT, URINGDATA(fd_gen[peer.sockfd], peer.sockfd, URINGWRITE));
+        return;
+    }
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(struct epoll_event));
+    ev.data.fd = peer.sockfd;
+    ev.events = EPOLLIN | (on ? EPOLLOUT : 0);
+    epoll_ctl(epollfd, EPOLL_CTL_MOD, peer.sockfd, &ev);
+    return;
+}
+
+// 关闭到集群节点的出站连接
+void ChatRoomServer::ClosePeer(size_t idx) {
+    PeerNode& peer = *peers[idx];
+    if (peer.sockfd == -1) return;
+    UnwatchFd(peer.sockfd);
+    map_peerfd.erase(peer.sockfd);
+    LI::TlsDetach(peer.sockfd);
+    close(peer.sockfd);
+    if (peer.state == PeerNode::CONNECTED) {
+        logfile.Write("node", peer.addr, "outbound closed.");
+    }
+    peer.sockfd = -1;
+    peer.state = PeerNode::DISCONNECTED;
+    peer.want_write = false;
+    peer.outbuf.clear(); // 断线期间的广播不再补发
+    return;
+}
+
+// 报文放入发送缓冲区
+void ChatRoomServer::AppendFrame(PeerNode& peer, const char* data, size_t len) {
+    uint32_t ilen = htonl((uint32_t)len);
+    peer.outbuf.append((const char*)&ilen, 4);
+    peer.outbuf.append(data, len);
+    return;
+}
+
+// 转发给其他节点
+void ChatRoomServer::ForwardToPeers(const LI::PoolString& name, const LI::PoolString& str, int colorIndex) {
+    // 报文只形成一次, 字段和客户端发送的报文相同, 长度不会超过报文的最大长度
+    LI::proto::RelayCmd msg;
+    msg.name = name;
+    msg.color = colorIndex;
+    msg.message = str;
+    LI::PoolString data;
+    msg.AppendTo(data);
+
+    for (size_t i = 0; i < peers.size(); ++i) {
+        PeerNode& peer = *peers[i];
+        // 没有连接或没有用户在线的节点不需要转发
+        if (peer.state != PeerNode::CONNECTED || peer.members == 0) continue;
+        AppendFrame(peer, data.c_str(), data.size());
+        if (peer.outbuf.size() >= PEERBATCH) {
+            FlushPeer(i);
+        }
+    }
+    return;
+}
+
+// 发送一个节点的缓冲区
+void ChatRoomServer::FlushPeer(size_t idx) {
+    PeerNode& peer = *peers[idx];
+    if (peer.state != PeerNode::CONNECTED) return;
+    size_t sent = 0;
+    while (sent < peer.outbuf.size()) {
+        const ssize_t n = LI::SendSome(peer.sockfd, peer.outbuf.data() + sent, peer.outbuf.size() - sent);
+        if (n > 0) {
+            sent += n;
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        logfile.Write("node", peer.addr, "send failed.");
+        ClosePeer(idx);
+        return;
+    }
+    // 没有发送的部分留在缓冲区开头, 下次从同样的数据开始发送(TLS 的要求); 全部发送时保留容量, 稳定后不再分配内存
+    if (sent > 0) peer.outbuf.erase(0, sent);
+    if (peer.outbuf.size() > PEEROUTMAX) {
+        logfile.Write("node", peer.addr, "backlog over", PEEROUTMAX, "bytes.");
+        ClosePeer(idx);
+        return;
+    }
+    PeerWantWrite(idx, !peer.outbuf.empty());
+    return;
+}
+
+// 发送所有节点的缓冲区
+void ChatRoomServer::FlushPeers() {
+    if (peers.empty()) return;
+
+    long members;
+    {
+        std::unique_lock<std::mutex> lk(set_lock);
+        members = (long)set_connfd.size();
+    }
+    if (members != announced) {
+        std::string data = "<cmd>8</cmd><members>" + std::to_string(members) + "</members>";
+        for (auto& peer : peers) {
+            if (peer->state == PeerNode::DISCONNECTED) continue;
+            AppendFrame(*peer, data.data(), data.size());
+        }
+        announced = members;
+    }
+
+    for (size_t i = 0; i < peers.size(); ++i) {
+        FlushPeer(i);
+    }
+    return;
+}
+
+// 加入分片组
+void ChatRoomServer::JoinShards(ShardGroup* group, const size_t id, const int cpu) {
+    shards = group;
+    shard_id = id;
+    shard_cpu = cpu;
+    wakefd = group->wakefd[id];
+    tcp_server.SetReusePort(true);
+    if (cpu >= 0) {
+        thread_pool.SetAffinity(cpu);
+    }
+    // 客户端重连时可能连到任何一个分片
+    if (id == 0) group->token_key = session_token.ExportKey();
+    else session_token.ImportKey(group->token_key);
+    return;
+}
+
+// 转来信号
+void ChatRoomServer::PostSignal(const int signo) {
+    shard_signal.store(signo);
+    const uint64_t one = 1;
+    if (write(wakefd, &one, sizeof(one)) != sizeof(one)) {
+        // 计数器满时已经可读
+    }
+    return;
+}
+
+// 转发给其他分片
+void ChatRoomServer::RelayToShards(const LI::PoolString& room, int64_t time, const LI::PoolString& data) {
+    // 所有目标分片共用一份, 只增加引用计数
+    ShardMsgPtr msg = std::allocate_shared<ShardMsg>(LI::PoolAllocator<ShardMsg>(), ShardMsg{room, time, data});
+    for (size_t to = 0; to < shards->count; ++to) {
+        if (to == shard_id) continue;
+        ShardLink& link = shards->Link(shard_id, to);
+        // 前面还有暂存的广播时也暂存, 保持顺序
+        ShardMsgPtr copy = msg;
+        if (!link.backlog.empty() || link.ring.Push(std::move(copy)) == false) {
+            link.backlog.push_back(std::move(copy));
+        }
+        link.wake = true;
+        ++shard_out;
+    }
+    return;
+}
+
+// 被唤醒
+void ChatRoomServer::OnShardWake() {
+    uint64_t count;
+    if (read(wakefd, &count, sizeof(count)) != sizeof(count)) {
+        // 非阻塞, 计数已经被上一次读取清零, 环中的广播照常处理
+    }
+    const int signo = shard_signal.exchange(0);
+    if (signo != 0) {
+        OnSignal(signo);
+    }
+
+    ShardMsgPtr msg;
+    for (size_t from = 0; from < shards->count && running; ++from) {
+        if (from == shard_id) continue;
+        ShardLink& link = shards->Link(from, shard_id);
+        while (link.ring.Pop(msg)) {
+            ++shard_in;
+            // 本分片中没有人的房间不需要发送, 也不保留最近广播
+            const FdSet* members = nullptr;
+            if (!msg->room.empty()) {
+                auto room = rooms.find(msg->room);
+                if (room == rooms.end()) continue;
+                members = &room->second;
+            }
+            // 各分片的广播到达的顺序和时间的顺序可能不同, 按时间插入
+            History& hist = history[msg->room];
+            auto pos = hist.end();
+            while (pos != hist.begin() && (pos - 1)->time > msg->time) --pos;
+            hist.insert(pos, HistoryEntry{msg->time, msg->data});
+            if (hist.size() > HISTORYSIZE) hist.pop_front();
+
+            Deliver(members, msg->data, -1);
+        }
+        msg.reset();
+    }
+    return;
 }
 
+// 唤醒其他分片
+void ChatRoomServer::FlushShards() {
+    if (shards == nullptr) return;
+
+    bool backlog = false;
+    for (size_t to = 0; to < shards->count; ++to) {
+        if (to == shard_id) continue;
+        ShardLink& link = shards->Link(shard_id, to);
+        // 目标分片取出了一部分, 暂存的依次放入
+        while (!link.backlog.empty() && link.ring.Push(std::move(link.backlog.front()))) {
+            link.backlog.pop_front();
+            link.wake = true;
+        }
+        if (!link.backlog.empty()) backlog = true;
+        // 每轮最多唤醒一次, 一次唤醒处理环中所有的广播
+        if (link.wake) {
+            link.wake = false;
+            const uint64_t one = 1;
+            if (write(shards->wakefd[to], &one, sizeof(one)) != sizeof(one)) {
+                // 计数器满时已经可读
+            }
+        }
+    }
+    if (backlog && !shard_retry) {
+        shard_retry = true;
+        timer_wheel.AddTimer(SHARDRETRY, [this]() { shard_retry = false; });
+    }
+    return;
+}
+
+std::shared_ptr<ChatRoomServer> crs_ptr;
+
+
+int main(int argc, char const *argv[])
+{
+    // 可选参数: takeover 热重启; peers=ip:port,ip:port 集群中的其他节点; secret=口令 签发会话令牌的口令;
+    // limit=命令名:每秒个数:突发个数 每个连接的限速, userlimit=... 每个用户的限速, 可以有多个;
+    // queue=容量:reject|block|dropoldest 线程池任务队列的容量和队列满时的策略;
+    // tls=证书文件:私钥文件[:optional] 使用 TLS, optional 表示同时接受明文连接;
+    // backend=epoll|uring 事件循环的后端, uring 不能和 tls 同时使用;
+    // zerocopy=字节数 不小于这个长度的广播用 MSG_ZEROCOPY 发送, 只用于 epoll 后端;
+    // cores=分片数 每个分片一个事件循环和线程池, 绑定在一个 CPU 上, 不能和 takeover、peers 同时使用;
+    // fanout=人数[:线程数] 不少于这个人数的房间的广播由多个分发线程并行发送, 只用于 epoll 后端, 不能和 zerocopy 同时使用;
+    // hash=线程数[:队列容量] 计算口令哈希(scrypt)的线程数和排队的上限, 缺省一半的 CPU 和 16;
+    // batch=行数[:毫秒] 注册合并写入数据库时一批最多的行数和等待时间, 缺省 100 行、不等待, 1 表示逐个写入;
+    // bloom=用户数 已有用户名的布隆过滤器预计的用户数, 缺省 1048576, 0 表示不使用, 不能和 peers 同时使用
+    bool takeover = false;
+    const char* cores = nullptr;
+    const char* fanout = nullptr;
+    const char* hash = nullptr;
+    const char* batch = nullptr;
+    const char* bloom = nullptr;
+    const char* backend = nullptr;
+    const char* zerocopy = nullptr;
+    const char* queue = nullptr;
+    const char* tls = nullptr;
+    std::vector<std::pair<const char*, bool>> limits;
+    const char* peerlist = nullptr;
+    const char* secret = nullptr;
+    bool badarg = (argc < 3);
+    for (int i = 3; i < argc; ++i) {
+        if (strcmp(argv[i], "takeover") == 0) takeover = true;
+        else if (strncmp(argv[i], "peers=", 6) == 0) peerlist = argv[i] + 6;
+        else if (strncmp(argv[i], "secret=", 7) == 0) secret = argv[i] + 7;
+        else if (strncmp(argv[i], "limit=", 6) == 0) limits.emplace_back(argv[i] + 6, false);
+        else if (strncmp(argv[i], "userlimit=", 10) == 0) limits.emplace_back(argv[i] + 10, true);
+        else if (strncmp(argv[i], "queue=", 6) == 0) queue = argv[i] + 6;
+        else if (strncmp(argv[i], "tls=", 4) == 0) tls = argv[i] + 4;
+        else if (strncmp(argv[i], "backend=", 8) == 0) backend = argv[i] + 8;
+        else if (strncmp(argv[i], "zerocopy=", 9) == 0) zerocopy = argv[i] + 9;
+        else if (strncmp(argv[i], "cores=", 6) == 0) cores = argv[i] + 6;
+        else if (strncmp(argv[i], "fanout=", 7) == 0) fanout = argv[i] + 7;
+        else if (strncmp(argv[i], "hash=", 5) == 0) hash = argv[i] + 5;
+        else if (strncmp(argv[i], "batch=", 6) == 0) batch = argv[i] + 6;
+        else if (strncmp(argv[i], "bloom=", 6) == 0) bloom = argv[i] + 6;
+        else badarg = true;
+    }
+    if (badarg) {
+        std::cout << "No ip and port" << std::endl;
+        std::cout << "Using example: ./chatRoomServer 192.168.1.101 5005 " << std::endl;
+        std::cout << "Hot restart:   ./chatRoomServer 192.168.1.101 5005 takeover" << std::endl;
+        std::cout << "Cluster:       ./chatRoomServer 192.168.1.101 5005 peers=192.168.1.102:5005,192.168.1.103:5005 secret=xxx" << std::endl;
+        std::cout << "Rate limits:   ./chatRoomServer 192.168.1.101 5005 limit=Message:10:20 userlimit=Message:20:40" << std::endl;
+        std::cout << "Task queue:    ./chatRoomServer 192.168.1.101 5005 queue=1024:block (reject|block|dropoldest)" << std::endl;
+        std::cout << "TLS:           ./chatRoomServer 192.168.1.101 5005 tls=server.crt:server.key[:optional]" << std::endl;
+        std::cout << "io_uring:      ./chatRoomServer 192.168.1.101 5005 backend=uring" << std::endl;
+        std::cout << "Zero-copy:     ./chatRoomServer 192.168.1.101 5005 zerocopy=16384" << std::endl;
+        std::cout << "Per-core:      ./chatRoomServer 192.168.1.101 5005 cores=4" << std::endl;
+        std::cout << "Fan-out:       ./chatRoomServer 192.168.1.101 5005 fanout=1000[:4]" << std::endl;
+        std::cout << "Password hash: ./chatRoomServer 192.168.1.101 5005 hash=2[:16]" << std::endl;
+        std::cout << "Group commit:  ./chatRoomServer 192.168.1.101 5005 batch=100[:5]" << std::endl;
+        std::cout << "Bloom filter:  ./chatRoomServer 192.168.1.101 5005 bloom=1048576 (0 disables)" << std::endl;
+        return -1;
+    }
+    signal(SIGPIPE, SIG_IGN); // 对端关闭后写 socket 不退出
+
+    // 屏蔽 SIGINT/SIGTERM, 由事件循环中的 signalfd 处理
+    // 必须在创建线程池之前屏蔽, 工作线程会继承信号屏蔽字
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigprocmask(SIG_BLOCK, &mask, nullptr);
+
+    // 分片数决定创建几个服务端对象, 先于其他参数检查
+    unsigned long nshards = 1;
+    if (cores != nullptr) {
+        char tail;
+        if (sscanf(cores, "%lu%c", &nshards, &tail) != 1 || nshards == 0 || nshards > MAXSHARDS) {
+            std::cout << "Invalid cores: " << cores << std::endl;
+            return -1;
+        }
+        // 分片不能单独交接; 集群节点之间的转发和在线人数按节点计算, 不能拆到多个分片
+        if (nshards > 1 && takeover) {
+            std::cout << "cores does not support takeover." << std::endl;
+            return -1;
+        }
+        if (nshards > 1 && peerlist != nullptr) {
+            std::cout << "cores does not support peers." << std::endl;
+            return -1;
+        }
+    }
+    // 分片依次绑定允许本进程使用的 CPU, 分片比 CPU 多时循环使用
+    std::vector<int> cpus;
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, &allowed)) cpus.push_back(cpu);
+        }
+    }
+    std::unique_ptr<ShardGroup> group;
+    if (nshards > 1) {
+        group.reset(new ShardGroup(nshards));
+    }
+
+    // 已有用户名的布隆过滤器, 所有分片共用. 集群的其他节点注册的用户不在本节点的过滤器中, 集群中缺省不使用
+    std::shared_ptr<LI::BloomFilter> user_filter;
+    unsigned long bloom_capacity = (peerlist == nullptr) ? BLOOMCAPACITY : 0;
+    if (bloom != nullptr) {
+        char tail;
+        if (sscanf(bloom, "%lu%c", &bloom_capacity, &tail) != 1) {
+            std::cout << "Invalid bloom: " << bloom << std::endl;
+            return -1;
+        }
+        if (bloom_capacity > 0 && peerlist != nullptr) {
+            std::cout << "bloom does not support peers." << std::endl;
+            return -1;
+        }
+    }
+    if (bloom_capacity > 0) {
+        user_filter = std::make_shared<LI::BloomFilter>(bloom_capacity, BLOOMFPRATE);
+        // 读取失败时不使用, 否则已有的用户无法登录
+        if (UserSQL().ForEachUser([&user_filter](const char* name, size_t len) { user_filter->Add(name, len); }) == false) {
+            std::cout << "Loading usernames failed, bloom filter disabled." << std::endl;
+            user_filter.reset();
+        }
+    }
+
+    std::vector<std::shared_ptr<ChatRoomServer>> servers;
+    for (size_t shard = 0; shard < nshards; ++shard) {
+        // 线程池的线程平均分到各个分片
+        std::shared_ptr<ChatRoomServer> crs = (nshards > 1) ? std::make_shared<ChatRoomServer>((5 + nshards - 1) / nshards) : std::make_shared<ChatRoomServer>();
+        servers.push_back(crs);
+
+        if (queue != nullptr) {
+            char policy[16] = {0};
+            unsigned long capacity = 0;
+            if (sscanf(queue, "%lu:%15s", &capacity, policy) != 2) policy[0] = '\0';
+            if (strcmp(policy, "reject") == 0) crs->SetQueue(capacity, LI::ThreadPool::REJECT);
+            else if (strcmp(policy, "block") == 0) crs->SetQueue(capacity, LI::ThreadPool::BLOCK);
+            else if (strcmp(policy, "dropoldest") == 0) crs->SetQueue(capacity, LI::ThreadPool::DROPOLDEST);
+            else {
+                std::cout << "Invalid queue: " << queue << std::endl;
+                return -1;
+            }
+        }
+
+        if (tls != nullptr && crs->SetTls(tls) == false) {
+            std::cout << "Invalid tls: " << tls << std::endl;
+            return -1;
+        }
+
+        if (backend != nullptr && crs->SetBackend(backend) == false) {
+            std::cout << "Invalid backend: " << backend << std::endl;
+            return -1;
+        }
+        if (backend != nullptr && strcmp(backend, "uring") == 0 && tls != nullptr) {
+            std::cout << "backend=uring does not support tls." << std::endl;
+            return -1;
+        }
+        if (zerocopy != nullptr) {
+            char tail;
+            unsigned long minbytes = 0;
+            if (sscanf(zerocopy, "%lu%c", &minbytes, &tail) != 1) {
+                std::cout << "Invalid zerocopy: " << zerocopy << std::endl;
+                return -1;
+            }
+            // io_uring 的 recv 在错误队列有通知时会反复被唤醒
+            if (minbytes > 0 && backend != nullptr && strcmp(backend, "uring") == 0) {
+                std::cout << "backend=uring does not support zerocopy." << std::endl;
+                return -1;
+            }
+            crs->SetZeroCopy(minbytes);
+        }
+
+        if (fanout != nullptr) {
+            // 缺省每个 CPU 一个分发线程, 分片模式中分到各个分片
+            unsigned long members = 0, threads = std::max(1u, std::thread::hardware_concurrency());
+            char tail;
+            bool ok = (sscanf(fanout, "%lu%c", &members, &tail) == 1);
+            if (ok == false) {
+                ok = (sscanf(fanout, "%lu:%lu%c", &members, &threads, &tail) == 2 && threads > 0);
+            }
+            if (ok == false) {
+                std::cout << "Invalid fanout: " << fanout << std::endl;
+                return -1;
+            }
+            // io_uring 后端的广播已经一次提交给内核
+            if (members > 0 && backend != nullptr && strcmp(backend, "uring") == 0) {
+                std::cout << "backend=uring does not support fanout." << std::endl;
+                return -1;
+            }
+            // 零拷贝在 epoll 线程中直接发送, 会越过分发线程中排队的报文
+            if (members > 0 && zerocopy != nullptr && strtoul(zerocopy, nullptr, 10) > 0) {
+                std::cout << "zerocopy does not support fanout." << std::endl;
+                return -1;
+            }
+            crs->SetFanout(members, std::max(1ul, threads / nshards));
+        }
+
+        if (hash != nullptr || nshards > 1) {
+            // 分片模式中口令哈希线程分到各个分片, 合计不超过设置的个数
+            unsigned long threads = std::max(1u, std::thread::hardware_concurrency() / 2), capacity = HASHQUEUE;
+            char tail;
+            bool ok = (hash == nullptr || sscanf(hash, "%lu%c", &threads, &tail) == 1);
+            if (ok == false) {
+                ok = (sscanf(hash, "%lu:%lu%c", &threads, &capacity, &tail) == 2);
+            }
+            if (ok == false || threads == 0) {
+                std::cout << "Invalid hash: " << hash << std::endl;
+                return -1;
+            }
+            crs->SetHashPool(std::max(1ul, threads / nshards), capacity);
+        }
+
+        if (batch != nullptr) {
+            unsigned long rows = 0, window = 0;
+            char tail;
+            bool ok = (sscanf(batch, "%lu%c", &rows, &tail) == 1);
+            if (ok == false) {
+                ok = (sscanf(batch, "%lu:%lu%c", &rows, &window, &tail) == 2 && window <= 1000);
+            }
+            if (ok == false || rows == 0) {
+                std::cout << "Invalid batch: " << batch << std::endl;
+                return -1;
+            }
+            crs->SetBatch(rows, (int)window);
+        }
+
+        for (const auto& limit : limits) {
+            if (crs->SetLimit(limit.first, limit.second) == false) {
+                std::cout << "Invalid limit: " << limit.first << std::endl;
+                return -1;
+            }
+        }
+
+        if (peerlist != nullptr) {
+            std::stringstream ss(peerlist);
+            std::string addr;
+            while (std::getline(ss, addr, ',')) {
+                if (!addr.empty() && crs->AddPeer(addr.c_str()) == false) {
+                    std::cout << "Invalid peer: " << addr << std::endl;
+                    return -1;
+                }
+            }
+        }
 
-// 捕获信号
-void Catch_ctrl_c(int sig) {
-    if (crs_ptr->epollfd != -1) {
-        close(crs_ptr->epollfd);
+        // 分片各自写一个日志文件, 第一个分片使用原来的文件名
+        const std::string logname = (shard == 0) ? "../log/test.log" : "../log/test." + std::to_string(shard) + ".log";
+        crs->InitLogFile(logname.c_str(), std::ios::app);
+        crs->SetUserFilter(user_filter);
+        if (group) {
+            crs->JoinShards(group.get(), shard, cpus.empty() ? -1 : cpus[shard % cpus.size()]);
+        }
+        if (takeover) {
+            if (crs->TakeOver(argv[1], atoi(argv[2])) == false) {
+                std::cout << "Takeover failed." << std::endl;
+                return -1;
+            }
+        }
+        else {
+            crs->InitServer(argv[1], atoi(argv[2]));
+        }
+        // 在 TakeOver 之后设置, 配置的口令优先于旧进程的密钥
+        if (secret != nullptr) {
+            crs->SetSecret(secret);
+        }
     }
+    crs_ptr = servers[0];
 
-    crs_ptr->logfile.Close();
+    if (nshards == 1) {
+        crs_ptr->runServer();
+        return 0;
+    }
 
-    exit(sig);
-}
\ No newline at end of file
+    // 每个分片一个线程, 信号屏蔽字已经继承; 信号由 main 线程等待, 转给所有分片
+    std::atomic<size_t> stopped(0);
+    std::vector<std::thread> threads;
+    for (const auto& crs : servers) {
+        threads.emplace_back([crs, &stopped]() {
+            crs->runServer();
+            ++stopped;
+        });
+    }
+    while (stopped < servers.size()) {
+        struct timespec timeout = {0, 100 * 1000 * 1000};
+        const int signo = sigtimedwait(&mask, nullptr, &timeout);
+        if (signo > 0) {
+            for (const auto& crs : servers) {
+                crs->PostSignal(signo);
+            }
+        }
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    // 分片组在所有分片之后释放
+    crs_ptr.reset();
+    servers.clear();
+    return 0;
+}
@@ -1,35 +1,264 @@
 // 自己网络库实现源码
 #include "cppNetWork.h"
+#include "Compress.h"
+#include "Tls.h"
+#include <random>
+#include <atomic>
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
 // 消息体长度
 #define MSGBODYLEN 4
+// 报文体长度的缺省上限
+#define DEFMAXMSGLEN (64 * 1024)
+// 长度头的最高位表示报文体是压缩的
+#define FRAMECOMPRESSED 0x80000000u
+// 短于这个长度的报文不压缩, 省下的字节抵不上压缩的开销
+#define COMPRESSMIN 256
+// TLS 握手的超时时间, 单位: s
+#define TLSHANDSHAKE 5
+// 发送的超时时间, 单位: ms
+#define WRITETIMEOUT (5 * 1000)
+// 查找标签时一次扫描的块的最大长度, 也是一次取出的位置的最大个数
+#define TAGBLOCK 64
+// 查找标签时第一次用 strnlen 确认的长度, 之后每次加倍, 只确认要扫描的部分, 不先求整个报文的长度
+#define TAGWINDOW 256
+// SendFdData 每个报文的最大长度
+#define FDCHUNK (64 * 1024)
 
 namespace LI {
 
 // ------------------ 格式解析全局函数 ---------------------------
-bool GetStrFromXML(const char* formBuffer, const char* labelname, std::string& RtnValue) {
-    // 标签开始格式
-    std::string startOflabelname("<");
-    startOflabelname.append(labelname);
-    startOflabelname += ">";
-    // 标签结束格式
-    std::string endOflabelname("</");
-    endOflabelname.append(labelname);
-    endOflabelname += ">";
-
-    // 定位标签
-    const char* start = strstr(formBuffer, startOflabelname.c_str());
+// 找可能是标签开头的 '<': 开始标签的后两个字节是 pat[0] pat[1](pat[1] 为 0 时只比较 pat[0]), 结束标签是 '/' pat[0].
+// 在 [s + *offset, s + len) 中找, 这些字节都不是 0, s[len] 可以读取(是结尾的 0 或者报文还没有结束);
+// 找到的第一个块中的候选位置存入 pos(相对 s 的偏移), pos 至少能存放 TAGBLOCK 个.
+// 返回找到的个数, *offset 更新为下一次开始的位置; 到 len 时 *done 置为 true. 按块读取时不读 s[len] 之后的字节,
+// 逐个字节比较时只在 s[len] 不是 0 时读 s[len + 1], 不会读到结尾的 0 之后
+typedef size_t (*TagScanner)(const char* s, const size_t len, const char* pat, size_t* offset, bool* done, uint32_t* pos);
+
+// 逐个字节比较, 也用于向量版本最后不足一个块的部分. s[i + 1] 是 0 时不会再读 s[i + 2]
+static size_t ScanTagsScalar(const char* s, const size_t len, const char* pat, size_t* offset, bool* done, uint32_t* pos) {
+    for (size_t i = *offset; i < len; ++i) {
+        if (s[i] == '<' && ((s[i + 1] == pat[0] && (pat[1] == '\0' || s[i + 2] == pat[1])) || (s[i + 1] == '/' && s[i + 2] == pat[0]))) {
+            pos[0] = (uint32_t)i;
+            *offset = i + 1;
+            return 1;
+        }
+    }
+    *offset = len;
+    *done = true;
+    return 0;
+}
+
+#ifdef __SSE2__
+// 候选位置的位掩码转成位置; 返回个数
+static inline size_t EmitTags(uint64_t cand, const size_t base, uint32_t* pos) {
+    size_t n = 0;
+    while (cand != 0) {
+        pos[n++] = (uint32_t)(base + __builtin_ctzll(cand));
+        cand &= cand - 1;
+    }
+    return n;
+}
+
+// 块中每个字节是否是 '<' 且后两个字节(从 s + i + 1 和 s + i + 2 不对齐读取)符合开始标签或结束标签
+static inline uint32_t CandidatesSSE2(const char* p, const __m128i c1, const __m128i c2, const __m128i any2) {
+    const __m128i a1 = _mm_loadu_si128((const __m128i*)(p + 1));
+    const __m128i a2 = _mm_loadu_si128((const __m128i*)(p + 2));
+    const __m128i open = _mm_and_si128(_mm_cmpeq_epi8(a1, c1), _mm_or_si128(_mm_cmpeq_epi8(a2, c2), any2));
+    const __m128i close = _mm_and_si128(_mm_cmpeq_epi8(a1, _mm_set1_epi8('/')), _mm_cmpeq_epi8(a2, c1));
+    return (uint32_t)_mm_movemask_epi8(_mm_or_si128(open, close));
+}
+
+// 每次 16 字节, 没有 '<' 时只做一次判断. 读取到 s + i + 18, 所以 i + 17 <= len 时才按块处理, 剩下的逐个字节比较
+static size_t ScanTagsSSE2(const char* s, const size_t len, const char* pat, size_t* offset, bool* done, uint32_t* pos) {
+    const __m128i lt = _mm_set1_epi8('<');
+    const __m128i c1 = _mm_set1_epi8(pat[0]);
+    const __m128i c2 = _mm_set1_epi8(pat[1]);
+    const __m128i any2 = _mm_set1_epi8((pat[1] == '\0') ? -1 : 0);
+    size_t i = *offset;
+    for (; i + 17 <= len; i += 16) {
+        const uint32_t ltmask = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(s + i)), lt));
+        if (ltmask == 0) {
+            continue;
+        }
+        const uint32_t cand = ltmask & CandidatesSSE2(s + i, c1, c2, any2);
+        if (cand != 0) {
+            *offset = i + 16;
+            return EmitTags(cand, i, pos);
+        }
+    }
+    *offset = i;
+    return ScanTagsScalar(s, len, pat, offset, done, pos);
+}
+
+// 同 CandidatesSSE2, 一次 32 字节
+__attribute__((target("avx2")))
+static inline uint32_t CandidatesAVX2(const char* p, const __m256i c1, const __m256i c2, const __m256i any2) {
+    const __m256i a1 = _mm256_loadu_si256((const __m256i*)(p + 1));
+    const __m256i a2 = _mm256_loadu_si256((const __m256i*)(p + 2));
+    const __m256i open = _mm256_and_si256(_mm256_cmpeq_epi8(a1, c1), _mm256_or_si256(_mm256_cmpeq_epi8(a2, c2), any2));
+    const __m256i close = _mm256_and_si256(_mm256_cmpeq_epi8(a1, _mm256_set1_epi8('/')), _mm256_cmpeq_epi8(a2, c1));
+    return (uint32_t)_mm256_movemask_epi8(_mm256_or_si256(open, close));
+}
+
+// 主循环每次检查 64 字节, 没有 '<' 时只做一次判断; 有 '<' 时才比较后两个字节. 不足 64 字节时按 32 字节, 最后逐个字节比较
+__attribute__((target("avx2")))
+static size_t ScanTagsAVX2(const char* s, const size_t len, const char* pat, size_t* offset, bool* done, uint32_t* pos) {
+    const __m256i lt = _mm256_set1_epi8('<');
+    const __m256i c1 = _mm256_set1_epi8(pat[0]);
+    const __m256i c2 = _mm256_set1_epi8(pat[1]);
+    const __m256i any2 = _mm256_set1_epi8((pat[1] == '\0') ? -1 : 0);
+    size_t i = *offset;
+    for (; i + 65 <= len; i += 64) {
+        const __m256i v0 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(s + i)), lt);
+        const __m256i v1 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(s + i + 32)), lt);
+        const __m256i any = _mm256_or_si256(v0, v1);
+        if (_mm256_testz_si256(any, any)) {
+            continue;
+        }
+        const uint64_t cand = ((uint64_t)((uint32_t)_mm256_movemask_epi8(v0) & CandidatesAVX2(s + i, c1, c2, any2))) |
+                              ((uint64_t)((uint32_t)_mm256_movemask_epi8(v1) & CandidatesAVX2(s + i + 32, c1, c2, any2)) << 32);
+        if (cand != 0) {
+            *offset = i + 64;
+            return EmitTags(cand, i, pos);
+        }
+    }
+    for (; i + 33 <= len; i += 32) {
+        const uint32_t ltmask = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(s + i)), lt));
+        const uint32_t cand = (ltmask == 0) ? 0 : ltmask & CandidatesAVX2(s + i, c1, c2, any2);
+        if (cand != 0) {
+            *offset = i + 32;
+            return EmitTags(cand, i, pos);
+        }
+    }
+    *offset = i;
+    return ScanTagsScalar(s, len, pat, offset, done, pos);
+}
+#endif
+
+// 可以选择的扫描函数
+static const struct {
+    const char* name;
+    TagScanner scanner;
+} kTagScanners[] = {
+    {"scalar", ScanTagsScalar},
+#ifdef __SSE2__
+    {"sse2", ScanTagsSSE2},
+    {"avx2", ScanTagsAVX2},
+#endif
+};
+
+// 当前使用的扫描函数, 缺省按 CPU 支持的指令集选择: AVX2, 其次 SSE2
+static std::atomic<TagScanner>& CurrentTagScanner() {
+    static std::atomic<TagScanner> scanner([]() -> TagScanner {
+#ifdef __SSE2__
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            return ScanTagsAVX2;
+        }
+        return ScanTagsSSE2;
+#else
+        return ScanTagsScalar;
+#endif
+    }());
+    return scanner;
+}
+
+bool SetXMLScanner(const char* name) {
+    if (strcmp(name, "auto") == 0) {
+#ifdef __SSE2__
+        __builtin_cpu_init();
+        CurrentTagScanner().store(__builtin_cpu_supports("avx2") ? ScanTagsAVX2 : ScanTagsSSE2);
+#else
+        CurrentTagScanner().store(ScanTagsScalar);
+#endif
+        return true;
+    }
+    for (const auto& entry : kTagScanners) {
+        if (strcmp(entry.name, name) != 0) {
+            continue;
+        }
+#ifdef __SSE2__
+        __builtin_cpu_init();
+        if (entry.scanner == ScanTagsAVX2 && __builtin_cpu_supports("avx2") == 0) {
+            return false;
+        }
+#endif
+        CurrentTagScanner().store(entry.scanner);
+        return true;
+    }
+    return false;
+}
+
+// 判断 p 处的标签: 1-<labelname>; 2-</labelname>; 0-其他. 标签名中没有 0, 报文先结束时在 0 处不相等
+static inline int ClassifyTag(const char* p, const char* labelname, const size_t n) {
+    const int kind = (p[1] == '/') ? 2 : 1;
+    const char* q = p + kind;
+    for (size_t i = 0; i < n; ++i) {
+        if (q[i] != labelname[i]) return 0;
+    }
+    return (q[n] == '>') ? kind : 0;
+}
+
+// 定位标签的内容, 成功时 start 指向内容开头, len 为内容长度.
+// 开始标签取整个报文中的第一个, 结束标签取它之后的第一个. 每次用 strnlen 确认一段的长度, 在这一段中按块扫描可能是标签开头的 '<',
+// 逐个判断, 两个都找到就停止; 字段在报文前面时不需要求整个报文的长度
+static bool LocateXML(const char* formBuffer, const char* labelname, const char** start, int* len) {
+    const TagScanner scanner = CurrentTagScanner().load(std::memory_order_relaxed);
+    const size_t n = strlen(labelname);
+    size_t window = TAGWINDOW;
+    size_t total = strnlen(formBuffer, window);
+    // 开始标签 '<' 之后的两个字节
+    const char pat[2] = {(n > 0) ? labelname[0] : '>', (n > 1) ? labelname[1] : (n == 1 ? '>' : '\0')};
+    const char* begin = nullptr;
     const char* end = nullptr;
-    if (start != nullptr) {
-        end = strstr(formBuffer, endOflabelname.c_str());
+    uint32_t pos[TAGBLOCK];
+    size_t offset = 0;
+    bool done = false;
+    while (begin == nullptr || end == nullptr) {
+        if (done) {
+            if (formBuffer[total] == '\0') break;
+            window *= 2;
+            total += strnlen(formBuffer + total, window);
+            done = false;
+        }
+        const size_t count = scanner(formBuffer, total, pat, &offset, &done, pos);
+        for (size_t i = 0; i < count; ++i) {
+            const char* p = formBuffer + pos[i];
+            const int kind = ClassifyTag(p, labelname, n);
+            if (kind == 1 && begin == nullptr) begin = p;
+            else if (kind == 2 && begin != nullptr && end == nullptr) end = p;
+        }
+    }
+
+    if (begin == nullptr || end == nullptr) {
+        return false;
     }
 
-    if (start == nullptr || end == nullptr) {
+    *start = begin + n + 2;
+    *len = end - begin - (n + 2); // 内容长度
+    return true;
+}
+
+bool GetStrFromXML(const char* formBuffer, const char* labelname, std::string& RtnValue) {
+    const char* start = nullptr;
+    int m_ValueLen = 0;
+    if (LocateXML(formBuffer, labelname, &start, &m_ValueLen) == false) {
         return false;
     }
 
-    int m_ValueLen = end - start - startOflabelname.size(); // 内容长度
+    RtnValue.assign(start, m_ValueLen); // 拼接内容
+    return true;
+}
+bool GetStrFromXML(const char* formBuffer, const char* labelname, PoolString& RtnValue) {
+    const char* start = nullptr;
+    int m_ValueLen = 0;
+    if (LocateXML(formBuffer, labelname, &start, &m_ValueLen) == false) {
+        return false;
+    }
 
-    RtnValue.assign(start + startOflabelname.size(), m_ValueLen); // 拼接内容
+    RtnValue.assign(start, m_ValueLen);
     return true;
 }
 bool GetStrFromXML(const char* formBuffer, const char* labelname, int& RtnValue) {
@@ -157,6 +386,19 @@ void LocalTime(char* stime, const int timetvl) {
     return;
 }
 
+int BackoffMs(const int basems, const int maxms, const int attempt) {
+    int64_t delay = basems > 0 ? basems : 1;
+    for (int i = 0; i < attempt && delay < maxms; ++i) {
+        delay *= 2;
+    }
+    if (delay > maxms) delay = maxms;
+
+    // 每个线程一个随机数发生器, 不需要加锁
+    thread_local std::mt19937 gen(std::random_device{}());
+    std::uniform_int_distribution<int64_t> dist(delay / 2, delay);
+    return (int)dist(gen);
+}
+
 // ------------------ /获取系统时间全局函数 ---------------------------
 
 
@@ -180,14 +422,20 @@ void LocalTime(char* stime, const int timetvl) {
 TcpClient::TcpClient(): m_sockfd(-1), 
                         m_port(0), 
                         m_btimeout(false), 
-                        m_buflen(0)
+                        m_buflen(0),
+                        m_tls(nullptr)
 {
     memset(m_ip, 0, sizeof(m_ip));
 }
 
+void TcpClient::SetTls(TlsContext* tls) {
+    m_tls = tls;
+}
+
 bool TcpClient::ConnectToServer(const char* ip, const int port) {
     // 如果上一个连接还存在就先close
     if (m_sockfd != -1) {
+        TlsDetach(m_sockfd);
         close(m_sockfd);
         m_sockfd = -1;
     }
@@ -223,6 +471,14 @@ bool TcpClient::ConnectToServer(const char* ip, const int port) {
         return false;
     }
 
+    // TLS 握手, 有上一次连接的会话时恢复会话
+    if (m_tls != nullptr && TlsConnect(*m_tls, m_sockfd, m_ip, TLSHANDSHAKE) == false) {
+        close(m_sockfd);
+        m_sockfd = -1;
+        fprintf(stderr, "TLS handshake failed.\n");
+        return false;
+    }
+
     return true;
 }
 
@@ -232,19 +488,16 @@ bool TcpClient::Read(char* buffer, const int itimeout) {
         return false;
     }
 
-    // 用 select 实现超时机制
-    if (itimeout > 0) {
-        fd_set tmpfd;
-
-        FD_ZERO(&tmpfd); // 清空socket集合
-        FD_SET(m_sockfd, &tmpfd); // 添加 sockfd到集合
-
-        struct timeval timeout;
-        timeout.tv_sec = itimeout;
-        timeout.tv_usec = 0;
+    // 用 poll 实现超时机制(select 不能处理大于 1024 的 fd), TLS 已经解密的数据不用等待
+    if (itimeout > 0 && TlsPending(m_sockfd) == false) {
+        struct pollfd pfd;
+        pfd.fd = m_sockfd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        int timeout = itimeout * 1000;
         // timeout 时间内没有读事件则返回false, 有读事件则下一步
         int i;
-        if ((i = select(m_sockfd + 1, &tmpfd, nullptr, nullptr, &timeout)) <= 0) {
+        if ((i = poll(&pfd, 1, timeout)) <= 0) {
             if (i == 0) {
                 m_btimeout = true;
             }
@@ -263,18 +516,15 @@ bool TcpClient::Write(const char* buffer, const int ibuflen) {
         return false;
     }
 
-    fd_set tmpfd;
-
-    FD_ZERO(&tmpfd); // 清空集和
-    FD_SET(m_sockfd, &tmpfd); // 添加 sockfd 到集合
-
-    struct timeval timeout;
-    timeout.tv_sec = 5; // 默认是 5 s (一般不会写超时)
-    timeout.tv_usec = 0;
+    struct pollfd pfd;
+    pfd.fd = m_sockfd;
+    pfd.events = POLLOUT;
+    pfd.revents = 0;
+    int timeout = 5 * 1000; // 默认是 5 s (一般不会写超时)
     m_btimeout = false;
-    // 使用 select 实现超时机制
+    // 使用 poll 实现超时机制
     int i;
-    if ( (i = select(m_sockfd + 1, nullptr, &tmpfd, nullptr, &timeout)) <= 0) {
+    if ( (i = poll(&pfd, 1, timeout)) <= 0) {
         if (i == 0) {
             m_btimeout = true;
         }
@@ -293,6 +543,7 @@ bool TcpClient::Write(const char* buffer, const int ibuflen) {
 void TcpClient::Close() {
     // 关闭连接并恢复变量状态
     if (m_sockfd > 0) {
+        TlsDetach(m_sockfd);
         close(m_sockfd);
     }
     m_sockfd = -1;
@@ -308,13 +559,23 @@ TcpClient::~TcpClient() {
 // ------------------ /TcpClient 类成员函数 -----------------------------
 
 // ------------------ TcpServer 类成员函数 -----------------------------
-TcpServer::TcpServer(): m_listenfd(-1),
+TcpServer::TcpServer(): m_socklen(0),
+                        m_listenfd(-1),
                         m_connfd(-1),
                         m_btimeout(false),
                         m_buflen(0),
-                        m_socklen(0)
+                        m_tls(nullptr),
+                        m_reuseport(false)
 { }
 
+void TcpServer::SetTls(TlsContext* tls) {
+    m_tls = tls;
+}
+
+void TcpServer::SetReusePort(const bool reuseport) {
+    m_reuseport = reuseport;
+}
+
 bool TcpServer::InitServer(const char* ip, const unsigned int port) {
     // 关闭上次未关闭的socket
     if (m_listenfd > 0) {
@@ -330,6 +591,9 @@ bool TcpServer::InitServer(const char* ip, const unsigned int port) {
     // 把socket设为可以重用的端口, 即已关闭的socket处于 Time_Wait 状态时就可以被使用
     int opt = 1;
     setsockopt(m_listenfd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    if (m_reuseport) {
+        setsockopt(m_listenfd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt));
+    }
     // 服务端信息
     memset(&m_serveraddr, 0, sizeof(m_serveraddr));
     m_serveraddr.sin_family = AF_INET;
@@ -343,8 +607,8 @@ bool TcpServer::InitServer(const char* ip, const unsigned int port) {
         return false;
     }
 
-    // 监听socket
-    if (listen(m_listenfd, 5) != 0) {
+    // 监听socket, 队列要能容纳大量客户端(机器人)同时连接
+    if (listen(m_listenfd, SOMAXCONN) != 0) {
         perror("listen");
         CloseListen();
         return false;
@@ -355,6 +619,16 @@ bool TcpServer::InitServer(const char* ip, const unsigned int port) {
     return true;
 }
 
+bool TcpServer::AttachListen(const int listenfd) {
+    if (listenfd < 0) {
+        return false;
+    }
+    CloseListen();
+    m_listenfd = listenfd;
+    m_socklen = sizeof(struct sockaddr_in);
+    return true;
+}
+
 bool TcpServer::Accept() {
     if (m_listenfd == -1) {
         return false;
@@ -363,6 +637,11 @@ bool TcpServer::Accept() {
     if ( (m_connfd = accept(m_listenfd, (struct sockaddr*)&m_clientaddr, (socklen_t*)&m_socklen)) < 0) {
         return false;
     }
+    if (m_tls != nullptr && TlsAccept(*m_tls, m_connfd) == false) {
+        close(m_connfd);
+        m_connfd = -1;
+        return false;
+    }
     return true;
 }
 
@@ -376,21 +655,18 @@ bool TcpServer::Read(char* buffer, const int itimeout) {
         return false;
     }
 
-    // 用 select 实现超时机制
-    if (itimeout > 0) {
-        fd_set tmpfd;
-
-        FD_ZERO(&tmpfd); // 清空socket集合
-        FD_SET(m_connfd, &tmpfd); // 添加 sockfd到集合
-
-        struct timeval timeout;
-        timeout.tv_sec = itimeout;
-        timeout.tv_usec = 0;
+    // 用 poll 实现超时机制, TLS 已经解密的数据不用等待
+    if (itimeout > 0 && TlsPending(m_connfd) == false) {
+        struct pollfd pfd;
+        pfd.fd = m_connfd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        int timeout = itimeout * 1000;
 
         m_btimeout = false;
         int i;
         // timeout 时间内没有读事件则返回false, 有读事件则下一步
-        if ( (i = select(m_connfd + 1, &tmpfd, nullptr, nullptr, &timeout)) <= 0) {
+        if ( (i = poll(&pfd, 1, timeout)) <= 0) {
             if (i == 0) {
                 m_btimeout = true;
             }
@@ -407,18 +683,15 @@ bool TcpServer::Write(const char* buffer, const int ibuflen) {
         return false;
     }
 
-    fd_set tmpfd;
-
-    FD_ZERO(&tmpfd); // 清空集和
-    FD_SET(m_connfd, &tmpfd); // 添加 sockfd 到集合
-
-    struct timeval timeout;
-    timeout.tv_sec = 5; // 默认是 5 s (一般不会写超时)
-    timeout.tv_usec = 0;
+    struct pollfd pfd;
+    pfd.fd = m_connfd;
+    pfd.events = POLLOUT;
+    pfd.revents = 0;
+    int timeout = 5 * 1000; // 默认是 5 s (一般不会写超时)
     m_btimeout = false;
-    // 使用 select 实现超时机制
+    // 使用 poll 实现超时机制
     int i;
-    if ( (i = select(m_connfd + 1, nullptr, &tmpfd, nullptr, &timeout)) <= 0) {
+    if ( (i = poll(&pfd, 1, timeout)) <= 0) {
         if (i == 0) {
             m_btimeout = true;
         }
@@ -443,6 +716,7 @@ void TcpServer::CloseListen() {
 
 void TcpServer::CloseClient() {
     if (m_connfd > 0) {
+        TlsDetach(m_connfd);
         close(m_connfd);
         m_connfd = -1;
     }
@@ -455,24 +729,64 @@ TcpServer::~TcpServer() {
 // ------------------ /TcpServer 类成员函数 -----------------------------
 
 // ------------------ 全局函数 ------------------------------------------
+static int g_maxmsglen = DEFMAXMSGLEN; // 报文体长度的上限
+
+void SetMaxMsgLen(const int imaxlen) {
+    if (imaxlen > 0) {
+        g_maxmsglen = imaxlen;
+    }
+}
+
+int GetMaxMsgLen() {
+    return g_maxmsglen;
+}
+
+// 循环发送 iov 数组中的全部数据, 处理只发送了一部分的情况
+static bool Writevn(const int sockfd, struct iovec* iov, int iovcnt) {
+    // TLS 连接拼成一块加密, 长度头和报文体在同一个记录中
+    if (TlsActive(sockfd)) {
+        std::string data;
+        for (int i = 0; i < iovcnt; ++i) {
+            data.append((const char*)iov[i].iov_base, iov[i].iov_len);
+        }
+        bool ok = false;
+        return TlsWriteAll(sockfd, data.data(), data.size(), WRITETIMEOUT, &ok) && ok;
+    }
+    while (iovcnt > 0) {
+        ssize_t nwrite = writev(sockfd, iov, iovcnt);
+        if (nwrite <= 0) {
+            if (nwrite < 0 && errno == EINTR) continue;
+            return false;
+        }
+        // 跳过已经发送完的部分
+        while (iovcnt > 0 && (size_t)nwrite >= iov->iov_len) {
+            nwrite -= iov->iov_len;
+            ++iov;
+            --iovcnt;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char*)iov->iov_base + nwrite;
+            iov->iov_len -= nwrite;
+        }
+    }
+    return true;
+}
+
 bool TcpRead(const int sockfd, char* buffer, int* ibuflen, const int itimeout) {
     // socket 连接无效
     if (sockfd == -1) {
         return false;
     }
 
-    // 用 select 实现超时机制
-    if (itimeout > 0) {
-        fd_set tmpfd;
-
-        FD_ZERO(&tmpfd); // 清空socket集合
-        FD_SET(sockfd, &tmpfd); // 添加 sockfd到集合
-
-        struct timeval timeout;
-        timeout.tv_sec = itimeout;
-        timeout.tv_usec = 0;
+    // 用 poll 实现超时机制, TLS 已经解密的数据不用等待
+    if (itimeout > 0 && TlsPending(sockfd) == false) {
+        struct pollfd pfd;
+        pfd.fd = sockfd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        int timeout = itimeout * 1000;
         // timeout 时间内没有读事件则返回false, 有读事件则下一步
-        if (select(sockfd + 1, &tmpfd, nullptr, nullptr, &timeout) <= 0) {
+        if (poll(&pfd, 1, timeout) <= 0) {
             return false;
         }
     }
@@ -489,31 +803,35 @@ bool TcpRead(const int sockfd, char* buffer, int* ibuflen, const int itimeout) {
 
     *ibuflen = ntohl(*ibuflen); // 把网络字节序转换为主机字节序
 
+    // 不信任长度头, 超过上限的报文会写越界
+    if (*ibuflen < 0 || *ibuflen > GetMaxMsgLen()) {
+        *ibuflen = 0;
+        return false;
+    }
+
     // 读取 ibuflen 个字节到 buffer
     if (Readn(sockfd, buffer, (*ibuflen)) == false) {
         return false;
     }
+    buffer[*ibuflen] = '\0';
 
     return true;
 }
 
 
-bool TcpWrite(const int sockfd, const char* buffer, const int ibuflen) {
+bool TcpWrite(const int sockfd, const char* buffer, const int ibuflen, const bool compressed) {
     // socket 连接无效
     if (sockfd == -1) {
         return false;
     }
 
-    fd_set tmpfd;
-
-    FD_ZERO(&tmpfd); // 清空集和
-    FD_SET(sockfd, &tmpfd); // 添加 sockfd 到集合
-
-    struct timeval timeout;
-    timeout.tv_sec = 5; // 默认是 5 s (一般不会写超时)
-    timeout.tv_usec = 0;
-    // 使用 select 实现超时机制
-    if ( select(sockfd + 1, nullptr, &tmpfd, nullptr, &timeout) <= 0) {
+    struct pollfd pfd;
+    pfd.fd = sockfd;
+    pfd.events = POLLOUT;
+    pfd.revents = 0;
+    int timeout = WRITETIMEOUT; // 默认是 5 s (一般不会写超时)
+    // 使用 poll 实现超时机制
+    if ( poll(&pfd, 1, timeout) <= 0) {
         return false;
     }
 
@@ -526,25 +844,88 @@ bool TcpWrite(const int sockfd, const char* buffer, const int ibuflen) {
         ilen = ibuflen;
     }
 
-    int ilenn = htonl(ilen); // 把主机字节序转换为网络字节序
+    uint32_t ilenn = htonl(compressed ? (ilen | FRAMECOMPRESSED) : ilen); // 把主机字节序转换为网络字节序
 
     // 为解决 TCP 粘包和分包 的问题
     // 报文组成为: 报文长度 + 报文体
 
-    // 组合报文
-    char strSendBuffer[ilen + 4];
-    memset(strSendBuffer, 0, sizeof(strSendBuffer));
-    memcpy(strSendBuffer, &ilenn, 4);
-    memcpy(strSendBuffer + 4, buffer, ilen);
+    // 用 writev 一次发送长度头和报文体, 不需要在栈上拼接报文
+    struct iovec iov[2];
+    iov[0].iov_base = &ilenn;
+    iov[0].iov_len = MSGBODYLEN;
+    iov[1].iov_base = const_cast<char*>(buffer);
+    iov[1].iov_len = ilen;
     // 发送数据
-    if (Writen(sockfd, strSendBuffer, ilen + 4) == false) {
+    if (Writevn(sockfd, iov, 2) == false) {
+        return false;
+    }
+
+    return true;
+}
+
+bool CompressFrame(const char* buffer, const int ibuflen, std::string& out) {
+    if (ibuflen < COMPRESSMIN) {
+        return false;
+    }
+    // 压缩结果只有比原报文短才使用, 所以目标缓冲区不需要按 LZBound 分配
+    out.resize(ibuflen);
+    const uint32_t rawlen = htonl(ibuflen);
+    memcpy(&out[0], &rawlen, MSGBODYLEN);
+    const size_t n = LZCompress(buffer, ibuflen, &out[MSGBODYLEN], ibuflen - MSGBODYLEN - 1);
+    if (n == 0) {
+        out.clear();
         return false;
     }
+    out.resize(MSGBODYLEN + n);
+    return true;
+}
+
+void AppendFrame(std::string& out, const char* buffer, const int ibuflen, const bool compress) {
+    std::string packed;
+    const bool compressed = compress && CompressFrame(buffer, ibuflen, packed);
+    if (compressed) {
+        buffer = packed.data();
+    }
+    const int ilen = compressed ? packed.size() : ibuflen;
+    const uint32_t ilenn = htonl(compressed ? (ilen | FRAMECOMPRESSED) : ilen);
+    out.append((const char*)&ilenn, MSGBODYLEN);
+    out.append(buffer, ilen);
+}
 
+void AppendPacked(std::string& out, const std::string& packed) {
+    const uint32_t ilenn = htonl(packed.size() | FRAMECOMPRESSED);
+    out.append((const char*)&ilenn, MSGBODYLEN);
+    out.append(packed);
+}
+
+// TLS 连接的 socket 是非阻塞的, 没有数据时用 poll 等待, 保持阻塞读取的语义
+static bool TlsReadn(const int sockfd, char* buffer, const size_t n) {
+    size_t idx = 0;
+    while (idx < n) {
+        ssize_t nread;
+        TlsRecv(sockfd, buffer + idx, n - idx, &nread);
+        if (nread > 0) {
+            idx += nread;
+            continue;
+        }
+        if (nread == 0 || errno != EAGAIN) {
+            return false;
+        }
+        struct pollfd pfd;
+        pfd.fd = sockfd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        if (poll(&pfd, 1, -1) < 0 && errno != EINTR) {
+            return false;
+        }
+    }
     return true;
 }
 
 bool Readn(const int sockfd, char* buffer, const size_t n) {
+    if (TlsActive(sockfd)) {
+        return TlsReadn(sockfd, buffer, n);
+    }
     int nLeft = n;
     int nread = 0, idx = 0;
 
@@ -563,6 +944,10 @@ bool Readn(const int sockfd, char* buffer, const size_t n) {
 }
 
 bool Writen(const int sockfd, const char* buffer, const size_t n) {
+    bool ok = false;
+    if (TlsWriteAll(sockfd, buffer, n, WRITETIMEOUT, &ok)) {
+        return ok;
+    }
     int nLeft = n;
     int nwrite = 0, idx = 0;
 
@@ -578,8 +963,446 @@ bool Writen(const int sockfd, const char* buffer, const size_t n) {
 
     return true;
 }
+
+ssize_t SendSome(const int sockfd, const char* buffer, const size_t n) {
+    ssize_t nsent;
+    if (TlsSend(sockfd, buffer, n, &nsent)) {
+        return nsent;
+    }
+    do {
+        nsent = write(sockfd, buffer, n);
+    } while (nsent < 0 && errno == EINTR);
+    return nsent;
+}
+
+int UnixListen(const char* path) {
+    int listenfd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    if (listenfd < 0) {
+        perror("socket");
+        return -1;
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    unlink(path); // 删除上次留下的 socket 文件
+
+    if (bind(listenfd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(listenfd, 1) != 0) {
+        perror("bind");
+        close(listenfd);
+        return -1;
+    }
+    return listenfd;
+}
+
+int UnixConnect(const char* path) {
+    int sockfd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    if (sockfd < 0) {
+        perror("socket");
+        return -1;
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+    if (connect(sockfd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        perror("connect");
+        close(sockfd);
+        return -1;
+    }
+    return sockfd;
+}
+
+bool SendFd(const int sockfd, const int fd, const char* buffer, const int ibuflen) {
+    if (sockfd == -1 || ibuflen <= 0) {
+        return false;
+    }
+
+    struct iovec iov;
+    iov.iov_base = const_cast<char*>(buffer);
+    iov.iov_len = ibuflen;
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    // 文件描述符放在辅助数据中(SCM_RIGHTS)
+    char control[CMSG_SPACE(sizeof(int))];
+    if (fd >= 0) {
+        memset(control, 0, sizeof(control));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    }
+
+    ssize_t nsend;
+    do {
+        nsend = sendmsg(sockfd, &msg, MSG_NOSIGNAL);
+    } while (nsend < 0 && errno == EINTR);
+
+    return nsend == ibuflen;
+}
+
+bool RecvFd(const int sockfd, int* fd, char* buffer, int* ibuflen, const int ibufsize, const int itimeout) {
+    *fd = -1;
+    *ibuflen = 0;
+    if (sockfd == -1) {
+        return false;
+    }
+
+    // 用 poll 实现超时机制
+    if (itimeout > 0) {
+        struct pollfd pfd;
+        pfd.fd = sockfd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        int timeout = itimeout * 1000;
+        if (poll(&pfd, 1, timeout) <= 0) {
+            return false;
+        }
+    }
+
+    struct iovec iov;
+    iov.iov_base = buffer;
+    iov.iov_len = ibufsize;
+
+    char control[CMSG_SPACE(sizeof(int))];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t nread;
+    do {
+        nread = recvmsg(sockfd, &msg, MSG_CMSG_CLOEXEC);
+    } while (nread < 0 && errno == EINTR);
+
+    struct cmsghdr* cmsg = (nread > 0) ? CMSG_FIRSTHDR(&msg) : nullptr;
+    if (cmsg != nullptr && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+        memcpy(fd, CMSG_DATA(cmsg), sizeof(int));
+    }
+    if (nread <= 0 || (msg.msg_flags & MSG_TRUNC)) {
+        // 报文被截断时文件描述符已经到了本进程, 关闭它
+        if (*fd >= 0) {
+            close(*fd);
+            *fd = -1;
+        }
+        return false;
+    }
+    *ibuflen = (int)nread;
+    return true;
+}
+
+bool SendFdData(const int sockfd, const int fd, const char* buffer, const size_t n) {
+    if (n > 0xffffffffu) {
+        return false;
+    }
+    // 第一个报文: 总长度 + 第一段数据
+    std::vector<char> first(MSGBODYLEN + std::min(n, (size_t)FDCHUNK - MSGBODYLEN));
+    const uint32_t total = htonl((uint32_t)n);
+    memcpy(first.data(), &total, MSGBODYLEN);
+    memcpy(first.data() + MSGBODYLEN, buffer, first.size() - MSGBODYLEN);
+    if (SendFd(sockfd, fd, first.data(), (int)first.size()) == false) {
+        return false;
+    }
+    // 之后的报文只有数据
+    for (size_t off = first.size() - MSGBODYLEN; off < n; off += FDCHUNK) {
+        if (SendFd(sockfd, -1, buffer + off, (int)std::min(n - off, (size_t)FDCHUNK)) == false) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool RecvFdData(const int sockfd, int* fd, std::string& data, const int itimeout) {
+    data.clear();
+    std::vector<char> buffer(FDCHUNK);
+    int ibuflen = 0;
+    if (RecvFd(sockfd, fd, buffer.data(), &ibuflen, (int)buffer.size(), itimeout) == false) {
+        return false;
+    }
+    uint32_t total = 0;
+    bool ok = (ibuflen >= MSGBODYLEN);
+    if (ok) {
+        memcpy(&total, buffer.data(), MSGBODYLEN);
+        total = ntohl(total);
+        ok = ((size_t)ibuflen - MSGBODYLEN <= total);
+    }
+    if (ok) {
+        data.reserve(total);
+        data.assign(buffer.data() + MSGBODYLEN, ibuflen - MSGBODYLEN);
+    }
+    // 后面的报文不应该带文件描述符
+    int extra = -1;
+    while (ok && data.size() < total) {
+        ok = RecvFd(sockfd, &extra, buffer.data(), &ibuflen, (int)buffer.size(), itimeout) && extra < 0
+             && data.size() + ibuflen <= total;
+        if (ok) data.append(buffer.data(), ibuflen);
+    }
+    if (ok == false) {
+        if (extra >= 0) close(extra);
+        if (*fd >= 0) close(*fd);
+        *fd = -1;
+        data.clear();
+    }
+    return ok;
+}
 // ------------------ /全局函数 ------------------------------------------
 
+// ------------------ BufferPool 类成员函数 ------------------------------
+BufferPool::BufferPool(const size_t maxfree): m_maxfree(maxfree) { }
+
+char* BufferPool::Get(const size_t n, size_t* cap) {
+    // 计算所属级别
+    int shift = MINSHIFT;
+    while (shift <= MAXSHIFT && ((size_t)1 << shift) < n) {
+        ++shift;
+    }
+    // 超过最大级别, 不缓存
+    if (shift > MAXSHIFT) {
+        *cap = n;
+        return new char[n];
+    }
+
+    *cap = (size_t)1 << shift;
+    // 小缓冲区从线程缓存的内存池取, 不加锁
+    if (*cap <= PoolMaxSize()) {
+        return static_cast<char*>(PoolAlloc(*cap));
+    }
+    {
+        std::unique_lock<std::mutex> lk(m_lock);
+        std::vector<char*>& freelist = m_free[shift - MINSHIFT];
+        if (!freelist.empty()) {
+            char* buffer = freelist.back();
+            freelist.pop_back();
+            return buffer;
+        }
+    }
+    return new char[*cap];
+}
+
+void BufferPool::Put(char* buffer, const size_t cap) {
+    if (buffer == nullptr) return;
+    if (cap <= PoolMaxSize() && (cap & (cap - 1)) == 0) {
+        PoolFree(buffer, cap);
+        return;
+    }
+    int shift = MINSHIFT;
+    while (shift <= MAXSHIFT && ((size_t)1 << shift) != cap) {
+        ++shift;
+    }
+    if (shift <= MAXSHIFT) {
+        std::unique_lock<std::mutex> lk(m_lock);
+        std::vector<char*>& freelist = m_free[shift - MINSHIFT];
+        if (freelist.size() < m_maxfree) {
+            freelist.push_back(buffer);
+            return;
+        }
+    }
+    delete[] buffer;
+}
+
+BufferPool::~BufferPool() {
+    for (auto& freelist : m_free) {
+        for (char* buffer : freelist) {
+            delete[] buffer;
+        }
+    }
+}
+
+BufferPool& DefaultBufferPool() {
+    static BufferPool pool;
+    return pool;
+}
+// ------------------ /BufferPool 类成员函数 -----------------------------
+
+// ------------------ Frame 类成员函数 -----------------------------------
+Frame::Frame(): m_buffer(nullptr), m_cap(0), m_len(0) { }
+
+void Frame::Assign(const char* buffer, const int ilen) {
+    // 缓冲区不够时换一块与报文大小匹配的
+    if (m_buffer == nullptr || m_cap < (size_t)ilen + 1) {
+        Release();
+        m_buffer = DefaultBufferPool().Get(ilen + 1, &m_cap);
+    }
+    memcpy(m_buffer, buffer, ilen);
+    m_buffer[ilen] = '\0'; // 解析函数要求以 '\0' 结尾
+    m_len = ilen;
+}
+
+bool Frame::AssignCompressed(const char* buffer, const int ilen) {
+    if (ilen < MSGBODYLEN) {
+        return false;
+    }
+    uint32_t rawlen = 0;
+    memcpy(&rawlen, buffer, MSGBODYLEN);
+    rawlen = ntohl(rawlen);
+    if (rawlen > (uint32_t)GetMaxMsgLen()) {
+        return false;
+    }
+    if (m_buffer == nullptr || m_cap < (size_t)rawlen + 1) {
+        Release();
+        m_buffer = DefaultBufferPool().Get(rawlen + 1, &m_cap);
+    }
+    if (LZDecompress(buffer + MSGBODYLEN, ilen - MSGBODYLEN, m_buffer, rawlen) == false) {
+        m_len = 0;
+        return false;
+    }
+    m_buffer[rawlen] = '\0';
+    m_len = rawlen;
+    return true;
+}
+
+void Frame::Release() {
+    if (m_buffer != nullptr) {
+        DefaultBufferPool().Put(m_buffer, m_cap);
+        m_buffer = nullptr;
+    }
+    m_cap = 0;
+    m_len = 0;
+}
+
+Frame::~Frame() {
+    Release();
+}
+// ------------------ /Frame 类成员函数 ----------------------------------
+
+// ------------------ RecvBuffer 类成员函数 ------------------------------
+RecvBuffer::RecvBuffer(): m_buffer(nullptr), m_cap(0), m_rd(0), m_wr(0) { }
+
+RecvBuffer::RecvBuffer(RecvBuffer&& other): m_buffer(other.m_buffer), 
+                                            m_cap(other.m_cap), 
+                                            m_rd(other.m_rd), 
+                                            m_wr(other.m_wr)
+{
+    other.m_buffer = nullptr;
+    other.m_cap = other.m_rd = other.m_wr = 0;
+}
+
+ssize_t RecvBuffer::ReadFd(const int sockfd) {
+    // 第一段是缓冲区剩余空间, 第二段是栈上的临时空间
+    // 一次系统调用就能读入长度头和报文体, 缓冲区只在数据确实放不下时才扩大
+    char extrabuf[65536];
+    ssize_t nread;
+    if (TlsRecv(sockfd, extrabuf, sizeof(extrabuf), &nread)) {
+        // 一个 TLS 记录可能比读到的数据大, 解密后留在 OpenSSL 中的数据 epoll 不会再通知, 读到没有数据为止
+        ssize_t total = 0;
+        while (nread > 0) {
+            Append(extrabuf, nread);
+            total += nread;
+            TlsRecv(sockfd, extrabuf, sizeof(extrabuf), &nread);
+        }
+        return total > 0 ? total : nread;
+    }
+
+    const size_t writable = m_cap - m_wr;
+    struct iovec iov[2];
+    iov[0].iov_base = m_buffer + m_wr;
+    iov[0].iov_len = writable;
+    iov[1].iov_base = extrabuf;
+    iov[1].iov_len = sizeof(extrabuf);
+    const int iovcnt = (writable < sizeof(extrabuf)) ? 2 : 1;
+
+    do {
+        nread = (writable > 0) ? readv(sockfd, iov, iovcnt) : readv(sockfd, iov + 1, 1);
+    } while (nread < 0 && errno == EINTR);
+
+    if (nread <= 0) {
+        return nread;
+    }
+    if ((size_t)nread <= writable) {
+        m_wr += nread;
+    }
+    else {
+        m_wr = m_cap;
+        Append(extrabuf, nread - writable);
+    }
+    return nread;
+}
+
+int RecvBuffer::NextFrame(Frame& frame) {
+    if (Readable() < MSGBODYLEN) {
+        return 0;
+    }
+
+    // 解析长度头, 最高位是压缩标志
+    uint32_t header = 0;
+    memcpy(&header, m_buffer + m_rd, MSGBODYLEN);
+    header = ntohl(header);
+    const bool compressed = (header & FRAMECOMPRESSED) != 0;
+    const int ilen = header & ~FRAMECOMPRESSED;
+    if (ilen > GetMaxMsgLen()) {
+        return -1;
+    }
+    if (Readable() < (size_t)MSGBODYLEN + ilen) {
+        return 0;
+    }
+
+    if (compressed) {
+        if (frame.AssignCompressed(m_buffer + m_rd + MSGBODYLEN, ilen) == false) {
+            return -1;
+        }
+    }
+    else {
+        frame.Assign(m_buffer + m_rd + MSGBODYLEN, ilen);
+    }
+    m_rd += MSGBODYLEN + ilen;
+    if (m_rd == m_wr) {
+        Release();
+    }
+    return 1;
+}
+
+void RecvBuffer::Append(const char* buffer, const size_t n) {
+    if (m_cap - m_wr < n) {
+        const size_t readable = Readable();
+        if (m_cap - readable >= n) {
+            // 空间足够, 把未处理的数据移到开头
+            memmove(m_buffer, m_buffer + m_rd, readable);
+        }
+        else {
+            // 换一块更大的缓冲区
+            size_t cap = 0;
+            char* newbuffer = DefaultBufferPool().Get(readable + n, &cap);
+            if (readable > 0) {
+                memcpy(newbuffer, m_buffer + m_rd, readable);
+            }
+            DefaultBufferPool().Put(m_buffer, m_cap);
+            m_buffer = newbuffer;
+            m_cap = cap;
+        }
+        m_rd = 0;
+        m_wr = readable;
+    }
+    memcpy(m_buffer + m_wr, buffer, n);
+    m_wr += n;
+}
+
+void RecvBuffer::Clear() {
+    Release();
+}
+
+void RecvBuffer::Release() {
+    DefaultBufferPool().Put(m_buffer, m_cap);
+    m_buffer = nullptr;
+    m_cap = m_rd = m_wr = 0;
+}
+
+RecvBuffer::~RecvBuffer() {
+    Release();
+}
+// ------------------ /RecvBuffer 类成员函数 -----------------------------
+
 
 }
 
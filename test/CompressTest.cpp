@@ -0,0 +1,136 @@
+// 报文压缩的测试: LZ 压缩和解压的往返, 损坏的压缩报文和超过上限的原始长度被拒绝
+#include "Compress.h"
+#include "cppNetWork.h"
+#include "TestUtil.h"
+#include <random>
+
+// 压缩后解压, 结果和原始数据相同
+static bool RoundTrip(const std::string& raw) {
+    std::string packed(LI::LZBound(raw.size()), '\0');
+    const size_t n = LI::LZCompress(raw.data(), raw.size(), &packed[0], packed.size());
+    if (n == 0 && !raw.empty()) return false;
+    std::string out(raw.size(), '\0');
+    return LI::LZDecompress(packed.data(), n, &out[0], out.size()) && out == raw;
+}
+
+// 一条广播报文, 信息内容是 text
+static std::string Broadcast(const std::string& text) {
+    return "<code>4</code><name>alice</name><color>3</color><message>" + text + "</message><time>1760000000000</time>";
+}
+
+static void TestRoundTrip() {
+    std::mt19937 rng(7);
+    CHECK(RoundTrip(""));
+    CHECK(RoundTrip("a"));
+    CHECK(RoundTrip(std::string(100000, 'x')));   // 重叠的长匹配
+    CHECK(RoundTrip("abcabcabcabcabcabcabcabcab")); // 偏移小于长度
+
+    // 不可压缩的数据略微变长, 不超过 LZBound
+    std::string random(70000, '\0');
+    for (auto& c : random) c = (char)rng();
+    CHECK(RoundTrip(random));
+
+    // 各种长度的文本, 覆盖字面量和匹配长度的扩展字节
+    const char words[][8] = {"hello ", "world ", "<msg>", "chat ", "room "};
+    for (size_t len = 1; len < 3000; len += 37) {
+        std::string text;
+        while (text.size() < len) text += words[rng() % 5];
+        CHECK(RoundTrip(text));
+        CHECK(RoundTrip(Broadcast(text)));
+    }
+
+    // 放不下时返回 0
+    const std::string text = Broadcast(std::string(1000, 'y'));
+    std::string small(8, '\0');
+    CHECK(LI::LZCompress(text.data(), text.size(), &small[0], small.size()) == 0);
+}
+
+// 损坏的数据: 偏移越界, 长度越界, 截断, 原始长度不符
+static void TestCorrupt() {
+    char out[64];
+    // 1 个字面量后偏移 5 的匹配, 偏移超过已经输出的长度
+    const char badoffset[] = {0x10, 'a', 0x05, 0x00};
+    CHECK(LI::LZDecompress(badoffset, sizeof(badoffset), out, 5) == false);
+    // 偏移 0
+    const char zerooffset[] = {0x10, 'a', 0x00, 0x00};
+    CHECK(LI::LZDecompress(zerooffset, sizeof(zerooffset), out, 5) == false);
+    // 字面量长度超过输入
+    const char longliteral[] = {(char)0xf0, 0x20, 'a', 'b'};
+    CHECK(LI::LZDecompress(longliteral, sizeof(longliteral), out, sizeof(out)) == false);
+    // 匹配长度超过输出
+    const char longmatch[] = {0x1f, 'a', 0x01, 0x00, 0x40, 'b'};
+    CHECK(LI::LZDecompress(longmatch, sizeof(longmatch), out, 20) == false);
+
+    const std::string raw = Broadcast(std::string(3000, 'z') + "tail");
+    std::string packed(LI::LZBound(raw.size()), '\0');
+    const size_t n = LI::LZCompress(raw.data(), raw.size(), &packed[0], packed.size());
+    REQUIRE(n > 0);
+    std::string dst(raw.size() + 1, '\0');
+    // 原始长度必须正好相符
+    CHECK(LI::LZDecompress(packed.data(), n, &dst[0], raw.size()));
+    CHECK(LI::LZDecompress(packed.data(), n, &dst[0], raw.size() - 1) == false);
+    CHECK(LI::LZDecompress(packed.data(), n, &dst[0], raw.size() + 1) == false);
+    // 截断在任何位置都不会读写越界, 除了完整的输入都失败
+    for (size_t cut = 0; cut < n; ++cut) {
+        CHECK(LI::LZDecompress(packed.data(), cut, &dst[0], raw.size()) == false);
+    }
+    // 随意修改一个字节: 不会读写越界, 成功时长度仍然正确
+    std::mt19937 rng(11);
+    for (int i = 0; i < 2000; ++i) {
+        std::string bad = packed.substr(0, n);
+        bad[rng() % n] = (char)rng();
+        LI::LZDecompress(bad.data(), bad.size(), &dst[0], raw.size());
+    }
+}
+
+// 压缩报文: 4 字节原始长度 + LZ 块, Frame 和 RecvBuffer 解压
+static void TestFrame() {
+    const std::string raw = Broadcast(std::string(2000, 'm'));
+    std::string packed;
+    CHECK(LI::CompressFrame(raw.data(), (int)raw.size(), packed));
+    CHECK(packed.size() < raw.size());
+    LI::Frame frame;
+    CHECK(frame.AssignCompressed(packed.data(), (int)packed.size()));
+    CHECK(frame.size() == (int)raw.size() && memcmp(frame.data(), raw.data(), raw.size()) == 0);
+
+    // 太短的报文不压缩
+    std::string tiny;
+    CHECK(LI::CompressFrame("<cmd>5</cmd>", 12, tiny) == false);
+
+    // 原始长度超过报文长度上限, 不分配缓冲区直接拒绝
+    std::string oversize = packed;
+    const uint32_t rawlen = htonl((uint32_t)LI::GetMaxMsgLen() + 1);
+    memcpy(&oversize[0], &rawlen, 4);
+    CHECK(frame.AssignCompressed(oversize.data(), (int)oversize.size()) == false);
+    const uint32_t huge = htonl(0xffffffffu);
+    memcpy(&oversize[0], &huge, 4);
+    CHECK(frame.AssignCompressed(oversize.data(), (int)oversize.size()) == false);
+    // 原始长度和 LZ 块不符
+    std::string mismatch = packed;
+    const uint32_t shorter = htonl((uint32_t)raw.size() - 1);
+    memcpy(&mismatch[0], &shorter, 4);
+    CHECK(frame.AssignCompressed(mismatch.data(), (int)mismatch.size()) == false);
+    // 不到 4 字节
+    CHECK(frame.AssignCompressed(packed.data(), 3) == false);
+
+    // 接收缓冲区: 正常的压缩报文解压后取出, 损坏的返回 -1, 连接应当关闭
+    LI::RecvBuffer recvbuf;
+    std::string wire;
+    LI::AppendFrame(wire, raw.data(), (int)raw.size(), true);
+    CHECK(wire.size() < raw.size());
+    recvbuf.Append(wire.data(), wire.size());
+    CHECK(recvbuf.NextFrame(frame) == 1);
+    CHECK(frame.size() == (int)raw.size() && memcmp(frame.data(), raw.data(), raw.size()) == 0);
+
+    std::string corrupt = wire;
+    corrupt[8] = (char)0xff; // LZ 块的第一个 token: 字面量长度越界
+    recvbuf.Append(corrupt.data(), corrupt.size());
+    CHECK(recvbuf.NextFrame(frame) == -1);
+}
+
+int main() {
+    TestRoundTrip();
+    TestCorrupt();
+    TestFrame();
+    return TestResult();
+}
@@ -0,0 +1,114 @@
+// 热重启交接的测试: SendFdData/RecvFdData 传递文件描述符和积压了多个最大长度报文的接收缓冲区
+#include "cppNetWork.h"
+#include "TestUtil.h"
+#include <sys/socket.h>
+#include <thread>
+
+// 一个最大长度的报文, 带长度头, 内容按序号填充
+static std::string MaxFrame(const int seq) {
+    const int len = LI::GetMaxMsgLen();
+    std::string frame(4 + len, '\0');
+    const uint32_t header = htonl((uint32_t)len);
+    memcpy(&frame[0], &header, 4);
+    for (int i = 0; i < len; ++i) {
+        frame[4 + i] = (char)('a' + (seq + i) % 26);
+    }
+    return frame;
+}
+
+// 一个连接的交接报文: XML + '\0' + 未处理的数据(3个最大长度的报文和半个报文)
+static void TestLargePending() {
+    int pair[2];
+    REQUIRE(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, pair) == 0);
+    int pipefd[2];
+    REQUIRE(pipe(pipefd) == 0);
+
+    std::string pending;
+    for (int i = 0; i < 3; ++i) pending += MaxFrame(i);
+    pending += MaxFrame(3).substr(0, 1000);
+    std::string data = "<type>conn</type><login>1</login>";
+    data.push_back('\0');
+    data += pending;
+    CHECK(data.size() > 3 * (size_t)LI::GetMaxMsgLen());
+
+    // 数据比 socket 缓冲区大, 发送方在另一个线程中等待接收方读取
+    bool sent = false;
+    std::thread sender([&]() {
+        sent = LI::SendFdData(pair[0], pipefd[1], data.data(), data.size());
+        sent = sent && LI::SendFdData(pair[0], -1, "<type>end</type>", strlen("<type>end</type>"));
+    });
+    int fd = -1;
+    std::string message;
+    CHECK(LI::RecvFdData(pair[1], &fd, message, 5));
+    CHECK(message == data);
+    REQUIRE(fd >= 0 && fd != pipefd[1]);
+    CHECK(strcmp(message.c_str(), "<type>conn</type><login>1</login>") == 0);
+
+    // 收到的描述符和原来的指向同一个管道
+    CHECK(write(fd, "x", 1) == 1);
+    char c = 0;
+    CHECK(read(pipefd[0], &c, 1) == 1 && c == 'x');
+    close(fd);
+
+    // 接管的进程把未处理的数据放回接收缓冲区, 拆出完整的报文, 剩下半个报文
+    LI::RecvBuffer recvbuf;
+    const size_t metalen = strlen(message.c_str()) + 1;
+    recvbuf.Append(message.data() + metalen, message.size() - metalen);
+    LI::Frame frame;
+    for (int i = 0; i < 3; ++i) {
+        CHECK(recvbuf.NextFrame(frame) == 1);
+        CHECK(frame.size() == LI::GetMaxMsgLen() && memcmp(frame.data(), MaxFrame(i).data() + 4, frame.size()) == 0);
+    }
+    CHECK(recvbuf.NextFrame(frame) == 0);
+    CHECK(recvbuf.Readable() == 1000);
+
+    // 没有附带数据的报文
+    CHECK(LI::RecvFdData(pair[1], &fd, message, 5));
+    CHECK(fd == -1 && message == "<type>end</type>");
+    sender.join();
+    CHECK(sent);
+
+    close(pipefd[0]);
+    close(pipefd[1]);
+    close(pair[0]);
+    close(pair[1]);
+}
+
+// 数据不完整时失败, 已经收到的描述符被关闭
+static void TestTruncated() {
+    int pair[2];
+    REQUIRE(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, pair) == 0);
+    int pipefd[2];
+    REQUIRE(pipe(pipefd) == 0);
+
+    // 声明 100000 字节, 只发送第一个报文就关闭
+    std::string first(4 + 100, 'x');
+    const uint32_t total = htonl(100000);
+    memcpy(&first[0], &total, 4);
+    CHECK(LI::SendFd(pair[0], pipefd[1], first.data(), (int)first.size()));
+    close(pair[0]);
+
+    int fd = -1;
+    std::string message;
+    CHECK(LI::RecvFdData(pair[1], &fd, message, 1) == false);
+    CHECK(fd == -1 && message.empty());
+    close(pair[1]);
+
+    // 管道的写端只剩原来的一个, 关闭后读端读到文件结束
+    close(pipefd[1]);
+    char c;
+    CHECK(read(pipefd[0], &c, 1) == 0);
+    close(pipefd[0]);
+
+    // 超时
+    REQUIRE(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, pair) == 0);
+    CHECK(LI::RecvFdData(pair[1], &fd, message, 1) == false);
+    close(pair[0]);
+    close(pair[1]);
+}
+
+int main() {
+    TestLargePending();
+    TestTruncated();
+    return TestResult();
+}
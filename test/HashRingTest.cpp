@@ -0,0 +1,102 @@
+// HashRing 的测试: 键的分布, 节点加入和离开时改变归属的键
+#include "HashRing.h"
+#include "TestUtil.h"
+#include <map>
+
+// 测试用的键(房间名)个数
+#define KEYS 100000
+
+static std::string Key(const int i) {
+    return "room" + std::to_string(i);
+}
+
+// 每个键的归属节点
+static std::vector<std::string> Owners(const LI::HashRing& ring) {
+    std::vector<std::string> owners(KEYS);
+    for (int i = 0; i < KEYS; ++i) {
+        const std::string key = Key(i);
+        owners[i] = ring.Owner(key.data(), key.size());
+    }
+    return owners;
+}
+
+// 4 个节点各分到约 1/4 的键
+static void TestDistribution() {
+    LI::HashRing ring;
+    CHECK(ring.Owner("room", 4).empty());
+    for (int i = 1; i <= 4; ++i) {
+        ring.AddNode("10.0.0." + std::to_string(i) + ":5005");
+    }
+    ring.AddNode("10.0.0.1:5005");
+    CHECK(ring.Size() == 4);
+    CHECK(ring.HasNode("10.0.0.3:5005") && !ring.HasNode("10.0.0.5:5005"));
+
+    std::map<std::string, int> counts;
+    for (const auto& owner : Owners(ring)) {
+        ++counts[owner];
+    }
+    CHECK(counts.size() == 4);
+    for (const auto& kv : counts) {
+        const double share = (double)kv.second / KEYS;
+        printf("%s %.3f\n", kv.first.c_str(), share);
+        CHECK(share > 0.18 && share < 0.32);
+    }
+
+    // 节点加入的顺序不影响结果, 各节点用相同的节点集合得到相同的归属
+    LI::HashRing other;
+    for (int i = 4; i >= 1; --i) {
+        other.AddNode("10.0.0." + std::to_string(i) + ":5005");
+    }
+    CHECK(Owners(other) == Owners(ring));
+}
+
+// 节点加入时只有分给新节点的键改变归属, 离开时只有它的键改变归属
+static void TestRemap() {
+    LI::HashRing ring;
+    for (int i = 1; i <= 4; ++i) {
+        ring.AddNode("10.0.0." + std::to_string(i) + ":5005");
+    }
+    const std::vector<std::string> before = Owners(ring);
+
+    ring.AddNode("10.0.0.5:5005");
+    const std::vector<std::string> joined = Owners(ring);
+    int moved = 0;
+    for (int i = 0; i < KEYS; ++i) {
+        if (joined[i] != before[i]) {
+            ++moved;
+            CHECK(joined[i] == "10.0.0.5:5005");
+        }
+    }
+    printf("join moved %.3f\n", (double)moved / KEYS);
+    CHECK(moved > KEYS * 0.12 && moved < KEYS * 0.28);
+
+    // 新节点离开后恢复原来的归属
+    ring.RemoveNode("10.0.0.5:5005");
+    CHECK(Owners(ring) == before);
+
+    // 原有的节点离开, 只有它的键分给其他节点
+    ring.RemoveNode("10.0.0.2:5005");
+    CHECK(ring.Size() == 3 && !ring.HasNode("10.0.0.2:5005"));
+    const std::vector<std::string> left = Owners(ring);
+    moved = 0;
+    for (int i = 0; i < KEYS; ++i) {
+        if (before[i] == "10.0.0.2:5005") {
+            ++moved;
+            CHECK(left[i] != "10.0.0.2:5005" && !left[i].empty());
+        }
+        else {
+            CHECK(left[i] == before[i]);
+        }
+    }
+    printf("leave moved %.3f\n", (double)moved / KEYS);
+
+    // 删除不存在的节点没有影响
+    ring.RemoveNode("10.0.0.9:5005");
+    CHECK(Owners(ring) == left);
+}
+
+int main() {
+    TestDistribution();
+    TestRemap();
+    return TestResult();
+}
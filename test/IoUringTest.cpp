@@ -0,0 +1,166 @@
+// io_uring 接收路径的测试: 多次触发的 recv 和提供的缓冲区, 缓冲区用完后重新提交, 对端关闭, 多次触发的 accept 和发送,
+// 不等待的发送.
+// 内核不支持 io_uring 或提供的缓冲区环时跳过
+#include "IoUring.h"
+#include "cppNetWork.h"
+#include "TestUtil.h"
+#include <sys/socket.h>
+#include <vector>
+
+// 缓冲区个数
+#define TESTBUFCOUNT 4
+// 每个缓冲区的大小
+#define TESTBUFSIZE 64
+
+// 等待一个完成事件. 先提交一次: 归还的缓冲区在 Submit 时才交给内核, 和服务端的事件循环一样
+static bool WaitEvent(LI::IoUring& ring, LI::IoEvent& event) {
+    REQUIRE(ring.Submit() == 0);
+    for (int i = 0; i < 20; ++i) {
+        if (ring.Reap(&event, 1) == 1) return true;
+        if (ring.Submit(1, 100) != 0 && errno != EINTR) return false;
+    }
+    return ring.Reap(&event, 1) == 1;
+}
+
+// 收到的数据按顺序追加到 got, 缓冲区暂不归还. 收够 total 字节或请求因为缓冲区用完(-ENOBUFS)而结束时返回
+static void Drain(LI::IoUring& ring, const size_t total, std::string& got, std::vector<uint16_t>& held) {
+    LI::IoEvent event;
+    while (got.size() < total) {
+        REQUIRE(WaitEvent(ring, event));
+        CHECK(event.user_data == 1);
+        if (event.res < 0) {
+            CHECK(event.res == -ENOBUFS && event.More() == false);
+            return;
+        }
+        REQUIRE(event.res > 0 && event.HasBuffer() && event.res <= TESTBUFSIZE);
+        got.append(ring.Buffer(event.BufferId()), event.res);
+        held.push_back(event.BufferId());
+        if (event.More() == false) return;
+    }
+}
+
+// 每次收到数据一个事件, 归还的缓冲区可以再次使用
+static void TestRecv(LI::IoUring& ring) {
+    int pair[2];
+    REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, pair) == 0);
+    ring.RecvMultishot(pair[1], 1);
+    REQUIRE(ring.Submit() == 0);
+
+    // 多于缓冲区个数的小报文, 每收到一个就归还缓冲区
+    for (int i = 0; i < 3 * TESTBUFCOUNT; ++i) {
+        const std::string text = "message " + std::to_string(i);
+        REQUIRE(write(pair[0], text.data(), text.size()) == (ssize_t)text.size());
+        LI::IoEvent event;
+        REQUIRE(WaitEvent(ring, event));
+        CHECK(event.user_data == 1 && event.More());
+        REQUIRE(event.res == (int)text.size() && event.HasBuffer());
+        CHECK(memcmp(ring.Buffer(event.BufferId()), text.data(), text.size()) == 0);
+        ring.RecycleBuffer(event.BufferId());
+    }
+
+    // 一次写入比所有缓冲区都大的数据: 缓冲区用完时请求以 -ENOBUFS 结束, 剩下的数据留在 socket 中
+    std::string data;
+    for (int i = 0; i < 1000; ++i) data.push_back((char)('a' + i % 26));
+    REQUIRE(ring.Submit() == 0); // 上面归还的缓冲区全部交给内核
+    REQUIRE(write(pair[0], data.data(), data.size()) == (ssize_t)data.size());
+    std::string got;
+    std::vector<uint16_t> held;
+    Drain(ring, data.size(), got, held);
+    CHECK(held.size() == TESTBUFCOUNT);
+    CHECK(got.size() == TESTBUFCOUNT * TESTBUFSIZE);
+
+    // 归还缓冲区后重新提交, 数据按顺序完整收到
+    while (got.size() < data.size()) {
+        for (auto bid : held) ring.RecycleBuffer(bid);
+        held.clear();
+        ring.RecvMultishot(pair[1], 1);
+        REQUIRE(ring.Submit() == 0);
+        Drain(ring, data.size(), got, held);
+    }
+    CHECK(got == data);
+    for (auto bid : held) ring.RecycleBuffer(bid);
+
+    // 对端关闭: 结果为 0, 请求结束. 最后一段数据正好用完缓冲区时请求先以 -ENOBUFS 结束, 重新提交
+    close(pair[0]);
+    LI::IoEvent event;
+    REQUIRE(WaitEvent(ring, event));
+    if (event.res == -ENOBUFS) {
+        ring.RecvMultishot(pair[1], 1);
+        REQUIRE(WaitEvent(ring, event));
+    }
+    CHECK(event.user_data == 1 && event.res == 0 && event.More() == false);
+    close(pair[1]);
+}
+
+// 多次触发的 accept 每个连接一个事件; 发送的数据完整到达
+static void TestAcceptSend(LI::IoUring& ring) {
+    const int listenfd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    REQUIRE(bind(listenfd, (struct sockaddr*)&addr, sizeof(addr)) == 0 && listen(listenfd, 8) == 0);
+    socklen_t len = sizeof(addr);
+    getsockname(listenfd, (struct sockaddr*)&addr, &len);
+    ring.AcceptMultishot(listenfd, 2);
+    REQUIRE(ring.Submit() == 0);
+
+    int clients[2];
+    int accepted[2];
+    for (int i = 0; i < 2; ++i) {
+        clients[i] = socket(AF_INET, SOCK_STREAM, 0);
+        REQUIRE(connect(clients[i], (struct sockaddr*)&addr, sizeof(addr)) == 0);
+        LI::IoEvent event;
+        REQUIRE(WaitEvent(ring, event));
+        CHECK(event.user_data == 2 && event.More());
+        REQUIRE(event.res >= 0);
+        accepted[i] = event.res;
+    }
+
+    // 比 socket 缓冲区小的数据一次发送完成
+    const std::string text(8000, 'z');
+    ring.Send(accepted[1], text.data(), text.size(), 3);
+    LI::IoEvent event;
+    REQUIRE(WaitEvent(ring, event));
+    CHECK(event.user_data == 3 && event.res == (int)text.size());
+    std::string got(text.size(), '\0');
+    CHECK(LI::Readn(clients[1], &got[0], got.size()) && got == text);
+
+    // 不等待的发送: 对端不读取, 比 socket 缓冲区大的数据只发送一部分就完成, 缓冲区满后以 -EAGAIN 完成
+    const std::string big(16 * 1024 * 1024, 'y');
+    ring.Send(accepted[1], big.data(), big.size(), 5, true);
+    REQUIRE(WaitEvent(ring, event));
+    CHECK(event.user_data == 5 && event.res > 0 && (size_t)event.res < big.size());
+    int sends = 0;
+    do {
+        ring.Send(accepted[1], big.data(), big.size(), 5, true);
+        REQUIRE(WaitEvent(ring, event));
+    } while (event.res > 0 && ++sends < 100);
+    CHECK(event.user_data == 5 && event.res == -EAGAIN);
+
+    // 取消监听 socket 上的请求, accept 以 -ECANCELED 结束
+    ring.CancelFd(listenfd, 4);
+    REQUIRE(ring.Submit() == 0);
+    bool cancelled = false;
+    for (int i = 0; i < 2; ++i) {
+        REQUIRE(WaitEvent(ring, event));
+        if (event.user_data == 2) cancelled = event.res == -ECANCELED && event.More() == false;
+    }
+    CHECK(cancelled);
+
+    for (int i = 0; i < 2; ++i) {
+        close(clients[i]);
+        close(accepted[i]);
+    }
+    close(listenfd);
+}
+
+int main() {
+    LI::IoUring ring;
+    if (ring.Init(64) == false) SKIP("io_uring is not available");
+    if (ring.SetupBuffers(TESTBUFCOUNT, TESTBUFSIZE) == false) SKIP("provided buffer rings are not supported");
+    TestRecv(ring);
+    TestAcceptSend(ring);
+    ring.Close();
+    return TestResult();
+}
@@ -0,0 +1,175 @@
+// MemoryPool 的测试: 大小分级, 跨线程归还, STL 分配器, 稳定运行时的分配次数和吞吐
+#include "MemoryPool.h"
+#include "TestUtil.h"
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <new>
+#include <thread>
+#include <vector>
+
+// 统计 operator new 的调用次数, 内存池向系统申请 slab 和超过 64KB 的请求也经过这里
+static std::atomic<long> new_calls(0);
+
+void* operator new(size_t n) {
+    new_calls.fetch_add(1, std::memory_order_relaxed);
+    void* p = malloc(n == 0 ? 1 : n);
+    if (p == nullptr) throw std::bad_alloc();
+    return p;
+}
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+
+// 请求的大小向上取整到 2 的幂, 同一级别的内存互相复用, 不同级别不复用
+static void TestSizeClass() {
+    void* p = LI::PoolAlloc(17);
+    CHECK(((uintptr_t)p & 15) == 0);
+    LI::PoolFree(p, 17);
+    // 17 和 32 都是 32 字节的级别, 本线程缓存是后进先出的
+    void* q = LI::PoolAlloc(32);
+    CHECK(q == p);
+    LI::PoolFree(q, 32);
+    // 33 属于 64 字节的级别, 不会拿到 32 字节的节点
+    void* r = LI::PoolAlloc(33);
+    CHECK(r != p);
+    void* s = LI::PoolAlloc(20);
+    CHECK(s == p);
+    LI::PoolFree(s, 20);
+    LI::PoolFree(r, 33);
+
+    // 1 字节也占 16 字节, 相邻的两次分配不会重叠
+    char* a = static_cast<char*>(LI::PoolAlloc(1));
+    char* b = static_cast<char*>(LI::PoolAlloc(1));
+    CHECK(a + 16 <= b || b + 16 <= a);
+    LI::PoolFree(a, 1);
+    LI::PoolFree(b, 1);
+
+    // 最大的级别仍在内存池中, 超过的直接使用 operator new
+    void* big = LI::PoolAlloc(LI::PoolMaxSize());
+    LI::PoolFree(big, LI::PoolMaxSize());
+    const long before = new_calls.load();
+    void* huge = LI::PoolAlloc(LI::PoolMaxSize() + 1);
+    CHECK(new_calls.load() == before + 1);
+    LI::PoolFree(huge, LI::PoolMaxSize() + 1);
+}
+
+// 一个线程分配, 另一个线程释放: 释放的节点经过仓库回到分配的线程, 不再申请新的 slab
+static void TestCrossThread() {
+    const size_t count = 10000;
+    const size_t size = 48;
+    std::vector<void*> ptrs(count);
+    for (auto& p : ptrs) p = LI::PoolAlloc(size);
+    const size_t slabs = LI::PoolSlabBytes();
+
+    std::thread freer([&]() {
+        for (auto p : ptrs) LI::PoolFree(p, size);
+    });
+    freer.join(); // 线程退出时缓存全部归还仓库
+
+    for (auto& p : ptrs) p = LI::PoolAlloc(size);
+    CHECK(LI::PoolSlabBytes() == slabs);
+    for (auto p : ptrs) LI::PoolFree(p, size);
+
+    // 多个线程同时在一个线程分配, 另一个线程释放
+    std::atomic<int> errors(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&errors]() {
+            std::vector<uint64_t*> nodes(count);
+            for (size_t round = 0; round < 3; ++round) {
+                for (size_t i = 0; i < count; ++i) {
+                    nodes[i] = static_cast<uint64_t*>(LI::PoolAlloc(size));
+                    *nodes[i] = i;
+                }
+                std::thread other([&]() {
+                    for (size_t i = 0; i < count; ++i) {
+                        if (*nodes[i] != i) ++errors;
+                        LI::PoolFree(nodes[i], size);
+                    }
+                });
+                other.join();
+            }
+        });
+    }
+    for (auto& t : threads) t.join();
+    CHECK(errors.load() == 0);
+}
+
+// PoolAllocator 接入 STL 容器, 预热后不再调用 operator new
+static void TestAllocator() {
+    using Map = std::map<int, LI::PoolString, std::less<int>,
+                         LI::PoolAllocator<std::pair<const int, LI::PoolString>>>;
+    for (int round = 0; round < 2; ++round) {
+        if (round == 1) new_calls.store(0);
+        Map m;
+        for (int i = 0; i < 1000; ++i) {
+            LI::PoolString s(100 + i % 50, 'a' + i % 26);
+            s += "<message>";
+            m.emplace(i, std::move(s));
+        }
+        CHECK(m.size() == 1000);
+        CHECK(m[7].size() == 116 && m[7][0] == 'h');
+        LI::PoolString joined;
+        for (auto& kv : m) {
+            joined.append(kv.second.data(), 3);
+        }
+        CHECK(joined.size() == 3000);
+        for (int i = 0; i < 1000; i += 2) m.erase(i);
+        CHECK(m.size() == 500);
+    }
+    CHECK(new_calls.load() == 0);
+}
+
+// 稳定运行时不调用 operator new, 并和 operator new 比较吞吐
+static void TestSteadyState() {
+    const size_t sizes[] = {24, 64, 100, 200, 1000, 4096, 16384};
+    const int rounds = 200000;
+    // 每个槽位记住自己的大小, 分配和释放交错进行
+    std::vector<void*> live(64, nullptr);
+    std::vector<size_t> live_size(live.size(), 0);
+    auto pool_round = [&]() {
+        for (int i = 0; i < rounds; ++i) {
+            const size_t slot = (size_t)(i * 7) % live.size();
+            if (live[slot] != nullptr) LI::PoolFree(live[slot], live_size[slot]);
+            live_size[slot] = sizes[i % 7];
+            live[slot] = LI::PoolAlloc(live_size[slot]);
+        }
+    };
+    auto new_round = [&]() {
+        for (int i = 0; i < rounds; ++i) {
+            const size_t slot = (size_t)(i * 7) % live.size();
+            ::operator delete(live[slot]);
+            live[slot] = ::operator new(sizes[i % 7]);
+        }
+    };
+
+    pool_round(); // 预热: 各级别的 slab 在这里申请
+    const size_t slabs = LI::PoolSlabBytes();
+    new_calls.store(0);
+    const long long t0 = NowNs();
+    pool_round();
+    const long long t1 = NowNs();
+    CHECK(new_calls.load() == 0);
+    CHECK(LI::PoolSlabBytes() == slabs);
+    for (size_t i = 0; i < live.size(); ++i) {
+        LI::PoolFree(live[i], live_size[i]);
+        live[i] = nullptr;
+    }
+
+    new_round();
+    const long long t2 = NowNs();
+    new_round();
+    const long long t3 = NowNs();
+    for (auto p : live) ::operator delete(p);
+    printf("alloc+free: pool %.1f ns, operator new %.1f ns, slab bytes %zu\n",
+           (double)(t1 - t0) / rounds, (double)(t3 - t2) / rounds, LI::PoolSlabBytes());
+}
+
+int main() {
+    TestSizeClass();
+    TestCrossThread();
+    TestAllocator();
+    TestSteadyState();
+    return TestResult();
+}
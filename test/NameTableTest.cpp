@@ -0,0 +1,51 @@
+// NameTable 的测试: 编号从 1 连续分配, 跨越多个段时按编号取回的用户名正确, 重复驻留得到同一个编号, 其他线程按编号无锁读取
+#include "NameTable.h"
+#include "TestUtil.h"
+#include <thread>
+#include <atomic>
+
+// 跨越前 9 个段(1024, 2048, ... 个)
+#define TESTNAMES 300000
+
+int main() {
+    LI::NameTable table;
+    CHECK(table.Size() == 0);
+    CHECK(table.Find("nobody", 6) == 0);
+
+    // 读线程一直读取已经发布的编号
+    std::atomic<bool> stop(false);
+    std::atomic<long> mismatched(0);
+    std::thread reader([&]() {
+        while (stop.load() == false) {
+            const size_t size = table.Size();
+            if (size == 0) continue;
+            // 刚发布的编号和更早的编号
+            for (const uint32_t id : {(uint32_t)size, (uint32_t)(size / 2 + 1)}) {
+                if (table.Name(id) != "user" + std::to_string(id)) ++mismatched;
+            }
+        }
+    });
+
+    for (uint32_t i = 1; i <= TESTNAMES; ++i) {
+        const std::string name = "user" + std::to_string(i);
+        CHECK(table.Intern(name.data(), name.size()) == i);
+    }
+    stop = true;
+    reader.join();
+    CHECK(mismatched.load() == 0);
+    CHECK(table.Size() == TESTNAMES);
+
+    // 段的边界: pos = id + 1024 是 2 的幂的前后
+    for (uint32_t id : {1u, 1023u, 1024u, 1025u, 3071u, 3072u, 3073u, 7167u, 7168u, 261119u, 261120u, (uint32_t)TESTNAMES}) {
+        const std::string name = "user" + std::to_string(id);
+        CHECK(table.Name(id) == name);
+        CHECK(table.Find(name.data(), name.size()) == id);
+        CHECK(table.Intern(name.data(), name.size()) == id);
+    }
+    // 引用在之后的分配中一直有效
+    const std::string& first = table.Name(1);
+    CHECK(table.Intern("late", 4) == TESTNAMES + 1);
+    CHECK(first == "user1" && &first == &table.Name(1));
+    CHECK(table.Size() == TESTNAMES + 1);
+    return TestResult();
+}
@@ -0,0 +1,134 @@
+// 口令哈希的测试: RFC 7914 的测试向量, 保存格式和校验, 重新哈希的判断, 校验过的口令的缓存, 在有界的线程池中计算 scrypt
+#include "PasswordHash.h"
+#include "ThreadPool.hpp"
+#include "TestUtil.h"
+#include <cstring>
+#include <vector>
+
+// 测试用的参数, 比服务端的缺省值弱, 每次约 1MB 内存
+static const LI::ScryptParams kParams = {10, 8, 1};
+
+// 十六进制字符串转换为字节
+static std::vector<uint8_t> FromHex(const char* hex) {
+    std::vector<uint8_t> out;
+    for (size_t i = 0; hex[i] != '\0' && hex[i + 1] != '\0'; i += 2) {
+        out.push_back((uint8_t)std::stoi(std::string(hex + i, 2), nullptr, 16));
+    }
+    return out;
+}
+
+// RFC 7914 第 12 节的前两个测试向量; 不正确的参数被拒绝
+static void TestVectors() {
+    uint8_t out[64];
+    CHECK(LI::Scrypt("", 0, (const uint8_t*)"", 0, LI::ScryptParams{4, 1, 1}, out, sizeof(out)));
+    std::vector<uint8_t> expect = FromHex("77d6576238657b203b19ca42c18a0497f16b4844e3074ae8dfdffa3fede21442"
+                                          "fcd0069ded0948f8326a753a0fc81f17e8d3e0fb2e0d3628cf35e20c38d18906");
+    CHECK(memcmp(out, expect.data(), sizeof(out)) == 0);
+
+    CHECK(LI::Scrypt("password", 8, (const uint8_t*)"NaCl", 4, LI::ScryptParams{10, 8, 16}, out, sizeof(out)));
+    expect = FromHex("fdbabe1c9d3472007856e7190d01e9fe7c6ad7cbc8237830e77376634b373162"
+                     "2eaf30d92e22a3886ff109279d9830dac727afb94a83ee6d8360cbdfa2cc0640");
+    CHECK(memcmp(out, expect.data(), sizeof(out)) == 0);
+
+    CHECK(LI::Scrypt("x", 1, (const uint8_t*)"s", 1, LI::ScryptParams{0, 8, 1}, out, sizeof(out)) == false);
+    CHECK(LI::Scrypt("x", 1, (const uint8_t*)"s", 1, LI::ScryptParams{10, 0, 1}, out, sizeof(out)) == false);
+    CHECK(LI::Scrypt("x", 1, (const uint8_t*)"s", 1, LI::ScryptParams{10, 8, 0}, out, sizeof(out)) == false);
+}
+
+// 保存格式: 每次的盐不同; 只有原口令校验通过; 旧版本的明文按原样比较; 明文和较弱的参数需要重新哈希
+static void TestHashVerify() {
+    const std::string first = LI::HashPassword("secret", 6, kParams);
+    const std::string second = LI::HashPassword("secret", 6, kParams);
+    REQUIRE(first.size() > 0 && first.size() <= 128);
+    CHECK(first.compare(0, 12, "$scrypt$10$8") == 0);
+    CHECK(first != second);
+    CHECK(LI::VerifyPassword("secret", 6, first));
+    CHECK(LI::VerifyPassword("secret", 6, second));
+    CHECK(LI::VerifyPassword("secreT", 6, first) == false);
+    CHECK(LI::VerifyPassword("secret!", 7, first) == false);
+    CHECK(LI::VerifyPassword("", 0, first) == false);
+
+    CHECK(LI::VerifyPassword("plain", 5, "plain"));
+    CHECK(LI::VerifyPassword("plain", 5, "plaim") == false);
+    CHECK(LI::VerifyPassword("plai", 4, "plain") == false);
+
+    CHECK(LI::NeedsRehash("plain", kParams));
+    CHECK(LI::NeedsRehash(first, kParams) == false);
+    CHECK(LI::NeedsRehash(first, LI::ScryptParams{11, 8, 1}));
+    CHECK(LI::NeedsRehash(first, LI::ScryptParams{10, 8, 2}));
+    CHECK(LI::NeedsRehash(first, LI::ScryptParams{9, 8, 1}) == false);
+}
+
+// 缓存: 同一个口令命中; 错误的口令和改变后的数据库哈希不命中; 过期后不命中; 容量满时删除过期的
+static void TestCredentialCache() {
+    const std::string stored = LI::HashPassword("secret", 6, kParams);
+    LI::CredentialCache cache(2, 60);
+    CHECK(cache.Lookup("alice", "secret", 6, stored, 1000) == false);
+    cache.Insert("alice", "secret", 6, stored, 1000);
+    CHECK(cache.Lookup("alice", "secret", 6, stored, 1000));
+    CHECK(cache.Lookup("alice", "secret", 6, stored, 1059));
+    CHECK(cache.Lookup("alice", "wrong", 5, stored, 1001) == false);
+    CHECK(cache.Lookup("bob", "secret", 6, stored, 1001) == false);
+    // 修改口令后数据库中的哈希改变, 原来的缓存失效, 旧口令和新口令都要重新校验
+    const std::string changed = LI::HashPassword("newpass", 7, kParams);
+    CHECK(cache.Lookup("alice", "secret", 6, changed, 1002) == false);
+    CHECK(cache.Lookup("alice", "newpass", 7, changed, 1002) == false);
+    cache.Insert("alice", "newpass", 7, changed, 1002);
+    CHECK(cache.Lookup("alice", "newpass", 7, changed, 1003));
+    CHECK(cache.Lookup("alice", "secret", 6, stored, 1003) == false);
+    // 有效期
+    CHECK(cache.Lookup("alice", "newpass", 7, changed, 1062) == false);
+    CHECK(cache.Lookup("alice", "newpass", 7, changed, 1003) == false); // 过期的已经删除
+
+    // 容量为 2: 第三个用户挤出过期的那个
+    cache.Insert("u1", "p", 1, stored, 2000);
+    cache.Insert("u2", "p", 1, stored, 2050);
+    cache.Insert("u3", "p", 1, stored, 2070);
+    CHECK(cache.Lookup("u1", "p", 1, stored, 2070) == false);
+    CHECK(cache.Lookup("u2", "p", 1, stored, 2070));
+    CHECK(cache.Lookup("u3", "p", 1, stored, 2070));
+
+    // 容量为 0 时不缓存
+    LI::CredentialCache disabled(0, 60);
+    disabled.Insert("alice", "secret", 6, stored, 1000);
+    CHECK(disabled.Lookup("alice", "secret", 6, stored, 1000) == false);
+}
+
+// 和服务端一样在一个线程, 队列容量为 1 的线程池中校验: 一个正在计算, 一个排队, 多出的请求立即被拒绝, 完成的结果正确.
+// 使用服务端缺省的参数, 每次校验几十毫秒
+static void TestPool() {
+    const std::string stored = LI::HashPassword("secret", 6, LI::ScryptParams{14, 8, 1});
+    LI::ThreadPool pool(1);
+    pool.SetCapacity(1, LI::ThreadPool::REJECT);
+    std::vector<std::future<bool>> results;
+    for (int i = 0; i < 8; ++i) {
+        // 第一个请求开始计算后再提交其他的
+        while (i == 1 && pool.Depth() > 0) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        const bool right = (i % 2 == 0);
+        results.push_back(pool.enqueue([&stored, right]() {
+            return right ? LI::VerifyPassword("secret", 6, stored) : LI::VerifyPassword("wrong", 5, stored);
+        }));
+    }
+    int done = 0, rejected = 0;
+    for (size_t i = 0; i < results.size(); ++i) {
+        try {
+            CHECK(results[i].get() == (i % 2 == 0));
+            ++done;
+        }
+        catch (const std::future_error& e) {
+            CHECK(e.code() == std::future_errc::broken_promise);
+            ++rejected;
+        }
+    }
+    printf("pool: %d verified, %d rejected\n", done, rejected);
+    CHECK(done == 2 && rejected == 6);
+    CHECK(pool.Rejected() == (uint64_t)rejected);
+}
+
+int main() {
+    TestVectors();
+    TestHashVerify();
+    TestCredentialCache();
+    TestPool();
+    return TestResult();
+}
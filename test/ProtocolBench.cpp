@@ -0,0 +1,90 @@
+// Protocol.hpp 的性能测试, 不加入 ctest: 和原来逐段拼接、逐个字段 GetStrFromXML 的实现比较
+// 形成广播报文(code 4)和服务端解析发信息报文(cmd 2)的耗时. 用法: ProtocolBench [次数]
+#include "Protocol.hpp"
+#include "cppNetWork.h"
+#include "TestUtil.h"
+
+using namespace LI::proto;
+
+// 防止编译器把结果没有用到的循环优化掉
+static volatile size_t sink;
+
+// 原来 broadcastMessage 中逐段拼接的广播报文
+static void HandEncode(std::string& data, const std::string& name, const int color, const std::string& text, const int64_t now) {
+    std::string colorstr = std::to_string(color);
+    std::string timestr = std::to_string(now);
+    data.reserve(name.size() + text.size() + colorstr.size() + timestr.size() + 80);
+    data.append("<code>4</code>");
+    data.append("<name>");
+    data.append(name);
+    data.append("</name>");
+    data.append("<color>");
+    data.append(colorstr.c_str(), colorstr.size());
+    data.append("</color>");
+    data.append("<message>");
+    data.append(text);
+    data.append("</message>");
+    data.append("<time>");
+    data.append(timestr.c_str(), timestr.size());
+    data.append("</time>");
+}
+
+// 每次的平均耗时, 单位: ns
+template<class F>
+static double Measure(const long n, F&& f) {
+    const long long start = NowNs();
+    for (long i = 0; i < n; ++i) f(i);
+    return (double)(NowNs() - start) / n;
+}
+
+static void Run(const size_t textlen, const long n) {
+    const std::string name = "alice";
+    std::string text;
+    for (size_t i = 0; i < textlen; ++i) text.push_back((char)('a' + i % 26));
+
+    const double hand = Measure(n, [&](long i) {
+        std::string data;
+        HandEncode(data, name, 3, text, 1700000000000LL + i);
+        sink = sink + data.size();
+    });
+    const double schema = Measure(n, [&](long i) {
+        BroadcastCode msg;
+        msg.name = name;
+        msg.color = 3;
+        msg.message = text;
+        msg.time = 1700000000000LL + i;
+        sink = sink + msg.Encode().size();
+    });
+
+    ChatCmd chat;
+    chat.name = name;
+    chat.color = 3;
+    chat.message = text;
+    const std::string frame = chat.Encode();
+    const double xml = Measure(n, [&](long) {
+        LI::PoolString message, sender;
+        int color = 0;
+        LI::GetStrFromXML(frame.c_str(), "message", message);
+        LI::GetStrFromXML(frame.c_str(), "name", sender);
+        LI::GetStrFromXML(frame.c_str(), "color", color);
+        sink = sink + message.size() + sender.size() + color;
+    });
+    const double decode = Measure(n, [&](long) {
+        ChatCmd msg;
+        LI::PoolString message, sender;
+        msg.Decode(frame.data(), frame.size());
+        Unescape(msg.message, message);
+        Unescape(msg.name, sender);
+        sink = sink + message.size() + sender.size() + msg.color;
+    });
+    printf("%5zu bytes: encode hand %6.1f ns, schema %6.1f ns; parse GetStrFromXML %6.1f ns, Decode %6.1f ns\n",
+           textlen, hand, schema, xml, decode);
+}
+
+int main(int argc, char* argv[]) {
+    const long n = (argc > 1) ? atol(argv[1]) : 1000000;
+    for (const size_t len : {16, 100, 1000, 4000}) {
+        Run(len, n);
+    }
+    return 0;
+}
@@ -0,0 +1,148 @@
+// Protocol.hpp 的测试: 各种报文编码后解码得到原值, 长度和编译期常量一致, 标签文本转义后原样还原,
+// 解码时字段的顺序、不认识的标签、重复和缺少的字段, 值中没有转义的标签字符不会变成字段
+#include "Protocol.hpp"
+#include "TestUtil.h"
+#include <climits>
+#include <vector>
+
+using namespace LI::proto;
+
+// 解码得到的文本字段还原后和 expect 相同
+static bool TextIs(const Text& v, const std::string& expect) {
+    std::string out;
+    Unescape(v, out);
+    return out == expect;
+}
+
+// 编码后解码: 广播的四个字段, 包括标签文本、转义序列本身、负数和边界的整数
+static void TestRoundTrip() {
+    const std::vector<std::string> texts = {
+        "", "hello", "a < b > c & d", "</message><time>1</time>", "<name>admin</name>",
+        "&lt; is not <", "&amp;&", "</item><item><code>4</code>", std::string(4000, 'x') + "<" + std::string(10, '&'),
+    };
+    const std::vector<Int> ints = {0, 7, -1, 1234567890123LL, LLONG_MAX, LLONG_MIN};
+    for (const auto& text : texts) {
+        for (const Int v : ints) {
+            BroadcastCode out;
+            out.name = "alice";
+            out.color = v;
+            out.message = text;
+            out.time = ~v;
+            const std::string data = out.Encode();
+            CHECK(data.size() == out.Size());
+            CHECK(data.compare(0, 14, "<code>4</code>") == 0);
+            // 转义后的报文中只有标签的 '<' 和 '>': 每个字段两个标签, 加上报文头
+            CHECK(CountChar(data.data(), data.size(), '<') == 10);
+
+            BroadcastCode in;
+            REQUIRE(in.Decode(data.data(), data.size()));
+            CHECK(TextIs(in.name, "alice"));
+            CHECK(TextIs(in.message, text));
+            CHECK(in.color == v && in.time == ~v);
+        }
+    }
+
+    // 没有需要转义的字符时和逐段拼接的相同
+    ChatCmd chat;
+    chat.name = "bob";
+    chat.color = 3;
+    chat.message = "hi";
+    CHECK(chat.Encode() == "<cmd>2</cmd><name>bob</name><color>3</color><message>hi</message>");
+    CHECK(ChatCmd::FixedSize() + 3 + 1 + 2 == chat.Size());
+    LoginCmd login;
+    login.message = "bob pw";
+    login.compress = 1;
+    CHECK(login.Encode() == "<cmd>1</cmd><message>bob pw</message><compress>1</compress>");
+    RegisterCmd reg;
+    reg.message = "bob pw";
+    std::string appended = "head";
+    reg.AppendTo(appended);
+    CHECK(appended == "head<cmd>0</cmd><message>bob pw</message>");
+}
+
+// 转义和还原
+static void TestEscape() {
+    CHECK(EscapedSize("a<b>&", 5) == 5 + 3 + 3 + 4);
+    CHECK(NeedsEscape(std::string("plain")) == false);
+    CHECK(NeedsEscape(std::string("a&b")) && NeedsEscape(std::string("<")) && NeedsEscape(std::string(">")));
+    std::string s = "&lt;&gt;&amp;&amp;lt;&unknown;&";
+    Unescape(s);
+    CHECK(s == "<>&&lt;&unknown;&");
+    s = "no entities";
+    Unescape(s);
+    CHECK(s == "no entities");
+    LI::PoolString pooled("x &lt;y&gt;");
+    Unescape(pooled);
+    CHECK(pooled.size() == 5 && memcmp(pooled.data(), "x <y>", 5) == 0);
+}
+
+// 解码: 字段的顺序不限, 报文头和不认识的标签跳过, 同名字段取第一个, 缺少字段返回 false 且保持原值
+static void TestDecode() {
+    ChatCmd msg;
+    const std::string reordered = "<cmd>2</cmd><message>m</message><extra>e</extra><color>5</color><name>n</name><name>second</name>";
+    CHECK(msg.Decode(reordered.data(), reordered.size()));
+    CHECK(TextIs(msg.name, "n") && TextIs(msg.message, "m") && msg.color == 5);
+
+    ChatCmd missing;
+    missing.color = 9;
+    const std::string nocolor = "<cmd>2</cmd><name>n</name><message>m</message>";
+    CHECK(missing.Decode(nocolor.data(), nocolor.size()) == false);
+    CHECK(missing.color == 9 && TextIs(missing.message, "m"));
+
+    // 没有结束标签的字段当作缺少
+    ChatCmd unclosed;
+    const std::string open = "<cmd>2</cmd><name>n</name><color>1</color><message>m";
+    CHECK(unclosed.Decode(open.data(), open.size()) == false);
+    CHECK(unclosed.message.size == 0);
+
+    // 值中的转义序列不是标签: 解码后原样引用报文中的内容
+    ChatCmd escaped;
+    const std::string entity = "<cmd>2</cmd><name>n</name><color>1</color><message>&lt;name&gt;x&lt;/name&gt;</message>";
+    CHECK(escaped.Decode(entity.data(), entity.size()));
+    CHECK(escaped.message.str() == "&lt;name&gt;x&lt;/name&gt;");
+    CHECK(TextIs(escaped.name, "n"));
+}
+
+// 注入: 没有按协议转义的报文, 值中的标签不会变成字段, 解码失败
+static void TestInjection() {
+    // 信息中的 <name> 在信息字段之后也不会被当作用户名
+    ChatCmd msg;
+    const std::string raw = "<cmd>2</cmd><color>1</color><message>hi <name>admin</name></message>";
+    CHECK(msg.Decode(raw.data(), raw.size()) == false);
+    CHECK(msg.name.size == 0 && msg.message.size == 0);
+
+    // 提前出现的结束标签: 值是 "a", 之后重复的 <time> 取第一个
+    BroadcastCode code;
+    code.time = 42;
+    const std::string forged = "<code>4</code><name>n</name><color>1</color><message>a</message><time>1</time></message><time>7</time>";
+    CHECK(code.Decode(forged.data(), forged.size()));
+    CHECK(TextIs(code.message, "a") && code.time == 1);
+
+    // 只有 '<' 能开始标签, 没有转义的 '>' 不影响字段的边界
+    BroadcastCode gt;
+    const std::string half = "<code>4</code><name>a>b</name><color>1</color><message>m</message><time>1</time>";
+    CHECK(gt.Decode(half.data(), half.size()));
+    CHECK(gt.name.str() == "a>b");
+
+    // 整数字段也一样: 之后的 <message> 不解析
+    ChatCmd color;
+    color.color = 9;
+    const std::string intval = "<cmd>2</cmd><name>n</name><color>3<message>x</message></color><message>m</message>";
+    CHECK(color.Decode(intval.data(), intval.size()) == false);
+    CHECK(color.color == 9 && color.message.size == 0);
+
+    // 修改过的值重新编码: 转义后的长度重新计算
+    BroadcastCode reuse;
+    reuse.message = "plain";
+    CHECK(reuse.Size() == BroadcastCode::FixedSize() + 5 + 1 + 1);
+    reuse.message = "<b>";
+    CHECK(reuse.Encode().find("<message>&lt;b&gt;</message>") != std::string::npos);
+}
+
+int main() {
+    TestRoundTrip();
+    TestEscape();
+    TestDecode();
+    TestInjection();
+    return TestResult();
+}
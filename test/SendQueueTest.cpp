@@ -0,0 +1,206 @@
+// SendQueue 的测试: 发送缓冲区满时剩下的部分排队, 可写时按顺序发送完; 多个线程同时放入时报文不交错;
+// 积压超过上限和连接出错时关闭; 直接发送用指定的函数; 复制还没有发送的数据
+#include "SendQueue.h"
+#include "cppNetWork.h"
+#include "TestUtil.h"
+#include <atomic>
+#include <csignal>
+#include <fcntl.h>
+#include <thread>
+#include <vector>
+
+// 一对 UNIX 域流 socket: fds[0] 非阻塞, 发送; fds[1] 阻塞, 接收. 发送缓冲区调小, 很快就满
+static void MakePair(int fds[2]) {
+    REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    const int size = 16 * 1024;
+    setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+    fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+}
+
+// 带长度头的报文, 报文体是 4 字节的来源和序号, 后面按序号填充到 len
+static std::string MakeFrame(const int from, const int seq, const size_t len) {
+    std::string body(len, '\0');
+    memcpy(&body[0], &from, sizeof(from));
+    memcpy(&body[4], &seq, sizeof(seq));
+    for (size_t i = 8; i < len; ++i) body[i] = (char)('a' + (seq + i) % 26);
+    std::string frame;
+    LI::AppendFrame(frame, body.data(), body.size());
+    return frame;
+}
+
+// 读出一个报文, 检查内容和 MakeFrame 一致, 返回来源和序号
+static bool ReadFrame(const int sockfd, int* from, int* seq) {
+    uint32_t len = 0;
+    if (LI::Readn(sockfd, (char*)&len, 4) == false) return false;
+    std::string body(ntohl(len), '\0');
+    if (body.size() < 8 || LI::Readn(sockfd, &body[0], body.size()) == false) return false;
+    memcpy(from, &body[0], 4);
+    memcpy(seq, &body[4], 4);
+    return body == MakeFrame(*from, *seq, body.size()).substr(4);
+}
+
+// 等 sockfd 可写后调用 Flush, 直到队列为空
+static LI::SendQueue::Result FlushAll(LI::SendQueue& queue, const int sockfd) {
+    LI::SendQueue::Result result = queue.Flush();
+    for (int i = 0; i < 1000 && result == LI::SendQueue::PENDING; ++i) {
+        struct pollfd pfd = {sockfd, POLLOUT, 0};
+        poll(&pfd, 1, 10);
+        result = queue.Flush();
+    }
+    return result;
+}
+
+// 对端不读时放入的报文排队, 之后按顺序全部到达
+static void TestBacklog() {
+    int fds[2];
+    MakePair(fds);
+    LI::SendQueue queue(fds[0], 1 << 20);
+    CHECK(queue.Push(MakeFrame(0, 0, 100).data(), 104) == LI::SendQueue::DONE);
+    CHECK(queue.Empty());
+
+    // 发送缓冲区满时第一次排队返回 QUEUED, 之后 PENDING
+    int n = 1;
+    LI::SendQueue::Result result = LI::SendQueue::DONE;
+    for (; n < 1000 && result == LI::SendQueue::DONE; ++n) {
+        const std::string frame = MakeFrame(0, n, 3000);
+        result = queue.Push(frame.data(), frame.size());
+    }
+    CHECK(result == LI::SendQueue::QUEUED);
+    CHECK(queue.Empty() == false);
+    for (int i = 0; i < 20; ++i, ++n) {
+        const std::string frame = MakeFrame(0, n, 3000);
+        CHECK(queue.Push(frame.data(), frame.size()) == LI::SendQueue::PENDING);
+    }
+
+    std::atomic<int> received(0);
+    std::thread reader([&]() {
+        int from, seq;
+        while (received.load() < n && ReadFrame(fds[1], &from, &seq) && seq == received.load()) ++received;
+    });
+    CHECK(FlushAll(queue, fds[0]) == LI::SendQueue::DONE);
+    reader.join();
+    CHECK(received.load() == n);
+    CHECK(queue.Empty());
+    close(fds[0]);
+    close(fds[1]);
+}
+
+// 多个线程同时放入, 事件循环的线程在可写时发送: 每个线程的报文按顺序到达, 报文完整
+static void TestThreads() {
+    int fds[2];
+    MakePair(fds);
+    LI::SendQueue queue(fds[0], 64 << 20);
+    const int nthreads = 4, nframes = 2000;
+    std::atomic<int> done(0);
+    std::vector<std::thread> writers;
+    for (int t = 0; t < nthreads; ++t) {
+        writers.emplace_back([&, t]() {
+            for (int i = 0; i < nframes; ++i) {
+                const std::string frame = MakeFrame(t, i, 8 + (size_t)(i * 37 % 2000));
+                CHECK(queue.Push(frame.data(), frame.size()) != LI::SendQueue::FAILED);
+            }
+            ++done;
+        });
+    }
+    int next[nthreads] = {0};
+    bool ordered = true;
+    std::thread reader([&]() {
+        int from, seq;
+        for (int i = 0; i < nthreads * nframes; ++i) {
+            if (ReadFrame(fds[1], &from, &seq) == false || from < 0 || from >= nthreads || seq != next[from]) {
+                ordered = false;
+                return;
+            }
+            ++next[from];
+        }
+    });
+    while (done.load() < nthreads || queue.Empty() == false) {
+        struct pollfd pfd = {fds[0], POLLOUT, 0};
+        poll(&pfd, 1, 1);
+        CHECK(queue.Flush() != LI::SendQueue::FAILED);
+    }
+    for (auto& writer : writers) writer.join();
+    reader.join();
+    CHECK(ordered);
+    for (int t = 0; t < nthreads; ++t) CHECK(next[t] == nframes);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+// 积压超过上限时关闭, 之后的报文丢弃; 对端关闭时发送出错也关闭
+static void TestClose() {
+    int fds[2];
+    MakePair(fds);
+    LI::SendQueue queue(fds[0], 64 * 1024);
+    LI::SendQueue::Result result = LI::SendQueue::DONE;
+    int n = 0;
+    for (; n < 10000 && result != LI::SendQueue::FAILED; ++n) {
+        const std::string frame = MakeFrame(0, n, 1000);
+        result = queue.Push(frame.data(), frame.size());
+    }
+    CHECK(result == LI::SendQueue::FAILED);
+    CHECK(queue.Push("x", 1) == LI::SendQueue::CLOSED);
+    CHECK(queue.Flush() == LI::SendQueue::CLOSED);
+    close(fds[0]);
+    close(fds[1]);
+
+    MakePair(fds);
+    LI::SendQueue broken(fds[0], 1 << 20);
+    close(fds[1]);
+    const std::string frame = MakeFrame(0, 0, 100);
+    CHECK(broken.Push(frame.data(), frame.size()) == LI::SendQueue::FAILED);
+    CHECK(broken.Push(frame.data(), frame.size()) == LI::SendQueue::CLOSED);
+    close(fds[0]);
+
+    // Close 之后不再写 socket
+    MakePair(fds);
+    LI::SendQueue closed(fds[0], 1 << 20);
+    closed.Close();
+    CHECK(closed.Push(frame.data(), frame.size()) == LI::SendQueue::CLOSED);
+    char byte;
+    CHECK(recv(fds[1], &byte, 1, MSG_DONTWAIT) < 0 && errno == EAGAIN);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+// 指定的发送函数只在队列为空时使用, 没有发送的部分复制到队列中; Unsent 复制没有发送的数据, 队列继续使用
+static void TestSenderAndUnsent() {
+    int fds[2];
+    MakePair(fds);
+    LI::SendQueue queue(fds[0], 1 << 20);
+    int calls = 0;
+    auto half = [&](const char* data, size_t len) -> ssize_t {
+        ++calls;
+        if (calls > 1) {
+            errno = EAGAIN;
+            return -1;
+        }
+        return send(fds[0], data, len / 2, MSG_DONTWAIT);
+    };
+    const std::string first = MakeFrame(0, 0, 1000), second = MakeFrame(0, 1, 1000);
+    CHECK(queue.Push(first.data(), first.size(), half) == LI::SendQueue::QUEUED);
+    CHECK(queue.Push(second.data(), second.size(), half) == LI::SendQueue::PENDING);
+    CHECK(calls == 2);
+
+    std::string unsent;
+    queue.Unsent(unsent);
+    CHECK(unsent == first.substr(first.size() / 2) + second);
+
+    // 接收到的前一半加上复制的数据是完整的报文; 复制后队列照常发送
+    std::string head(first.size() / 2, '\0');
+    CHECK(LI::Readn(fds[1], &head[0], head.size()) && head + unsent.substr(0, first.size() - head.size()) == first);
+    CHECK(FlushAll(queue, fds[0]) == LI::SendQueue::DONE);
+    std::string rest(unsent.size(), '\0');
+    CHECK(LI::Readn(fds[1], &rest[0], rest.size()) && rest == unsent);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+int main() {
+    signal(SIGPIPE, SIG_IGN);
+    TestBacklog();
+    TestThreads();
+    TestClose();
+    TestSenderAndUnsent();
+    return TestResult();
+}
@@ -0,0 +1,710 @@
+// 服务端的集成测试: 启动 chatRoomServer 进程, 用 socket 模拟客户端.
+// 服务端要能连接 README 中配置的账号数据库, 测试注册的用户名以 t 开头, 口令都是 testpw
+// 用法: ServerTest chatRoomServer的路径 用例名
+#include "cppNetWork.h"
+#include "IoUring.h"
+#include "Protocol.hpp"
+#include "TestUtil.h"
+#include <algorithm>
+#include <csignal>
+#include <map>
+#include <memory>
+#include <sys/wait.h>
+#include <thread>
+#include <vector>
+
+// 服务端的报文长度上限
+#define SERVERMAXMSG (64 * 1024)
+// 测试用户的口令
+#define TESTPASSWORD "testpw"
+
+static const char* server_path = nullptr;
+
+// 连接本机的端口, 失败时返回 -1. rcvbuf 不为 0 时设置接收缓冲区的大小
+static int ConnectLocal(const int port, const int rcvbuf = 0) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (rcvbuf > 0) setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// ------------------ 服务端进程 ---------------------------------------
+// 启动服务端, 等到端口可以连接
+static pid_t StartServer(const int port, const std::vector<std::string>& args, const bool wait_listen = true) {
+    pid_t pid = fork();
+    REQUIRE(pid >= 0);
+    if (pid == 0) {
+        std::vector<std::string> argv = {server_path, "127.0.0.1", std::to_string(port)};
+        argv.insert(argv.end(), args.begin(), args.end());
+        std::vector<char*> cargv;
+        for (auto& arg : argv) cargv.push_back(&arg[0]);
+        cargv.push_back(nullptr);
+        // 服务端的用法和启动信息不影响测试结果
+        freopen("/dev/null", "w", stdout);
+        execv(server_path, cargv.data());
+        _exit(127);
+    }
+    for (int i = 0; wait_listen && i < 100; ++i) {
+        const int probe = ConnectLocal(port);
+        if (probe >= 0) {
+            close(probe);
+            return pid;
+        }
+        int status;
+        REQUIRE(waitpid(pid, &status, WNOHANG) == 0);
+        usleep(50 * 1000);
+    }
+    REQUIRE(wait_listen == false);
+    return pid;
+}
+
+// 等待服务端退出, 超时后强制结束
+static bool WaitServer(const pid_t pid, const int seconds) {
+    for (int i = 0; i < seconds * 20; ++i) {
+        int status;
+        if (waitpid(pid, &status, WNOHANG) == pid) return true;
+        usleep(50 * 1000);
+    }
+    kill(pid, SIGKILL);
+    waitpid(pid, nullptr, 0);
+    return false;
+}
+
+// 正常关闭服务端
+static bool StopServer(const pid_t pid) {
+    kill(pid, SIGTERM);
+    return WaitServer(pid, 15);
+}
+// ------------------ /服务端进程 --------------------------------------
+
+// ------------------ 模拟客户端 ---------------------------------------
+struct Client {
+    int fd = -1;
+    LI::RecvBuffer recvbuf;
+
+    ~Client() { Close(); }
+
+    bool Connect(const int port, const int rcvbuf = 0) {
+        Close();
+        recvbuf.Clear();
+        fd = ConnectLocal(port, rcvbuf);
+        return fd >= 0;
+    }
+
+    void Close() {
+        if (fd >= 0) close(fd);
+        fd = -1;
+    }
+
+    bool Send(const std::string& data) {
+        return LI::TcpWrite(fd, data.data(), (int)data.size());
+    }
+
+    // 接收一个报文, 超时或连接断开时返回 false
+    bool Recv(std::string& data, const int timeoutms = 3000) {
+        LI::Frame frame;
+        const long long deadline = NowNs() / 1000000 + timeoutms;
+        while (true) {
+            const int ret = recvbuf.NextFrame(frame);
+            if (ret == 1) {
+                data.assign(frame.data(), frame.size());
+                return true;
+            }
+            if (ret < 0) return false;
+            const long long left = deadline - NowNs() / 1000000;
+            struct pollfd pfd = {fd, POLLIN, 0};
+            if (left <= 0 || poll(&pfd, 1, (int)left) <= 0) return false;
+            if (recvbuf.ReadFd(fd) <= 0) return false;
+        }
+    }
+
+    // 接收到指定 code 的报文为止, 中间的心跳探测(code 6)回应, 其他报文丢弃
+    bool Expect(const int code, std::string& data, const int timeoutms = 3000) {
+        const long long deadline = NowNs() / 1000000 + timeoutms;
+        while (true) {
+            const long long left = deadline - NowNs() / 1000000;
+            if (left <= 0 || Recv(data, (int)left) == false) return false;
+            int got = -1;
+            LI::GetStrFromXML(data.c_str(), "code", got);
+            if (got == code) return true;
+            if (got == 6) Send("<cmd>5</cmd>");
+        }
+    }
+};
+
+// 注册(已经存在也可以)并登录
+static bool Login(Client& client, const std::string& name) {
+    std::string reply;
+    const std::string account = name + " " + TESTPASSWORD;
+    if (client.Send("<cmd>0</cmd><message>" + account + "</message>") == false) return false;
+    if (client.Recv(reply, 10000) == false) return false;
+    if (client.Send("<cmd>1</cmd><message>" + account + "</message>") == false) return false;
+    return client.Expect(3, reply, 10000);
+}
+
+// 发信息的报文, 总长度为 len 字节, 信息内容按序号填充
+static std::string ChatFrame(const std::string& name, const int seq, const size_t len) {
+    std::string data = "<cmd>2</cmd><name>" + name + "</name><color>1</color><message>";
+    const std::string tail = "</message>";
+    const size_t textlen = len - data.size() - tail.size();
+    for (size_t i = 0; i < textlen; ++i) {
+        data.push_back((char)('a' + (seq + i) % 26));
+    }
+    return data + tail;
+}
+// ------------------ /模拟客户端 --------------------------------------
+
+// ------------------ 用例 ---------------------------------------------
+// 热重启: 暂停读取的连接积压了多个最大长度的报文, 交接后都由新进程处理
+static void TestHandoff() {
+    const int port = 5631;
+    // 队列容量为 1, 一个口令哈希线程: 几个错误口令的登录就能占满线程池, 连接暂停读取
+    const std::vector<std::string> args = {"queue=1:block", "hash=1"};
+    pid_t old_server = StartServer(port, args);
+    Client sender, receiver, filler;
+    REQUIRE(sender.Connect(port) && Login(sender, "t030a"));
+    REQUIRE(receiver.Connect(port) && Login(receiver, "t030b"));
+    REQUIRE(filler.Connect(port) && Login(filler, "t030c"));
+
+    // 先发一个最大长度的报文, 接收缓冲区扩大到能一次读入多个最大长度的报文
+    std::string reply;
+    CHECK(sender.Send(ChatFrame("t030a", 9, SERVERMAXMSG)));
+    CHECK(receiver.Expect(4, reply));
+
+    // 错误口令每次都计算 scrypt, 线程池的任务排满
+    std::vector<std::unique_ptr<Client>> fillers;
+    for (int i = 0; i < 8; ++i) {
+        fillers.emplace_back(new Client());
+        REQUIRE(fillers.back()->Connect(port));
+        fillers.back()->Send("<cmd>1</cmd><message>t030c wrong</message>");
+    }
+    usleep(50 * 1000);
+    // 一个阻塞命令和 3 个最大长度的报文一次写出, 服务端读入后因为队列满暂停, 都留在接收缓冲区中
+    std::string burst;
+    std::vector<std::string> frames = {"<cmd>1</cmd><message>t030c wrong</message>"};
+    for (int i = 0; i < 3; ++i) {
+        frames.push_back(ChatFrame("t030a", i, SERVERMAXMSG));
+    }
+    for (const auto& frame : frames) {
+        const uint32_t header = htonl((uint32_t)frame.size());
+        burst.append((const char*)&header, 4);
+        burst += frame;
+    }
+    CHECK(LI::Writen(sender.fd, burst.data(), burst.size()));
+    usleep(100 * 1000);
+
+    pid_t new_server = StartServer(port, {"takeover", "queue=1:block", "hash=1"}, false);
+    CHECK(WaitServer(old_server, 20));
+
+    // 接收者收到全部 3 条广播, 内容完整
+    for (int i = 0; i < 3; ++i) {
+        REQUIRE(receiver.Expect(4, reply, 20000));
+        LI::PoolString text;
+        CHECK(LI::GetStrFromXML(reply.c_str(), "message", text));
+        std::string expect;
+        LI::GetStrFromXML(ChatFrame("t030a", i, SERVERMAXMSG).c_str(), "message", expect);
+        CHECK(text.size() == expect.size() && memcmp(text.data(), expect.data(), text.size()) == 0);
+    }
+    // 旧进程交接后不再处理这个连接的数据, 没有重复的广播
+    CHECK(receiver.Expect(4, reply, 500) == false);
+    CHECK(StopServer(new_server));
+}
+
+// 集群: 一个节点上的用户发送的信息到达另一个节点上的用户, 每条只收到一次
+static void TestCluster() {
+    const int port1 = 5641, port2 = 5642;
+    pid_t node1 = StartServer(port1, {"peers=127.0.0.1:5642", "secret=clustertest"});
+    // node2 用 io_uring 后端(不支持时退回 epoll), 出站连接的连接和发送在两种后端上都经过事件循环
+    pid_t node2 = StartServer(port2, {"peers=127.0.0.1:5641", "secret=clustertest", "backend=uring"});
+    Client alice, bob;
+    REQUIRE(alice.Connect(port1) && Login(alice, "t031a"));
+    REQUIRE(bob.Connect(port2) && Login(bob, "t031b"));
+
+    // 节点之间的连接和在线人数的通告需要一点时间, 重复发送直到对方收到
+    std::string reply, text;
+    bool relayed = false;
+    for (int i = 0; i < 50 && relayed == false; ++i) {
+        CHECK(alice.Send("<cmd>2</cmd><name>t031a</name><color>2</color><message>probe</message>"));
+        relayed = bob.Expect(4, reply, 200);
+    }
+    REQUIRE(relayed);
+    while (bob.Expect(4, reply, 500)) { }
+
+    // 两个方向各发送几条, 按顺序各收到一次
+    for (int i = 0; i < 5; ++i) {
+        CHECK(alice.Send("<cmd>2</cmd><name>t031a</name><color>2</color><message>from node1 " + std::to_string(i) + "</message>"));
+        CHECK(bob.Send("<cmd>2</cmd><name>t031b</name><color>3</color><message>from node2 " + std::to_string(i) + "</message>"));
+    }
+    for (int i = 0; i < 5; ++i) {
+        REQUIRE(bob.Expect(4, reply));
+        // 发送者自己也收到本节点的广播, 跳过
+        while (reply.find("<name>t031b</name>") != std::string::npos) REQUIRE(bob.Expect(4, reply));
+        LI::GetStrFromXML(reply.c_str(), "message", text);
+        CHECK(text == "from node1 " + std::to_string(i));
+        CHECK(reply.find("<name>t031a</name><color>2</color>") != std::string::npos);
+    }
+    for (int i = 0; i < 5; ++i) {
+        REQUIRE(alice.Expect(4, reply));
+        while (reply.find("<name>t031a</name>") != std::string::npos) REQUIRE(alice.Expect(4, reply));
+        LI::GetStrFromXML(reply.c_str(), "message", text);
+        CHECK(text == "from node2 " + std::to_string(i));
+    }
+    // 只剩下各自的广播, 转发没有重复
+    while (bob.Expect(4, reply, 500)) CHECK(reply.find("<name>t031a</name>") == std::string::npos);
+    while (alice.Expect(4, reply, 500)) CHECK(reply.find("<name>t031b</name>") == std::string::npos);
+
+    CHECK(StopServer(node1));
+    CHECK(StopServer(node2));
+}
+// io_uring 后端: 一次写出的多个报文跨越多个接收缓冲区, 按顺序完整广播. 内核不支持时服务端退回 epoll, 测试跳过
+static void TestUring() {
+    LI::IoUring probe;
+    if (probe.Init(8) == false || probe.SetupBuffers(8, 4096) == false) SKIP("io_uring is not available");
+    probe.Close();
+
+    const int port = 5661;
+    pid_t server = StartServer(port, {"backend=uring"});
+    Client sender, receiver;
+    REQUIRE(sender.Connect(port) && Login(sender, "t041a"));
+    REQUIRE(receiver.Connect(port) && Login(receiver, "t041b"));
+
+    // 不超过限速的突发个数, 长度从几十字节到 40KB, 大报文跨越十几个 4KB 的接收缓冲区
+    std::string burst;
+    std::vector<std::string> frames;
+    for (int i = 0; i < 15; ++i) {
+        frames.push_back(ChatFrame("t041a", i, i % 3 == 0 ? 40 * 1024 : 100 + i * 700));
+        const uint32_t header = htonl((uint32_t)frames.back().size());
+        burst.append((const char*)&header, 4);
+        burst += frames.back();
+    }
+    CHECK(LI::Writen(sender.fd, burst.data(), burst.size()));
+
+    std::string reply;
+    for (const auto& frame : frames) {
+        REQUIRE(receiver.Expect(4, reply, 10000));
+        LI::PoolString text;
+        std::string expect;
+        CHECK(LI::GetStrFromXML(reply.c_str(), "message", text));
+        LI::GetStrFromXML(frame.c_str(), "message", expect);
+        CHECK(text.size() == expect.size() && memcmp(text.data(), expect.data(), text.size()) == 0);
+    }
+
+    // 对端关闭后连接被回收, 新的连接仍然正常
+    sender.Close();
+    REQUIRE(sender.Connect(port) && Login(sender, "t041a"));
+    CHECK(sender.Send("<cmd>2</cmd><name>t041a</name><color>1</color><message>again</message>"));
+    CHECK(receiver.Expect(4, reply) && reply.find("<message>again</message>") != std::string::npos);
+    CHECK(StopServer(server));
+}
+
+// 一次写出多个发信息的报文
+static bool SendBurst(Client& client, const std::vector<std::string>& frames) {
+    std::string burst;
+    for (const auto& frame : frames) {
+        const uint32_t header = htonl((uint32_t)frame.size());
+        burst.append((const char*)&header, 4);
+        burst += frame;
+    }
+    return LI::Writen(client.fd, burst.data(), burst.size());
+}
+
+// 并行发送: 接收者读得慢, 广播在分发线程中排队. 之后的回应排在这些广播后面, 关闭的连接排队的报文不会发给复用 fd 的新连接
+static void TestOrdering() {
+    const int port = 5671;
+    pid_t server = StartServer(port, {"fanout=1:2"});
+    Client alice, bob;
+    REQUIRE(alice.Connect(port) && Login(alice, "t044a"));
+    REQUIRE(bob.Connect(port, 4096) && Login(bob, "t044b"));
+
+    // bob 不读取, 发送缓冲区满后分发线程阻塞在 bob 上, 后面的广播排队. 最大长度的报文共 2MB 多, 超过内核的发送缓冲区.
+    // 按频率限制的速度发送
+    std::vector<std::string> frames;
+    for (int i = 0; i < 36; ++i) frames.push_back(ChatFrame("t044a", i, SERVERMAXMSG));
+    for (const auto& frame : frames) {
+        CHECK(alice.Send(frame));
+        usleep(60 * 1000);
+    }
+    usleep(300 * 1000);
+    // 历史记录的回应和心跳回应排在排队的广播之后
+    CHECK(bob.Send("<cmd>11</cmd><since>0</since>"));
+    CHECK(bob.Send("<cmd>4</cmd>"));
+
+    std::string reply;
+    int broadcasts = 0;
+    bool history = false, pong = false;
+    while ((history == false || pong == false) && bob.Recv(reply, 10000)) {
+        int code = -1;
+        LI::GetStrFromXML(reply.c_str(), "code", code);
+        if (code == 4) {
+            CHECK(history == false && pong == false);
+            LI::PoolString text;
+            std::string expect;
+            LI::GetStrFromXML(reply.c_str(), "message", text);
+            LI::GetStrFromXML(frames[broadcasts % frames.size()].c_str(), "message", expect);
+            CHECK(text.size() == expect.size() && memcmp(text.data(), expect.data(), text.size()) == 0);
+            ++broadcasts;
+        }
+        if (code == 11) history = true;
+        if (code == 5) pong = true;
+        if (code == 6) bob.Send("<cmd>5</cmd>");
+    }
+    CHECK(broadcasts == (int)frames.size());
+    CHECK(history && pong);
+
+    // carol 不读取就断开, 分发线程中发给她的广播作废; 新连接复用 fd 后只收到自己的报文
+    Client carol, dave;
+    REQUIRE(carol.Connect(port, 4096) && Login(carol, "t044c"));
+    CHECK(SendBurst(alice, std::vector<std::string>(frames.begin(), frames.begin() + 10)));
+    usleep(300 * 1000);
+    const int carol_fd = carol.fd;
+    carol.Close();
+    usleep(100 * 1000);
+    REQUIRE(dave.Connect(port) && Login(dave, "t044d"));
+    printf("carol fd %d, dave fd %d\n", carol_fd, dave.fd);
+    CHECK(alice.Send("<cmd>2</cmd><name>t044a</name><color>1</color><message>for dave</message>"));
+    REQUIRE(dave.Expect(4, reply, 10000));
+    CHECK(reply.find("<message>for dave</message>") != std::string::npos);
+    while (bob.Expect(4, reply, 500)) { }
+
+    CHECK(StopServer(server));
+}
+
+// 口令哈希线程池: 一个线程, 排队一个. 同时到达的多个需要计算 scrypt 的登录中多出的立即回应忙(code 10),
+// 其他的照常校验; 缓存命中的登录不进入线程池, 线程池忙时也能登录; 缓存不会让错误的口令通过
+static void TestHashPool() {
+    const int port = 5681;
+    pid_t server = StartServer(port, {"hash=1:1"});
+    Client first;
+    REQUIRE(first.Connect(port) && Login(first, "t045a")); // 注册并登录, 登录成功后放入缓存
+    first.Close();
+    REQUIRE(first.Connect(port) && Login(first, "t045b"));
+    first.Close();
+
+    // 同时发送 8 个错误口令的登录, 然后是一个缓存命中的登录
+    const int n = 8;
+    std::vector<Client> flood(n);
+    for (auto& client : flood) REQUIRE(client.Connect(port));
+    Client cached;
+    REQUIRE(cached.Connect(port));
+    for (auto& client : flood) CHECK(client.Send("<cmd>1</cmd><message>t045a wrong</message>"));
+    CHECK(cached.Send(std::string("<cmd>1</cmd><message>t045b ") + TESTPASSWORD + "</message>"));
+
+    std::string reply;
+    int busy = 0, failed = 0;
+    for (auto& client : flood) {
+        REQUIRE(client.Recv(reply, 10000));
+        int code = -1;
+        LI::GetStrFromXML(reply.c_str(), "code", code);
+        CHECK(code == 10 || code == 2);
+        if (code == 10) ++busy;
+        if (code == 2) ++failed;
+    }
+    printf("hash pool: %d busy, %d rejected by password\n", busy, failed);
+    CHECK(busy >= 1 && failed >= 1);
+    CHECK(cached.Expect(3, reply, 10000));
+
+    // 缓存命中只对同一个口令: 缓存过的用户用错误的口令登录失败
+    Client wrong;
+    REQUIRE(wrong.Connect(port));
+    CHECK(wrong.Send("<cmd>1</cmd><message>t045b wrong</message>"));
+    REQUIRE(wrong.Recv(reply, 10000));
+    CHECK(reply.find("<code>2</code>") != std::string::npos);
+
+    CHECK(StopServer(server));
+}
+
+// fd 复用: 登录在线程池中校验口令期间连接关闭, 新连接复用了这个 fd, 校验的结果不能让新连接登录, 回应也不能发给它
+static void TestReuse() {
+    const int port = 5691;
+    pid_t server = StartServer(port, {"hash=1:16"});
+    std::string reply;
+    // 只注册不登录, 口令不在缓存中, 登录时要计算 scrypt
+    Client victim;
+    REQUIRE(victim.Connect(port));
+    CHECK(victim.Send(std::string("<cmd>0</cmd><message>t045r ") + TESTPASSWORD + "</message>"));
+    REQUIRE(victim.Recv(reply, 10000));
+
+    // 几个错误口令的登录排在前面, 口令哈希线程只有一个, 留出关闭和重连的时间
+    std::vector<Client> fillers(4);
+    for (auto& client : fillers) {
+        REQUIRE(client.Connect(port));
+        CHECK(client.Send("<cmd>1</cmd><message>t045r wrong</message>"));
+    }
+    usleep(20 * 1000);
+    CHECK(victim.Send(std::string("<cmd>1</cmd><message>t045r ") + TESTPASSWORD + "</message>"));
+    usleep(20 * 1000);
+    victim.Close();
+    usleep(20 * 1000);
+    Client intruder;
+    REQUIRE(intruder.Connect(port));
+
+    // 没有登录: 收不到登录成功, 取最近的广播也没有回应
+    CHECK(intruder.Expect(3, reply, 3000) == false);
+    CHECK(intruder.Send("<cmd>11</cmd><since>0</since>"));
+    CHECK(intruder.Expect(11, reply, 1000) == false);
+    for (auto& client : fillers) CHECK(client.Expect(2, reply, 10000));
+    CHECK(StopServer(server));
+}
+
+// 慢的接收者: 不读取的连接积压在它的发送队列中, 事件循环不等待它, 其他客户端的回应照常及时到达;
+// 积压超过发送队列的上限(4MB)后服务端关闭这个连接. 直接发送、io_uring 批量发送和分发线程发送各一次
+static void SlowReceiver(const int port, const std::string& option) {
+    std::vector<std::string> args = {"limit=Message:1000:1000", "userlimit=Message:1000:1000"};
+    if (!option.empty()) args.push_back(option);
+    pid_t server = StartServer(port, args);
+    Client alice, slow;
+    REQUIRE(alice.Connect(port) && Login(alice, "t028a"));
+    REQUIRE(slow.Connect(port, 4096) && Login(slow, "t028s"));
+
+    // 最大长度的报文共 13MB 多, 超过发送队列的上限加上内核发送缓冲区的上限(tcp_wmem 默认最大 4MB)
+    const int n = 200;
+    std::vector<std::string> frames;
+    for (int i = 0; i < n; ++i) frames.push_back(ChatFrame("t028a", i, SERVERMAXMSG));
+    const long long start = NowNs();
+    CHECK(SendBurst(alice, frames));
+    CHECK(alice.Send("<cmd>4</cmd>"));
+    std::string reply;
+    CHECK(alice.Expect(5, reply, 3000));
+    const long long elapsed = (NowNs() - start) / 1000000;
+    printf("%s: pong after %lld ms\n", option.empty() ? "epoll" : option.c_str(), elapsed);
+    CHECK(elapsed < 2000);
+
+    // 慢的接收者收到的是完整的报文, 但不是全部, 之后连接被关闭
+    int broadcasts = 0;
+    while (slow.Recv(reply, 3000)) {
+        if (reply.find("<code>4</code>") != std::string::npos) ++broadcasts;
+    }
+    char byte;
+    printf("slow receiver got %d of %d broadcasts\n", broadcasts, n);
+    CHECK(broadcasts < n);
+    CHECK(recv(slow.fd, &byte, 1, MSG_DONTWAIT) <= 0 && errno != EAGAIN);
+
+    // 服务端照常工作
+    CHECK(alice.Send("<cmd>4</cmd>"));
+    CHECK(alice.Expect(5, reply, 3000));
+    CHECK(StopServer(server));
+}
+
+static void TestSlowReceiver() {
+    SlowReceiver(5701, "");
+    SlowReceiver(5702, "backend=uring");
+    SlowReceiver(5703, "fanout=1:2");
+}
+
+// 监听但不 accept 的 socket, 连接队列已经填满: 之后的 SYN 被丢弃, connect 一直等待. fills 是填充队列的连接
+static int StalledListen(const int port, std::vector<int>& fills) {
+    const int fd = socket(AF_INET, SOCK_STREAM, 0);
+    const int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    REQUIRE(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0 && listen(fd, 0) == 0);
+    // 填到有一个连接 100 ms 内没有完成为止
+    for (int i = 0; i < 16; ++i) {
+        const int conn = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        fills.push_back(conn);
+        if (connect(conn, (struct sockaddr*)&addr, sizeof(addr)) == 0) continue;
+        struct pollfd pfd = {conn, POLLOUT, 0};
+        if (poll(&pfd, 1, 100) == 0) return fd;
+    }
+    REQUIRE(false);
+    return -1;
+}
+
+// 集群节点不可达: 出站连接不阻塞事件循环, 客户端的回应照常及时到达; 哈希环由配置的节点组成,
+// 节点是否在线不影响归属, 各节点给出相同的归属, 不会互相重定向
+static void TestPeers() {
+    const int port1 = 5711, port2 = 5712;
+    // 第三个节点的连接队列是满的, connect 一直等不到回应, 5 s 后超时重连
+    std::vector<int> fills;
+    const int stalled = StalledListen(5713, fills);
+    const std::string blackhole = "127.0.0.1:5713";
+    const std::vector<std::string> limits = {"limit=Ping:100:100", "limit=JoinRoom:100:100", "userlimit=JoinRoom:100:100"};
+    std::vector<std::string> args = {"peers=127.0.0.1:5712," + blackhole, "secret=clustertest"};
+    args.insert(args.end(), limits.begin(), limits.end());
+    pid_t node1 = StartServer(port1, args);
+    Client alice;
+    REQUIRE(alice.Connect(port1) && Login(alice, "t031p"));
+
+    // 期间连接超时并重连一次
+    std::string reply;
+    long long worst = 0;
+    for (int i = 0; i < 32; ++i) {
+        const long long start = NowNs();
+        CHECK(alice.Send("<cmd>4</cmd>"));
+        CHECK(alice.Expect(5, reply, 3000));
+        worst = std::max(worst, (NowNs() - start) / 1000000);
+        usleep(250 * 1000);
+    }
+    printf("worst pong %lld ms\n", worst);
+    CHECK(worst < 1000);
+
+    // node2 还没有启动, 属于它的房间仍然重定向到它
+    const std::string addr1 = "127.0.0.1:" + std::to_string(port1), addr2 = "127.0.0.1:" + std::to_string(port2);
+    const int nrooms = 30;
+    std::vector<std::string> owners;
+    int redirected = 0;
+    for (int i = 0; i < nrooms; ++i) {
+        const std::string room = "t031room" + std::to_string(i);
+        CHECK(alice.Send("<cmd>9</cmd><room>" + room + "</room>"));
+        REQUIRE(alice.Recv(reply, 3000));
+        std::string owner = addr1;
+        if (reply.find("<code>8</code>") != std::string::npos) {
+            LI::GetStrFromXML(reply.c_str(), "node", owner);
+            ++redirected;
+        }
+        owners.push_back(owner);
+    }
+    CHECK(redirected > 0 && redirected < nrooms);
+    CHECK(std::count(owners.begin(), owners.end(), addr2) > 0);
+
+    // node2 启动后给出相同的归属: 属于 node2 的房间直接加入, 其他的重定向到同一个节点
+    args = {"peers=127.0.0.1:5711," + blackhole, "secret=clustertest"};
+    args.insert(args.end(), limits.begin(), limits.end());
+    pid_t node2 = StartServer(port2, args);
+    Client bob;
+    REQUIRE(bob.Connect(port2) && Login(bob, "t031q"));
+    for (int i = 0; i < nrooms; ++i) {
+        const std::string room = "t031room" + std::to_string(i);
+        CHECK(bob.Send("<cmd>9</cmd><room>" + room + "</room>"));
+        REQUIRE(bob.Recv(reply, 3000));
+        if (owners[i] == addr2) {
+            CHECK(reply.find("<code>7</code>") != std::string::npos);
+            continue;
+        }
+        std::string owner;
+        LI::GetStrFromXML(reply.c_str(), "node", owner);
+        CHECK(reply.find("<code>8</code>") != std::string::npos && owner == owners[i]);
+    }
+    CHECK(StopServer(node1));
+    CHECK(StopServer(node2));
+    for (const int fd : fills) close(fd);
+    close(stalled);
+}
+
+// 注入: 信息中的标签文本编码后原样到达接收者, 不会改写广播的字段和历史记录的分隔; 用户名和房间名不能含有标签字符,
+// 用户名中的引号不会改写 sql 语句
+static void TestInjection() {
+    const int port = 5651;
+    pid_t server = StartServer(port, {});
+    Client alice, bob;
+    REQUIRE(alice.Connect(port) && Login(alice, "t039a"));
+    REQUIRE(bob.Connect(port) && Login(bob, "t039b"));
+
+    const std::vector<std::string> texts = {
+        "hi</message><time>1</time><message>forged",
+        "</item><item><code>4</code><name>admin</name>",
+        "a &amp; b &lt;3 & <>",
+        "<name>t039c</name>",
+    };
+    std::string reply;
+    for (const auto& text : texts) {
+        LI::proto::ChatCmd msg;
+        msg.name = "t039a";
+        msg.color = 1;
+        msg.message = text;
+        const std::string data = msg.Encode();
+        CHECK(data.find("</message>") == data.size() - strlen("</message>"));
+        CHECK(alice.Send(data));
+
+        REQUIRE(bob.Expect(4, reply));
+        LI::proto::BroadcastCode got;
+        CHECK(got.Decode(reply.data(), reply.size()));
+        std::string name, message;
+        LI::proto::Unescape(got.name, name);
+        LI::proto::Unescape(got.message, message);
+        CHECK(name == "t039a");
+        CHECK(message == text);
+        CHECK(got.time > 1); // 服务端的时间, 不是信息中的 <time>1</time>
+    }
+
+    // 历史记录中每个 <item> 是一条完整的广播, 条数和 <count> 相同
+    CHECK(bob.Send("<cmd>11</cmd><since>0</since>"));
+    REQUIRE(bob.Expect(11, reply));
+    int count = 0;
+    LI::GetStrFromXML(reply.c_str(), "count", count);
+    CHECK(count == (int)texts.size());
+    size_t pos = 0;
+    for (int i = 0; i < count; ++i) {
+        const size_t open = reply.find("<item>", pos);
+        const size_t close = reply.find("</item>", open);
+        REQUIRE(open != std::string::npos && close != std::string::npos);
+        LI::proto::BroadcastCode got;
+        CHECK(got.Decode(reply.data() + open + 6, close - open - 6));
+        std::string message;
+        LI::proto::Unescape(got.message, message);
+        CHECK(message == texts[i]);
+        pos = close + 7;
+    }
+    CHECK(reply.find("<item>", pos) == std::string::npos);
+
+    // 含有标签字符的用户名注册失败
+    Client eve;
+    REQUIRE(eve.Connect(port));
+    LI::proto::RegisterCmd reg;
+    const std::string account = std::string("t039<x> ") + TESTPASSWORD;
+    reg.message = account;
+    CHECK(eve.Send(reg.Encode()));
+    CHECK(eve.Expect(0, reply, 10000));
+
+    // 用户名中的引号不会结束 sql 语句中的字符串: 整个用户名注册成一个用户, 不会另外写入 t046v
+    Client mallory;
+    REQUIRE(mallory.Connect(port));
+    const std::string quoted = "t046','x'),('t046v";
+    REQUIRE(Login(mallory, quoted));
+    Client victim;
+    REQUIRE(victim.Connect(port));
+    CHECK(victim.Send(std::string("<cmd>1</cmd><message>t046v ") + TESTPASSWORD + "</message>"));
+    CHECK(victim.Expect(2, reply, 10000));
+
+    // 含有标签字符的房间名被拒绝, 留在大厅
+    CHECK(bob.Send("<cmd>9</cmd><room>r&lt;1</room>"));
+    REQUIRE(bob.Expect(7, reply));
+    CHECK(reply == "<code>7</code><room></room>");
+    CHECK(alice.Send("<cmd>2</cmd><name>t039a</name><color>1</color><message>lobby</message>"));
+    CHECK(bob.Expect(4, reply));
+
+    CHECK(StopServer(server));
+}
+// ------------------ /用例 --------------------------------------------
+
+int main(int argc, char* argv[]) {
+    if (argc != 3) {
+        printf("Using: ServerTest chatRoomServer case\n");
+        return 1;
+    }
+    server_path = argv[1];
+    signal(SIGPIPE, SIG_IGN);
+    // 广播报文比客户端的发信息报文长, 测试的客户端放宽长度上限
+    LI::SetMaxMsgLen(2 * SERVERMAXMSG);
+
+    const std::map<std::string, void (*)()> cases = {
+        {"handoff", TestHandoff},
+        {"cluster", TestCluster},
+        {"injection", TestInjection},
+        {"uring", TestUring},
+        {"ordering", TestOrdering},
+        {"hash", TestHashPool},
+        {"reuse", TestReuse},
+        {"slow", TestSlowReceiver},
+        {"peers", TestPeers},
+    };
+    auto it = cases.find(argv[2]);
+    if (it == cases.end()) {
+        printf("Unknown case: %s\n", argv[2]);
+        return 1;
+    }
+    it->second();
+    return TestResult();
+}
@@ -0,0 +1,39 @@
+// SessionToken 的测试: 签发的令牌在过期前校验通过, 改动任何部分后失败, 过期时间超出 int64_t 或格式错误的令牌被拒绝
+#include "SessionToken.h"
+#include "TestUtil.h"
+
+int main() {
+    LI::SessionToken token;
+    token.SetSecret("test secret");
+    const int64_t now = 1700000000;
+    const std::string issued = token.Issue("alice", 5, now + 60);
+    std::string name;
+    CHECK(token.Verify(issued.data(), issued.size(), now, &name) && name == "alice");
+    CHECK(token.Verify(issued.data(), issued.size(), now + 60, nullptr) == false);
+
+    // 改动过期时间、签名、用户名中的任何一个字节
+    for (size_t i = 0; i < issued.size(); ++i) {
+        std::string forged = issued;
+        forged[i] = (forged[i] == '1') ? '2' : '1';
+        CHECK(token.Verify(forged.data(), forged.size(), now, nullptr) == false);
+    }
+    // 其他密钥签发的令牌
+    LI::SessionToken other;
+    other.SetSecret("other secret");
+    CHECK(other.Verify(issued.data(), issued.size(), now, nullptr) == false);
+    CHECK(other.ImportKey(token.ExportKey()) && other.Verify(issued.data(), issued.size(), now, nullptr));
+
+    // 过期时间的边界: int64_t 的最大值可以签发和校验, 19 个 9 超出 int64_t, 20 个数字不是过期时间
+    const std::string longest = token.Issue("bob", 3, INT64_MAX);
+    CHECK(token.Verify(longest.data(), longest.size(), now, &name) && name == "bob");
+    for (const char* expire : {"9223372036854775808", "9999999999999999999", "18446744073709551616", "99999999999999999999"}) {
+        const std::string forged = expire + longest.substr(longest.find('.'));
+        CHECK(token.Verify(forged.data(), forged.size(), now, nullptr) == false);
+    }
+
+    // 格式错误: 没有过期时间, 签名太短, 没有用户名
+    for (const std::string& bad : {std::string(""), std::string(".0123456789abcdef.a"), std::string("1.0123.a"), issued.substr(0, issued.rfind('.') + 1)}) {
+        CHECK(token.Verify(bad.data(), bad.size(), now, nullptr) == false);
+    }
+    return TestResult();
+}
@@ -0,0 +1,58 @@
+// 测试用的检查宏和计时函数, 每个测试是一个独立的可执行文件
+
+#ifndef TESTUTIL_H_
+#define TESTUTIL_H_
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+// 条件不成立时打印位置并记为失败, 继续执行后面的检查
+#define CHECK(cond)                                                             \
+    do {                                                                        \
+        if (!(cond)) {                                                          \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            ++TestFailures();                                                   \
+        }                                                                       \
+    } while (0)
+
+// 条件不成立时打印位置并结束测试
+#define REQUIRE(cond)                                                           \
+    do {                                                                        \
+        if (!(cond)) {                                                          \
+            fprintf(stderr, "%s:%d: REQUIRE(%s) failed\n", __FILE__, __LINE__, #cond); \
+            exit(1);                                                            \
+        }                                                                       \
+    } while (0)
+
+// 测试依赖的系统功能不可用时跳过, ctest 把这个返回值记为 Skipped
+#define TEST_SKIP_CODE 77
+#define SKIP(reason)                                                            \
+    do {                                                                        \
+        printf("skipped: %s\n", reason);                                        \
+        exit(TEST_SKIP_CODE);                                                   \
+    } while (0)
+
+// 失败的检查个数
+inline int& TestFailures() {
+    static int failures = 0;
+    return failures;
+}
+
+// main 的返回值
+inline int TestResult() {
+    if (TestFailures() == 0) {
+        printf("passed\n");
+        return 0;
+    }
+    printf("%d checks failed\n", TestFailures());
+    return 1;
+}
+
+// 单调时钟, 单位: ns
+inline long long NowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+#endif
@@ -0,0 +1,109 @@
+// ThreadPool 的测试: 队列满时三种策略下任务的去向
+#include "ThreadPool.hpp"
+#include "TestUtil.h"
+#include <atomic>
+
+// 让唯一的工作线程停在一个任务中, 直到 Release
+struct Gate {
+    std::promise<void> started;
+    std::promise<void> release;
+    std::shared_future<void> released = release.get_future().share();
+
+    void Block(LI::ThreadPool& pool) {
+        std::shared_future<void> wait = released;
+        std::promise<void>* ready = &started;
+        pool.post([wait, ready]() {
+            ready->set_value();
+            wait.wait();
+        });
+        started.get_future().wait();
+    }
+    void Release() { release.set_value(); }
+};
+
+// DROPOLDEST: 被挤出的任务不执行; enqueue 的 future 得到 broken_promise, try_post 的 reject 在提交新任务的线程中调用
+static void TestDropOldest() {
+    LI::ThreadPool pool(1);
+    pool.SetCapacity(1, LI::ThreadPool::DROPOLDEST);
+    Gate gate;
+    gate.Block(pool);
+
+    std::atomic<int> ran(0), rejected(0);
+    // try_post 的任务被 enqueue 挤出
+    CHECK(pool.try_post([&rejected]() { ++rejected; }, [&ran]() { ++ran; }));
+    CHECK(pool.Full());
+    std::future<int> second = pool.enqueue([&ran]() { ++ran; return 2; });
+    CHECK(rejected.load() == 1);
+    // enqueue 的任务被 enqueue 挤出
+    std::future<int> third = pool.enqueue([&ran]() { ++ran; return 3; });
+    bool broken = false;
+    try {
+        second.get();
+    }
+    catch (const std::future_error& e) {
+        broken = (e.code() == std::future_errc::broken_promise);
+    }
+    CHECK(broken);
+    // enqueue 的任务被 try_post 挤出
+    CHECK(pool.try_post([&rejected]() { ++rejected; }, [&ran]() { ++ran; }));
+    CHECK(third.wait_for(std::chrono::seconds(0)) == std::future_status::ready);
+    CHECK(pool.Dropped() == 3);
+
+    gate.Release();
+    while (!pool.Idle()) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    // 只有最后一个任务执行
+    CHECK(ran.load() == 1);
+    CHECK(rejected.load() == 1);
+}
+
+// REJECT: 队列满时新任务立即被拒绝, 队列中的任务照常执行
+static void TestReject() {
+    LI::ThreadPool pool(1);
+    pool.SetCapacity(1, LI::ThreadPool::REJECT);
+    Gate gate;
+    gate.Block(pool);
+
+    std::atomic<int> ran(0), rejected(0);
+    CHECK(pool.try_post([&rejected]() { ++rejected; }, [&ran]() { ++ran; }));
+    CHECK(pool.try_post([&rejected]() { ++rejected; }, [&ran]() { ++ran; }) == false);
+    CHECK(rejected.load() == 1);
+    std::future<int> refused = pool.enqueue([]() { return 1; });
+    CHECK(refused.wait_for(std::chrono::seconds(0)) == std::future_status::ready);
+    CHECK(pool.Rejected() == 2);
+
+    gate.Release();
+    while (!pool.Idle()) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    CHECK(ran.load() == 1);
+}
+
+// BLOCK: 提交任务的线程等到队列有空位, 所有任务都执行
+static void TestBlock() {
+    LI::ThreadPool pool(1);
+    pool.SetCapacity(2, LI::ThreadPool::BLOCK);
+    Gate gate;
+    gate.Block(pool);
+
+    std::atomic<int> ran(0);
+    std::atomic<bool> submitted(false);
+    std::thread producer([&]() {
+        for (int i = 0; i < 5; ++i) pool.post([&ran]() { ++ran; });
+        submitted = true;
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    CHECK(submitted.load() == false);
+    CHECK(pool.Depth() == 2);
+
+    gate.Release();
+    producer.join();
+    while (!pool.Idle()) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    CHECK(ran.load() == 5);
+    CHECK(pool.Rejected() == 0 && pool.Dropped() == 0);
+    CHECK(pool.TakePeakDepth() == 2);
+}
+
+int main() {
+    TestDropOldest();
+    TestReject();
+    TestBlock();
+    return TestResult();
+}
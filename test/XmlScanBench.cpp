@@ -0,0 +1,98 @@
+// GetStrFromXML 的性能测试, 不加入 ctest: 在实际的报文上比较查找标签的各种实现和原来两次 strstr 的实现.
+// 每个报文按服务端或客户端实际的顺序取字段. 用法: XmlScanBench [次数]
+#include "cppNetWork.h"
+#include "Protocol.hpp"
+#include "TestUtil.h"
+
+// 防止编译器把结果没有用到的循环优化掉
+static volatile size_t sink;
+
+// 原来的实现: 开始标签和结束标签各 strstr 一次
+static bool StrstrXML(const char* buffer, const char* label, LI::PoolString& value) {
+    std::string open("<"), close("</");
+    open.append(label).append(">");
+    close.append(label).append(">");
+    const char* begin = strstr(buffer, open.c_str());
+    if (begin == nullptr) return false;
+    const char* end = strstr(begin + open.size(), close.c_str());
+    if (end == nullptr) return false;
+    value.assign(begin + open.size(), end - begin - open.size());
+    return true;
+}
+
+// 一种报文和取字段的顺序
+struct Frame {
+    std::string title;
+    std::string data;
+    std::vector<const char*> labels;
+};
+
+// 和 ServerTest 一样按序号填充的信息内容
+static std::string Text(const size_t len) {
+    std::string text;
+    for (size_t i = 0; i < len; ++i) text.push_back((char)('a' + i % 26));
+    return text;
+}
+
+static std::vector<Frame> Frames() {
+    std::vector<Frame> frames;
+    frames.push_back({"login cmd 1", "<cmd>1</cmd><message>alice secretpw</message><compress>1</compress>", {"cmd", "message", "compress"}});
+    for (const size_t len : {16, 100, 1000, 4000, 60000}) {
+        LI::proto::ChatCmd chat;
+        const std::string text = Text(len);
+        chat.name = "alice";
+        chat.color = 3;
+        chat.message = text;
+        // 服务端先取 cmd, 发信息的字段由 Decode 解析; 这里比较原来逐个字段取的方式
+        frames.push_back({"chat cmd 2, " + std::to_string(len) + "B", chat.Encode(), {"cmd", "message", "name", "color"}});
+    }
+    // 客户端收到的历史记录: 20 条 100 字节的广播
+    std::string history = "<code>11</code><room>lobby</room><count>20</count>";
+    for (int i = 0; i < 20; ++i) {
+        LI::proto::BroadcastCode item;
+        const std::string text = Text(100);
+        item.name = "bob";
+        item.color = i;
+        item.message = text;
+        item.time = 1700000000000LL + i;
+        history += "<item>" + item.Encode() + "</item>";
+    }
+    frames.push_back({"history code 11", history, {"code", "room", "count"}});
+    return frames;
+}
+
+// 每个报文取完所有字段的平均耗时, 单位: ns
+template<class F>
+static double Measure(const Frame& frame, const long n, F&& get) {
+    LI::PoolString value;
+    const long long start = NowNs();
+    for (long i = 0; i < n; ++i) {
+        for (const char* label : frame.labels) {
+            get(frame.data.c_str(), label, value);
+            sink = sink + value.size();
+        }
+    }
+    return (double)(NowNs() - start) / n;
+}
+
+int main(int argc, char* argv[]) {
+    const long n = (argc > 1) ? atol(argv[1]) : 200000;
+    const char* names[] = {"scalar", "sse2", "avx2"};
+    printf("%-22s %10s", "frame", "strstr");
+    for (const char* name : names) printf(" %10s", name);
+    printf("   (ns per frame)\n");
+    for (const auto& frame : Frames()) {
+        const long rounds = std::max(1L, n * 100 / (long)(frame.data.size() + 100));
+        printf("%-22s %10.1f", frame.title.c_str(), Measure(frame, rounds, StrstrXML));
+        for (const char* name : names) {
+            if (LI::SetXMLScanner(name) == false) {
+                printf(" %10s", "-");
+                continue;
+            }
+            printf(" %10.1f", Measure(frame, rounds, [](const char* b, const char* l, LI::PoolString& v) { return LI::GetStrFromXML(b, l, v); }));
+        }
+        printf("\n");
+    }
+    LI::SetXMLScanner("auto");
+    return 0;
+}
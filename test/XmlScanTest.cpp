@@ -0,0 +1,153 @@
+// GetStrFromXML 查找标签的测试: 每种实现(AVX2, SSE2, 逐个字节)和 strstr 的结果一致. 报文放在紧挨着不可访问页的内存中,
+// 结尾的 0 是可访问的最后一个字节, 读过 0 就会 SIGSEGV. 覆盖跨 16/32/64 字节边界的标签、在报文结尾的标签、缺少结束标签
+#include "cppNetWork.h"
+#include "TestUtil.h"
+#include <random>
+#include <sys/mman.h>
+
+// 结尾是不可访问页的缓冲区, 报文复制到可访问部分的最后
+struct GuardedBuffer {
+    char* base = nullptr;
+    size_t size = 0;
+
+    explicit GuardedBuffer(const size_t pages) {
+        const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+        size = pages * page;
+        base = (char*)mmap(nullptr, size + page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        REQUIRE(base != MAP_FAILED);
+        REQUIRE(mprotect(base + size, page, PROT_NONE) == 0);
+    }
+    ~GuardedBuffer() { munmap(base, size + (size_t)sysconf(_SC_PAGESIZE)); }
+
+    // 复制 text 和结尾的 0, 0 在可访问部分的最后一个字节
+    const char* Place(const std::string& text) {
+        REQUIRE(text.size() + 1 <= size);
+        char* p = base + size - text.size() - 1;
+        memcpy(p, text.c_str(), text.size() + 1);
+        return p;
+    }
+};
+
+// 参照: 开始标签用 strstr 找第一个, 结束标签找它之后的第一个
+static bool Reference(const char* buffer, const std::string& label, std::string& value) {
+    const std::string open = "<" + label + ">";
+    const std::string close = "</" + label + ">";
+    const char* begin = strstr(buffer, open.c_str());
+    if (begin == nullptr) return false;
+    const char* end = strstr(begin + open.size(), close.c_str());
+    if (end == nullptr) return false;
+    value.assign(begin + open.size(), end);
+    return true;
+}
+
+// 所有实现的结果都和参照相同
+static std::vector<std::string> scanners;
+static bool Agree(const char* buffer, const std::string& label) {
+    std::string expect;
+    const bool found = Reference(buffer, label, expect);
+    bool ok = true;
+    for (const auto& name : scanners) {
+        REQUIRE(LI::SetXMLScanner(name.c_str()));
+        std::string value = "unchanged";
+        const bool got = LI::GetStrFromXML(buffer, label.c_str(), value);
+        if (got != found || (found && value != expect) || (!found && value != "unchanged")) {
+            printf("%s disagrees on <%s> in \"%.80s\"\n", name.c_str(), label.c_str(), buffer);
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+// 标签的每个位置: 开始标签和结束标签的 '<' 分别落在 16/32/64 字节块的每个位置, 包括块的最后两个字节
+static void TestBoundaries(GuardedBuffer& guard) {
+    for (size_t pre = 0; pre < 130; ++pre) {
+        for (size_t mid = 0; mid < 70; mid += 3) {
+            const std::string text = std::string(pre, 'x') + "<message>" + std::string(mid, 'y') + "</message>" + std::string(pre % 5, 'z');
+            CHECK(Agree(guard.Place(text), "message"));
+            // 不在报文结尾的 0 之后: 放在缓冲区开头, 后面还有可访问的内存
+            memcpy(guard.base, text.c_str(), text.size() + 1);
+            CHECK(Agree(guard.base, "message"));
+        }
+    }
+}
+
+// 报文结尾: 结束标签的 '>' 紧挨着 0; 报文在标签中间结束; 只有一个 '<'; 空报文
+static void TestEnd(GuardedBuffer& guard) {
+    for (size_t pre = 0; pre < 70; ++pre) {
+        const std::string filler(pre, 'a');
+        for (const std::string& tail : {std::string("<m>v</m>"), std::string("<m>v</m"), std::string("<m>v</"), std::string("<m>v<"),
+                                        std::string("<m"), std::string("<"), std::string("</m>"), std::string("<mm>v</mm>")}) {
+            CHECK(Agree(guard.Place(filler + tail), "m"));
+            CHECK(Agree(guard.Place(filler + tail), "mm"));
+        }
+    }
+    CHECK(Agree(guard.Place(""), "m"));
+
+    std::string value;
+    for (const auto& name : scanners) {
+        REQUIRE(LI::SetXMLScanner(name.c_str()));
+        CHECK(LI::GetStrFromXML(guard.Place("<code>4</code><time>17</time>"), "time", value) && value == "17");
+    }
+}
+
+// 缺少结束标签, 结束标签在开始标签之前(原来会得到负的长度), 标签名是另一个的前缀, 值中有相似的标签
+static void TestMissing(GuardedBuffer& guard) {
+    const char* cases[] = {
+        "<cmd>2</cmd><message>no close",
+        "</message><message>after",
+        "</message>x<message>y</message>",
+        "<messages>a</messages>",
+        "<message>a</messages></message>",
+        "<mess<message>a</message>",
+        "<<message>>a<</message>",
+        "<message>a</message><message>b</message>",
+        "<name>n</name><color>1</color>",
+    };
+    for (const char* text : cases) {
+        CHECK(Agree(guard.Place(text), "message"));
+        CHECK(Agree(guard.Place(text), "name"));
+    }
+    std::string value;
+    for (const auto& name : scanners) {
+        REQUIRE(LI::SetXMLScanner(name.c_str()));
+        CHECK(LI::GetStrFromXML(guard.Place("</message>x<message>y</message>"), "message", value) && value == "y");
+        CHECK(LI::GetStrFromXML(guard.Place("<message>no close"), "message", value) == false);
+    }
+}
+
+// 随机的报文: 真实的和相似的标签、任意的长度和字节
+static void TestRandom(GuardedBuffer& guard) {
+    std::mt19937 rng(50);
+    const char* pieces[] = {"<message>", "</message>", "<m", "</m", "<me", "<", "/", ">", "<name>", "</name>", "<code>4</code>", "<mm>", "</mm>"};
+    const char* labels[] = {"message", "name", "m", "mm", "code", "me"};
+    for (int round = 0; round < 20000; ++round) {
+        std::string text;
+        const int parts = (int)(rng() % 12);
+        for (int i = 0; i < parts; ++i) {
+            if (rng() % 2) text += pieces[rng() % (sizeof(pieces) / sizeof(pieces[0]))];
+            else text += std::string(rng() % 80, (char)('a' + rng() % 26));
+        }
+        const char* label = labels[rng() % (sizeof(labels) / sizeof(labels[0]))];
+        if (Agree(guard.Place(text), label) == false) {
+            CHECK(false);
+            break;
+        }
+    }
+}
+
+int main() {
+    for (const char* name : {"scalar", "sse2", "avx2"}) {
+        if (LI::SetXMLScanner(name)) scanners.push_back(name);
+        else printf("%s scanner is not available\n", name);
+    }
+    CHECK(LI::SetXMLScanner("no such scanner") == false);
+    REQUIRE(scanners.size() > 0);
+
+    GuardedBuffer guard(4);
+    TestBoundaries(guard);
+    TestEnd(guard);
+    TestMissing(guard);
+    TestRandom(guard);
+    CHECK(LI::SetXMLScanner("auto"));
+    return TestResult();
+}
@@ -0,0 +1,200 @@
+// 零拷贝发送的测试: 完成通知释放报文, 连接关闭时取出等待的报文, 热重启时接续通知序号, 发送超时, 非阻塞发送.
+// 内核或 socket 不支持 SO_ZEROCOPY 时跳过
+#include "ZeroCopy.h"
+#include "cppNetWork.h"
+#include "TestUtil.h"
+#include <thread>
+
+// 一个 TCP 连接: fds[0] 发送, fds[1] 接收
+static void ConnectPair(int fds[2]) {
+    const int listenfd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    REQUIRE(bind(listenfd, (struct sockaddr*)&addr, sizeof(addr)) == 0 && listen(listenfd, 1) == 0);
+    socklen_t len = sizeof(addr);
+    getsockname(listenfd, (struct sockaddr*)&addr, &len);
+    fds[0] = socket(AF_INET, SOCK_STREAM, 0);
+    REQUIRE(connect(fds[0], (struct sockaddr*)&addr, sizeof(addr)) == 0);
+    fds[1] = accept(listenfd, nullptr, nullptr);
+    REQUIRE(fds[1] >= 0);
+    close(listenfd);
+}
+
+// 带长度头的报文, 内容按序号填充
+static std::shared_ptr<const std::string> MakeFrame(const int seq, const size_t len) {
+    std::shared_ptr<std::string> frame = std::make_shared<std::string>();
+    std::string body(len, '\0');
+    for (size_t i = 0; i < len; ++i) body[i] = (char)('a' + (seq + i) % 26);
+    LI::AppendFrame(*frame, body.data(), body.size());
+    return frame;
+}
+
+// 等待错误队列中的通知, 直到没有等待的报文
+static bool ReapAll(LI::ZeroCopyQueue& queue, const int sockfd, int* copied) {
+    for (int i = 0; i < 100 && queue.Pending() > 0; ++i) {
+        struct pollfd pfd = {sockfd, 0, 0}; // POLLERR 总是报告
+        poll(&pfd, 1, 50);
+        queue.Reap(sockfd, copied);
+    }
+    return queue.Pending() == 0;
+}
+
+// 在另一个线程中读取 total 字节
+static std::thread Reader(const int sockfd, const size_t total, std::string* out) {
+    return std::thread([sockfd, total, out]() {
+        out->resize(total);
+        if (LI::Readn(sockfd, &(*out)[0], total) == false) out->clear();
+    });
+}
+
+// 完成通知到达后报文被释放, 接收方收到的数据完整
+static void TestComplete() {
+    int fds[2];
+    ConnectPair(fds);
+    LI::ZeroCopyQueue queue;
+    if (queue.Enable(fds[0]) == false) SKIP("SO_ZEROCOPY is not supported");
+
+    std::vector<std::shared_ptr<const std::string>> frames;
+    std::string expect;
+    for (int i = 0; i < 8; ++i) {
+        frames.push_back(MakeFrame(i, 64 * 1024));
+        expect += *frames.back();
+    }
+    std::string got;
+    std::thread reader = Reader(fds[1], expect.size(), &got);
+    for (auto& frame : frames) {
+        CHECK(queue.Send(fds[0], frame, 5000));
+    }
+    // 每个报文至少一次 sendmsg, 每次成功的 sendmsg 一个序号
+    CHECK(queue.Sequence() >= frames.size());
+    reader.join();
+    CHECK(got == expect);
+
+    int copied = 0;
+    CHECK(ReapAll(queue, fds[0], &copied));
+    for (auto& frame : frames) {
+        CHECK(frame.use_count() == 1); // 队列不再持有
+    }
+    printf("zerocopy notifications copied by the kernel: %d\n", copied);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+// 接收方不读取时发送超时, 内核已经引用的部分仍由队列持有; 关闭连接时取出
+static void TestTimeoutRelease() {
+    int fds[2];
+    ConnectPair(fds);
+    LI::ZeroCopyQueue queue;
+    REQUIRE(queue.Enable(fds[0]));
+    const int small = 64 * 1024;
+    setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &small, sizeof(small));
+    setsockopt(fds[1], SOL_SOCKET, SO_RCVBUF, &small, sizeof(small));
+
+    std::shared_ptr<const std::string> frame = MakeFrame(0, 8 * 1024 * 1024);
+    CHECK(queue.Send(fds[0], frame, 200) == false);
+    CHECK(queue.Pending() == 1 && frame.use_count() == 2);
+
+    std::vector<std::shared_ptr<const std::string>> held;
+    queue.Release(held);
+    CHECK(queue.Pending() == 0);
+    CHECK(held.size() == 1 && held[0] == frame);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+// 非阻塞发送: 发送缓冲区满时返回 EAGAIN 不等待, 从返回的位置继续发送, 接收方收到完整的报文
+static void TestSendSome() {
+    int fds[2];
+    ConnectPair(fds);
+    LI::ZeroCopyQueue queue;
+    REQUIRE(queue.Enable(fds[0]));
+    const int small = 64 * 1024;
+    setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &small, sizeof(small));
+    setsockopt(fds[1], SOL_SOCKET, SO_RCVBUF, &small, sizeof(small));
+
+    std::shared_ptr<const std::string> frame = MakeFrame(3, 4 * 1024 * 1024);
+    size_t offset = 0;
+    const long long start = NowNs();
+    while (offset < frame->size()) {
+        const ssize_t n = queue.SendSome(fds[0], frame, offset);
+        if (n < 0) break;
+        offset += n;
+    }
+    CHECK(errno == EAGAIN && offset > 0 && offset < frame->size());
+    CHECK(NowNs() - start < 1000LL * 1000 * 1000);
+    CHECK(queue.Pending() > 0 && frame.use_count() > 1);
+
+    // 接收方读取时从 offset 继续
+    std::string got;
+    std::thread reader = Reader(fds[1], frame->size(), &got);
+    while (offset < frame->size()) {
+        const ssize_t n = queue.SendSome(fds[0], frame, offset);
+        if (n > 0) {
+            offset += n;
+            continue;
+        }
+        REQUIRE(n < 0 && errno == EAGAIN);
+        struct pollfd pfd = {fds[0], POLLOUT, 0};
+        poll(&pfd, 1, 100);
+    }
+    reader.join();
+    CHECK(got == *frame);
+    CHECK(ReapAll(queue, fds[0], nullptr));
+    CHECK(frame.use_count() == 1);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+// 热重启: 新进程的队列接续旧进程的通知序号. 旧报文的通知由新进程取出, 不会提前释放新进程还在发送的报文
+static void TestSequenceHandoff() {
+    int fds[2];
+    ConnectPair(fds);
+    const int small = 64 * 1024;
+    setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &small, sizeof(small));
+    setsockopt(fds[1], SOL_SOCKET, SO_RCVBUF, &small, sizeof(small));
+    LI::ZeroCopyQueue old_queue;
+    REQUIRE(old_queue.Enable(fds[0]));
+    // 旧进程发送了 20 个小报文, 通知序号用到了 19
+    std::shared_ptr<const std::string> first = MakeFrame(1, 1024);
+    for (int i = 0; i < 20; ++i) {
+        CHECK(old_queue.Send(fds[0], first, 5000));
+    }
+    CHECK(old_queue.Sequence() == 20);
+    // 等到旧报文的通知到达错误队列, 旧进程没有取出就交接了
+    usleep(50 * 1000);
+    struct pollfd pfd = {fds[0], 0, 0};
+    CHECK(poll(&pfd, 1, 2000) == 1 && (pfd.revents & POLLERR));
+
+    // 接收方不读取, 新报文只有一部分离开发送队列, 内核一直引用它
+    LI::ZeroCopyQueue new_queue;
+    new_queue.SetSequence(old_queue.Sequence());
+    REQUIRE(new_queue.Enable(fds[0]));
+    std::shared_ptr<const std::string> second = MakeFrame(2, 8 * 1024 * 1024);
+    CHECK(new_queue.Send(fds[0], second, 200) == false);
+    CHECK(new_queue.Reap(fds[0]) >= 1);
+    CHECK(new_queue.Pending() == 1 && second.use_count() == 2);
+
+    // 接收方读取后内核发送完剩下的部分, 通知到达后释放
+    std::vector<char> buffer(small);
+    size_t total = 0;
+    for (int i = 0; i < 200 && new_queue.Pending() > 0; ++i) {
+        const ssize_t n = recv(fds[1], buffer.data(), buffer.size(), MSG_DONTWAIT);
+        if (n > 0) total += n;
+        else usleep(10 * 1000);
+        new_queue.Reap(fds[0]);
+    }
+    CHECK(new_queue.Pending() == 0 && second.use_count() == 1);
+    CHECK(total >= 20 * first->size());
+    close(fds[0]);
+    close(fds[1]);
+}
+
+int main() {
+    TestComplete();
+    TestTimeoutRelease();
+    TestSendSome();
+    TestSequenceHandoff();
+    return TestResult();
+}